@@ -0,0 +1,964 @@
+/*!
+  Simulated LTC6811 daisy chain for host builds
+@verbatim
+  Drop-in replacement for lib/LTC681x/bms_hardware.cpp. See LTC681x_sim.h
+  for what is modelled.
+@endverbatim
+*/
+#include <Arduino.h>
+#include <stdint.h>
+#include <string.h>
+#include "bms_hardware.h"
+#include "LTC681x_sim.h"
+
+HostSerial Serial;
+
+/* Command codes, the 11 bits of CMD0[2:0] and CMD1 */
+#define CMD_WRCFGA  0x001
+#define CMD_RDCFGA  0x002
+#define CMD_RDCVA   0x004
+#define CMD_RDCVB   0x006
+#define CMD_RDCVC   0x008
+#define CMD_RDCVD   0x00A
+#define CMD_RDAUXA  0x00C
+#define CMD_RDAUXB  0x00E
+#define CMD_RDSTATA 0x010
+#define CMD_RDSTATB 0x012
+#define CMD_WRSCTRL 0x014
+#define CMD_RDSCTRL 0x016
+#define CMD_CLRSCTRL 0x018
+#define CMD_STSCTRL 0x019
+#define CMD_WRPWM   0x020
+#define CMD_RDPWM   0x022
+#define CMD_CLRCELL 0x711
+#define CMD_CLRAUX  0x712
+#define CMD_CLRSTAT 0x713
+#define CMD_PLADC   0x714
+#define CMD_DIAGN   0x715
+#define CMD_WRCOMM  0x721
+#define CMD_RDCOMM  0x722
+#define CMD_STCOMM  0x723
+
+/* Conversions that can be pending on an IC */
+enum
+{
+  CONV_NONE = 0,
+  CONV_ADCV,
+  CONV_ADOW,
+  CONV_CVST,
+  CONV_ADOL,
+  CONV_ADAX,
+  CONV_ADAXD,
+  CONV_AXST,
+  CONV_AXOW,
+  CONV_ADSTAT,
+  CONV_ADSTATD,
+  CONV_STATST,
+  CONV_ADCVAX,
+  CONV_ADCVSC,
+  CONV_DIAGN
+};
+
+/* What the bytes after the command do in the current frame */
+enum
+{
+  FRAME_CMD = 0,
+  FRAME_WRITE,
+  FRAME_READ,
+  FRAME_POLL,
+  FRAME_IGNORE
+};
+
+/*
+Conversion times in microseconds, indexed [ADCOPT][MD]. MD 0..3 with ADCOPT=0
+is 422Hz, 27kHz, 7kHz, 26Hz; with ADCOPT=1 it is 1kHz, 14kHz, 3kHz, 2kHz.
+Approximate values after the LTC6811 datasheet conversion time tables.
+*/
+static const uint32_t T_ALL_CELLS[2][4] = {{12807, 1113, 2335, 201317}, {5900, 1288, 3033, 4430}};
+static const uint32_t T_ALL_GPIO[2][4] = {{21340, 1825, 3862, 335543}, {9800, 2116, 5025, 7353}};
+static const uint32_t T_ALL_STAT[2][4] = {{8537, 748, 1563, 134218}, {3950, 865, 2028, 2959}};
+static const uint32_t T_ONE_GROUP[2][4] = {{2171, 201, 405, 33568}, {1000, 230, 521, 754}};
+static const uint32_t T_DIAGN = 1000;
+static const uint32_t T_WAKE = 300;   // tWAKE, SLEEP to STANDBY
+
+typedef struct
+{
+  uint8_t cfgr[6];
+  uint8_t cv[4][6];
+  uint8_t aux[2][6];
+  uint8_t stat[2][6];
+  uint8_t comm[6];
+  uint8_t sctrl[6];
+  uint8_t pwm[6];
+
+  uint16_t cell_in[12];
+  uint16_t gpio_in[5];
+  int16_t die_temp;
+  uint8_t open_wire;
+
+  bool awake;
+  bool waking;
+  bool ready;
+  uint64_t awake_at;
+  uint64_t last_traffic;
+  uint64_t last_cmd;
+
+  uint8_t conv;
+  uint8_t conv_md;
+  uint8_t conv_arg;
+  uint64_t conv_done;
+} sim_ic;
+
+/* One daisy chain and the chip select it answers to */
+typedef struct
+{
+  uint8_t cs_pin;
+  uint8_t total_ic;
+  sim_ic ic[SIM_MAX_IC];
+} sim_string;
+
+typedef struct
+{
+  sim_string strings[SIM_MAX_CHAINS];   // strings[0] answers to every pin no other chain claims
+  uint8_t chains;
+  uint8_t total_ic;                     // the chain on the selected chip select
+  sim_ic *ic;
+
+  uint64_t now;
+  uint32_t byte_ns;
+  uint32_t byte_overhead_ns;
+  uint32_t cs_overhead_ns;
+  uint64_t idle_ns;
+  uint64_t sleep_ns;
+  uint16_t noise;
+  uint32_t ber;
+  uint32_t rng;
+
+  bool cs_active;
+  uint8_t mode;
+  uint16_t count;
+  uint8_t cmd[4];
+  uint16_t code;
+  uint8_t reached;
+  uint8_t buf[8*SIM_MAX_IC];
+  uint16_t len;
+
+  spi_transaction *queue[SPI_QUEUE_LEN];   // interrupt driven engine, queue[head] is on the wire
+  uint8_t head;
+  uint8_t queued;
+  uint16_t index;
+  uint64_t next_byte;
+  bool in_isr;
+
+  sim_stats stats;
+} sim_chain;
+
+static sim_chain chain;
+
+/* Bitwise CRC15, kept independent of the driver's table implementation */
+static uint16_t sim_pec15(const uint8_t *data, uint16_t len)
+{
+  uint16_t remainder = 16;
+  for (uint16_t i = 0; i < len; i++)
+  {
+    remainder ^= (uint16_t)data[i] << 7;
+    for (uint8_t bit = 0; bit < 8; bit++)
+    {
+      if (remainder & 0x4000)
+      {
+        remainder = (remainder << 1) ^ 0x4599;
+      }
+      else
+      {
+        remainder = remainder << 1;
+      }
+    }
+    remainder &= 0x7FFF;
+  }
+  return(remainder*2);
+}
+
+static uint32_t sim_rand()
+{
+  chain.rng = chain.rng*1103515245u + 12345u;
+  return(chain.rng >> 8);
+}
+
+static uint16_t sim_measure(uint16_t code)
+{
+  int32_t value = code;
+  if (chain.noise)
+  {
+    value += (int32_t)(sim_rand() % (chain.noise + 1)) - chain.noise/2;
+  }
+  if (value < 0) value = 0;
+  if (value > 0xFFFE) value = 0xFFFE;
+  return((uint16_t)value);
+}
+
+static void put16(uint8_t *reg, uint8_t index, uint16_t code)
+{
+  reg[index*2] = (uint8_t)code;
+  reg[index*2 + 1] = (uint8_t)(code >> 8);
+}
+
+static uint16_t get16(const uint8_t *reg, uint8_t index)
+{
+  return(reg[index*2] | (reg[index*2 + 1] << 8));
+}
+
+static uint8_t adcopt(const sim_ic *ic)
+{
+  return(ic->cfgr[0] & 0x01);
+}
+
+static void reset_registers(sim_ic *ic)
+{
+  memset(ic->cfgr, 0, sizeof(ic->cfgr));
+  ic->cfgr[0] = 0xF8;
+  memset(ic->cv, 0xFF, sizeof(ic->cv));
+  memset(ic->aux, 0xFF, sizeof(ic->aux));
+  memset(ic->stat, 0xFF, sizeof(ic->stat));
+  memset(ic->comm, 0, sizeof(ic->comm));
+  memset(ic->sctrl, 0, sizeof(ic->sctrl));
+  memset(ic->pwm, 0, sizeof(ic->pwm));
+  ic->conv = CONV_NONE;
+}
+
+/* Digital filter self test pattern, see LTC681x_st_lookup */
+static uint16_t st_pattern(const sim_ic *ic, uint8_t md, uint8_t st)
+{
+  if (md == 1 && adcopt(ic) == 0) return(st == 1 ? 0x9565 : 0x6A9A);
+  if (md == 1) return(st == 1 ? 0x9553 : 0x6AAC);
+  return(st == 1 ? 0x9555 : 0x6AAA);
+}
+
+/* Cells converted by an ADCV/ADOW channel selection */
+static bool cell_selected(uint8_t ch, uint8_t cell)
+{
+  return(ch == 0 || (cell % 6) == (ch - 1));
+}
+
+static void update_cell_flags(sim_ic *ic)
+{
+  uint16_t vuv = ic->cfgr[1] | ((ic->cfgr[2] & 0x0F) << 8);
+  uint16_t vov = (ic->cfgr[2] >> 4) | (ic->cfgr[3] << 4);
+  uint32_t uv_limit = ((uint32_t)vuv + 1)*16;
+  uint32_t ov_limit = (uint32_t)vov*16;
+
+  for (uint8_t cell = 0; cell < 12; cell++)
+  {
+    uint16_t code = get16(ic->cv[cell/3], cell%3);
+    uint8_t byte = 2 + cell/4;
+    uint8_t shift = (cell%4)*2;
+    ic->stat[1][byte] &= ~(0x03 << shift);
+    if (code < uv_limit) ic->stat[1][byte] |= 0x01 << shift;
+    if (code > ov_limit) ic->stat[1][byte] |= 0x02 << shift;
+  }
+}
+
+static void convert_cells(sim_ic *ic, uint8_t ch, int8_t pup)
+{
+  for (uint8_t cell = 0; cell < 12; cell++)
+  {
+    if (!cell_selected(ch, cell)) continue;
+
+    uint16_t code = sim_measure(ic->cell_in[cell]);
+    if (pup == 1 && ic->open_wire == cell && cell > 0 && ic->open_wire <= 11)
+    {
+      code = (code > 0xFFFE - 6000) ? 0xFFFE : code + 6000;
+    }
+    if (pup == 1 && ((ic->open_wire == 0 && cell == 0) || (ic->open_wire == 12 && cell == 11)))
+    {
+      code = 0;
+    }
+    if (pup == 0 && ((ic->open_wire == 0 && cell == 0) || (ic->open_wire == 12 && cell == 11)))
+    {
+      code = 0;
+    }
+    put16(ic->cv[cell/3], cell%3, code);
+  }
+  update_cell_flags(ic);
+}
+
+static void convert_gpio(sim_ic *ic, uint8_t chg)
+{
+  for (uint8_t gpio = 0; gpio < 5; gpio++)
+  {
+    if (chg == 0 || chg == gpio + 1)
+    {
+      put16(ic->aux[gpio/3], gpio%3, sim_measure(ic->gpio_in[gpio]));
+    }
+  }
+  if (chg == 0 || chg == 6)
+  {
+    put16(ic->aux[1], 2, sim_measure(30000));   // VREF2
+  }
+}
+
+static void convert_stat(sim_ic *ic, uint8_t chst)
+{
+  uint32_t sum = 0;
+  for (uint8_t cell = 0; cell < 12; cell++) sum += ic->cell_in[cell];
+
+  if (chst == 0 || chst == 1) put16(ic->stat[0], 0, sim_measure((uint16_t)(sum/20)));
+  if (chst == 0 || chst == 2) put16(ic->stat[0], 1, sim_measure((uint16_t)((ic->die_temp + 273)*75)));
+  if (chst == 0 || chst == 3) put16(ic->stat[0], 2, sim_measure(50000));
+  if (chst == 0 || chst == 4) put16(ic->stat[1], 0, sim_measure(30000));
+}
+
+static void commit_conversion(sim_ic *ic)
+{
+  uint8_t md = ic->conv_md;
+  uint16_t pattern;
+
+  switch (ic->conv)
+  {
+    case CONV_ADCV:
+      convert_cells(ic, ic->conv_arg, -1);
+      break;
+    case CONV_ADOW:
+      convert_cells(ic, ic->conv_arg & 0x07, ic->conv_arg >> 4);
+      break;
+    case CONV_CVST:
+      pattern = st_pattern(ic, md, ic->conv_arg);
+      for (uint8_t cell = 0; cell < 12; cell++) put16(ic->cv[cell/3], cell%3, pattern);
+      break;
+    case CONV_ADOL:
+      put16(ic->cv[2], 0, sim_measure(ic->cell_in[6]));
+      put16(ic->cv[2], 1, sim_measure(ic->cell_in[6]));
+      break;
+    case CONV_ADAX:
+    case CONV_ADAXD:
+      convert_gpio(ic, ic->conv_arg);
+      break;
+    case CONV_AXOW:
+      convert_gpio(ic, 0);
+      break;
+    case CONV_AXST:
+      pattern = st_pattern(ic, md, ic->conv_arg);
+      for (uint8_t i = 0; i < 6; i++) put16(ic->aux[i/3], i%3, pattern);
+      break;
+    case CONV_ADSTAT:
+    case CONV_ADSTATD:
+      convert_stat(ic, ic->conv_arg);
+      break;
+    case CONV_STATST:
+      pattern = st_pattern(ic, md, ic->conv_arg);
+      for (uint8_t i = 0; i < 3; i++) put16(ic->stat[0], i, pattern);
+      put16(ic->stat[1], 0, pattern);
+      break;
+    case CONV_ADCVAX:
+      convert_cells(ic, 0, -1);
+      convert_gpio(ic, 1);
+      convert_gpio(ic, 2);
+      break;
+    case CONV_ADCVSC:
+      convert_cells(ic, 0, -1);
+      convert_stat(ic, 1);
+      break;
+    case CONV_DIAGN:
+      ic->stat[1][5] &= ~0x02;   // MUXFAIL clear, the decoder is healthy
+      break;
+    default:
+      break;
+  }
+  ic->conv = CONV_NONE;
+}
+
+/* Applies conversion completion, wake completion and the idle and sleep timeouts up to now */
+static void update_timers()
+{
+  for (uint8_t n = 0; n < chain.chains; n++)
+  for (uint8_t i = 0; i < chain.strings[n].total_ic; i++)
+  {
+    sim_ic *ic = &chain.strings[n].ic[i];
+
+    if (ic->waking && chain.now >= ic->awake_at)
+    {
+      ic->waking = false;
+      ic->awake = true;
+      ic->ready = true;
+      ic->last_traffic = ic->awake_at;
+      ic->last_cmd = ic->awake_at;
+      chain.stats.wakeups++;
+    }
+    if (!ic->awake) continue;
+
+    if (ic->conv != CONV_NONE && chain.now >= ic->conv_done)
+    {
+      commit_conversion(ic);
+    }
+    if (ic->ready && chain.now - ic->last_traffic > chain.idle_ns)
+    {
+      ic->ready = false;
+      chain.stats.idles++;
+    }
+    if (chain.now - ic->last_cmd > chain.sleep_ns)
+    {
+      ic->awake = false;
+      ic->ready = false;
+      reset_registers(ic);
+      chain.stats.sleeps++;
+    }
+  }
+}
+
+static void engine_step();
+
+/* Moves the clock forward, shifting any queued SPI engine bytes that fall due on the way */
+static void advance_ns(uint64_t ns)
+{
+  uint64_t target = chain.now + ns;
+
+  while (!chain.in_isr && chain.queued && chain.next_byte <= target)
+  {
+    chain.now = chain.next_byte;
+    engine_step();
+  }
+  if (target > chain.now) chain.now = target;
+}
+
+static uint32_t conv_time(const sim_ic *ic, uint8_t kind, uint8_t md, uint8_t arg)
+{
+  uint8_t opt = adcopt(ic);
+  switch (kind)
+  {
+    case CONV_ADCV:
+      return(arg == 0 ? T_ALL_CELLS[opt][md] : T_ONE_GROUP[opt][md]);
+    case CONV_ADOW:
+    case CONV_CVST:
+      return(T_ALL_CELLS[opt][md]);
+    case CONV_ADOL:
+      return(T_ONE_GROUP[opt][md]);
+    case CONV_ADAX:
+    case CONV_ADAXD:
+      return(arg == 0 ? T_ALL_GPIO[opt][md] : T_ONE_GROUP[opt][md]);
+    case CONV_AXOW:
+    case CONV_AXST:
+      return(T_ALL_GPIO[opt][md]);
+    case CONV_ADSTAT:
+    case CONV_ADSTATD:
+      return(arg == 0 ? T_ALL_STAT[opt][md] : T_ONE_GROUP[opt][md]);
+    case CONV_STATST:
+      return(T_ALL_STAT[opt][md]);
+    case CONV_ADCVAX:
+      return(T_ALL_CELLS[opt][md] + 2*T_ONE_GROUP[opt][md]);
+    case CONV_ADCVSC:
+      return(T_ALL_CELLS[opt][md] + T_ONE_GROUP[opt][md]);
+    case CONV_DIAGN:
+      return(T_DIAGN);
+    default:
+      return(0);
+  }
+}
+
+static void start_conversion(uint8_t kind, uint8_t md, uint8_t arg)
+{
+  chain.stats.conversions++;
+  for (uint8_t i = 0; i < chain.reached; i++)
+  {
+    sim_ic *ic = &chain.ic[i];
+    if (ic->conv != CONV_NONE) continue;   // the core only leaves MEASURE when the conversion ends
+    ic->conv = kind;
+    ic->conv_md = md;
+    ic->conv_arg = arg;
+    ic->conv_done = chain.now + (uint64_t)conv_time(ic, kind, md, arg)*1000;
+  }
+}
+
+static uint8_t *read_register(sim_ic *ic, uint16_t code)
+{
+  switch (code)
+  {
+    case CMD_RDCFGA: return(ic->cfgr);
+    case CMD_RDCVA: return(ic->cv[0]);
+    case CMD_RDCVB: return(ic->cv[1]);
+    case CMD_RDCVC: return(ic->cv[2]);
+    case CMD_RDCVD: return(ic->cv[3]);
+    case CMD_RDAUXA: return(ic->aux[0]);
+    case CMD_RDAUXB: return(ic->aux[1]);
+    case CMD_RDSTATA: return(ic->stat[0]);
+    case CMD_RDSTATB: return(ic->stat[1]);
+    case CMD_RDSCTRL: return(ic->sctrl);
+    case CMD_RDPWM: return(ic->pwm);
+    case CMD_RDCOMM: return(ic->comm);
+    default: return(NULL);
+  }
+}
+
+static uint8_t *write_register(sim_ic *ic, uint16_t code)
+{
+  switch (code)
+  {
+    case CMD_WRCFGA: return(ic->cfgr);
+    case CMD_WRSCTRL: return(ic->sctrl);
+    case CMD_WRPWM: return(ic->pwm);
+    case CMD_WRCOMM: return(ic->comm);
+    default: return(NULL);
+  }
+}
+
+static void decode_command()
+{
+  uint16_t pec = sim_pec15(chain.cmd, 2);
+  uint16_t code = ((chain.cmd[0] & 0x07) << 8) | chain.cmd[1];
+  uint8_t md = ((chain.cmd[0] & 0x01) << 1) | (chain.cmd[1] >> 7);
+
+  if (chain.cmd[2] != (uint8_t)(pec >> 8) || chain.cmd[3] != (uint8_t)pec)
+  {
+    chain.stats.bad_cmd_pec++;
+    chain.mode = FRAME_IGNORE;
+    return;
+  }
+
+  chain.stats.commands++;
+  if (chain.reached < chain.total_ic) chain.stats.missed++;
+  for (uint8_t i = 0; i < chain.reached; i++) chain.ic[i].last_cmd = chain.now;
+
+  chain.code = code;
+  chain.mode = FRAME_IGNORE;
+
+  if (write_register(&chain.ic[0], code) != NULL)
+  {
+    chain.mode = FRAME_WRITE;
+    chain.len = 0;
+    return;
+  }
+  if (read_register(&chain.ic[0], code) != NULL)
+  {
+    for (uint8_t i = 0; i < chain.total_ic; i++)
+    {
+      uint8_t *out = &chain.buf[i*8];
+      if (i < chain.reached)
+      {
+        const uint8_t *reg = read_register(&chain.ic[i], code);
+        uint16_t data_pec = sim_pec15(reg, 6);
+        memcpy(out, reg, 6);
+        out[6] = (uint8_t)(data_pec >> 8);
+        out[7] = (uint8_t)data_pec;
+      }
+      else
+      {
+        memset(out, 0xFF, 8);
+      }
+    }
+    chain.len = 0;
+    chain.mode = FRAME_READ;
+    return;
+  }
+
+  switch (code)
+  {
+    case CMD_PLADC:
+      chain.mode = FRAME_POLL;
+      return;
+    case CMD_CLRCELL:
+      for (uint8_t i = 0; i < chain.reached; i++) memset(chain.ic[i].cv, 0xFF, sizeof(chain.ic[i].cv));
+      return;
+    case CMD_CLRAUX:
+      for (uint8_t i = 0; i < chain.reached; i++) memset(chain.ic[i].aux, 0xFF, sizeof(chain.ic[i].aux));
+      return;
+    case CMD_CLRSTAT:
+      for (uint8_t i = 0; i < chain.reached; i++) memset(chain.ic[i].stat, 0xFF, sizeof(chain.ic[i].stat));
+      return;
+    case CMD_CLRSCTRL:
+      for (uint8_t i = 0; i < chain.reached; i++) memset(chain.ic[i].sctrl, 0, sizeof(chain.ic[i].sctrl));
+      return;
+    case CMD_DIAGN:
+      start_conversion(CONV_DIAGN, md, 0);
+      return;
+    case CMD_STSCTRL:
+    case CMD_STCOMM:
+      return;
+    default:
+      break;
+  }
+
+  if ((code & 0x668) == 0x260) start_conversion(CONV_ADCV, md, code & 0x07);
+  else if ((code & 0x628) == 0x228) start_conversion(CONV_ADOW, md, (code & 0x07) | (((code >> 6) & 0x01) << 4));
+  else if ((code & 0x61F) == 0x207) start_conversion(CONV_CVST, md, (code >> 5) & 0x03);
+  else if ((code & 0x66F) == 0x201) start_conversion(CONV_ADOL, md, 0);
+  else if ((code & 0x66F) == 0x46F) start_conversion(CONV_ADCVAX, md, 0);
+  else if ((code & 0x66F) == 0x467) start_conversion(CONV_ADCVSC, md, 0);
+  else if ((code & 0x678) == 0x468) start_conversion(CONV_ADSTAT, md, code & 0x07);
+  else if ((code & 0x678) == 0x460) start_conversion(CONV_ADAX, md, code & 0x07);
+  else if ((code & 0x678) == 0x408) start_conversion(CONV_ADSTATD, md, code & 0x07);
+  else if ((code & 0x678) == 0x400) start_conversion(CONV_ADAXD, md, code & 0x07);
+  else if ((code & 0x61F) == 0x40F) start_conversion(CONV_STATST, md, (code >> 5) & 0x03);
+  else if ((code & 0x61F) == 0x407) start_conversion(CONV_AXST, md, (code >> 5) & 0x03);
+  else if ((code & 0x638) == 0x410) start_conversion(CONV_AXOW, md, 0);
+}
+
+static void finish_write()
+{
+  uint8_t blocks = chain.len/8;
+  for (uint8_t b = 0; b < blocks; b++)
+  {
+    int16_t target = (int16_t)blocks - 1 - b;   // the first block shifts through to the far end of the chain
+    if (target >= chain.reached) continue;
+
+    const uint8_t *block = &chain.buf[b*8];
+    uint16_t data_pec = sim_pec15(block, 6);
+    if (block[6] != (uint8_t)(data_pec >> 8) || block[7] != (uint8_t)data_pec)
+    {
+      chain.stats.bad_data_pec++;
+      continue;
+    }
+    memcpy(write_register(&chain.ic[target], chain.code), block, 6);
+  }
+}
+
+/* Clocks one byte through the chain at the current time */
+static uint8_t shift(uint8_t tx)
+{
+  uint8_t rx = 0xFF;
+
+  chain.stats.spi_bytes++;
+  if (!chain.cs_active) return(rx);
+
+  update_timers();
+  if (chain.count < 4)
+  {
+    chain.cmd[chain.count++] = tx;
+    if (chain.count == 4) decode_command();
+    return(rx);
+  }
+  chain.count++;
+
+  switch (chain.mode)
+  {
+    case FRAME_WRITE:
+      if (chain.len < sizeof(chain.buf)) chain.buf[chain.len++] = tx;
+      break;
+    case FRAME_READ:
+      if (chain.len < chain.total_ic*8) rx = chain.buf[chain.len++];
+      if (chain.ber && (sim_rand() % chain.ber) == 0)
+      {
+        rx ^= (uint8_t)(1 << (sim_rand() % 8));
+        chain.stats.corrupted++;
+      }
+      break;
+    case FRAME_POLL:
+      rx = 0xFF;
+      for (uint8_t i = 0; i < chain.reached; i++)
+      {
+        if (chain.ic[i].conv != CONV_NONE) rx = 0x00;
+      }
+      break;
+    default:
+      break;
+  }
+  return(rx);
+}
+
+static uint8_t transfer(uint8_t tx)
+{
+  advance_ns(chain.byte_ns + chain.byte_overhead_ns);
+  return(shift(tx));
+}
+
+/* Connects the bus to the chain behind a chip select */
+static void select_chain(uint8_t pin)
+{
+  sim_string *string = &chain.strings[0];
+  for (uint8_t n = 1; n < chain.chains; n++)
+  {
+    if (chain.strings[n].cs_pin == pin) string = &chain.strings[n];
+  }
+  chain.ic = string->ic;
+  chain.total_ic = string->total_ic;
+}
+
+static void frame_begin(uint8_t pin)
+{
+  select_chain(pin);
+  update_timers();
+
+  chain.cs_active = true;
+  chain.count = 0;
+  chain.mode = FRAME_CMD;
+  chain.stats.cs_frames++;
+
+  // The falling edge travels through every ready port and wakes the first one that is not
+  uint8_t ready = 0;
+  while (ready < chain.total_ic && chain.ic[ready].ready) ready++;
+  chain.reached = ready;
+  for (uint8_t i = 0; i < ready; i++) chain.ic[i].last_traffic = chain.now;
+
+  if (ready < chain.total_ic)
+  {
+    sim_ic *ic = &chain.ic[ready];
+    if (ic->awake)
+    {
+      ic->ready = true;
+      ic->last_traffic = chain.now;
+      chain.stats.readies++;
+    }
+    else if (!ic->waking)
+    {
+      ic->waking = true;
+      ic->awake_at = chain.now + (uint64_t)T_WAKE*1000;
+    }
+  }
+}
+
+static void frame_end()
+{
+  if (chain.cs_active && chain.mode == FRAME_WRITE) finish_write();
+  chain.cs_active = false;
+  update_timers();
+}
+
+/*
+SPI engine mock. The hardware loads the first byte when a transaction starts
+and the SPI interrupt moves each following byte one byte time later, so here
+each byte is shifted when the clock passes its completion time. The CPU time
+of the interrupt itself is not charged to the foreground.
+*/
+static void engine_start(spi_transaction *trans)
+{
+  frame_begin(trans->cs_pin);
+  chain.index = 0;
+  chain.next_byte = chain.now + chain.cs_overhead_ns + chain.byte_ns;
+}
+
+static void engine_step()
+{
+  spi_transaction *trans = chain.queue[chain.head];
+  uint16_t total = trans->tx_len + trans->rx_len;
+  uint8_t tx = chain.index < trans->tx_len ? trans->tx_data[chain.index] : 0xFF;
+
+  chain.in_isr = true;
+  uint8_t rx = shift(tx);
+  if (chain.index >= trans->tx_len) trans->rx_data[chain.index - trans->tx_len] = rx;
+  chain.index++;
+
+  if (chain.index < total)
+  {
+    chain.next_byte = chain.now + chain.byte_ns;
+  }
+  else
+  {
+    frame_end();
+    trans->done = 1;
+    chain.head = (chain.head + 1) % SPI_QUEUE_LEN;
+    chain.queued--;
+    if (chain.queued) engine_start(chain.queue[chain.head]);
+    if (trans->on_complete != NULL) trans->on_complete(trans);
+  }
+  chain.in_isr = false;
+}
+
+/* Fills a chain with sleeping ICs and the default inputs */
+static void init_string(sim_string *string, uint8_t cs_pin, uint8_t total_ic)
+{
+  string->cs_pin = cs_pin;
+  string->total_ic = total_ic > SIM_MAX_IC ? SIM_MAX_IC : total_ic;
+  for (uint8_t i = 0; i < string->total_ic; i++)
+  {
+    sim_ic *ic = &string->ic[i];
+    memset(ic, 0, sizeof(sim_ic));
+    reset_registers(ic);
+    for (uint8_t cell = 0; cell < 12; cell++) ic->cell_in[cell] = 36000 + i*100 + cell;
+    for (uint8_t gpio = 0; gpio < 5; gpio++) ic->gpio_in[gpio] = 15000 + i*100 + gpio;
+    ic->die_temp = 25;
+    ic->open_wire = SIM_NO_OPEN_WIRE;
+  }
+}
+
+void LTC681x_sim_init(uint8_t total_ic)
+{
+  memset(&chain, 0, sizeof(chain));
+  chain.idle_ns = 4300ull*1000;
+  chain.sleep_ns = 1800ull*1000000;
+  chain.rng = 1;
+  LTC681x_sim_set_timing(1000000, 4000, 500);
+
+  init_string(&chain.strings[0], 0, total_ic);
+  chain.chains = 1;
+  select_chain(0);
+}
+
+int8_t LTC681x_sim_add_chain(uint8_t cs_pin, uint8_t total_ic)
+{
+  if (chain.chains == SIM_MAX_CHAINS) return(-1);
+  init_string(&chain.strings[chain.chains++], cs_pin, total_ic);
+  return(0);
+}
+
+void LTC681x_sim_set_timing(uint32_t spi_hz, uint16_t cs_overhead_ns, uint16_t byte_overhead_ns)
+{
+  chain.byte_ns = (uint32_t)(8000000000ull/spi_hz);
+  chain.cs_overhead_ns = cs_overhead_ns;
+  chain.byte_overhead_ns = byte_overhead_ns;
+}
+
+void LTC681x_sim_set_timeouts(uint32_t idle_us, uint32_t sleep_ms)
+{
+  chain.idle_ns = (uint64_t)idle_us*1000;
+  chain.sleep_ns = (uint64_t)sleep_ms*1000000;
+}
+
+void LTC681x_sim_set_cell(uint8_t nIC, uint8_t cell, uint16_t code)
+{
+  if (nIC < SIM_MAX_IC && cell < 12) chain.strings[0].ic[nIC].cell_in[cell] = code;
+}
+
+void LTC681x_sim_set_gpio(uint8_t nIC, uint8_t gpio, uint16_t code)
+{
+  if (nIC < SIM_MAX_IC && gpio < 5) chain.strings[0].ic[nIC].gpio_in[gpio] = code;
+}
+
+void LTC681x_sim_set_die_temp(uint8_t nIC, int16_t celsius)
+{
+  if (nIC < SIM_MAX_IC) chain.strings[0].ic[nIC].die_temp = celsius;
+}
+
+void LTC681x_sim_set_open_wire(uint8_t nIC, uint8_t input)
+{
+  if (nIC < SIM_MAX_IC) chain.strings[0].ic[nIC].open_wire = input;
+}
+
+void LTC681x_sim_set_noise(uint16_t codes)
+{
+  chain.noise = codes;
+}
+
+void LTC681x_sim_set_bit_error_rate(uint32_t one_in_n)
+{
+  chain.ber = one_in_n;
+}
+
+void LTC681x_sim_advance_us(uint32_t us)
+{
+  advance_ns((uint64_t)us*1000);
+}
+
+uint64_t LTC681x_sim_time_ns()
+{
+  return(chain.now);
+}
+
+void LTC681x_sim_get_stats(sim_stats *stats)
+{
+  *stats = chain.stats;
+}
+
+void LTC681x_sim_reset_stats()
+{
+  memset(&chain.stats, 0, sizeof(chain.stats));
+}
+
+uint8_t LTC681x_sim_ready_count()
+{
+  uint8_t count = 0;
+  update_timers();
+  while (count < chain.strings[0].total_ic && chain.strings[0].ic[count].ready) count++;
+  return(count);
+}
+
+/* bms_hardware.h */
+
+void cs_low(uint8_t pin)
+{
+  spi_wait_idle();
+  advance_ns(chain.cs_overhead_ns);
+  frame_begin(pin);
+}
+
+void cs_high(uint8_t)
+{
+  advance_ns(chain.cs_overhead_ns);
+  frame_end();
+}
+
+void delay_u(uint16_t micro)
+{
+  advance_ns((uint64_t)micro*1000);
+}
+
+void delay_m(uint16_t milli)
+{
+  advance_ns((uint64_t)milli*1000000);
+}
+
+void spi_write_array(uint8_t len, uint8_t data[])
+{
+  for (uint8_t i = 0; i < len; i++)
+  {
+    transfer(data[i]);
+  }
+}
+
+void spi_write_read(uint8_t tx_Data[], uint8_t tx_len, uint8_t *rx_data, uint8_t rx_len)
+{
+  for (uint8_t i = 0; i < tx_len; i++)
+  {
+    transfer(tx_Data[i]);
+  }
+  for (uint8_t i = 0; i < rx_len; i++)
+  {
+    rx_data[i] = transfer(0xFF);
+  }
+}
+
+uint8_t spi_read_byte(uint8_t tx_dat)
+{
+  return(transfer(tx_dat));
+}
+
+int8_t spi_submit(spi_transaction *trans)
+{
+  if (trans->tx_len + trans->rx_len == 0 || chain.queued == SPI_QUEUE_LEN) return(-1);
+
+  trans->done = 0;
+  chain.queue[(chain.head + chain.queued) % SPI_QUEUE_LEN] = trans;
+  chain.queued++;
+  if (chain.queued == 1) engine_start(trans);
+  return(0);
+}
+
+uint8_t spi_busy()
+{
+  return(chain.queued != 0);
+}
+
+void spi_wait_idle()
+{
+  while (chain.queued)
+  {
+    advance_ns(chain.next_byte > chain.now ? chain.next_byte - chain.now : 0);
+  }
+}
+
+/* Arduino time base */
+
+void digitalWrite(uint8_t, uint8_t)
+{
+}
+
+void pinMode(uint8_t, uint8_t)
+{
+}
+
+unsigned long millis(void)
+{
+  return((unsigned long)(chain.now/1000000));
+}
+
+unsigned long micros(void)
+{
+  advance_ns(1000);   // reading the timer is not free, and polling loops must see time pass
+  return((unsigned long)(chain.now/1000));
+}
+
+void delay(unsigned long ms)
+{
+  advance_ns((uint64_t)ms*1000000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  advance_ns((uint64_t)us*1000);
+}
@@ -0,0 +1,171 @@
+/*!
+  Simulated LTC6811 daisy chain for host builds
+@verbatim
+  Implements the bms_hardware.h interface (cs_low, cs_high, spi_write_array,
+  spi_write_read, spi_read_byte, delay_u, delay_m) against a model of N
+  LTC6811 devices, so LTC681x.cpp and LTC6811.cpp can be linked unchanged
+  on Linux in place of bms_hardware.cpp.
+
+  The model covers:
+   - command decoding with command and data PEC checking
+   - the register file (CFGR, CV A-D, AUX A-B, STAT A-B, COMM, SCTRL, PWM)
+   - daisy chain ordering (writes land on the last IC first, reads return
+     the IC nearest the host first)
+   - ADC conversion latency per MD/ADCOPT setting; results are committed
+     only once the conversion completes, and PLADC reports busy until then
+   - the isoSPI IDLE timer and the core watchdog (SLEEP) timer; ICs that
+     are not awake and ready do not see commands and read back as 0xFF
+   - digital filter self tests, overlap, redundancy, open wire and the
+     MUX decoder self test
+   - several daisy chains sharing the SPI bus on separate chip selects
+   - the interrupt driven SPI engine (spi_submit): queued bytes are shifted
+     as the clock passes their completion time, so the foreground only pays
+     for the work it does while the transfer runs
+
+  Time is virtual. Every SPI byte, chip select edge and driver delay
+  advances a single clock, which is also what millis() and micros() return
+  in the host build.
+@endverbatim
+*/
+#ifndef LTC681X_SIM_H
+#define LTC681X_SIM_H
+
+#include <stdint.h>
+
+#define SIM_MAX_IC 32           //!< Largest daisy chain the model supports
+#define SIM_MAX_CHAINS 4        //!< Daisy chains on separate chip selects the model supports
+#define SIM_NO_OPEN_WIRE 0xFF   //!< Open wire setting for an intact cell input
+
+/*! Traffic and state change counters collected by the model */
+typedef struct
+{
+  uint32_t spi_bytes;     //!< Bytes clocked on the SPI port
+  uint32_t cs_frames;     //!< Chip select low/high frames
+  uint32_t commands;      //!< Commands received with a valid command PEC
+  uint32_t bad_cmd_pec;   //!< Commands dropped because of a command PEC error
+  uint32_t bad_data_pec;  //!< Register writes dropped because of a data PEC error
+  uint32_t conversions;   //!< ADC conversions started
+  uint32_t wakeups;       //!< ICs brought from SLEEP to STANDBY
+  uint32_t readies;       //!< isoSPI ports brought from IDLE to READY
+  uint32_t sleeps;        //!< ICs that timed out into SLEEP
+  uint32_t idles;         //!< isoSPI ports that timed out into IDLE
+  uint32_t missed;        //!< Frames that reached at least one IC that was not ready
+  uint32_t corrupted;     //!< Bytes corrupted by the injected bit error rate
+} sim_stats;
+
+/*!
+ Resets the model to a chain of total_ic sleeping ICs with default inputs
+ and sets the virtual clock to zero
+ @return void
+ */
+void LTC681x_sim_init(uint8_t total_ic //!< Number of ICs in the simulated daisy chain
+                     );
+
+/*!
+ Adds another daisy chain of total_ic sleeping ICs that answers to cs_pin.
+ The chain from LTC681x_sim_init() answers to every other pin. The input,
+ open wire and ready count functions below act on that first chain.
+ @return int8_t, 0 when added, -1 if SIM_MAX_CHAINS chains already exist
+ */
+int8_t LTC681x_sim_add_chain(uint8_t cs_pin, //!< Chip select of the new chain
+                             uint8_t total_ic //!< Number of ICs in the new chain
+                            );
+
+/*!
+ Sets the SPI clock and the per-transfer software overheads used for timing
+ @return void
+ */
+void LTC681x_sim_set_timing(uint32_t spi_hz, //!< SPI clock frequency in Hz
+                            uint16_t cs_overhead_ns, //!< Cost of one chip select edge
+                            uint16_t byte_overhead_ns //!< Software cost per transferred byte on top of the shift time
+                           );
+
+/*!
+ Sets the isoSPI idle and watchdog sleep timeouts
+ @return void
+ */
+void LTC681x_sim_set_timeouts(uint32_t idle_us, //!< tIDLE, isoSPI port goes to IDLE after this long without traffic
+                              uint32_t sleep_ms //!< tSLEEP, core goes to SLEEP after this long without a valid command
+                             );
+
+/*!
+ Sets the analog input of a cell
+ @return void
+ */
+void LTC681x_sim_set_cell(uint8_t nIC, //!< IC position in the chain, 0 is nearest the host
+                          uint8_t cell, //!< Cell index, 0 to 11
+                          uint16_t code //!< Cell voltage, LSB = 100uV
+                         );
+
+/*!
+ Sets the analog input of a GPIO
+ @return void
+ */
+void LTC681x_sim_set_gpio(uint8_t nIC, //!< IC position in the chain
+                          uint8_t gpio, //!< GPIO index, 0 to 4
+                          uint16_t code //!< GPIO voltage, LSB = 100uV
+                         );
+
+/*!
+ Sets the internal die temperature of an IC
+ @return void
+ */
+void LTC681x_sim_set_die_temp(uint8_t nIC, //!< IC position in the chain
+                              int16_t celsius //!< Die temperature in degrees C
+                             );
+
+/*!
+ Opens the wire to a cell input of an IC
+ @return void
+ */
+void LTC681x_sim_set_open_wire(uint8_t nIC, //!< IC position in the chain
+                               uint8_t input //!< Cn input 0 to 12, or SIM_NO_OPEN_WIRE
+                              );
+
+/*!
+ Adds peak-to-peak measurement noise to every conversion
+ @return void
+ */
+void LTC681x_sim_set_noise(uint16_t codes //!< Noise amplitude in ADC codes, 0 disables
+                          );
+
+/*!
+ Corrupts one bit in roughly one out of every one_in_n bytes read back by the host
+ @return void
+ */
+void LTC681x_sim_set_bit_error_rate(uint32_t one_in_n //!< 0 disables bit errors
+                                   );
+
+/*!
+ Advances the virtual clock without any SPI traffic
+ @return void
+ */
+void LTC681x_sim_advance_us(uint32_t us //!< Microseconds to advance
+                           );
+
+/*!
+ Reads the virtual clock
+ @return uint64_t, nanoseconds since LTC681x_sim_init
+ */
+uint64_t LTC681x_sim_time_ns();
+
+/*!
+ Reads the traffic counters
+ @return void
+ */
+void LTC681x_sim_get_stats(sim_stats *stats //!< Structure the counters are copied to
+                          );
+
+/*!
+ Clears the traffic counters
+ @return void
+ */
+void LTC681x_sim_reset_stats();
+
+/*!
+ Counts the ICs that are awake and whose isoSPI port is ready, starting at the host end
+ @return uint8_t, number of contiguous ready ICs
+ */
+uint8_t LTC681x_sim_ready_count();
+
+#endif
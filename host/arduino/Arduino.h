@@ -0,0 +1,63 @@
+/*!
+  Minimal Arduino core stand-in for host builds
+@verbatim
+  Provides just enough of the Arduino API for the LTC681x/LTC6811 driver to
+  compile on Linux. Time (millis, micros, delay, delayMicroseconds) is
+  provided by the simulated daisy chain in LTC681x_sim.cpp so every driver
+  delay advances the same virtual clock as the simulated SPI traffic.
+@endverbatim
+*/
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define DEC 10
+#define HEX 16
+
+#define PROGMEM
+#define pgm_read_byte_near(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word_near(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword_near(addr) (*(const uint32_t *)(addr))
+#define F(string_literal) (string_literal)
+
+#define noInterrupts()
+#define interrupts()
+
+void digitalWrite(uint8_t pin, uint8_t val);
+void pinMode(uint8_t pin, uint8_t mode);
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+/*! Serial stand-in that writes to stdout */
+class HostSerial
+{
+  public:
+    void print(const char *s) { fputs(s, stdout); }
+    void print(char c) { putchar(c); }
+    void print(long n, int base = DEC) { printf(base == HEX ? "%lX" : "%ld", n); }
+    void print(int n, int base = DEC) { print((long)n, base); }
+    void print(unsigned long n, int base = DEC) { printf(base == HEX ? "%lX" : "%lu", n); }
+    void print(unsigned int n, int base = DEC) { print((unsigned long)n, base); }
+    void print(uint8_t n, int base = DEC) { print((unsigned long)n, base); }
+    void print(double x, int digits = 2) { printf("%.*f", digits, x); }
+    void println(void) { putchar('\n'); }
+    template <typename T> void println(T value) { print(value); println(); }
+    template <typename T> void println(T value, int fmt) { print(value, fmt); println(); }
+};
+
+extern HostSerial Serial;
+
+#endif  // HOST_ARDUINO_H
@@ -0,0 +1,298 @@
+/*!
+  Binary columnar SD log against a simulated card
+@verbatim
+  Logs an hour of LTC6811 records at 10 per second through lib/BinLog and
+  lib/SdLog to a simulated card. The power is cut at 20 minutes and the
+  log reopened. The aux codes are left out from 40 to 50 minutes. The hour
+  is logged twice, in 'D' blocks and in delta coded 'Z' blocks. It checks
+  several things:
+
+    decoding the card gives back every record appended, in order, each
+    block passes its check, and the sequence numbers count the records
+    a power cut keeps every record older than the flush time
+    every block n with n % BL_INDEX_SPAN == BL_INDEX_SPAN - 1 below the
+    end is an index, and a complete index matches the records of its span
+    only the span of the reset is flagged partial
+
+  It prints the bytes per record against the print_cells_SD text. It also
+  prints the blocks read to find one minute by the index, against a full
+  scan. With a file name it also writes a card image of hours of logging,
+  24 by default, in 'D' blocks or with "delta" in 'Z' blocks, for
+  binlog_export. The exit status is non-zero if a check fails.
+
+  Usage: binlog_bench [image.bin [hours [delta]]]
+@endverbatim
+*/
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "BinLog.h"
+
+#define FLUSH_MS 1000
+#define SYNC_BLOCKS 8
+#define PERIOD_MS 100
+#define RTC_START ((uint32_t)1792224000UL)
+#define CELLS 12
+#define AUX 6
+#define TEXT_RECORD 176 // print_cells_SD text of one IC, from sdlog_bench
+
+static uint16_t failures = 0;
+
+static void fail(const char *what, unsigned got, unsigned expected)
+{
+  failures++;
+  if (failures < 10) printf("FAIL %s: %u, expected %u\n", what, got, expected);
+}
+
+/*! The log file on the card */
+struct Card
+{
+  std::vector<std::vector<uint8_t> > blocks;
+  uint32_t synced_blocks = 0; //!< File size as of the last sync
+};
+
+static Card card;
+
+static int8_t card_read(uint32_t block, uint8_t *data)
+{
+  if (block >= card.blocks.size()) return(-1);
+  memcpy(data, card.blocks[block].data(), SDLOG_BLOCK);
+  return(0);
+}
+
+static int8_t card_write(uint32_t block, const uint8_t *data)
+{
+  if (block > card.blocks.size()) return(-1);
+  if (block == card.blocks.size()) card.blocks.push_back(std::vector<uint8_t>(SDLOG_BLOCK, 0));
+  if (data) memcpy(card.blocks[block].data(), data, SDLOG_BLOCK);
+  else memset(card.blocks[block].data(), 0, SDLOG_BLOCK);
+  return(0);
+}
+
+static int8_t card_sync(void)
+{
+  card.synced_blocks = (uint32_t)card.blocks.size();
+  return(0);
+}
+
+static const sd_log_io CARD_IO = {card_read, card_write, card_sync};
+
+/*! Codes of one IC, laid out like ic_measurement so the stride is not 2 */
+typedef struct
+{
+  uint16_t cells[18];
+  uint16_t pad[3];
+  uint16_t aux[9];
+} ic_codes;
+
+typedef struct
+{
+  uint32_t rtc;
+  uint32_t ms;
+  uint8_t aux;
+  uint32_t n;   //!< Record number, sets the codes
+  uint32_t seq; //!< Sequence number in the log
+} record;
+
+static uint16_t code(uint32_t n, unsigned channel)
+{
+  return((uint16_t)(30000 + n*7 + channel*131));
+}
+
+static bool same(const record &a, const record &b)
+{
+  return(a.rtc == b.rtc && a.ms == b.ms && a.aux == b.aux && a.n == b.n);
+}
+
+/* Decodes every data block on the card, checking each record's codes */
+static std::vector<record> decode(const Card &c)
+{
+  std::vector<record> out;
+  uint16_t codes[CELLS + AUX];
+  for (const std::vector<uint8_t> &block : c.blocks)
+  {
+    bl_reader reader;
+    uint32_t seq = SDLOG_SEQ_ANY;
+    if (bl_first(&reader, block.data()) != 0) continue;
+    if (bl_check(block.data(), &seq) != 0) fail("data block failing its check", 1, 0);
+    const bl_layout &l = reader.layout;
+    for (uint8_t i = 0; i < l.count; i++)
+    {
+      if (bl_next(&reader, codes) != 0)
+      {
+        fail("record not decoded, block record", i, 0);
+        break;
+      }
+      record r = {reader.rtc, reader.ms, l.aux, (reader.ms - PERIOD_MS)/PERIOD_MS, reader.seq};
+      for (unsigned ch = 0; ch < (unsigned)l.total_ic*(l.cells + l.aux); ch++)
+      {
+        if (codes[ch] != code(r.n, ch)) r.n = 0xFFFFFFFF; // Shows as a mismatch
+      }
+      out.push_back(r);
+    }
+    if (bl_next(&reader, codes) == 0) fail("record past the count", 1, 0);
+  }
+  return(out);
+}
+
+/* Logs for run_ms in blocks of type, cutting the power once at cut_ms if it is not 0 */
+static std::vector<record> run(sd_log *log, bin_log *b, uint8_t type, uint32_t run_ms, uint32_t cut_ms)
+{
+  std::vector<record> expected;
+  ic_codes ic;
+
+  card = Card();
+  if (sd_log_open(log, &CARD_IO, 0, FLUSH_MS, SYNC_BLOCKS, &bl_format) != 0) fail("opening an empty card", 1, 0);
+  if (bl_open(b, log, 1, CELLS, AUX, 6811, RTC_START, 0) != 0) fail("writing the session header", 1, 0);
+  b->type = type;
+  for (uint32_t now = 1; now <= run_ms; now++)
+  {
+    if (now % PERIOD_MS == 0)
+    {
+      record r = {RTC_START + now/1000, now, (uint8_t)((now >= 2400000 && now < 3000000) ? 0 : AUX), now/PERIOD_MS - 1, 0};
+      for (unsigned c = 0; c < CELLS; c++) ic.cells[c] = code(r.n, c);
+      for (unsigned a = 0; a < AUX; a++) ic.aux[a] = code(r.n, CELLS + a);
+      bl_add(b, r.rtc, r.ms, 1, CELLS, r.aux, ic.cells, ic.aux, sizeof(ic_codes), now);
+      expected.push_back(r);
+    }
+    sd_log_service(log, now);
+
+    if (now == cut_ms)
+    {
+      card.blocks.resize(card.synced_blocks);
+      std::vector<record> kept = decode(card);
+      size_t must_have = 0;
+      while (must_have < expected.size() && expected[must_have].ms + FLUSH_MS + 1 < now) must_have++;
+      for (size_t i = 0; i < kept.size(); i++)
+      {
+        if (i >= expected.size() || !same(kept[i], expected[i]))
+        {
+          fail("record after a power cut differs, record", (unsigned)i, 0);
+          break;
+        }
+      }
+      if (kept.size() < must_have) fail("records older than the flush time lost in a power cut", (unsigned)kept.size(), (unsigned)must_have);
+      expected.resize(kept.size());
+      if (sd_log_open(log, &CARD_IO, card.synced_blocks, FLUSH_MS, SYNC_BLOCKS, &bl_format) != 0) fail("reopening after a power cut", 1, 0);
+      if (bl_open(b, log, 1, CELLS, AUX, 6811, RTC_START + now/1000, now) != 0) fail("writing the session header after a reset", 1, 0);
+      b->type = type;
+    }
+  }
+  sd_log_flush(log);
+  return(expected);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+  return(p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+/* Checks the index blocks, returns the blocks read to find [from, to] with them */
+static uint32_t check_index(uint32_t from, uint32_t to)
+{
+  uint32_t used = (uint32_t)card.blocks.size();
+  uint32_t partial = 0, read = 0;
+
+  while (used > 0 && card.blocks[used - 1][0] == 0) used--;
+  for (uint32_t first = 0; first < used; first += BL_INDEX_SPAN)
+  {
+    uint32_t at = first + BL_INDEX_SPAN - 1;
+    uint32_t lo = 0xFFFFFFFF, hi = 0, records = 0;
+    if (at >= used)
+    {
+      read += used - first; // No index yet, the reader scans the span
+      break;
+    }
+    for (uint32_t b = first; b < at; b++)
+    {
+      bl_reader reader;
+      uint16_t codes[CELLS + AUX];
+      if (bl_first(&reader, card.blocks[b].data()) != 0) continue;
+      while (bl_next(&reader, codes) == 0)
+      {
+        uint32_t rtc = reader.rtc;
+        lo = (rtc < lo) ? rtc : lo;
+        hi = (rtc > hi) ? rtc : hi;
+        records++;
+      }
+    }
+    const uint8_t *index = card.blocks[at].data();
+    read++;
+    if (index[0] != BL_INDEX)
+    {
+      fail("block without its index, block", at, 0);
+      continue;
+    }
+    if (get32(&index[4]) != first) fail("index first block", get32(&index[4]), first);
+    if (index[2] & BL_INDEX_PARTIAL)
+    {
+      partial++;
+      read += BL_INDEX_SPAN - 1;
+      continue;
+    }
+    if (get32(&index[16]) != lo || get32(&index[20]) != hi || get32(&index[24]) != records) fail("index differs from its span, block", at, 0);
+    if (records != 0 && hi >= from && lo <= to) read += BL_INDEX_SPAN - 1;
+  }
+  if (partial > 1) fail("partial indexes with one reset", partial, 1);
+  return(read);
+}
+
+int main(int argc, char **argv)
+{
+  static sd_log log;
+  static bin_log b;
+  const uint8_t types[2] = {BL_DATA, BL_DELTA};
+  double bytes[2] = {0, 0};
+
+  printf("1 hour of 1 IC, %u cells and %u aux codes every %u ms, power cut at 20 minutes\n", CELLS, AUX, PERIOD_MS);
+  for (int t = 0; t < 2; t++)
+  {
+    std::vector<record> expected = run(&log, &b, types[t], 3600000, 1200000);
+    std::vector<record> got = decode(card);
+    if (got.size() != expected.size()) fail("records decoded", (unsigned)got.size(), (unsigned)expected.size());
+    for (size_t i = 0; i < got.size() && i < expected.size(); i++)
+    {
+      if (!same(got[i], expected[i]))
+      {
+        fail("decoded record differs, record", (unsigned)i, 0);
+        break;
+      }
+      if (got[i].seq != i)
+      {
+        fail("sequence number of record", got[i].seq, (unsigned)i);
+        break;
+      }
+    }
+    if (b.count.errors != 0 || log.count.errors != 0) fail("card errors", b.count.errors + log.count.errors, 0);
+    while (card.synced_blocks > 0 && card.blocks[card.synced_blocks - 1][0] == 0) card.synced_blocks--; // Blocks in use
+    uint32_t from = RTC_START + 1800, to = RTC_START + 1860;
+    uint32_t read = check_index(from, to);
+    bytes[t] = (double)card.synced_blocks*SDLOG_BLOCK/got.size();
+
+    printf("'%c' blocks: records %u, blocks %u, indexes %u, %.1f bytes per record, text %u\n", types[t], (unsigned)got.size(),
+           (unsigned)card.blocks.size(), b.count.indexes, bytes[t], TEXT_RECORD);
+    printf("blocks read to find one minute: %u by the index, %u by a full scan\n", read, (unsigned)card.blocks.size());
+  }
+  if (bytes[1] >= bytes[0]) fail("delta coded blocks no smaller", (unsigned)bytes[1], (unsigned)bytes[0]);
+
+  if (argc > 1)
+  {
+    uint32_t hours = (argc > 2) ? (uint32_t)atoi(argv[2]) : 24;
+    uint8_t type = (argc > 3 && strcmp(argv[3], "delta") == 0) ? BL_DELTA : BL_DATA;
+    run(&log, &b, type, hours*3600000UL, 0);
+    FILE *f = fopen(argv[1], "wb");
+    if (f == NULL)
+    {
+      printf("cannot write %s\n", argv[1]);
+      return(1);
+    }
+    for (const std::vector<uint8_t> &block : card.blocks) fwrite(block.data(), 1, SDLOG_BLOCK, f);
+    fclose(f);
+    printf("wrote %u '%c' blocks of %u hours to %s, RTC from %u\n", (unsigned)card.blocks.size(), type, hours, argv[1], RTC_START);
+  }
+
+  printf("%s, %u failures\n", failures ? "FAIL" : "PASS", failures);
+  return(failures ? 1 : 0);
+}
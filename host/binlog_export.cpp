@@ -0,0 +1,257 @@
+/*!
+  SD binary log export to CSV
+@verbatim
+  Reads SD logs in the lib/BinLog format and writes their records as CSV
+  on stdout, one line per record:
+
+    seq,rtc,millis,C1,...,Cn,A1,...,Am
+    34,1792224000,3400,3.6001,3.6012,...
+
+  seq is the record's sequence number in the log, rtc is in RTC seconds
+  since 1970. Codes are printed in volts, cells as
+  C1 to Cn counted down the whole chain, then the aux codes. A new header
+  line comes before any record whose layout differs from the line above.
+
+  Each file is split at its index blocks into spans of BL_INDEX_SPAN
+  blocks. With -from or -to, a span whose index shows no record in the
+  range is skipped without reading it. The spans left are decoded on -j
+  threads, and written out in file order. 'D' and delta coded 'Z' blocks
+  decode alike. A block that fails its CRC is left out and counted.
+
+  Usage: binlog_export [-j threads] [-from rtc] [-to rtc] log.bin ...
+@endverbatim
+*/
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BinLog.h"
+
+typedef struct
+{
+  const uint8_t *data; //!< Mapped file
+  uint64_t first;      //!< First block of the span
+  uint64_t blocks;     //!< Blocks in the span
+} span_job;
+
+typedef struct
+{
+  std::string text;    //!< CSV lines, less the header of the first layout
+  bl_layout first;     //!< Layout of the first record
+  bl_layout last;      //!< Layout of the last record
+  uint32_t records;
+  uint32_t blocks;     //!< Data blocks read
+  uint32_t torn;       //!< Blocks failing their check
+} span_result;
+
+static uint32_t from_rtc = 0, to_rtc = 0xFFFFFFFF;
+
+static bool same_layout(const bl_layout &a, const bl_layout &b)
+{
+  return(a.total_ic == b.total_ic && a.cells == b.cells && a.aux == b.aux);
+}
+
+static void put_header(std::string &out, const bl_layout &l)
+{
+  char name[16];
+  out += "seq,rtc,millis";
+  for (unsigned c = 0; c < (unsigned)l.total_ic*l.cells; c++)
+  {
+    snprintf(name, sizeof(name), ",C%u", c + 1);
+    out += name;
+  }
+  for (unsigned a = 0; a < (unsigned)l.total_ic*l.aux; a++)
+  {
+    snprintf(name, sizeof(name), ",A%u", a + 1);
+    out += name;
+  }
+  out += '\n';
+}
+
+/* Appends an unsigned number */
+static char *put_u32(char *p, uint32_t value)
+{
+  char digits[10];
+  int n = 0;
+  do
+  {
+    digits[n++] = (char)('0' + value % 10);
+    value /= 10;
+  }
+  while (value != 0);
+  while (n > 0) *p++ = digits[--n];
+  return(p);
+}
+
+/* Appends a code in volts, 100 uV per count */
+static char *put_volts(char *p, uint16_t code)
+{
+  p = put_u32(p, code/10000);
+  *p++ = '.';
+  uint16_t frac = code % 10000;
+  p[0] = (char)('0' + frac/1000);
+  p[1] = (char)('0' + frac/100 % 10);
+  p[2] = (char)('0' + frac/10 % 10);
+  p[3] = (char)('0' + frac % 10);
+  return(p + 4);
+}
+
+static void decode_span(const span_job &job, span_result &result)
+{
+  std::vector<char> line;
+  std::vector<uint16_t> codes;
+  bool any = false;
+
+  for (uint64_t b = job.first; b < job.first + job.blocks; b++)
+  {
+    const uint8_t *block = job.data + b*SDLOG_BLOCK;
+    uint32_t seq = SDLOG_SEQ_ANY;
+    bl_reader reader;
+    if (block[0] == 0 || block[0] == SDLOG_SUPER) continue; // Preallocated or a checkpoint
+    if (bl_check(block, &seq) != 0)
+    {
+      result.torn++;
+      continue;
+    }
+    if (bl_first(&reader, block) != 0) continue; // Header or index
+    result.blocks++;
+    const bl_layout &layout = reader.layout;
+    uint16_t channels = (uint16_t)layout.total_ic*(layout.cells + layout.aux);
+    line.resize(36 + 8*(size_t)channels);
+    codes.resize(channels);
+    while (bl_next(&reader, codes.data()) == 0)
+    {
+      uint32_t rtc = reader.rtc;
+      if (rtc < from_rtc || rtc > to_rtc) continue;
+      if (!any) result.first = layout;
+      else if (!same_layout(layout, result.last)) put_header(result.text, layout);
+      any = true;
+      result.last = layout;
+      char *p = line.data();
+      p = put_u32(p, reader.seq);
+      *p++ = ',';
+      p = put_u32(p, rtc);
+      *p++ = ',';
+      p = put_u32(p, reader.ms);
+      for (uint16_t c = 0; c < channels; c++)
+      {
+        *p++ = ',';
+        p = put_volts(p, codes[c]);
+      }
+      *p++ = '\n';
+      result.text.append(line.data(), p - line.data());
+      result.records++;
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  unsigned threads = std::thread::hardware_concurrency();
+  std::vector<span_job> jobs;
+  uint64_t skipped = 0, total_blocks = 0, bytes = 0;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) threads = (unsigned)atoi(argv[++i]);
+    else if (strcmp(argv[i], "-from") == 0 && i + 1 < argc) from_rtc = (uint32_t)strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "-to") == 0 && i + 1 < argc) to_rtc = (uint32_t)strtoul(argv[++i], NULL, 10);
+    else
+    {
+      int fd = open(argv[i], O_RDONLY);
+      struct stat st;
+      if (fd < 0 || fstat(fd, &st) != 0)
+      {
+        fprintf(stderr, "cannot open %s\n", argv[i]);
+        return(1);
+      }
+      uint64_t blocks = (uint64_t)st.st_size/SDLOG_BLOCK;
+      if (blocks == 0)
+      {
+        close(fd);
+        continue;
+      }
+      const uint8_t *data = (const uint8_t *)mmap(NULL, blocks*SDLOG_BLOCK, PROT_READ, MAP_PRIVATE, fd, 0);
+      close(fd);
+      if (data == MAP_FAILED)
+      {
+        fprintf(stderr, "cannot map %s\n", argv[i]);
+        return(1);
+      }
+      bytes += blocks*SDLOG_BLOCK;
+      total_blocks += blocks;
+      for (uint64_t first = 0; first < blocks; first += BL_INDEX_SPAN)
+      {
+        span_job job = {data, first, (blocks - first < BL_INDEX_SPAN) ? blocks - first : BL_INDEX_SPAN};
+        const uint8_t *index = data + (first + BL_INDEX_SPAN - 1)*SDLOG_BLOCK;
+        uint32_t seq = SDLOG_SEQ_ANY;
+        if (job.blocks == BL_INDEX_SPAN && index[0] == BL_INDEX && bl_check(index, &seq) == 0 && !(index[2] & BL_INDEX_PARTIAL))
+        {
+          uint32_t lo = index[16] | (index[17] << 8) | (index[18] << 16) | ((uint32_t)index[19] << 24);
+          uint32_t hi = index[20] | (index[21] << 8) | (index[22] << 16) | ((uint32_t)index[23] << 24);
+          uint32_t records = index[24] | (index[25] << 8) | (index[26] << 16) | ((uint32_t)index[27] << 24);
+          if (records == 0 || hi < from_rtc || lo > to_rtc)
+          {
+            skipped++;
+            continue;
+          }
+        }
+        jobs.push_back(job);
+      }
+    }
+  }
+  if (threads == 0) threads = 1;
+
+  auto start = std::chrono::steady_clock::now();
+  const size_t window = 64*(size_t)threads; // Spans decoded before they are written, bounds the memory used
+  bl_layout written = {0, 0, 0, 0, 0};
+  bool header = false;
+  uint64_t records = 0, read_blocks = 0, torn = 0;
+  for (size_t base = 0; base < jobs.size(); base += window)
+  {
+    size_t n = (jobs.size() - base < window) ? jobs.size() - base : window;
+    std::vector<span_result> results(n);
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < threads; t++)
+    {
+      pool.push_back(std::thread([&]()
+      {
+        size_t k;
+        while ((k = next++) < n) decode_span(jobs[base + k], results[k]);
+      }));
+    }
+    for (std::thread &t : pool) t.join();
+    for (span_result &r : results)
+    {
+      torn += r.torn;
+      if (r.records == 0) continue;
+      if (!header || !same_layout(r.first, written))
+      {
+        std::string h;
+        put_header(h, r.first);
+        fwrite(h.data(), 1, h.size(), stdout);
+      }
+      fwrite(r.text.data(), 1, r.text.size(), stdout);
+      header = true;
+      written = r.last;
+      records += r.records;
+      read_blocks += r.blocks;
+    }
+  }
+  fflush(stdout);
+  double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  fprintf(stderr, "%llu blocks, %llu spans skipped by the index, %llu data blocks decoded, %llu failing their check, %llu records, %.2f s, %.0f MB/s on %u threads\n",
+          (unsigned long long)total_blocks, (unsigned long long)skipped, (unsigned long long)read_blocks, (unsigned long long)torn,
+          (unsigned long long)records, s, s > 0 ? bytes/1e6/s : 0.0, threads);
+  return(0);
+}
@@ -0,0 +1,138 @@
+/*!
+  BLE packetizer check and link budget simulation
+@verbatim
+  Packs cycles of pack fields and cell codes through lib/BlePacket at a
+  range of link budgets. It checks several things. Every framed packet
+  fits in BLE_MTU, holds no zero byte before its delimiter and unpacks to
+  the fields that went in. A flipped bit fails the COBS or checksum check. The required fields arrive every cycle. The bytes sent stay
+  within the budget plus one second of burst and the required overdraft.
+  Every cell is refreshed within the number of cycles the budget implies.
+  For each budget it prints the bytes per cycle and the worst cell age.
+  The exit status is non-zero if a check fails.
+
+  Usage: ble_bench [ics]
+@endverbatim
+*/
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "BlePacket.h"
+
+#define CELLS 12
+#define REQUIRED 6
+#define CYCLE_MS 1000
+
+static uint16_t failures = 0;
+static uint32_t bytes_sent = 0;
+static std::vector<ble_field> received;
+static uint8_t last_seen = 0;
+
+static void fail(const char *what, unsigned got, unsigned expected)
+{
+  failures++;
+  if (failures < 10) printf("FAIL %s: %u, expected %u\n", what, got, expected);
+}
+
+/* Stands in for queueing the frame on Serial1: unpacks it as the app would */
+static void receive(const uint8_t *frame, uint8_t len)
+{
+  ble_field fields[BLE_FIELDS_PER_PACKET];
+  uint8_t seq, last;
+  uint8_t copy[BLE_MTU];
+
+  bytes_sent += len;
+  if (len > BLE_MTU) fail("packet longer than the MTU", len, BLE_MTU);
+  if (frame[len - 1] != 0) fail("frame without its delimiter", frame[len - 1], 0);
+  if (memchr(frame, 0, len - 1) != NULL) fail("zero byte inside a frame", len, 0);
+  len--; // The app splits the stream at the delimiter
+  int8_t count = ble_unpack(frame, len, &seq, &last, fields);
+  if (count < 0)
+  {
+    fail("packet rejected", len, 0);
+    return;
+  }
+  for (int8_t i = 0; i < count; i++) received.push_back(fields[i]);
+  last_seen |= last;
+
+  // Any single flipped bit must fail the COBS or checksum check
+  for (uint8_t i = 0; i < len; i++)
+  {
+    memcpy(copy, frame, len);
+    copy[i] ^= (uint8_t)(1 << (i % 8));
+    if (ble_unpack(copy, len, &seq, &last, fields) >= 0 && memcmp(copy, frame, len) != 0) fail("corrupted packet accepted", i, 0);
+  }
+}
+
+static void run_budget(uint16_t budget_bps, uint8_t total_ic)
+{
+  const uint16_t n_cells = (uint16_t)total_ic*CELLS;
+  std::vector<ble_field> fields(REQUIRED + n_cells);
+  std::vector<uint32_t> age(n_cells, 0);
+  uint32_t worst_age = 0;
+  ble_link link;
+  const uint32_t cycles = 200;
+
+  ble_init(&link, budget_bps);
+  bytes_sent = 0;
+  for (uint32_t cycle = 0; cycle < cycles; cycle++)
+  {
+    for (uint8_t i = 0; i < REQUIRED; i++) fields[i] = {(uint8_t)(BLE_PACK_VOLTAGE + i), (uint16_t)(cycle*7 + i)};
+    for (uint16_t c = 0; c < n_cells; c++) fields[REQUIRED + c] = {(uint8_t)(BLE_CELL + c), (uint16_t)(36000 + cycle + c)};
+
+    received.clear();
+    last_seen = 0;
+    ble_pack(&link, fields.data(), (uint16_t)fields.size(), REQUIRED, cycle*CYCLE_MS, receive);
+
+    if (!last_seen) fail("cycle without a last packet", cycle, 1);
+    if (received.size() < REQUIRED) fail("required fields missing", (unsigned)received.size(), REQUIRED);
+    for (uint8_t i = 0; i < REQUIRED && i < received.size(); i++)
+    {
+      if (received[i].id != fields[i].id || received[i].value != fields[i].value) fail("required field", received[i].value, fields[i].value);
+    }
+    for (uint16_t c = 0; c < n_cells; c++) age[c]++;
+    for (size_t i = REQUIRED; i < received.size(); i++)
+    {
+      uint16_t c = (uint16_t)(received[i].id - BLE_CELL);
+      if (c >= n_cells || received[i].value != fields[REQUIRED + c].value) fail("cell field", received[i].id, BLE_CELL + c);
+      else age[c] = 0;
+    }
+    if (cycle >= 10)
+    {
+      for (uint16_t c = 0; c < n_cells; c++) if (age[c] > worst_age) worst_age = age[c];
+    }
+  }
+
+  // Steady state fields per cycle the budget pays for, and the age that implies
+  double per_cycle = budget_bps*(CYCLE_MS/1000.0);
+  double required_cost = REQUIRED*BLE_FIELD_LEN + ((REQUIRED + BLE_FIELDS_PER_PACKET - 1)/BLE_FIELDS_PER_PACKET)*(BLE_FRAME_OVERHEAD + BLE_PACKET_OVERHEAD);
+  double cell_cost = BLE_FIELD_LEN*(1.0 + (double)(BLE_FRAME_OVERHEAD + BLE_PACKET_OVERHEAD)/(BLE_FIELD_LEN*BLE_FIELDS_PER_PACKET));
+  double cells_per_cycle = (per_cycle - required_cost)/cell_cost;
+  uint32_t bound = cells_per_cycle >= n_cells ? 0 : (cells_per_cycle < 1 ? cycles : (uint32_t)(n_cells/(cells_per_cycle - 1)) + 1);
+  if (worst_age > bound) fail("cell refreshed too rarely, cycles", worst_age, bound);
+
+  double limit = budget_bps*(cycles*CYCLE_MS/1000.0) + budget_bps + cycles*required_cost;
+  if (bytes_sent > limit) fail("budget exceeded, bytes", bytes_sent, (unsigned)limit);
+  double bps = bytes_sent/(cycles*CYCLE_MS/1000.0);
+  printf("%6u %12.0f %14.1f %10u %12.0f\n", budget_bps, bps, (double)link.sent/cycles, worst_age, 100.0*link.sent/(link.sent + link.deferred));
+}
+
+int main(int argc, char *argv[])
+{
+  uint8_t total_ic = 1;
+  if (argc > 1) total_ic = (uint8_t)atoi(argv[1]);
+  if (total_ic < 1 || (uint16_t)total_ic*CELLS > BLE_CELLS_MAX)
+  {
+    fprintf(stderr, "usage: %s [ics 1-%u]\n", argv[0], BLE_CELLS_MAX/CELLS);
+    return(2);
+  }
+
+  printf("%u ICs x %u cells, %u required fields, %u byte MTU, one cycle a second\n", total_ic, CELLS, REQUIRED, BLE_MTU);
+  printf("budget  bytes/s sent  cells per cycle  worst age  %% cells sent\n");
+  const uint16_t budgets[] = {30, 60, 120, 240, 480, 960};
+  for (uint8_t i = 0; i < sizeof(budgets)/sizeof(budgets[0]); i++) run_budget(budgets[i], total_ic);
+
+  printf("%s, %u failures\n", failures ? "FAIL" : "PASS", failures);
+  return(failures ? 1 : 0);
+}
@@ -0,0 +1,179 @@
+/*!
+  Cell statistics check and micro-benchmark
+@verbatim
+  Feeds random walk cell codes through lib/CellStats and compares the
+  running min, max, mean, variance and dv/dt against a double precision
+  reference, checks the snapshot ring buffer order and that stale cells are
+  left out, then times one update and one pack summary. The exit status is
+  non-zero if a check fails.
+
+  Usage: cell_stats_bench [ics] [cycles]
+@endverbatim
+*/
+#include <Arduino.h>
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "LTC681x.h"
+#include "CellStats.h"
+
+#define CELLS 12
+
+static uint16_t failures = 0;
+static cell_asic bms_ic[BMS_TOTAL_IC];
+static cell_history history;
+
+/* Double precision reference of one cell */
+struct reference
+{
+  double sum;
+  double sum_sq;
+  uint32_t count;
+  uint16_t min;
+  uint16_t max;
+};
+
+static void check(bool ok, const char *what, uint8_t ic, uint8_t cell, double got, double expected)
+{
+  if (!ok)
+  {
+    failures++;
+    printf("FAIL %s IC %u cell %u: %.3f, expected %.3f\n", what, ic, cell, got, expected);
+  }
+}
+
+static uint32_t rng = 1;
+static uint16_t next_random()
+{
+  rng = rng*1103515245u + 12345u;
+  return((uint16_t)(rng >> 16));
+}
+
+static void check_stats(uint8_t total_ic, uint16_t cycles)
+{
+  static reference ref[BMS_TOTAL_IC][CELLS];
+  uint32_t time_ms = 1000;
+
+  memset(ref, 0, sizeof(ref));
+  cell_stats_reset(&history);
+  for (uint8_t ic = 0; ic < total_ic; ic++)
+  {
+    bms_ic[ic].ic_reg.cell_channels = CELLS;
+    for (uint8_t cell = 0; cell < CELLS; cell++) bms_ic[ic].cells.c_codes[cell] = 36000 + 100*cell;
+  }
+
+  for (uint16_t cycle = 0; cycle < cycles; cycle++)
+  {
+    for (uint8_t ic = 0; ic < total_ic; ic++)
+    {
+      bms_ic[ic].cells.stale = (cycle % 5 == 4) ? 0x00F : 0; // Every fifth cycle leaves cells 1 to 4 stale
+      for (uint8_t cell = 0; cell < CELLS; cell++)
+      {
+        if (bms_ic[ic].cells.stale & (1UL << cell)) continue;
+        uint16_t code = cell == 0 ? 36000 + 3*cycle : bms_ic[ic].cells.c_codes[cell] + (next_random() % 41) - 20; // Cell 1 charges steadily
+        bms_ic[ic].cells.c_codes[cell] = code;
+        reference *r = &ref[ic][cell];
+        if (r->count == 0 || code < r->min) r->min = code;
+        if (r->count == 0 || code > r->max) r->max = code;
+        r->sum += code;
+        r->sum_sq += (double)code*code;
+        r->count++;
+      }
+    }
+    cell_stats_update(&history, total_ic, bms_ic, time_ms);
+    time_ms += 250;
+  }
+
+  for (uint8_t ic = 0; ic < total_ic; ic++)
+  {
+    for (uint8_t cell = 0; cell < CELLS; cell++)
+    {
+      cell_summary s;
+      reference *r = &ref[ic][cell];
+      double mean = r->sum/r->count;
+      double variance = r->sum_sq/r->count - mean*mean;
+
+      check(cell_stats_cell(&history, ic, cell, &s) == 0, "no samples", ic, cell, 0, r->count);
+      check(s.count == r->count, "count", ic, cell, s.count, r->count);
+      check(s.min == r->min, "min", ic, cell, s.min, r->min);
+      check(s.max == r->max, "max", ic, cell, s.max, r->max);
+      check(fabs(s.mean - mean) <= 0.5, "mean", ic, cell, s.mean, mean);
+      check(fabs(s.variance - variance) <= 1.0 + variance*1e-6, "variance", ic, cell, s.variance, variance);
+    }
+    // Cell 1 rises 3 codes (300 uV) every 250 ms, 1200 uV/s, also across the stale cycles
+    cell_summary s;
+    cell_stats_cell(&history, ic, 0, &s);
+    check(cycles < 100 || abs(s.dvdt - 1200) <= 8, "dv/dt", ic, 0, s.dvdt, 1200);
+  }
+
+  const cell_snapshot *newest = cell_stats_snapshot(&history, 0);
+  check(newest != NULL && newest->time_ms == time_ms - 250, "newest snapshot", 0, 0, newest ? newest->time_ms : 0, time_ms - 250);
+  check(newest != NULL && newest->c_codes[0][5] == bms_ic[0].cells.c_codes[5], "snapshot codes", 0, 5,
+        newest ? newest->c_codes[0][5] : 0, bms_ic[0].cells.c_codes[5]);
+  uint8_t held = cycles < STATS_HISTORY ? cycles : STATS_HISTORY;
+  const cell_snapshot *oldest = cell_stats_snapshot(&history, held - 1);
+  check(oldest != NULL && oldest->time_ms == time_ms - 250*held, "oldest snapshot", 0, 0, oldest ? oldest->time_ms : 0, time_ms - 250*held);
+  check(cell_stats_snapshot(&history, held) == NULL, "snapshot past the history", 0, 0, 1, 0);
+}
+
+/* Long run past STATS_COUNT_MAX: the sums are halved, mean and variance must stay close */
+static void check_halving()
+{
+  cell_stats_reset(&history);
+  bms_ic[0].ic_reg.cell_channels = CELLS;
+  bms_ic[0].cells.stale = 0;
+  for (uint32_t cycle = 0; cycle < 3UL*STATS_COUNT_MAX; cycle++)
+  {
+    for (uint8_t cell = 0; cell < CELLS; cell++) bms_ic[0].cells.c_codes[cell] = (uint16_t)(40000 + (cycle & 1)*200); // mean 40100, variance 10000
+    cell_stats_update(&history, 1, bms_ic, cycle*100);
+  }
+  cell_summary s;
+  cell_stats_cell(&history, 0, 3, &s);
+  check(s.count <= STATS_COUNT_MAX && s.count > STATS_COUNT_MAX/2, "count after halving", 0, 3, s.count, STATS_COUNT_MAX);
+  check(abs((int)s.mean - 40100) <= 1, "mean after halving", 0, 3, s.mean, 40100);
+  check(fabs(s.variance - 10000.0) <= 10.0, "variance after halving", 0, 3, s.variance, 10000);
+}
+
+int main(int argc, char *argv[])
+{
+  uint8_t total_ic = 4;
+  uint32_t cycles = 20000;
+  if (argc > 1) total_ic = (uint8_t)atoi(argv[1]);
+  if (argc > 2) cycles = (uint32_t)atol(argv[2]);
+  if (total_ic < 1 || total_ic > BMS_TOTAL_IC || cycles < 1)
+  {
+    fprintf(stderr, "usage: %s [ics 1-%u] [cycles]\n", argv[0], BMS_TOTAL_IC);
+    return(2);
+  }
+
+  check_stats(total_ic, 5);
+  check_stats(total_ic, 1000);
+  check_halving();
+
+  printf("%u ICs x %u cells, cell history %u bytes (%u snapshots)\n", total_ic, CELLS,
+         (unsigned)sizeof(cell_history), STATS_HISTORY);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < cycles; i++)
+  {
+    bms_ic[0].cells.c_codes[i % CELLS] = (uint16_t)(36000 + i % 97);
+    cell_stats_update(&history, total_ic, bms_ic, i*250);
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  printf("%-24s %10.1f ns per cycle %8.1f ns per cell\n", "cell_stats_update", ns/cycles, ns/cycles/(total_ic*CELLS));
+
+  pack_summary pack;
+  volatile uint16_t sink = 0;
+  start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < cycles; i++)
+  {
+    cell_stats_pack(&history, total_ic, CELLS, &pack);
+    sink += pack.mean;
+  }
+  ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  printf("%-24s %10.1f ns per call, independent of the history depth\n", "cell_stats_pack", ns/cycles);
+
+  printf("%s, %u failures\n", failures ? "FAIL" : "PASS", failures);
+  return(failures ? 1 : 0);
+}
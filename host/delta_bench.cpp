@@ -0,0 +1,361 @@
+/*!
+  Delta coded telemetry and SD records on a realistic signal
+@verbatim
+  Models cell codes the way a pack gives them: 3.7 V cells a few mV apart,
+  a slow discharge, +-0.4 mV of noise, load steps that move every cell
+  50 mV at once, and channel selective reads leaving cells stale. It
+  sends an hour of cycles at 10 per second over a simulated link through
+  lib/Telemetry delta frames, cells, aux and stat, COBS encoded. The link
+  loses messages at random, some of them lost before they went out, which
+  the sender learns of, as tx_end() tells the sketch. It checks:
+
+    every frame the receiver accepts gives back the codes sent exactly
+    a corrupted frame is never accepted
+    after a loss the receiver is back within keyframe_every frames, and
+    at once when the sender knew of it
+    no type goes more than keyframe_every frames without a keyframe
+    tlm_parse() rejects delta frames
+
+  It then logs the same hour through lib/BinLog to a card in RAM, in 'D'
+  blocks and in delta coded 'Z' blocks, and checks both decode back
+  exactly. It prints the bytes per cycle of each, against the JSON of the
+  cells the links send as text and the text of the SD log. The exit status
+  is non-zero if a check fails.
+
+  Usage: delta_bench [ics [keyframe_every]]
+@endverbatim
+*/
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "LTC681x.h"
+#include "BmsSnapshot.h"
+#include "Telemetry.h"
+#include "BinLog.h"
+
+#define CELLS 12
+#define AUX_CODES 6
+#define STAT_CODES 4
+#define PERIOD_MS 100
+#define CYCLES 36000 // An hour
+#define LOSS 50       // One message in LOSS lost
+#define RTC_START ((uint32_t)1792224000UL)
+
+static uint16_t failures = 0;
+static bms_snapshot snap;
+static uint8_t raw[TLM_FRAME_MAX];
+static uint8_t encoded[TLM_COBS_MAX(TLM_FRAME_MAX)];
+static uint8_t decoded[TLM_COBS_MAX(TLM_FRAME_MAX)];
+static tlm_frame frame;
+
+static void fail(const char *what, unsigned got, unsigned expected)
+{
+  failures++;
+  if (failures < 10) printf("FAIL %s: %u, expected %u\n", what, got, expected);
+}
+
+static uint32_t rng = 7;
+static uint16_t next_random()
+{
+  rng = rng*1103515245u + 12345u;
+  return((uint16_t)(rng >> 16));
+}
+
+/* Noise of about sigma counts, a sum of uniforms */
+static int32_t noise(int32_t sigma)
+{
+  int32_t sum = 0;
+  for (int i = 0; i < 4; i++) sum += (int32_t)(next_random() % (2*sigma + 1)) - sigma;
+  return(sum/2);
+}
+
+/* Fills the snapshot of one cycle */
+static void cycle(uint8_t total_ic, uint32_t n)
+{
+  bool load = (n/600) % 4 == 3; // One minute in four under load
+  snap.seq = (uint16_t)n;
+  snap.time_ms = n*PERIOD_MS + (next_random() % 3); // The loop is a ms late now and then
+  snap.total_ic = total_ic;
+  for (uint8_t ic = 0; ic < total_ic; ic++)
+  {
+    for (uint8_t c = 0; c < 18; c++)
+    {
+      int32_t code = 37000 + 30*((ic*CELLS + c) % 7) - (int32_t)(n/120) - (load ? 500 : 0) + noise(4);
+      snap.ic[ic].cells.c_codes[c] = (uint16_t)code;
+    }
+    for (uint8_t a = 0; a < 9; a++) snap.ic[ic].aux.a_codes[a] = (uint16_t)(15000 + 2000*a + (int32_t)(n/3000) + noise(3));
+    snap.ic[ic].stat.stat_codes[0] = (uint16_t)(37000*CELLS/20 + noise(10));
+    snap.ic[ic].stat.stat_codes[1] = (uint16_t)(12000 + (int32_t)(n/2000) + noise(2));
+    snap.ic[ic].stat.stat_codes[2] = (uint16_t)(50000 + noise(3));
+    snap.ic[ic].stat.stat_codes[3] = (uint16_t)(33000 + noise(3));
+    snap.ic[ic].cells.stale = (n % 10 == 5) ? 0xF00 : 0; // Channel selective reads of the first cells
+  }
+}
+
+static const uint16_t *codes_of(uint8_t type, uint8_t ic)
+{
+  return(type == TLM_CELLS ? snap.ic[ic].cells.c_codes : type == TLM_AUX ? snap.ic[ic].aux.a_codes : snap.ic[ic].stat.stat_codes);
+}
+
+static void check_frame(uint8_t type, uint8_t channels)
+{
+  if (frame.type != type || frame.seq != snap.seq || frame.time_ms != snap.time_ms || frame.total_ic != snap.total_ic)
+  {
+    fail("header", frame.seq, snap.seq);
+    return;
+  }
+  for (uint8_t ic = 0; ic < snap.total_ic; ic++)
+  {
+    uint32_t expected = ((1UL << channels) - 1) & ~(type == TLM_CELLS ? snap.ic[ic].cells.stale : 0);
+    if (frame.present[ic] != expected) fail("bitmap", frame.present[ic], expected);
+    for (uint8_t ch = 0; ch < channels; ch++)
+    {
+      if ((expected & (1UL << ch)) && frame.codes[ic][ch] != codes_of(type, ic)[ch]) fail("code", frame.codes[ic][ch], codes_of(type, ic)[ch]);
+    }
+  }
+}
+
+/* JSON of the cells, as build_json() writes them for the text links */
+static uint16_t json_cells_bytes()
+{
+  uint16_t bytes = 2;
+  char text[FIXED_TEXT_LEN];
+  for (uint8_t ic = 0; ic < snap.total_ic; ic++)
+  {
+    for (uint8_t c = 0; c < CELLS; c++)
+    {
+      bytes += snprintf(NULL, 0, "\"C%u\":,", ic*CELLS + c + 1) + LTC681x_format_fixed(snap.ic[ic].cells.c_codes[c], 4, text);
+    }
+  }
+  return(bytes);
+}
+
+/* Sends every cycle over a lossy link, returns the wire bytes of the cell frames */
+static double run_link(uint8_t total_ic, uint8_t keyframe_every)
+{
+  static tlm_delta sender, receiver;
+  const uint8_t types[3] = {TLM_CELLS, TLM_AUX, TLM_STAT};
+  const uint8_t channels[3] = {CELLS, AUX_CODES, STAT_CODES};
+  uint32_t since_key[3] = {0, 0, 0}, missed_since[3] = {0, 0, 0};
+  uint32_t lost = 0, known = 0, accepted = 0, refused = 0, keyframes = 0, cell_keyframes = 0, corrupt_tried = 0;
+  double cell_bytes = 0, key_bytes = 0;
+  bool missed[3] = {false, false, false}, known_loss = false;
+
+  tlm_delta_init(&sender, keyframe_every);
+  tlm_delta_init(&receiver, 0);
+  for (uint32_t n = 0; n < CYCLES; n++)
+  {
+    cycle(total_ic, n);
+    bool drop = next_random() % LOSS == 0;
+    bool sender_knows = drop && (next_random() & 1); // Discarded in the queue, not lost on the air
+    for (int t = 0; t < 3; t++)
+    {
+      uint16_t len = tlm_build_delta(raw, types[t], &snap, channels[t], &sender);
+      bool key = !(raw[1] & TLM_DELTA);
+      uint16_t enc_len = tlm_cobs_encode(raw, len, encoded);
+      if (key)
+      {
+        since_key[t] = 0;
+        keyframes++;
+        if (t == 0)
+        {
+          key_bytes += enc_len;
+          cell_keyframes++;
+        }
+      }
+      else if (++since_key[t] >= keyframe_every)
+      {
+        fail("frames without a keyframe", since_key[t], keyframe_every - 1);
+      }
+      if (!key && tlm_parse(raw, len, &frame) == 0) fail("delta frame taken by tlm_parse", 1, 0);
+      if (t == 0) cell_bytes += enc_len;
+      if (drop)
+      {
+        lost++;
+        missed[t] = true;
+        missed_since[t] = 0;
+        continue;
+      }
+
+      if (n % 97 == 0) // A bit flipped on the way, the copy is dropped
+      {
+        uint16_t at = next_random() % (enc_len - 2) + 1;
+        static uint8_t bad[TLM_COBS_MAX(TLM_FRAME_MAX)];
+        memcpy(bad, encoded, enc_len);
+        bad[at] ^= (uint8_t)(1 << (next_random() % 8));
+        tlm_delta copy = receiver;
+        uint16_t dec = tlm_cobs_decode(bad + 1, enc_len - 2, decoded);
+        if (dec != 0 && tlm_parse_delta(decoded, dec, &frame, &copy) == 0)
+        {
+          fail("corrupted frame accepted, cycle", n, 0);
+        }
+        corrupt_tried++;
+      }
+
+      uint16_t dec = tlm_cobs_decode(encoded + 1, enc_len - 2, decoded);
+      if (dec != len || tlm_parse_delta(decoded, dec, &frame, &receiver) != 0)
+      {
+        refused++;
+        missed_since[t]++;
+        if (!missed[t]) fail("frame refused with nothing missed, cycle", n, 0);
+        if (known_loss) fail("frame refused after a loss the sender knew of, cycle", n, 0);
+        if (missed_since[t] >= keyframe_every) fail("frames refused after a loss", missed_since[t], keyframe_every - 1);
+        continue;
+      }
+      missed[t] = false;
+      accepted++;
+      check_frame(types[t], channels[t]);
+    }
+    known_loss = false;
+    if (sender_knows)
+    {
+      tlm_delta_init(&sender, keyframe_every); // What send_link() does when tx_end() fails
+      known++;
+      known_loss = true;
+    }
+  }
+  cycle(total_ic, CYCLES);
+  uint16_t json = json_cells_bytes();
+  double delta = cell_bytes/CYCLES;
+  printf("%u ICs, keyframe every %u frames, one message in %u lost, %u of them known to the sender\n",
+         total_ic, keyframe_every, LOSS, known);
+  printf("frames accepted %u, refused awaiting a keyframe %u, lost %u, keyframes %u, corrupted copies dropped %u\n",
+         accepted, refused, lost, keyframes, corrupt_tried);
+  printf("cells per cycle                  bytes   ms at 9600\n");
+  printf("%-32s %6u %12.1f\n", "JSON text", json, json*10000.0/9600);
+  printf("%-32s %6.1f %12.1f\n", "keyframe", key_bytes/cell_keyframes, key_bytes/cell_keyframes*10000.0/9600);
+  printf("%-32s %6.1f %12.1f  %.1fx smaller than JSON\n", "delta frames, keyframes included", delta, delta*10000.0/9600, json/delta);
+  return(delta);
+}
+
+/*! The log file in RAM */
+/* More channels than a base keeps go as keyframes, and both ends drop the base */
+static void check_wide_frames(uint8_t total_ic)
+{
+  static tlm_delta sender, receiver;
+  const uint8_t wide = TLM_BASE_CELLS + 1;
+  if (wide > TLM_MAX_CHANNELS) return; // Bases as wide as any frame
+  tlm_delta_init(&sender, 16);
+  tlm_delta_init(&receiver, 0);
+  cycle(total_ic, 0);
+  for (uint8_t n = 0; n < 3; n++)
+  {
+    uint16_t len = tlm_build_delta(raw, TLM_CELLS, &snap, n < 2 ? wide : CELLS, &sender); // The first narrow frame has no base either
+    if (len == 0 || (raw[1] & TLM_DELTA)) fail("frame wider than its base not a keyframe", n, 0);
+    if (tlm_parse_delta(raw, len, &frame, &receiver) != 0) fail("keyframe wider than its base refused", n, 0);
+  }
+}
+
+static std::vector<std::vector<uint8_t> > card;
+
+static int8_t card_read(uint32_t block, uint8_t *data)
+{
+  if (block >= card.size()) return(-1);
+  memcpy(data, card[block].data(), SDLOG_BLOCK);
+  return(0);
+}
+
+static int8_t card_write(uint32_t block, const uint8_t *data)
+{
+  if (block > card.size()) return(-1);
+  if (block == card.size()) card.push_back(std::vector<uint8_t>(SDLOG_BLOCK, 0));
+  if (data) memcpy(card[block].data(), data, SDLOG_BLOCK);
+  else memset(card[block].data(), 0, SDLOG_BLOCK);
+  return(0);
+}
+
+static int8_t card_sync(void)
+{
+  return(0);
+}
+
+static const sd_log_io CARD_IO = {card_read, card_write, card_sync};
+
+/* Logs every cycle in blocks of type, checks they decode back, returns the bytes per record */
+static double run_sd(uint8_t total_ic, uint8_t type)
+{
+  static sd_log log;
+  static bin_log b;
+  std::vector<uint16_t> codes((size_t)total_ic*(CELLS + AUX_CODES));
+  uint32_t n = 0, used = 0, seed = rng;
+
+  card.clear();
+  if (sd_log_open(&log, &CARD_IO, 0, 1000, 8, &bl_format) != 0 || bl_open(&b, &log, total_ic, CELLS, AUX_CODES, 6811, RTC_START, 0) != 0)
+  {
+    fail("opening the log", 1, 0);
+    return(0);
+  }
+  b.type = type;
+  for (uint32_t i = 0; i < CYCLES; i++)
+  {
+    cycle(total_ic, i);
+    bl_add(&b, RTC_START + snap.time_ms/1000, snap.time_ms, total_ic, CELLS, AUX_CODES,
+           snap.ic[0].cells.c_codes, snap.ic[0].aux.a_codes, sizeof(ic_measurement), snap.time_ms);
+    sd_log_service(&log, snap.time_ms);
+  }
+  sd_log_flush(&log);
+
+  rng = seed; // Same cycles again
+  for (uint32_t blk = 0; blk < card.size(); blk++)
+  {
+    bl_reader r;
+    uint32_t seq = SDLOG_SEQ_ANY;
+    if (card[blk][0] != 0) used = blk + 1;
+    if (bl_first(&r, card[blk].data()) != 0) continue;
+    if (bl_check(card[blk].data(), &seq) != 0) fail("data block failing its check", blk, 0);
+    if (card[blk][0] != type) fail("block type", card[blk][0], type);
+    while (bl_next(&r, codes.data()) == 0)
+    {
+      cycle(total_ic, n);
+      if (r.seq != n || r.ms != snap.time_ms || r.rtc != RTC_START + snap.time_ms/1000) fail("record header", r.seq, n);
+      for (uint8_t ic = 0; ic < total_ic; ic++)
+      {
+        for (uint8_t c = 0; c < CELLS; c++) if (codes[ic*CELLS + c] != snap.ic[ic].cells.c_codes[c]) fail("cell code of record", n, 0);
+        for (uint8_t a = 0; a < AUX_CODES; a++) if (codes[total_ic*CELLS + ic*AUX_CODES + a] != snap.ic[ic].aux.a_codes[a]) fail("aux code of record", n, 0);
+      }
+      n++;
+    }
+  }
+  if (n != CYCLES) fail("records decoded", n, CYCLES);
+  if (b.count.errors != 0) fail("log errors", b.count.errors, 0);
+  return((double)(used - SDLOG_SUPER_BLOCKS)*SDLOG_BLOCK/CYCLES);
+}
+
+int main(int argc, char *argv[])
+{
+  uint8_t total_ic = 1;
+  uint8_t keyframe_every = 16;
+  if (argc > 1) total_ic = (uint8_t)atoi(argv[1]);
+  if (argc > 2) keyframe_every = (uint8_t)atoi(argv[2]);
+  if (total_ic < 1 || total_ic > BMS_TOTAL_IC || keyframe_every < 1)
+  {
+    fprintf(stderr, "usage: %s [ics 1-%u [keyframe_every]]\n", argv[0], BMS_TOTAL_IC);
+    return(2);
+  }
+
+  uint32_t start = rng;
+  run_link(total_ic, keyframe_every);
+  check_wide_frames(total_ic);
+  printf("\n");
+  if (bl_capacity(total_ic, CELLS, AUX_CODES) == 0)
+  {
+    printf("a record of %u ICs does not fit in an SD block\n", total_ic);
+    printf("%s, %u failures\n", failures ? "FAIL" : "PASS", failures);
+    return(failures ? 1 : 0);
+  }
+  rng = start;
+  double plain = run_sd(total_ic, BL_DATA);
+  rng = start;
+  double delta = run_sd(total_ic, BL_DELTA);
+  double text = 176.0*total_ic; // print_cells_SD text of one IC, from sdlog_bench
+  printf("SD log, 1 hour at %u ms     bytes per record\n", PERIOD_MS);
+  printf("%-32s %6.1f\n", "print_cells_SD text", text);
+  printf("%-32s %6.1f  %.1fx smaller than text\n", "'D' blocks", plain, text/plain);
+  printf("%-32s %6.1f  %.1fx smaller than text, %.1fx than 'D'\n", "'Z' blocks", delta, text/delta, plain/delta);
+  if (delta >= plain) fail("delta coded blocks no smaller", (unsigned)delta, (unsigned)plain);
+
+  printf("%s, %u failures\n", failures ? "FAIL" : "PASS", failures);
+  return(failures ? 1 : 0);
+}
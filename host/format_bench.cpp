@@ -0,0 +1,181 @@
+/*!
+  Voltage formatting micro-benchmark
+@verbatim
+  Compares the way the sketch used to print a cell code, code*0.0001 printed
+  with Serial.print(x,4), against LTC681x_format_fixed(). The float path is
+  a copy of the Arduino core's Print::printFloat() done in single precision,
+  which is what double is on the AVR. Every 16 bit code is checked against
+  exact decimal text first, as are the die temperature conversion and
+  negative values; the exit status is non-zero if any of them disagree.
+
+  Host timings only rank the two paths. On the AVR every float multiply and
+  float to integer conversion is a soft-float library call, so the gap is
+  wider there than on a host with a floating point unit.
+
+  Usage: format_bench [iterations]
+@endverbatim
+*/
+#include <Arduino.h>
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "LTC681x.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
+
+static uint16_t failures = 0;
+static volatile uint8_t sink;
+
+/* Print::printNumber() for base 10 into a buffer */
+static uint8_t float_print_number(unsigned long n, char *buf)
+{
+  char digits[11];
+  uint8_t count = 0;
+  uint8_t len = 0;
+  do
+  {
+    digits[count++] = (char)('0' + n % 10);
+    n /= 10;
+  }
+  while (n);
+  while (count) buf[len++] = digits[--count];
+  return(len);
+}
+
+/* Print::printFloat() in single precision into a buffer */
+static uint8_t float_format(float number, uint8_t digits, char *buf)
+{
+  uint8_t len = 0;
+  if (number < 0.0f)
+  {
+    buf[len++] = '-';
+    number = -number;
+  }
+  float rounding = 0.5f;
+  for (uint8_t i = 0; i < digits; ++i) rounding /= 10.0f;
+  number += rounding;
+
+  unsigned long int_part = (unsigned long)number;
+  float remainder = number - (float)int_part;
+  len += float_print_number(int_part, buf + len);
+  if (digits > 0) buf[len++] = '.';
+  while (digits-- > 0)
+  {
+    remainder *= 10.0f;
+    unsigned int to_print = (unsigned int)remainder;
+    len += float_print_number(to_print, buf + len);
+    remainder -= to_print;
+  }
+  buf[len] = '\0';
+  return(len);
+}
+
+/* The sketch's old cell path: code*0.0001 then Serial.print(x,4) */
+static uint8_t cell_float(uint16_t code, char *buf)
+{
+  return(float_format(code*0.0001f, 4, buf));
+}
+
+static uint8_t cell_fixed(uint16_t code, char *buf)
+{
+  return(LTC681x_format_fixed(code, 4, buf));
+}
+
+static void check_format()
+{
+  char text[FIXED_TEXT_LEN];
+  char expected[32];
+  uint32_t float_off = 0;
+
+  for (uint32_t code = 0; code <= 0xFFFF; code++)
+  {
+    snprintf(expected, sizeof(expected), "%u.%04u", (unsigned)(code/10000), (unsigned)(code%10000));
+    uint8_t len = cell_fixed((uint16_t)code, text);
+    if (strcmp(text, expected) != 0 || len != strlen(expected))
+    {
+      failures++;
+      printf("FAIL code %u: %s, expected %s\n", (unsigned)code, text, expected);
+    }
+    cell_float((uint16_t)code, text);
+    if (strcmp(text, expected) != 0) float_off++;
+
+    int32_t die = LTC681x_die_temp((uint16_t)code);
+    int32_t die_expected = (int32_t)lround(code*4.0/3.0) - 27300;
+    if (die != die_expected)
+    {
+      failures++;
+      printf("FAIL die temp code %u: %ld, expected %ld\n", (unsigned)code, (long)die, (long)die_expected);
+    }
+  }
+
+  static const struct
+  {
+    int32_t value;
+    uint8_t decimals;
+    const char *text;
+  } cases[] =
+  {
+    {0, 0, "0"}, {7, 0, "7"}, {-7, 2, "-0.07"}, {-27300, 2, "-273.00"},
+    {1310700, 4, "131.0700"}, {2147483647L, 9, "2.147483647"},
+    {-2147483647L - 1, 0, "-2147483648"}, {12345, 12, "0.000012345"},
+  };
+  for (uint8_t i = 0; i < sizeof(cases)/sizeof(cases[0]); i++)
+  {
+    LTC681x_format_fixed(cases[i].value, cases[i].decimals, text);
+    if (strcmp(text, cases[i].text) != 0)
+    {
+      failures++;
+      printf("FAIL %ld/10^%u: %s, expected %s\n", (long)cases[i].value, cases[i].decimals, text, cases[i].text);
+    }
+  }
+  printf("float path differs from the exact text for %lu of 65536 codes\n", (unsigned long)float_off);
+}
+
+typedef uint8_t (*format_fn)(uint16_t code, char *buf);
+
+/* Prints the average time and host cycles to format one cell */
+static void bench_path(const char *what, format_fn fn, uint32_t iterations)
+{
+  char text[FIXED_TEXT_LEN + 8];
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+#if HAVE_TSC
+  uint64_t tsc = __rdtsc();
+#endif
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    sink = fn((uint16_t)(30000 + (i*7919) % 12000), text); // 3.0 V to 4.2 V
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+#if HAVE_TSC
+  double cycles = (double)(__rdtsc() - tsc);
+  printf("%-28s %8.1f ns %8.1f cycles per cell\n", what, ns/iterations, cycles/iterations);
+#else
+  printf("%-28s %8.1f ns per cell\n", what, ns/iterations);
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+  uint32_t iterations = 2000000;
+  if (argc > 1) iterations = (uint32_t)atol(argv[1]);
+  if (iterations < 1)
+  {
+    fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+    return(2);
+  }
+
+  check_format();
+
+  bench_path("code*0.0001, print(x,4)", cell_float, iterations);
+  bench_path("LTC681x_format_fixed", cell_fixed, iterations);
+
+  printf("%s, %u failures\n", failures ? "FAIL" : "PASS", failures);
+  return(failures ? 1 : 0);
+}
@@ -0,0 +1,189 @@
+/*!
+  Streaming JSON writer check and micro-benchmark
+@verbatim
+  Checks lib/JsonWriter output against known documents: nesting, commas,
+  numbered keys, fixed point and float numbers, null for out of range
+  floats and string escaping. Writes the measurement_loop2 document into
+  every buffer size shorter than it, and checks each one reports 0 without
+  writing past the buffer, and sends it in pieces of one member each
+  through a 32 byte buffer. Then builds that document for 1 to 16 ICs and
+  reports its size and the time to write it. The exit status is non-zero
+  if a check fails.
+
+  Usage: json_bench [ics]
+@endverbatim
+*/
+#include <Arduino.h>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "LTC681x.h"
+#include "JsonWriter.h"
+
+#define CELLS 12
+
+static uint16_t failures = 0;
+static const char KEY_CELL[] PROGMEM = "C";
+static const char KEY_CHARGE[] PROGMEM = "Charge";
+static const char KEY_CURRENT[] PROGMEM = "Current";
+static const char KEY_VOLTAGE[] PROGMEM = "Voltage";
+static const char KEY_TIME[] PROGMEM = "Time";
+static const char KEY_TEMPERATURE[] PROGMEM = "Temperature";
+static const char KEY_LIST[] PROGMEM = "list";
+static const char KEY_TEXT[] PROGMEM = "text";
+
+static void fail(const char *what, unsigned got, unsigned expected)
+{
+  failures++;
+  if (failures < 10) printf("FAIL %s: %u, expected %u\n", what, got, expected);
+}
+
+static void expect(const char *what, const char *got, uint16_t len, const char *expected)
+{
+  if (len != strlen(expected) || strcmp(got, expected) != 0)
+  {
+    failures++;
+    if (failures < 10) printf("FAIL %s:\n  got      %s\n  expected %s\n", what, got, expected);
+  }
+}
+
+/* Ends a member, handing it over when the document goes out in pieces */
+static void piece(json_writer *w, std::string *pieces)
+{
+  if (pieces == NULL) return;
+  uint16_t len = json_flush(w);
+  if (len == 0) fail("piece did not fit", 0, 1);
+  pieces->append(w->buf, len);
+}
+
+/* The document measurement_loop2 sends: cells of every IC, then the LTC2944 readings */
+static uint16_t telemetry(json_writer *w, char *buf, uint16_t size, uint8_t total_ic, std::string *pieces = NULL)
+{
+  json_begin(w, buf, size);
+  json_open_object(w);
+  for (uint8_t ic = 0; ic < total_ic; ic++)
+  {
+    for (uint8_t i = 0; i < CELLS; i++)
+    {
+      json_key_index_P(w, KEY_CELL, ic*CELLS + i + 1);
+      json_fixed(w, 36000 + 37*i + 101*ic, 4);
+      piece(w, pieces);
+    }
+  }
+  json_key_P(w, KEY_CHARGE);
+  json_float(w, 1234.5625f, 4);
+  piece(w, pieces);
+  json_key_P(w, KEY_CURRENT);
+  json_float(w, -1.25f, 4);
+  piece(w, pieces);
+  json_key_P(w, KEY_VOLTAGE);
+  json_float(w, 48.1f, 4);
+  piece(w, pieces);
+  json_key_P(w, KEY_TIME);
+  json_string(w, "2020-05-01T12:34:56");
+  piece(w, pieces);
+  json_key_P(w, KEY_TEMPERATURE);
+  json_float(w, 25.0f, 4);
+  json_close(w);
+  uint16_t len = json_end(w);
+  if (pieces != NULL && len != 0) pieces->append(buf, len);
+  return(len);
+}
+
+static void check_documents()
+{
+  static char buf[4096];
+  json_writer w;
+
+  json_begin(&w, buf, sizeof(buf));
+  json_open_object(&w);
+  json_key_P(&w, KEY_LIST);
+  json_open_array(&w);
+  json_fixed(&w, 1, 0);
+  json_open_object(&w);
+  json_close(&w);
+  json_open_array(&w);
+  json_fixed(&w, -5, 1);
+  json_close(&w);
+  json_float(&w, 1e30f, 2);
+  json_close(&w);
+  json_key_P(&w, KEY_TEXT);
+  json_string(&w, "a\"b\\c\n\x01");
+  json_close(&w);
+  expect("nesting and escaping", buf, json_end(&w), "{\"list\":[1,{},[-0.5],null],\"text\":\"a\\\"b\\\\c\\u000a\\u0001\"}");
+
+  json_begin(&w, buf, sizeof(buf));
+  json_open_array(&w);
+  json_float(&w, 3.14159f, 3);
+  json_float(&w, -0.0004f, 3);
+  json_float(&w, 0.00049f, 3);
+  json_float(&w, 2.5f, 0);
+  json_close(&w);
+  expect("float rounding", buf, json_end(&w), "[3.142,0.000,0.000,3]");
+
+  json_begin(&w, buf, sizeof(buf));
+  json_open_object(&w);
+  json_key_P(&w, KEY_TEXT);
+  if (json_end(&w) != 0) fail("unfinished document accepted", 1, 0);
+
+  uint16_t len = telemetry(&w, buf, sizeof(buf), 1);
+  expect("telemetry document", buf, len,
+         "{\"C1\":3.6000,\"C2\":3.6037,\"C3\":3.6074,\"C4\":3.6111,\"C5\":3.6148,\"C6\":3.6185,\"C7\":3.6222,"
+         "\"C8\":3.6259,\"C9\":3.6296,\"C10\":3.6333,\"C11\":3.6370,\"C12\":3.6407,\"Charge\":1234.5625,"
+         "\"Current\":-1.2500,\"Voltage\":48.1000,\"Time\":\"2020-05-01T12:34:56\",\"Temperature\":25.0000}");
+
+  // Every shorter buffer must report 0 and leave the bytes after it alone
+  static char small[4096 + 16];
+  for (uint16_t size = 0; size <= len; size++)
+  {
+    memset(small, 0x55, sizeof(small));
+    uint16_t got = telemetry(&w, small, size, 1);
+    if (got != 0) fail("cut off document accepted, buffer", size, 0);
+    for (uint16_t i = size; i < size + 16; i++) if ((uint8_t)small[i] != 0x55) fail("write past the buffer", size, i);
+  }
+  if (telemetry(&w, small, len + 1, 1) != len) fail("document that just fits", len + 1, len);
+
+  // In pieces, each member goes through a buffer far smaller than the document
+  std::string whole, pieces;
+  char piece_buf[32];
+  telemetry(&w, buf, sizeof(buf), 2);
+  whole.assign(buf);
+  if (telemetry(&w, piece_buf, sizeof(piece_buf), 2, &pieces) == 0) fail("last piece refused", 0, 1);
+  expect("document in pieces", pieces.c_str(), (uint16_t)pieces.size(), whole.c_str());
+  json_begin(&w, piece_buf, 8);
+  json_open_object(&w);
+  json_key_P(&w, KEY_TEMPERATURE);
+  if (json_flush(&w) != 0) fail("piece larger than the buffer handed over", 1, 0);
+}
+
+int main(int argc, char *argv[])
+{
+  uint8_t max_ic = 16;
+  if (argc > 1) max_ic = (uint8_t)atoi(argv[1]);
+  if (max_ic < 1 || max_ic > 31)
+  {
+    fprintf(stderr, "usage: %s [ics 1-31]\n", argv[0]);
+    return(2);
+  }
+
+  check_documents();
+
+  static char buf[160 + 14*31*18];
+  json_writer w;
+  printf("ICs   JSON bytes   ns per document on this host\n");
+  for (uint8_t total_ic = 1; total_ic <= max_ic; total_ic *= 2)
+  {
+    const uint32_t reps = 20000;
+    uint16_t len = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (uint32_t r = 0; r < reps; r++) len = telemetry(&w, buf, sizeof(buf), total_ic);
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    if (len == 0 || len > 160 + 14*total_ic*18) fail("document larger than JSON_TELEMETRY_MAX", len, 160 + 14*total_ic*18);
+    printf("%3u %12u %14.0f\n", total_ic, len, ns/reps);
+  }
+
+  printf("%s, %u failures\n", failures ? "FAIL" : "PASS", failures);
+  return(failures ? 1 : 0);
+}
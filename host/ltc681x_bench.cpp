@@ -0,0 +1,606 @@
+/*!
+  LTC681x driver cycle-time benchmark
+@verbatim
+  Runs the unmodified LTC681x/LTC6811 driver against the simulated daisy
+  chain in LTC681x_sim.cpp and reports, for each operation, the time the
+  controller spends on it and the SPI bytes it moves. Each operation is also
+  checked against the values the simulator was given, so the run doubles as
+  a regression check for driver changes: the exit status is non-zero if any
+  check fails.
+
+  Usage: ltc681x_bench [total_ic] [iterations]
+@endverbatim
+*/
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "LTC681x.h"
+#include "LTC6811.h"
+#include "LTC681x_sim.h"
+
+#if BMS_TOTAL_IC < SIM_MAX_IC
+#define BENCH_MAX_IC BMS_TOTAL_IC
+#else
+#define BENCH_MAX_IC SIM_MAX_IC
+#endif
+
+static cell_asic bms_ic[BENCH_MAX_IC];
+static uint8_t total_ic = 4;
+static uint16_t iterations = 100;
+static uint16_t failures = 0;
+
+typedef struct
+{
+  uint64_t start_ns;
+  sim_stats start;
+} bench_mark;
+
+static void begin(bench_mark *mark)
+{
+  mark->start_ns = LTC681x_sim_time_ns();
+  LTC681x_sim_get_stats(&mark->start);
+}
+
+/* Prints the average virtual time and SPI bytes per iteration since begin() */
+static void report(const char *name, const bench_mark *mark, uint16_t count)
+{
+  sim_stats now;
+  LTC681x_sim_get_stats(&now);
+  uint64_t elapsed_ns = LTC681x_sim_time_ns() - mark->start_ns;
+
+  printf("%-28s %10.1f us %8.1f bytes %6.1f frames\n", name,
+         (double)elapsed_ns/1000.0/count,
+         (double)(now.spi_bytes - mark->start.spi_bytes)/count,
+         (double)(now.cs_frames - mark->start.cs_frames)/count);
+}
+
+static void check(bool ok, const char *what, uint8_t nIC, int value)
+{
+  if (!ok)
+  {
+    failures++;
+    printf("FAIL %s ic %u value %d\n", what, nIC, value);
+  }
+}
+
+static uint16_t expected_cell(uint8_t nIC, uint8_t cell)
+{
+  return(36000 + nIC*100 + cell);
+}
+
+static void check_cells(const char *what)
+{
+  for (uint8_t cic = 0; cic < total_ic; cic++)
+  {
+    for (uint8_t cell = 0; cell < IC_REG(bms_ic[0], cell_channels); cell++)
+    {
+      check(bms_ic[cic].cells.c_codes[cell] == expected_cell(cic, cell), what, cic, bms_ic[cic].cells.c_codes[cell]);
+    }
+  }
+}
+
+static void bench_measurement_cycle()
+{
+  bench_mark mark;
+  int8_t error = 0;
+
+  begin(&mark);
+  for (uint16_t i = 0; i < iterations; i++)
+  {
+    wakeup_idle(total_ic);
+    LTC6811_adcv(MD_7KHZ_3KHZ, DCP_DISABLED, CELL_CH_ALL);
+    LTC6811_pollAdc();
+    wakeup_idle(total_ic);
+    error |= LTC6811_rdcv(0, total_ic, bms_ic);
+  }
+  report("adcv+poll+rdcv cycle", &mark, iterations);
+  check(error == 0, "cycle pec", 0, error);
+  check_cells("cycle cells");
+}
+
+static uint32_t idle_calls = 0;
+
+static void count_idle()
+{
+  idle_calls++;
+}
+
+static void bench_async_cycle()
+{
+  bench_mark mark;
+  adc_conversion conv = {0, 0, 0, NULL};
+  int8_t error = 0;
+
+  idle_calls = 0;
+  begin(&mark);
+  for (uint16_t i = 0; i < iterations; i++)
+  {
+    wakeup_idle(total_ic);
+    LTC6811_adcv_start(MD_7KHZ_3KHZ, DCP_DISABLED, CELL_CH_ALL, false, &conv);
+    LTC6811_conv_wait(total_ic, &conv, count_idle);
+    wakeup_idle(total_ic);
+    error |= LTC6811_rdcv(0, total_ic, bms_ic);
+  }
+  report("adcv_start+wait+rdcv cycle", &mark, iterations);
+  printf("%-28s %10.1f idle task calls per cycle\n", "", (double)idle_calls/iterations);
+  check(error == 0, "async cycle pec", 0, error);
+  check_cells("async cycle cells");
+}
+
+static void bench_queued_rdcv()
+{
+  bench_mark mark;
+  int8_t error = 0;
+
+  idle_calls = 0;
+  begin(&mark);
+  for (uint16_t i = 0; i < iterations; i++)
+  {
+    wakeup_idle(total_ic);
+    error |= LTC6811_rdcv_start(total_ic, bms_ic);
+    while (LTC6811_rdcv_busy())
+    {
+      count_idle();
+      micros();
+    }
+    error |= LTC6811_rdcv_finish(total_ic, bms_ic);
+  }
+  report("rdcv_start+finish", &mark, iterations);
+  printf("%-28s %10.1f us free for other work per readback\n", "", (double)idle_calls/iterations);
+  check(error == 0, "queued rdcv pec", 0, error);
+  check_cells("queued rdcv cells");
+}
+
+static void bench_plan()
+{
+  bench_mark mark;
+  int8_t error = 0;
+
+  // The same cell, GPIO and status sequence by hand and as a plan
+  begin(&mark);
+  for (uint16_t i = 0; i < iterations; i++)
+  {
+    wakeup_sleep(total_ic);
+    LTC6811_adcv(MD_7KHZ_3KHZ, DCP_DISABLED, CELL_CH_ALL);
+    LTC6811_pollAdc();
+    wakeup_idle(total_ic);
+    error |= LTC6811_rdcv(0, total_ic, bms_ic);
+    wakeup_sleep(total_ic);
+    LTC6811_adax(MD_7KHZ_3KHZ, AUX_CH_ALL);
+    LTC6811_pollAdc();
+    wakeup_idle(total_ic);
+    error |= LTC6811_rdaux(0, total_ic, bms_ic);
+    wakeup_sleep(total_ic);
+    LTC6811_adstat(MD_7KHZ_3KHZ, STAT_CH_ALL);
+    LTC6811_pollAdc();
+    wakeup_idle(total_ic);
+    error |= LTC6811_rdstat(0, total_ic, bms_ic);
+  }
+  report("cv+aux+stat by hand", &mark, iterations);
+  check(error == 0, "hand sequence pec", 0, error);
+
+  meas_step steps[] =
+  {
+    {PLAN_ADCV, CELL_CH_ALL, 0, 0}, {PLAN_RDCV, 0, 0, 0},
+    {PLAN_ADAX, AUX_CH_ALL, 0, 0}, {PLAN_RDAUX, 0, 0, 0},
+    {PLAN_ADSTAT, STAT_CH_ALL, 0, 0}, {PLAN_RDSTAT, 0, 0, 0}
+  };
+  meas_plan plan = {steps, 6, MD_7KHZ_3KHZ, DCP_DISABLED, false, NULL, 0};
+
+  memset(bms_ic, 0, sizeof(bms_ic[0])*total_ic);
+  LTC6811_init_cfg(total_ic, bms_ic);
+  LTC6811_init_reg_limits(total_ic, bms_ic);
+  begin(&mark);
+  for (uint16_t i = 0; i < iterations; i++)
+  {
+    error |= LTC6811_run_plan(total_ic, bms_ic, &plan);
+  }
+  report("cv+aux+stat plan", &mark, iterations);
+  for (uint8_t s = 0; s < plan.count; s++)
+  {
+    printf("%-28s %10lu us step %u\n", "", (unsigned long)steps[s].time_us, steps[s].op);
+  }
+  check(error == 0, "plan pec", 0, error);
+  check_cells("plan cells");
+  for (uint8_t cic = 0; cic < total_ic; cic++)
+  {
+    check(bms_ic[cic].aux.a_codes[4] == 15000 + cic*100 + 4, "plan gpio", cic, bms_ic[cic].aux.a_codes[4]);
+    check(bms_ic[cic].stat.stat_codes[1] == (25 + 273)*75, "plan itmp", cic, bms_ic[cic].stat.stat_codes[1]);
+  }
+}
+
+static void bench_reads()
+{
+  bench_mark mark;
+  int8_t error = 0;
+
+  wakeup_idle(total_ic);
+  LTC6811_adax(MD_7KHZ_3KHZ, AUX_CH_ALL);
+  LTC6811_pollAdc();
+  wakeup_idle(total_ic);
+  LTC6811_adstat(MD_7KHZ_3KHZ, STAT_CH_ALL);
+  LTC6811_pollAdc();
+
+  begin(&mark);
+  for (uint16_t i = 0; i < iterations; i++)
+  {
+    wakeup_idle(total_ic);
+    error |= LTC6811_rdcv(0, total_ic, bms_ic);
+  }
+  report("rdcv all groups", &mark, iterations);
+  check(error == 0, "rdcv pec", 0, error);
+  check_cells("rdcv cells");
+
+  int8_t group_error = 0;
+  begin(&mark);
+  for (uint16_t i = 0; i < iterations; i++)
+  {
+    wakeup_idle(total_ic);
+    group_error |= LTC6811_rdcv(1, total_ic, bms_ic);
+  }
+  report("rdcv single group", &mark, iterations);
+  check(group_error == 0, "rdcv single group pec", 0, group_error);
+
+  begin(&mark);
+  for (uint16_t i = 0; i < iterations; i++)
+  {
+    wakeup_idle(total_ic);
+    error |= LTC6811_rdaux(0, total_ic, bms_ic);
+  }
+  report("rdaux all groups", &mark, iterations);
+  for (uint8_t cic = 0; cic < total_ic; cic++)
+  {
+    for (uint8_t gpio = 0; gpio < 5; gpio++)
+    {
+      check(bms_ic[cic].aux.a_codes[gpio] == 15000 + cic*100 + gpio, "rdaux gpio", cic, bms_ic[cic].aux.a_codes[gpio]);
+    }
+  }
+
+  begin(&mark);
+  for (uint16_t i = 0; i < iterations; i++)
+  {
+    wakeup_idle(total_ic);
+    error |= LTC6811_rdstat(0, total_ic, bms_ic);
+  }
+  report("rdstat all groups", &mark, iterations);
+  for (uint8_t cic = 0; cic < total_ic; cic++)
+  {
+    check(bms_ic[cic].stat.stat_codes[1] == (25 + 273)*75, "rdstat itmp", cic, bms_ic[cic].stat.stat_codes[1]);
+  }
+  check(error == 0, "read pec", 0, error);
+}
+
+static void bench_channel_select()
+{
+  bench_mark mark;
+  int8_t error = 0;
+
+  // A fast loop on cells 1 and 7 only, reading every group and then only the converted ones
+  begin(&mark);
+  for (uint16_t i = 0; i < iterations; i++)
+  {
+    wakeup_idle(total_ic);
+    LTC6811_adcv(MD_7KHZ_3KHZ, DCP_DISABLED, CELL_CH_1and7);
+    LTC6811_pollAdc();
+    wakeup_idle(total_ic);
+    error |= LTC6811_rdcv(0, total_ic, bms_ic);
+  }
+  report("adcv 1and7, rdcv all", &mark, iterations);
+
+  begin(&mark);
+  for (uint16_t i = 0; i < iterations; i++)
+  {
+    wakeup_idle(total_ic);
+    LTC6811_adcv(MD_7KHZ_3KHZ, DCP_DISABLED, CELL_CH_1and7);
+    LTC6811_pollAdc();
+    wakeup_idle(total_ic);
+    error |= LTC6811_rdcv_ch(CELL_CH_1and7, total_ic, bms_ic);
+  }
+  report("adcv 1and7, rdcv_ch", &mark, iterations);
+  check(error == 0, "rdcv_ch pec", 0, error);
+  for (uint8_t cic = 0; cic < total_ic; cic++)
+  {
+    check(bms_ic[cic].cells.c_codes[0] == expected_cell(cic, 0), "rdcv_ch cell 1", cic, bms_ic[cic].cells.c_codes[0]);
+    check(bms_ic[cic].cells.c_codes[6] == expected_cell(cic, 6), "rdcv_ch cell 7", cic, bms_ic[cic].cells.c_codes[6]);
+    check(bms_ic[cic].cells.stale == (0xFFFUL & ~0x41UL), "rdcv_ch stale", cic, (int)bms_ic[cic].cells.stale);
+  }
+
+  // The same selection through a plan picks the groups from the conversion step
+  meas_step steps[] = {{PLAN_ADCV, CELL_CH_4and10, 0, 0}, {PLAN_RDCV, 0, 0, 0}};
+  meas_plan plan = {steps, 2, MD_7KHZ_3KHZ, DCP_DISABLED, false, NULL, 0};
+  begin(&mark);
+  for (uint16_t i = 0; i < iterations; i++)
+  {
+    error |= LTC6811_run_plan(total_ic, bms_ic, &plan);
+  }
+  report("plan adcv 4and10", &mark, iterations);
+  check(error == 0, "plan rdcv_ch pec", 0, error);
+  for (uint8_t cic = 0; cic < total_ic; cic++)
+  {
+    check(bms_ic[cic].cells.stale == (0xFFFUL & ~0x208UL), "plan rdcv_ch stale", cic, (int)bms_ic[cic].cells.stale);
+  }
+
+  wakeup_idle(total_ic);
+  error |= LTC6811_rdcv(0, total_ic, bms_ic);
+  for (uint8_t cic = 0; cic < total_ic; cic++)
+  {
+    check(bms_ic[cic].cells.stale == 0, "rdcv all clears stale", cic, (int)bms_ic[cic].cells.stale);
+  }
+}
+
+static void bench_self_tests()
+{
+  bench_mark mark;
+  int16_t error;
+
+  begin(&mark);
+  error = LTC6811_run_cell_adc_st(CELL, total_ic, bms_ic, MD_7KHZ_3KHZ, false);
+  report("cell adc self test", &mark, 1);
+  check(error == 0, "cell self test", 0, error);
+
+  begin(&mark);
+  error = LTC6811_run_cell_adc_st(AUX, total_ic, bms_ic, MD_7KHZ_3KHZ, false);
+  report("aux adc self test", &mark, 1);
+  check(error == 0, "aux self test", 0, error);
+
+  begin(&mark);
+  error = LTC6811_run_cell_adc_st(STAT, total_ic, bms_ic, MD_7KHZ_3KHZ, false);
+  report("stat adc self test", &mark, 1);
+  check(error == 0, "stat self test", 0, error);
+
+  begin(&mark);
+  error = LTC6811_run_adc_overlap(total_ic, bms_ic);
+  report("adc overlap", &mark, 1);
+  check(error == 0, "overlap", 0, error);
+
+  begin(&mark);
+  error = LTC6811_run_adc_redundancy_st(MD_7KHZ_3KHZ, AUX, total_ic, bms_ic);
+  report("aux redundancy", &mark, 1);
+  check(error == 0, "aux redundancy", 0, error);
+
+  begin(&mark);
+  error = LTC6811_run_adc_redundancy_st(MD_7KHZ_3KHZ, STAT, total_ic, bms_ic);
+  report("stat redundancy", &mark, 1);
+  check(error == 0, "stat redundancy", 0, error);
+}
+
+static void bench_open_wire()
+{
+  bench_mark mark;
+  uint8_t victim = total_ic - 1;
+
+  LTC681x_sim_set_open_wire(victim, 5);
+  begin(&mark);
+  LTC6811_run_openwire_single(total_ic, bms_ic);
+  report("open wire single", &mark, 1);
+  LTC681x_sim_set_open_wire(victim, SIM_NO_OPEN_WIRE);
+
+  for (uint8_t cic = 0; cic < total_ic; cic++)
+  {
+    bool open = bms_ic[cic].system_open_wire != 0xFFFF;
+    check(open == (cic == victim), "open wire", cic, bms_ic[cic].system_open_wire);
+  }
+}
+
+static void bench_idle_timeout()
+{
+  bench_mark mark;
+  int8_t error;
+
+  // Let the isoSPI ports drop to IDLE, then read without waking them first
+  LTC681x_sim_advance_us(5000);
+  begin(&mark);
+  error = LTC6811_rdcv(0, total_ic, bms_ic);
+  report("rdcv without wakeup", &mark, 1);
+  check(error != 0, "idle rdcv pec", 0, error);
+
+  begin(&mark);
+  wakeup_idle(total_ic);
+  report("wakeup_idle", &mark, 1);
+  check(LTC681x_sim_ready_count() == total_ic, "ready count", 0, LTC681x_sim_ready_count());
+}
+
+static void bench_wake_tracker()
+{
+  bench_mark mark;
+  int8_t error;
+
+  // A command within tIDLE leaves nothing for the wakeups to do
+  wakeup_sleep(total_ic);
+  LTC6811_rdcv(1, total_ic, bms_ic);
+  begin(&mark);
+  wakeup_sleep(total_ic);
+  report("wakeup_sleep, chain ready", &mark, 1);
+
+  // Past tIDLE only the isoSPI ports need waking
+  LTC681x_sim_advance_us(10000);
+  begin(&mark);
+  wakeup_sleep(total_ic);
+  report("wakeup_sleep, chain idle", &mark, 1);
+  check(LTC681x_sim_ready_count() == total_ic, "idle wake ready count", 0, LTC681x_sim_ready_count());
+
+  // Past tSLEEP the cores have to be woken as well
+  LTC681x_sim_advance_us(2000000);
+  begin(&mark);
+  wakeup_sleep(total_ic);
+  report("wakeup_sleep, chain asleep", &mark, 1);
+  error = LTC6811_rdcfg(total_ic, bms_ic);
+  check(error == 0, "wake after sleep pec", 0, error);
+  LTC6811_wrcfg(total_ic, bms_ic);
+}
+
+static void bench_pec_noise()
+{
+  sim_stats stats;
+  uint16_t bad_reads = 0;
+
+  LTC681x_sim_set_bit_error_rate(2000);
+  LTC6811_reset_crc_count(total_ic, bms_ic);
+  for (uint16_t i = 0; i < iterations; i++)
+  {
+    wakeup_idle(total_ic);
+    if (LTC6811_rdcv(0, total_ic, bms_ic) != 0) bad_reads++;
+  }
+  LTC681x_sim_set_bit_error_rate(0);
+  LTC681x_sim_get_stats(&stats);
+
+  uint32_t pec_count = 0;
+  for (uint8_t cic = 0; cic < total_ic; cic++) pec_count += bms_ic[cic].crc_count.pec_count;
+  printf("%-28s %u of %u reads failed, %lu corrupted bytes, %lu pec errors counted\n", "rdcv with bit errors",
+         bad_reads, iterations, (unsigned long)stats.corrupted, (unsigned long)pec_count);
+  check(stats.corrupted == 0 || bad_reads > 0, "pec detection", 0, bad_reads);
+
+  // The same link with two retries per register group
+  bench_mark mark;
+  sim_stats before;
+  bad_reads = 0;
+  wakeup_idle(total_ic);
+  LTC6811_adcv(MD_7KHZ_3KHZ, DCP_DISABLED, CELL_CH_ALL);
+  LTC6811_pollAdc();
+  LTC681x_sim_get_stats(&before);
+  LTC6811_set_read_retries(2);
+  LTC6811_reset_retry_stats();
+  LTC681x_sim_set_bit_error_rate(2000);
+  begin(&mark);
+  for (uint16_t i = 0; i < iterations; i++)
+  {
+    wakeup_idle(total_ic);
+    if (LTC6811_rdcv(0, total_ic, bms_ic) != 0) bad_reads++;
+  }
+  report("rdcv with 2 retries", &mark, iterations);
+  LTC681x_sim_set_bit_error_rate(0);
+  LTC681x_sim_get_stats(&stats);
+  LTC6811_set_read_retries(0);
+
+  const retry_counter *retries = LTC6811_retry_stats();
+  printf("%-28s %u of %u reads failed, %lu corrupted bytes, group retries %u %u %u %u, %u recovered\n", "",
+         bad_reads, iterations, (unsigned long)(stats.corrupted - before.corrupted),
+         retries->cell_retry[0], retries->cell_retry[1], retries->cell_retry[2], retries->cell_retry[3],
+         retries->recovered);
+  check(stats.corrupted == before.corrupted || retries->recovered + retries->failed > 0, "retry accounting", 0, retries->recovered);
+  check(bad_reads <= retries->failed, "retry failures", 0, bad_reads);
+  check_cells("rdcv after retries");
+}
+
+static void bench_shadows()
+{
+  // PWM goes through the register shadows, claimed on the first wrpwm
+  for (uint8_t cic = 0; cic < total_ic; cic++) check(bms_ic[cic].shadow == NULL, "shadow unclaimed", cic, 0);
+  check(LTC6811_claim_shadows(total_ic, bms_ic) == 0, "shadow claim", 0, 0);
+  for (uint8_t cic = 0; cic < total_ic; cic++)
+  {
+    for (uint8_t i = 0; i < 6; i++) bms_ic[cic].shadow->pwm.tx_data[i] = (uint8_t)(0x81 + i*0x11);
+  }
+  wakeup_idle(total_ic);
+  LTC6811_wrpwm(total_ic, 0, bms_ic);
+  int8_t error = LTC6811_rdpwm(total_ic, 0, bms_ic);
+  check(error == 0, "rdpwm pec", 0, error);
+  for (uint8_t cic = 0; cic < total_ic; cic++)
+  {
+    check(memcmp(bms_ic[cic].shadow->pwm.rx_data, bms_ic[cic].shadow->pwm.tx_data, 6) == 0, "pwm shadow", cic,
+          bms_ic[cic].shadow->pwm.rx_data[0]);
+  }
+  printf("%-28s %10u bytes per IC, %u with shadows, %u at %u ICs\n", "cell_asic (host sizes)", (unsigned)sizeof(cell_asic),
+         (unsigned)(sizeof(cell_asic) + sizeof(ic_shadow)), LTC6811_ram_budget(total_ic, BMS_SHADOW_IC), total_ic);
+}
+
+static cell_asic chain_ic[2][BENCH_MAX_IC];
+
+static void bench_chains()
+{
+  bench_mark mark;
+  bms_chain chains[3];
+  int8_t error = 0;
+
+  // Two more packs on their own chip selects next to the chain on CS_PIN
+  LTC681x_sim_add_chain(49, total_ic);
+  LTC681x_sim_add_chain(48, total_ic);
+  LTC6811_chain_init(&chains[0], CS_PIN, total_ic, bms_ic);
+  LTC6811_chain_init(&chains[1], 49, total_ic, chain_ic[0]);
+  LTC6811_chain_init(&chains[2], 48, total_ic, chain_ic[1]);
+  for (uint8_t n = 1; n < 3; n++)
+  {
+    LTC6811_init_cfg(total_ic, chains[n].ic);
+    LTC6811_init_reg_limits(total_ic, chains[n].ic);
+  }
+
+  begin(&mark);
+  for (uint16_t i = 0; i < iterations; i++)
+  {
+    for (uint8_t n = 0; n < 3; n++)
+    {
+      LTC6811_chain_select(&chains[n]);
+      wakeup_sleep(total_ic);
+      LTC6811_adcv_start(MD_7KHZ_3KHZ, DCP_DISABLED, CELL_CH_ALL, false, &chains[n].conv);
+      LTC6811_conv_wait(total_ic, &chains[n].conv, NULL);
+      wakeup_idle(total_ic);
+      error |= LTC6811_rdcv(0, total_ic, chains[n].ic);
+    }
+  }
+  report("3 chains one at a time", &mark, iterations);
+  check(error == 0, "chains sequential pec", 0, error);
+
+  for (uint8_t n = 0; n < 3; n++) memset(chains[n].ic[0].cells.c_codes, 0, sizeof(chains[n].ic[0].cells.c_codes));
+  begin(&mark);
+  for (uint16_t i = 0; i < iterations; i++)
+  {
+    error |= LTC6811_chains_rdcv(chains, 3, MD_7KHZ_3KHZ, DCP_DISABLED, CELL_CH_ALL, false, NULL);
+  }
+  report("3 chains interleaved", &mark, iterations);
+  check(error == 0, "chains interleaved pec", 0, error);
+  for (uint8_t n = 0; n < 3; n++)
+  {
+    for (uint8_t cell = 0; cell < 12; cell++)
+    {
+      check(chains[n].ic[0].cells.c_codes[cell] == expected_cell(0, cell), "chain cells", n, chains[n].ic[0].cells.c_codes[cell]);
+    }
+  }
+  LTC6811_chain_select(&chains[0]);
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc > 1) total_ic = (uint8_t)atoi(argv[1]);
+  if (argc > 2) iterations = (uint16_t)atoi(argv[2]);
+  if (total_ic < 1 || total_ic > BENCH_MAX_IC || iterations < 1)
+  {
+    fprintf(stderr, "usage: %s [total_ic 1-%d] [iterations]\n", argv[0], BENCH_MAX_IC);
+    return(2);
+  }
+
+  LTC681x_sim_init(total_ic);
+  LTC6811_init_cfg(total_ic, bms_ic);
+  LTC6811_reset_crc_count(total_ic, bms_ic);
+  LTC6811_init_reg_limits(total_ic, bms_ic);
+
+  printf("%u ICs, %u iterations, 1 MHz SPI\n", total_ic, iterations);
+
+  bench_mark mark;
+  begin(&mark);
+  wakeup_sleep(total_ic);
+  LTC6811_wrcfg(total_ic, bms_ic);
+  report("wakeup_sleep+wrcfg", &mark, 1);
+
+  bench_measurement_cycle();
+  bench_async_cycle();
+  bench_plan();
+  bench_reads();
+  bench_queued_rdcv();
+  bench_channel_select();
+  bench_self_tests();
+  bench_open_wire();
+  bench_idle_timeout();
+  bench_wake_tracker();
+  bench_pec_noise();
+  bench_shadows();
+  bench_chains();
+
+  sim_stats stats;
+  LTC681x_sim_get_stats(&stats);
+  printf("total: %.3f ms, %lu bytes, %lu commands, %lu missed, %lu wakeups, %lu sleeps\n",
+         (double)LTC681x_sim_time_ns()/1e6, (unsigned long)stats.spi_bytes, (unsigned long)stats.commands,
+         (unsigned long)stats.missed, (unsigned long)stats.wakeups, (unsigned long)stats.sleeps);
+  printf("%s, %u failures\n", failures ? "FAIL" : "PASS", failures);
+  return(failures ? 1 : 0);
+}
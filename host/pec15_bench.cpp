@@ -0,0 +1,177 @@
+/*!
+  PEC15 micro-benchmark
+@verbatim
+  Compares the PEC15 variants in LTC681x.cpp on the host: the byte-wise
+  table loop pec15_calc() used before, the two-bytes-per-step block update
+  that pec15_calc() now uses, folding one byte at a time with pec15_update(),
+  and the compile time PEC15_CMD() for fixed command words. Every variant is
+  checked against a bitwise reference first; the exit status is non-zero if
+  any of them disagree.
+
+  Host timings only rank the variants. On the AVR each table lookup is a
+  pgm_read_word and shifts are done a bit at a time, which favours the block
+  update more than a 64-bit host does.
+
+  Usage: pec15_bench [iterations]
+@endverbatim
+*/
+#include <Arduino.h>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include "LTC681x.h"
+
+static uint16_t failures = 0;
+static volatile uint16_t sink;
+
+/* Bitwise CRC15 straight from the data sheet polynomial */
+static uint16_t pec15_reference(uint8_t len, const uint8_t *data)
+{
+  uint16_t remainder = PEC15_SEED;
+  for (uint8_t i = 0; i < len; i++)
+  {
+    remainder ^= (uint16_t)data[i] << 7;
+    for (uint8_t bit = 0; bit < 8; bit++)
+    {
+      remainder = (remainder & 0x4000) ? ((remainder << 1) ^ 0x4599) : (remainder << 1);
+    }
+    remainder &= 0x7FFF;
+  }
+  return(PEC15_FINAL(remainder));
+}
+
+/* The byte-wise table loop pec15_calc() used before the block update */
+static uint16_t pec15_bytewise(uint8_t len, const uint8_t *data)
+{
+  uint16_t remainder = PEC15_SEED;
+  for (uint8_t i = 0; i < len; i++)
+  {
+    uint16_t addr = ((remainder >> 7) ^ data[i]) & 0xff;
+    remainder = (remainder << 8) ^ pgm_read_word_near(crc15Table + addr);
+  }
+  return(PEC15_FINAL(remainder));
+}
+
+static uint16_t pec15_block(uint8_t len, const uint8_t *data)
+{
+  return(pec15_calc(len, (uint8_t *)data));
+}
+
+static uint16_t pec15_incremental(uint8_t len, const uint8_t *data)
+{
+  uint16_t remainder = PEC15_SEED;
+  for (uint8_t i = 0; i < len; i++)
+  {
+    remainder = pec15_update(remainder, data[i]);
+  }
+  return(PEC15_FINAL(remainder));
+}
+
+typedef uint16_t (*pec15_fn)(uint8_t len, const uint8_t *data);
+
+static const struct
+{
+  const char *name;
+  pec15_fn fn;
+} variants[] =
+{
+  {"bitwise", pec15_reference},
+  {"byte table", pec15_bytewise},
+  {"2-byte table", pec15_block},
+  {"incremental", pec15_incremental},
+};
+
+static void check_variants()
+{
+  uint8_t data[255];
+  uint32_t rng = 1;
+
+  for (uint16_t trial = 0; trial < 2000; trial++)
+  {
+    uint8_t len = (uint8_t)(trial % 64);
+    for (uint8_t i = 0; i < len; i++)
+    {
+      rng = rng*1103515245u + 12345u;
+      data[i] = (uint8_t)(rng >> 16);
+    }
+    uint16_t expected = pec15_reference(len, data);
+    for (uint8_t v = 1; v < sizeof(variants)/sizeof(variants[0]); v++)
+    {
+      uint16_t pec = variants[v].fn(len, data);
+      if (pec != expected)
+      {
+        failures++;
+        printf("FAIL %s len %u: 0x%04x, expected 0x%04x\n", variants[v].name, len, pec, expected);
+      }
+    }
+  }
+
+  // Known command PEC from the data sheet: RDCVA is 0x00 0x04 0x07 0xC2
+  static const uint16_t rdcva = PEC15_CMD(0x00, 0x04);
+  if (rdcva != 0x07C2)
+  {
+    failures++;
+    printf("FAIL PEC15_CMD RDCVA: 0x%04x\n", rdcva);
+  }
+  for (uint16_t word = 0; word < 0x800; word++)
+  {
+    uint8_t cmd[2] = {(uint8_t)(word >> 8), (uint8_t)word};
+    if (PEC15_CMD(cmd[0], cmd[1]) != pec15_reference(2, cmd))
+    {
+      failures++;
+      printf("FAIL PEC15_CMD 0x%03x\n", word);
+    }
+  }
+}
+
+/* Prints the average time of one PEC over len bytes for each variant */
+static void bench_length(const char *what, uint8_t len, uint32_t iterations)
+{
+  uint8_t data[255];
+  for (uint8_t i = 0; i < len; i++) data[i] = (uint8_t)(i*37 + 11);
+
+  printf("%-24s", what);
+  for (uint8_t v = 0; v < sizeof(variants)/sizeof(variants[0]); v++)
+  {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+      data[0] = (uint8_t)i;
+      sink = variants[v].fn(len, data);
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    printf(" %12.1f", ns/iterations);
+  }
+  printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+  uint32_t iterations = 2000000;
+  if (argc > 1) iterations = (uint32_t)atol(argv[1]);
+  if (iterations < 1)
+  {
+    fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+    return(2);
+  }
+
+  check_variants();
+
+  printf("ns per PEC                   bitwise   byte table 2-byte table  incremental\n");
+  bench_length("command, 2 bytes", 2, iterations);
+  bench_length("register, 6 bytes", 6, iterations);
+  bench_length("odd length, 7 bytes", 7, iterations);
+  bench_length("frame, 248 bytes", 248, iterations/32);
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    static const uint16_t pladc = PEC15_CMD(0x07, 0x14);
+    sink = pladc;
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  printf("%-24s %12.1f ns, PEC15_CMD, evaluated at compile time\n", "fixed command", ns/iterations);
+
+  printf("%s, %u failures\n", failures ? "FAIL" : "PASS", failures);
+  return(failures ? 1 : 0);
+}
@@ -0,0 +1,292 @@
+/*!
+  SD log recovery after power cuts
+@verbatim
+  Logs LTC6811 records at 10 per second through lib/BinLog and lib/SdLog
+  to a simulated card for 4 hours, cutting the power every 1 to 10
+  minutes. Blocks reach the card as they are written, but the file size
+  only on a sync. At a cut the file goes back to its size at the last
+  sync. Half of the cuts fall inside a write, which leaves that block
+  torn: the start of the new data, then garbage. Each block written since
+  the last sync may also go back to what it held then, as with a card
+  that lost its write cache. At some cuts a card that acknowledged a
+  sync still loses one of the last blocks it took, which leaves a stale
+  block inside the log. The log is then reopened, and after some cuts
+  both checkpoints are spoiled first. It checks several things:
+
+    recovery ends the log where a full scan from the start of the file
+    following the sequence numbers ends it
+    no record that was synced is lost, but those in a torn block, or in
+    and after a stale one
+    the records kept are the ones appended, in order, numbered without a
+    gap
+    recovery reads at most a bounded number of blocks however long the
+    file, and a few more without a checkpoint
+
+  It prints the blocks read and the boot time at 1.5 ms per read against
+  a full scan of the file, and the records lost. The exit status is
+  non-zero if a check fails.
+
+  Usage: recovery_bench
+@endverbatim
+*/
+#include <Arduino.h>
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <random>
+#include <set>
+#include <vector>
+#include "BinLog.h"
+
+#define READ_MS 1.5
+#define FLUSH_MS 1000
+#define SYNC_BLOCKS 8
+#define PERIOD_MS 100
+#define RUN_MS (4*3600000UL)
+#define RTC_START ((uint32_t)1792224000UL)
+#define CELLS 12
+#define AUX 6
+#define BOUND (SDLOG_SUPER_BLOCKS + 2*SDLOG_CHECKPOINT_BLOCKS + 2*SYNC_BLOCKS) // Blocks read with a checkpoint
+
+static uint16_t failures = 0;
+
+static void fail(const char *what, unsigned got, unsigned expected)
+{
+  failures++;
+  if (failures < 10) printf("FAIL %s: %u, expected %u\n", what, got, expected);
+}
+
+typedef std::vector<uint8_t> block_data;
+
+/*! The log file on the card */
+struct Card
+{
+  std::vector<block_data> blocks;  //!< What the card holds now
+  std::vector<block_data> durable; //!< What it held at the last sync
+  std::set<uint32_t> unsynced;     //!< Blocks written since the last sync
+  std::map<uint32_t, block_data> previous; //!< What recently written blocks held before
+  bool tear_next = false;          //!< The power goes during the next write
+  bool off = false;
+  uint32_t torn = 0xFFFFFFFF;      //!< Block the power went during
+};
+
+static Card card;
+static std::mt19937 rng(498);
+
+static int8_t card_read(uint32_t block, uint8_t *data)
+{
+  if (card.off || block >= card.blocks.size()) return(-1);
+  memcpy(data, card.blocks[block].data(), SDLOG_BLOCK);
+  return(0);
+}
+
+static int8_t card_write(uint32_t block, const uint8_t *data)
+{
+  if (card.off || block > card.blocks.size()) return(-1);
+  if (block == card.blocks.size()) card.blocks.push_back(block_data(SDLOG_BLOCK, 0));
+  block_data &b = card.blocks[block];
+  card.unsynced.insert(block);
+  card.previous[block] = b;
+  if (card.tear_next)
+  {
+    uint16_t kept = (uint16_t)(rng() % SDLOG_BLOCK);
+    for (uint16_t i = 0; i < SDLOG_BLOCK; i++) b[i] = (i < kept) ? (data ? data[i] : 0) : (uint8_t)rng();
+    card.tear_next = false;
+    card.off = true;
+    card.torn = block;
+    return(-1);
+  }
+  if (data) memcpy(b.data(), data, SDLOG_BLOCK);
+  else memset(b.data(), 0, SDLOG_BLOCK);
+  return(0);
+}
+
+static int8_t card_sync(void)
+{
+  if (card.off) return(-1);
+  card.durable = card.blocks;
+  card.unsynced.clear();
+  while (!card.previous.empty() && card.previous.begin()->first + 4*SDLOG_EXTENT_BLOCKS < card.previous.rbegin()->first) card.previous.erase(card.previous.begin());
+  return(0);
+}
+
+static const sd_log_io CARD_IO = {card_read, card_write, card_sync};
+
+/*! Codes of one IC, laid out like ic_measurement */
+typedef struct
+{
+  uint16_t cells[18];
+  uint16_t pad[3];
+  uint16_t aux[9];
+} ic_codes;
+
+static uint16_t code(uint32_t ms, unsigned channel)
+{
+  return((uint16_t)(30000 + ms/PERIOD_MS*7 + channel*131));
+}
+
+/*! The log as a full scan reads it, following the sequence numbers from the start of the file */
+struct Chain
+{
+  uint32_t end = SDLOG_SUPER_BLOCKS; //!< First block that does not follow
+  uint32_t seq = 0;                  //!< Sequence number there
+  std::vector<uint32_t> ms;          //!< millis() of each record, in order
+  uint32_t bad = 0;                  //!< Records with wrong codes or numbers
+};
+
+static Chain full_scan(const std::vector<block_data> &blocks, uint32_t file_blocks)
+{
+  Chain c;
+  while (c.end < file_blocks && c.end < blocks.size())
+  {
+    const uint8_t *block = blocks[c.end].data();
+    uint32_t seq = SDLOG_SEQ_ANY;
+    bl_reader r;
+    uint16_t codes[CELLS + AUX];
+    if (bl_check(block, &seq) != 0) break;
+    if ((block[8] | (block[9] << 8) | (block[10] << 16) | ((uint32_t)block[11] << 24)) != c.seq) break; // Out of place
+    if (bl_first(&r, block) == 0)
+    {
+      for (uint8_t i = 0; i < r.layout.count; i++)
+      {
+        if (bl_next(&r, codes) != 0)
+        {
+          c.bad++;
+          break;
+        }
+        for (unsigned ch = 0; ch < (unsigned)CELLS + r.layout.aux; ch++)
+        {
+          if (codes[ch] != code(r.ms, ch)) c.bad++;
+        }
+        if (r.seq != c.seq + i || (!c.ms.empty() && r.ms <= c.ms.back())) c.bad++;
+        c.ms.push_back(r.ms);
+      }
+    }
+    c.seq = seq;
+    c.end++;
+  }
+  return(c);
+}
+
+/* Records of the blocks in a chain, by millis() */
+static std::set<uint32_t> records_in(const std::vector<block_data> &blocks, uint32_t first, uint32_t end)
+{
+  std::set<uint32_t> out;
+  for (uint32_t b = first; b < end && b < blocks.size(); b++)
+  {
+    bl_reader r;
+    uint16_t codes[CELLS + AUX];
+    if (bl_first(&r, blocks[b].data()) != 0) continue;
+    while (bl_next(&r, codes) == 0) out.insert(r.ms);
+  }
+  return(out);
+}
+
+int main()
+{
+  static sd_log log;
+  static bin_log b;
+  ic_codes ic;
+  uint32_t cuts = 0, torn_cuts = 0, stale = 0, spoiled = 0, lost = 0, appended = 0;
+  uint32_t max_read = 0, max_read_spoiled = 0, max_full = 0;
+  double total_read = 0;
+
+  memset(&ic, 0, sizeof(ic));
+  if (sd_log_open(&log, &CARD_IO, 0, FLUSH_MS, SYNC_BLOCKS, &bl_format) != 0) fail("opening an empty file", 1, 0);
+  if (bl_open(&b, &log, 1, CELLS, AUX, 6811, RTC_START, 0) != 0) fail("writing the session header", 1, 0);
+  uint32_t next_cut = 60000 + rng() % 540000;
+  for (uint32_t now = 1; now <= RUN_MS; now++)
+  {
+    if (now % PERIOD_MS == 0)
+    {
+      uint8_t aux = (now/600000 % 3 == 2) ? 0 : AUX; // Some blocks without aux codes
+      for (unsigned c = 0; c < CELLS; c++) ic.cells[c] = code(now, c);
+      for (unsigned a = 0; a < AUX; a++) ic.aux[a] = code(now, CELLS + a);
+      bl_add(&b, RTC_START + now/1000, now, 1, CELLS, aux, ic.cells, ic.aux, sizeof(ic_codes), now);
+      appended++;
+    }
+    if (!card.off) sd_log_service(&log, now);
+    if (now == next_cut)
+    {
+      if (rng() % 2) card.tear_next = true; // The power goes during the next write
+      else card.off = true;
+    }
+    if (!card.off) continue;
+
+    // Power cut: the file size goes back to the last sync, some writes since then are lost
+    cuts++;
+    uint32_t file_blocks = (uint32_t)card.durable.size();
+    Chain before = full_scan(card.durable, file_blocks);
+    std::set<uint32_t> must_have = records_in(card.durable, SDLOG_SUPER_BLOCKS, before.end);
+    if (card.torn < before.end)
+    {
+      torn_cuts++;
+      for (uint32_t ms : records_in(card.durable, card.torn, card.torn + 1)) must_have.erase(ms); // Synced, then torn by a rewrite
+    }
+    card.blocks.resize(file_blocks);
+    for (uint32_t block : card.unsynced)
+    {
+      if (block < file_blocks && block != card.torn && rng() % 4 == 0) card.blocks[block] = card.durable[block];
+    }
+    uint32_t lying = before.end - 1 - rng() % 3; // One of the last blocks of the log
+    if (cuts % 3 == 0 && lying >= SDLOG_SUPER_BLOCKS && lying != card.torn && card.previous.count(lying) != 0)
+    {
+      stale++;
+      card.blocks[lying] = card.previous[lying];
+      for (uint32_t ms : records_in(card.durable, lying, before.end)) must_have.erase(ms); // The log ends at the stale block
+    }
+    if (cuts % 5 == 0)
+    {
+      card.blocks[0][0] = card.blocks[1][0] = 0xFF; // No checkpoint, as after both were torn
+      spoiled++;
+    }
+    card.unsynced.clear();
+    card.off = false;
+    card.torn = 0xFFFFFFFF;
+    card.durable = card.blocks;
+
+    Chain after = full_scan(card.blocks, file_blocks);
+    if (sd_log_open(&log, &CARD_IO, file_blocks, FLUSH_MS, SYNC_BLOCKS, &bl_format) != 0) fail("reopening after a power cut", 1, 0);
+    if (log.block != after.end) fail("block recovery ends the log at", log.block, after.end);
+    if (log.seq != after.seq) fail("sequence number recovery resumes at", log.seq, after.seq);
+    if (after.bad != 0) fail("records kept that differ from those appended", after.bad, 0);
+    std::set<uint32_t> kept(after.ms.begin(), after.ms.end());
+    for (uint32_t ms : must_have)
+    {
+      if (kept.count(ms) == 0)
+      {
+        fail("synced record lost, millis()", ms, 0);
+        break;
+      }
+    }
+    if (cuts % 5 == 0) max_read_spoiled = (log.count.scanned > max_read_spoiled) ? log.count.scanned : max_read_spoiled;
+    else
+    {
+      if (log.count.scanned > BOUND) fail("blocks read by recovery", log.count.scanned, BOUND);
+      max_read = (log.count.scanned > max_read) ? log.count.scanned : max_read;
+      total_read += log.count.scanned;
+    }
+    max_full = (after.end > max_full) ? after.end : max_full;
+    if (bl_open(&b, &log, 1, CELLS, AUX, 6811, RTC_START + now/1000, now) != 0) fail("writing the session header after a reset", 1, 0);
+    next_cut = now + 60000 + rng() % 540000;
+  }
+  sd_log_flush(&log);
+
+  Chain end = full_scan(card.blocks, (uint32_t)card.blocks.size());
+  lost = appended - (uint32_t)end.ms.size();
+  if (end.bad != 0) fail("records in the log that differ from those appended", end.bad, 0);
+  if (end.seq != end.ms.size()) fail("sequence number at the end", end.seq, (unsigned)end.ms.size());
+  uint32_t log2_blocks = 0;
+  while ((1UL << log2_blocks) < card.blocks.size()) log2_blocks++;
+  if (max_read_spoiled > SDLOG_SUPER_BLOCKS + log2_blocks + 2*SDLOG_CHECKPOINT_BLOCKS + 1) fail("blocks read without a checkpoint", max_read_spoiled, SDLOG_SUPER_BLOCKS + log2_blocks + 2*SDLOG_CHECKPOINT_BLOCKS + 1);
+
+  printf("4 hours of 1 IC at %u ms, %u power cuts, %u torn rewrites of synced blocks, %u stale blocks, %u without a checkpoint\n",
+         PERIOD_MS, cuts, torn_cuts, stale, spoiled);
+  printf("records appended %u, in the log %u, lost %u, file %u blocks\n", appended, (unsigned)end.ms.size(), lost, (unsigned)card.blocks.size());
+  printf("blocks read by recovery: mean %.1f, max %u, max %u without a checkpoint, full scan up to %u\n",
+         total_read/(cuts - spoiled), max_read, max_read_spoiled, max_full);
+  printf("boot time at %.1f ms per read: max %.0f ms, full scan %.0f ms\n", READ_MS, max_read*READ_MS, max_full*READ_MS);
+
+  printf("%s, %u failures\n", failures ? "FAIL" : "PASS", failures);
+  return(failures ? 1 : 0);
+}
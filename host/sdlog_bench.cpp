@@ -0,0 +1,203 @@
+/*!
+  Append only SD log against a simulated card
+@verbatim
+  Runs lib/SdLog on a virtual clock, 1 ms per step, with a text record
+  like print_cells_SD writes arriving at several rates. The card keeps
+  every block it is written, and the file size as of the last sync. Block
+  reads cost 1.5 ms and writes 2.5 ms. A sync writes the directory entry,
+  plus a FAT block if the file grew since the last one. It checks several
+  things:
+
+    the file reads back as exactly the records appended
+    the log is never written past the end of the file
+    no byte waits in RAM longer than the flush time
+    preallocation stays ahead of the data, so the file never grows on a
+    data write
+    after a power cut at any moment the log reopens, keeps every record
+    older than the flush time, and appends after them
+
+  For each rate it prints card time per record and the share of time the
+  card is busy. It compares these with the old open, write, close and
+  delay(100) per record. The exit status is non-zero if a check fails.
+
+  Usage: sdlog_bench
+@endverbatim
+*/
+#include <Arduino.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "SdLog.h"
+
+#define READ_MS 1.5
+#define WRITE_MS 2.5
+#define FLUSH_MS 1000
+#define SYNC_BLOCKS 8
+#define CLUSTER_BLOCKS 8 // 4 KB clusters
+
+static uint16_t failures = 0;
+
+static void fail(const char *what, unsigned got, unsigned expected)
+{
+  failures++;
+  if (failures < 10) printf("FAIL %s: %u, expected %u\n", what, got, expected);
+}
+
+/*! The log file on the card */
+struct Card
+{
+  std::vector<std::vector<uint8_t> > blocks;
+  uint32_t synced_blocks = 0; //!< File size as of the last sync
+  bool grew = false;
+  double busy_ms = 0;
+  uint32_t writes = 0;
+  uint32_t past_end = 0;
+};
+
+static Card card;
+
+static int8_t card_read(uint32_t block, uint8_t *data)
+{
+  card.busy_ms += READ_MS;
+  if (block >= card.blocks.size()) return(-1);
+  memcpy(data, card.blocks[block].data(), SDLOG_BLOCK);
+  return(0);
+}
+
+static int8_t card_write(uint32_t block, const uint8_t *data)
+{
+  card.busy_ms += WRITE_MS;
+  card.writes++;
+  if (block > card.blocks.size())
+  {
+    card.past_end++;
+    return(-1);
+  }
+  if (block == card.blocks.size())
+  {
+    card.blocks.push_back(std::vector<uint8_t>(SDLOG_BLOCK, 0));
+    card.grew = true;
+  }
+  if (data) memcpy(card.blocks[block].data(), data, SDLOG_BLOCK);
+  else memset(card.blocks[block].data(), 0, SDLOG_BLOCK);
+  return(0);
+}
+
+static int8_t card_sync(void)
+{
+  card.busy_ms += WRITE_MS*(card.grew ? 2 : 1); // Directory entry, and the FAT when clusters were added
+  card.writes += card.grew ? 2 : 1;
+  card.grew = false;
+  card.synced_blocks = (uint32_t)card.blocks.size();
+  return(0);
+}
+
+static const sd_log_io CARD_IO = {card_read, card_write, card_sync};
+
+/* A print_cells_SD record, about 180 bytes, numbered so any mix up shows */
+static std::string make_record(uint32_t n)
+{
+  char line[256];
+  int len = snprintf(line, sizeof(line), "DateTime:\t2026-10-17T08:%02u:%02u #%u\n IC 1: ", (n/60) % 60, n % 60, n);
+  for (int i = 0; i < 12; i++) len += snprintf(line + len, sizeof(line) - len, " C%d:%d.%04u,", i + 1, 3, (n*7 + i*131) % 10000);
+  snprintf(line + len, sizeof(line) - len, "\n");
+  return(line);
+}
+
+/* The text in the file, up to the first NUL */
+static std::string file_text(const Card &c, uint32_t blocks)
+{
+  std::string s;
+  for (uint32_t b = 0; b < blocks && b < c.blocks.size(); b++)
+  {
+    for (uint16_t i = 0; i < SDLOG_BLOCK; i++)
+    {
+      if (c.blocks[b][i] == 0) return(s);
+      s += (char)c.blocks[b][i];
+    }
+  }
+  return(s);
+}
+
+/* Card ms per record of the old print_cells_SD: open, append, close, delay(100) */
+static double old_record_ms(uint32_t n, uint32_t record_len, uint32_t *writes)
+{
+  uint64_t start = (uint64_t)n*record_len;
+  uint64_t end = start + record_len;
+  uint32_t touched = (uint32_t)((end - 1)/SDLOG_BLOCK - start/SDLOG_BLOCK + 1);
+  bool new_cluster = start/(SDLOG_BLOCK*CLUSTER_BLOCKS) != (end - 1)/(SDLOG_BLOCK*CLUSTER_BLOCKS);
+  *writes += touched + 1 + (new_cluster ? 1 : 0);
+  return(2*READ_MS                               // Directory entry, FAT to the end of the file
+         + touched*(READ_MS + WRITE_MS)          // Read, change and write each data block
+         + WRITE_MS + (new_cluster ? WRITE_MS : 0) // Directory entry and FAT on close
+         + 100);                                 // delay(100)
+}
+
+static void run(uint32_t period_ms, uint32_t run_ms)
+{
+  static sd_log log;
+  std::string appended;
+  std::vector<uint32_t> appended_at; // Bytes appended by each ms, for the power cut checks
+  uint32_t max_wait = 0;
+
+  card = Card();
+  if (sd_log_open(&log, &CARD_IO, 0, FLUSH_MS, SYNC_BLOCKS, NULL) != 0) fail("opening an empty file", 1, 0);
+  uint32_t n = 0;
+  for (uint32_t now = 1; now <= run_ms; now++)
+  {
+    if (now % period_ms == 0)
+    {
+      std::string r = make_record(n++);
+      sd_log_write(&log, (const uint8_t *)r.data(), (uint16_t)r.size(), now);
+      appended += r;
+    }
+    sd_log_service(&log, now);
+    appended_at.push_back((uint32_t)appended.size());
+    if (log.len > log.saved && now - log.dirty_ms > max_wait) max_wait = now - log.dirty_ms;
+
+    // Power cut: only the blocks written and the size as of the last sync survive
+    if (now % 7919 == 0)
+    {
+      static sd_log reopened;
+      Card saved = card;
+      card.blocks.resize(card.synced_blocks);
+      uint32_t must_have = (now > FLUSH_MS + 1) ? appended_at[now - FLUSH_MS - 2] : 0;
+      if (sd_log_open(&reopened, &CARD_IO, card.synced_blocks, FLUSH_MS, SYNC_BLOCKS, NULL) != 0) fail("reopening after a power cut", 1, 0);
+      std::string kept = file_text(card, card.synced_blocks);
+      if (appended.compare(0, kept.size(), kept) != 0) fail("data after a power cut is not what was appended", (unsigned)kept.size(), 0);
+      if (kept.size() < must_have) fail("bytes older than the flush time lost in a power cut", (unsigned)kept.size(), must_have);
+      std::string more = make_record(999999);
+      sd_log_write(&reopened, (const uint8_t *)more.data(), (uint16_t)more.size(), now);
+      sd_log_flush(&reopened);
+      if (file_text(card, (uint32_t)card.blocks.size()) != kept + more) fail("appending after a reopen", (unsigned)kept.size(), 0);
+      card = saved;
+    }
+  }
+  double busy_ms = card.busy_ms;
+  sd_log_flush(&log);
+
+  if (file_text(card, (uint32_t)card.blocks.size()) != appended) fail("file differs from the records appended", (unsigned)appended.size(), 0);
+  if (card.past_end != 0) fail("writes past the end of the file", card.past_end, 0);
+  if (max_wait > FLUSH_MS) fail("ms a byte waited in RAM", max_wait, FLUSH_MS);
+  if (log.count.grown != 0) fail("data blocks past the preallocation", log.count.grown, 0);
+  if (log.count.syncs > log.count.blocks/SYNC_BLOCKS + log.count.extended/SYNC_BLOCKS + log.count.partials + 2) fail("syncs", log.count.syncs, log.count.blocks/SYNC_BLOCKS);
+
+  double old_ms = 0;
+  uint32_t old_writes = 0;
+  uint32_t record_len = (uint32_t)make_record(0).size();
+  for (uint32_t i = 0; i < n; i++) old_ms += old_record_ms(i, record_len, &old_writes);
+  printf("%5u Hz %8u %10.2f %9.1f%% %11.2f %8.1f%% %12u %11u\n", 1000/period_ms, n, busy_ms/n, 100.0*busy_ms/run_ms,
+         old_ms/n, 100.0*old_ms/run_ms, card.writes, old_writes);
+}
+
+int main()
+{
+  printf("10 minutes of %u byte print_cells_SD records\n", (unsigned)make_record(0).size());
+  printf(" rate  records  ms/record  card busy  old ms/rec  old busy  card writes  old writes\n");
+  const uint32_t periods[] = {1000, 100, 20, 10};
+  for (uint32_t period : periods) run(period, 600000);
+
+  printf("%s, %u failures\n", failures ? "FAIL" : "PASS", failures);
+  return(failures ? 1 : 0);
+}
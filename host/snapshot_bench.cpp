@@ -0,0 +1,131 @@
+/*!
+  Snapshot buffer check and micro-benchmark
+@verbatim
+  Drives lib/BmsSnapshot the way an acquisition ISR and slow output code
+  would share it: a producer publishes cycles at random points while a
+  consumer holds a snapshot across many of them. Every cycle writes one
+  stamp into all of its codes, so a held snapshot that the producer
+  touched, or one that mixes two cycles, shows up as mismatched codes.
+  Then times capture plus publish, and acquire. The exit status is non-zero
+  if a check fails.
+
+  Usage: snapshot_bench [ics] [cycles]
+@endverbatim
+*/
+#include <Arduino.h>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "LTC681x.h"
+#include "BmsSnapshot.h"
+
+static uint16_t failures = 0;
+static cell_asic bms_ic[BMS_TOTAL_IC];
+static snapshot_buffer snapshots;
+
+static void fail(const char *what, unsigned got, unsigned expected)
+{
+  failures++;
+  if (failures < 10) printf("FAIL %s: %u, expected %u\n", what, got, expected);
+}
+
+/* Fills every code of the chain with the cycle's stamp, as a finished read would */
+static void acquire_cycle(uint8_t total_ic, uint16_t stamp)
+{
+  for (uint8_t ic = 0; ic < total_ic; ic++)
+  {
+    for (uint8_t i = 0; i < 18; i++) bms_ic[ic].cells.c_codes[i] = stamp;
+    for (uint8_t i = 0; i < 9; i++) bms_ic[ic].aux.a_codes[i] = stamp;
+    for (uint8_t i = 0; i < 4; i++) bms_ic[ic].stat.stat_codes[i] = stamp;
+  }
+}
+
+/* Every code of a snapshot must carry one stamp, the one it had when acquired */
+static void check_consistent(const bms_snapshot *snap, uint16_t stamp)
+{
+  for (uint8_t ic = 0; ic < snap->total_ic; ic++)
+  {
+    for (uint8_t i = 0; i < 18; i++) if (snap->ic[ic].cells.c_codes[i] != stamp) fail("cell code", snap->ic[ic].cells.c_codes[i], stamp);
+    for (uint8_t i = 0; i < 9; i++) if (snap->ic[ic].aux.a_codes[i] != stamp) fail("aux code", snap->ic[ic].aux.a_codes[i], stamp);
+    for (uint8_t i = 0; i < 4; i++) if (snap->ic[ic].stat.stat_codes[i] != stamp) fail("stat code", snap->ic[ic].stat.stat_codes[i], stamp);
+  }
+}
+
+static void check_interleaving(uint8_t total_ic)
+{
+  uint32_t rng = 7;
+  uint16_t stamp = 0;
+  uint16_t last_seq = 0;
+
+  snapshot_init(&snapshots);
+  if (snapshot_acquire(&snapshots)->seq != 0) fail("seq before the first publish", 1, 0);
+
+  for (uint16_t round = 0; round < 2000; round++)
+  {
+    const bms_snapshot *held = snapshot_acquire(&snapshots);
+    uint16_t held_seq = held->seq;
+    uint16_t held_stamp = held->ic[0].cells.c_codes[0];
+
+    if (held_seq != 0 && held_seq < last_seq) fail("seq went backwards", held_seq, last_seq);
+    last_seq = held_seq;
+
+    rng = rng*1103515245u + 12345u;
+    uint8_t cycles = (uint8_t)((rng >> 16) % 6); // The producer publishes 0 to 5 cycles while the output runs
+    for (uint8_t c = 0; c < cycles; c++)
+    {
+      acquire_cycle(total_ic, ++stamp);
+      snapshot_capture(&snapshots, total_ic, bms_ic, stamp);
+      if (c == 2)
+      {
+        check_consistent(held, held_stamp); // Mid capture, the held slot is untouched
+      }
+      snapshot_publish(&snapshots);
+    }
+    if (held->seq != held_seq) fail("held seq changed", held->seq, held_seq);
+    if (held_seq != 0) check_consistent(held, held_stamp);
+
+    const bms_snapshot *newest = snapshot_acquire(&snapshots);
+    if (stamp != 0 && newest->ic[0].cells.c_codes[0] != stamp) fail("newest cycle", newest->ic[0].cells.c_codes[0], stamp);
+    if (rng & 0x100) snapshot_release(&snapshots);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  uint8_t total_ic = 4;
+  uint32_t cycles = 200000;
+  if (argc > 1) total_ic = (uint8_t)atoi(argv[1]);
+  if (argc > 2) cycles = (uint32_t)atol(argv[2]);
+  if (total_ic < 1 || total_ic > BMS_TOTAL_IC || cycles < 1)
+  {
+    fprintf(stderr, "usage: %s [ics 1-%u] [cycles]\n", argv[0], BMS_TOTAL_IC);
+    return(2);
+  }
+
+  check_interleaving(total_ic);
+
+  printf("%u ICs, snapshot %u bytes, %u slots %u bytes\n", total_ic, (unsigned)sizeof(bms_snapshot),
+         SNAPSHOT_SLOTS, (unsigned)sizeof(snapshot_buffer));
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < cycles; i++)
+  {
+    bms_ic[0].cells.c_codes[0] = (uint16_t)i;
+    snapshot_capture(&snapshots, total_ic, bms_ic, i);
+    snapshot_publish(&snapshots);
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  printf("%-24s %10.1f ns per cycle\n", "capture+publish", ns/cycles);
+
+  volatile uint16_t sink = 0;
+  start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < cycles; i++)
+  {
+    sink += snapshot_acquire(&snapshots)->seq;
+  }
+  ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  printf("%-24s %10.1f ns per call\n", "acquire", ns/cycles);
+
+  printf("%s, %u failures\n", failures ? "FAIL" : "PASS", failures);
+  return(failures ? 1 : 0);
+}
@@ -0,0 +1,127 @@
+/*!
+  Subscription scheduler check and acquisition count
+@verbatim
+  Runs the measurement_loop2 pass schedule of lib/Subscriptions on a
+  virtual clock. It checks several things. Every sink is served once per
+  period, and never early by more than the window. Sinks due within the
+  window share a pass. A pass that overruns makes the late sinks skip the
+  missed slots instead of bursting. Invalid subscriptions are rejected.
+  Then it counts the passes and register conversions of a mixed table,
+  and compares them with sending every field to every sink at the fastest
+  period. The exit status is non-zero if a check fails.
+
+  Usage: sub_bench
+@endverbatim
+*/
+#include <Arduino.h>
+#include <stdio.h>
+#include "Subscriptions.h"
+
+#define WINDOW_MS 50
+
+static uint16_t failures = 0;
+
+static void fail(const char *what, unsigned got, unsigned expected)
+{
+  failures++;
+  if (failures < 10) printf("FAIL %s: %u, expected %u\n", what, got, expected);
+}
+
+typedef struct
+{
+  uint32_t passes;
+  uint32_t served[SUB_SINKS];
+  uint32_t conversions[3]; //!< Cells, aux, stat
+  uint32_t field_outputs;  //!< Fields handed to sinks, summed over sinks
+} schedule_count;
+
+/* Runs the loop for run_ms, each pass taking pass_ms, and checks the spacing of every sink */
+static void run(sub_table *t, uint32_t run_ms, uint32_t pass_ms, uint32_t overrun_at, schedule_count *count)
+{
+  uint32_t last[SUB_SINKS];
+  uint32_t now = 1000;
+
+  memset(count, 0, sizeof(schedule_count));
+  for (uint8_t sink = 0; sink < SUB_SINKS; sink++) last[sink] = 0;
+  sub_start(t, now);
+  while (now < 1000 + run_ms)
+  {
+    uint16_t wait = sub_wait_ms(t, now);
+    if (wait == 0xFFFF)
+    {
+      fail("nothing to wait for in a table with sinks", 0, 1);
+      return;
+    }
+    now += wait;
+    uint8_t due = sub_due(t, now);
+    uint8_t fields = sub_fields(t, due);
+    if (due == 0) fail("pass with no sink due", now, 1);
+    count->passes++;
+    for (uint8_t i = 0; i < 3; i++) if (fields & (1 << i)) count->conversions[i]++;
+    for (uint8_t sink = 0; sink < SUB_SINKS; sink++)
+    {
+      if (!(due & (1 << sink))) continue;
+      const sub_entry *e = &t->sink[sink];
+      uint32_t gap = now - last[sink];
+      if (last[sink] != 0 && gap + WINDOW_MS < e->period_ms) fail("sink served early, gap ms", gap, e->period_ms);
+      if (last[sink] != 0 && overrun_at == 0 && gap > (uint32_t)e->period_ms + WINDOW_MS) fail("sink served late, gap ms", gap, e->period_ms);
+      last[sink] = now;
+      count->served[sink]++;
+      for (uint8_t f = e->fields; f != 0; f &= (uint8_t)(f - 1)) count->field_outputs++;
+    }
+    now += (overrun_at != 0 && count->passes == overrun_at) ? 5000 : pass_ms;
+  }
+}
+
+static void check_table()
+{
+  sub_table t;
+  schedule_count count;
+
+  sub_init(&t, WINDOW_MS);
+  if (sub_wait_ms(&t, 0) != 0xFFFF) fail("empty table has something due", sub_wait_ms(&t, 0), 0xFFFF);
+  if (sub_set(&t, SUB_SINKS, SUB_CELLS, 1000, 0) == 0) fail("unknown sink accepted", SUB_SINKS, 0);
+  if (sub_set(&t, SUB_BLE, SUB_CELLS, 0, 0) == 0) fail("period of 0 accepted", 0, 1);
+  if (sub_set(&t, SUB_SD, 0, 0, 0) != 0) fail("unsubscribing rejected", 0, 0);
+
+  // Periods that do not divide each other, and two sinks a window apart
+  sub_set(&t, SUB_SERIAL, SUB_ALL, 1000, 0);
+  sub_set(&t, SUB_BLE, SUB_CELLS | SUB_VOLTAGE, 700, 0);
+  sub_set(&t, SUB_WIFI, SUB_CELLS, 1030, 0);
+  run(&t, 60000, 20, 0, &count);
+  if (count.served[SUB_SERIAL] < 60 || count.served[SUB_SERIAL] > 61) fail("Serial passes in 60 s", count.served[SUB_SERIAL], 60);
+  if (count.served[SUB_BLE] < 85 || count.served[SUB_BLE] > 87) fail("BLE passes in 60 s", count.served[SUB_BLE], 86);
+  if (count.served[SUB_SD] != 0) fail("unsubscribed sink served", count.served[SUB_SD], 0);
+  uint32_t outputs = count.served[SUB_SERIAL] + count.served[SUB_BLE] + count.served[SUB_WIFI];
+  if (count.passes + 15 > outputs) fail("passes, sinks due within the window did not share them", count.passes, outputs - 15);
+
+  // One pass that takes 5 s must not be followed by a burst of catch up passes
+  run(&t, 20000, 20, 10, &count);
+  if (count.served[SUB_SERIAL] > 16) fail("Serial passes after an overrun", count.served[SUB_SERIAL], 15);
+}
+
+int main()
+{
+  check_table();
+
+  // A mixed table against every field to every sink at the fastest period
+  sub_table mixed, flat;
+  schedule_count m, f;
+  sub_init(&mixed, WINDOW_MS);
+  sub_set(&mixed, SUB_SERIAL, SUB_CELLS | SUB_LTC2944 | SUB_PEC, 5000, 0);
+  sub_set(&mixed, SUB_BLE, SUB_CELLS | SUB_VOLTAGE | SUB_CURRENT, 1000, 0);
+  sub_set(&mixed, SUB_WIFI, SUB_CELLS | SUB_AUX | SUB_LTC2944, 10000, 0);
+  sub_set(&mixed, SUB_SD, SUB_CELLS | SUB_AUX | SUB_STAT, 60000, 0);
+  sub_init(&flat, WINDOW_MS);
+  for (uint8_t sink = 0; sink < SUB_SINKS; sink++) sub_set(&flat, sink, SUB_ALL, 1000, 0);
+  run(&mixed, 600000, 20, 0, &m);
+  run(&flat, 600000, 20, 0, &f);
+
+  printf("10 minutes    passes  cell conv  aux conv  stat conv  fields sent\n");
+  printf("subscribed %9u %10u %9u %10u %12u\n", m.passes, m.conversions[0], m.conversions[1], m.conversions[2], m.field_outputs);
+  printf("everything %9u %10u %9u %10u %12u\n", f.passes, f.conversions[0], f.conversions[1], f.conversions[2], f.field_outputs);
+  if (m.conversions[1] > f.conversions[1]/9 || m.field_outputs > f.field_outputs/4) fail("subscriptions saved too little", m.field_outputs, f.field_outputs/4);
+
+  printf("%s, %u failures\n", failures ? "FAIL" : "PASS", failures);
+  return(failures ? 1 : 0);
+}
@@ -0,0 +1,204 @@
+/*!
+  Telemetry frame check and size comparison
+@verbatim
+  Round-trips random snapshots, with stale cells, through lib/Telemetry:
+  build, COBS encode, decode and parse, and checks every code comes back.
+  Also checks the CRC against its published check value, COBS runs of
+  zeros and of 254 non zero bytes, that corrupted frames are rejected, and
+  that a receiver joining mid stream resyncs on the next delimiter.
+
+  Then compares the bytes one cycle of cells takes on the wire as binary
+  frames against the text print_cells() writes and the JSON BLE_cells()
+  builds, with the wire time at 9600 and 115200 baud. The exit status is
+  non-zero if a check fails.
+
+  Usage: telemetry_bench [ics]
+@endverbatim
+*/
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "LTC681x.h"
+#include "BmsSnapshot.h"
+#include "Telemetry.h"
+
+#define CELLS 12
+
+static uint16_t failures = 0;
+static bms_snapshot snap;
+static uint8_t raw[TLM_FRAME_MAX];
+static uint8_t encoded[TLM_COBS_MAX(TLM_FRAME_MAX)];
+static uint8_t decoded[TLM_COBS_MAX(TLM_FRAME_MAX)];
+static tlm_frame frame;
+
+static void fail(const char *what, unsigned got, unsigned expected)
+{
+  failures++;
+  if (failures < 10) printf("FAIL %s: %u, expected %u\n", what, got, expected);
+}
+
+static uint32_t rng = 3;
+static uint16_t next_random()
+{
+  rng = rng*1103515245u + 12345u;
+  return((uint16_t)(rng >> 16));
+}
+
+static void random_snapshot(uint8_t total_ic)
+{
+  snap.seq = next_random();
+  snap.time_ms = ((uint32_t)next_random() << 16) | next_random();
+  snap.total_ic = total_ic;
+  for (uint8_t ic = 0; ic < total_ic; ic++)
+  {
+    for (uint8_t i = 0; i < 18; i++) snap.ic[ic].cells.c_codes[i] = (i & 3) == 0 ? (uint16_t)(next_random() & 0xFF00) : next_random(); // Some zero bytes for COBS
+    for (uint8_t i = 0; i < 9; i++) snap.ic[ic].aux.a_codes[i] = next_random();
+    for (uint8_t i = 0; i < 4; i++) snap.ic[ic].stat.stat_codes[i] = next_random();
+    snap.ic[ic].cells.stale = (next_random() & 1) ? 0 : (0x041UL << (next_random() % 6)); // Channel selective reads
+  }
+}
+
+/* Build, encode, decode and parse one frame; returns the encoded length */
+static uint16_t round_trip(uint8_t type, uint8_t channels)
+{
+  uint16_t len = tlm_build(raw, type, &snap, channels);
+  uint16_t enc_len = tlm_cobs_encode(raw, len, encoded);
+
+  for (uint16_t i = 1; i + 1 < enc_len; i++) if (encoded[i] == 0) fail("zero inside an encoded frame", i, enc_len);
+  if (encoded[0] != 0 || encoded[enc_len - 1] != 0) fail("missing delimiter", encoded[enc_len - 1], 0);
+  if (enc_len > TLM_COBS_MAX(len)) fail("encoded length", enc_len, TLM_COBS_MAX(len));
+
+  uint16_t dec_len = tlm_cobs_decode(encoded + 1, enc_len - 2, decoded);
+  if (dec_len != len || memcmp(decoded, raw, len) != 0) fail("COBS round trip", dec_len, len);
+  if (tlm_parse(decoded, dec_len, &frame) != 0)
+  {
+    fail("parse", 1, 0);
+    return(enc_len);
+  }
+  if (frame.type != type || frame.seq != snap.seq || frame.time_ms != snap.time_ms || frame.total_ic != snap.total_ic)
+  {
+    fail("header", frame.seq, snap.seq);
+  }
+  for (uint8_t ic = 0; ic < snap.total_ic; ic++)
+  {
+    const uint16_t *codes = type == TLM_CELLS ? snap.ic[ic].cells.c_codes : type == TLM_AUX ? snap.ic[ic].aux.a_codes : snap.ic[ic].stat.stat_codes;
+    uint32_t expected = ((1UL << channels) - 1) & ~(type == TLM_CELLS ? snap.ic[ic].cells.stale : 0);
+    if (frame.present[ic] != expected) fail("bitmap", frame.present[ic], expected);
+    for (uint8_t ch = 0; ch < channels; ch++)
+    {
+      if ((expected & (1UL << ch)) && frame.codes[ic][ch] != codes[ch]) fail("code", frame.codes[ic][ch], codes[ch]);
+    }
+  }
+  return(enc_len);
+}
+
+static void check_cobs_edges()
+{
+  static uint8_t in[600], out[TLM_COBS_MAX(600)], back[TLM_COBS_MAX(600)];
+  const uint16_t lengths[] = {1, 253, 254, 255, 508, 600};
+  for (uint8_t fill = 0; fill < 3; fill++)
+  {
+    for (uint8_t l = 0; l < sizeof(lengths)/sizeof(lengths[0]); l++)
+    {
+      uint16_t len = lengths[l];
+      for (uint16_t i = 0; i < len; i++) in[i] = fill == 0 ? 0 : fill == 1 ? 0x5A : (uint8_t)(i % 7 == 0 ? 0 : i);
+      uint16_t enc = tlm_cobs_encode(in, len, out);
+      uint16_t dec = tlm_cobs_decode(out + 1, enc - 2, back);
+      if (dec != len || memcmp(in, back, len) != 0) fail("COBS edge case length", dec, len);
+    }
+  }
+}
+
+static void check_rejects(uint8_t total_ic)
+{
+  random_snapshot(total_ic);
+  uint16_t len = tlm_build(raw, TLM_CELLS, &snap, CELLS);
+  for (uint16_t i = 0; i < len; i++)
+  {
+    for (uint8_t b = 0; b < 8; b++)
+    {
+      memcpy(decoded, raw, len);
+      decoded[i] ^= (uint8_t)(1 << b);
+      if (tlm_parse(decoded, len, &frame) == 0) fail("corrupted frame accepted", i, b);
+    }
+  }
+  if (tlm_parse(raw, len - 1, &frame) == 0) fail("short frame accepted", len - 1, len);
+
+  // A receiver that starts mid frame sees a tail it must drop, then the next frame whole
+  uint16_t enc = tlm_cobs_encode(raw, len, encoded);
+  uint16_t tail = enc/2;
+  uint16_t dec = tlm_cobs_decode(encoded + tail, enc - 1 - tail, decoded);
+  if (dec != 0 && tlm_parse(decoded, dec, &frame) == 0) fail("partial frame accepted", dec, 0);
+}
+
+static uint16_t text_cells_bytes()
+{
+  // print_cells(), DATALOG_DISABLED: date line, then " IC n: " and " Cn:v.vvvv," per cell
+  uint16_t bytes = 0;
+  char text[FIXED_TEXT_LEN];
+  for (uint8_t ic = 0; ic < snap.total_ic; ic++)
+  {
+    bytes += strlen("DateTime:\t2020-01-01T00:00:00\r\n") + snprintf(NULL, 0, " IC %u: ", ic + 1);
+    for (uint8_t i = 0; i < CELLS; i++)
+    {
+      bytes += LTC681x_format_fixed(snap.ic[ic].cells.c_codes[i], 4, text) + snprintf(NULL, 0, " C%u:,", i + 1);
+    }
+    bytes += 2;
+  }
+  return(bytes + 4);
+}
+
+static uint16_t json_cells_bytes()
+{
+  // BLE_cells() fills "C1":v.vvvv,... for each IC in turn, serializeJson() sends the last one
+  uint16_t bytes = 2;
+  char text[FIXED_TEXT_LEN];
+  for (uint8_t i = 0; i < CELLS; i++)
+  {
+    bytes += snprintf(NULL, 0, "\"C%u\":,", i + 1) + LTC681x_format_fixed(snap.ic[0].cells.c_codes[i], 4, text);
+  }
+  return(bytes);
+}
+
+int main(int argc, char *argv[])
+{
+  uint8_t total_ic = 4;
+  if (argc > 1) total_ic = (uint8_t)atoi(argv[1]);
+  if (total_ic < 1 || total_ic > BMS_TOTAL_IC)
+  {
+    fprintf(stderr, "usage: %s [ics 1-%u]\n", argv[0], BMS_TOTAL_IC);
+    return(2);
+  }
+
+  const uint8_t check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+  if (tlm_crc16(check, sizeof(check)) != 0x29B1) fail("CRC-16/CCITT-FALSE check value", tlm_crc16(check, sizeof(check)), 0x29B1);
+  check_cobs_edges();
+  for (uint16_t trial = 0; trial < 500; trial++)
+  {
+    random_snapshot((uint8_t)(1 + trial % total_ic));
+    round_trip(TLM_CELLS, trial % 2 ? CELLS : 18);
+    round_trip(TLM_AUX, 6);
+    round_trip(TLM_STAT, 4);
+  }
+  check_rejects(total_ic);
+
+  // Size of one cycle of 12 cells per IC, every cell fresh, 3.0 V to 4.2 V
+  random_snapshot(total_ic);
+  for (uint8_t ic = 0; ic < total_ic; ic++)
+  {
+    snap.ic[ic].cells.stale = 0;
+    for (uint8_t i = 0; i < CELLS; i++) snap.ic[ic].cells.c_codes[i] = (uint16_t)(30000 + next_random() % 12000);
+  }
+  uint16_t binary = round_trip(TLM_CELLS, CELLS);
+  uint16_t text = text_cells_bytes();
+  uint16_t json = json_cells_bytes();
+  printf("%u ICs x %u cells per cycle        bytes   ms at 9600   ms at 115200\n", total_ic, CELLS);
+  printf("%-32s %6u %12.1f %14.2f\n", "print_cells text", text, text*10000.0/9600, text*10000.0/115200);
+  printf("%-32s %6u %12.1f %14.2f  (first IC only)\n", "BLE_cells JSON", json, json*10000.0/9600, json*10000.0/115200);
+  printf("%-32s %6u %12.1f %14.2f  %.1fx smaller than text\n", "binary frame", binary, binary*10000.0/9600,
+         binary*10000.0/115200, (double)text/binary);
+
+  printf("%s, %u failures\n", failures ? "FAIL" : "PASS", failures);
+  return(failures ? 1 : 0);
+}
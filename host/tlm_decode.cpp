@@ -0,0 +1,105 @@
+/*!
+  Telemetry frame decoder
+@verbatim
+  Reads the byte stream of the sketch's binary output mode from a file or
+  stdin (for example a capture of the serial port), splits it on the 0x00
+  delimiters, and prints one line per IC of every frame that passes the
+  CRC. Text between frames and frames cut off by the start of the capture
+  fail the CRC and are counted, not printed.
+
+    cells seq 12 t 3400 ms IC 1: 3.6001 3.6012 - 3.5998 ...
+
+  "-" marks a code the frame did not carry, a stale cell. Delta frames
+  are decoded against the frame of their type before them. One whose base
+  was missed is counted as dropped, as is every delta until the next
+  keyframe of its type.
+
+  Usage: tlm_decode [capture.bin]
+@endverbatim
+*/
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "LTC681x.h"
+#include "Telemetry.h"
+
+static const char *type_name(uint8_t type)
+{
+  switch (type)
+  {
+    case TLM_CELLS: return("cells");
+    case TLM_AUX: return("aux");
+    case TLM_STAT: return("stat");
+    default: return("unknown");
+  }
+}
+
+static void print_frame(const tlm_frame *frame)
+{
+  char text[FIXED_TEXT_LEN];
+  for (uint8_t ic = 0; ic < frame->total_ic; ic++)
+  {
+    printf("%s seq %u t %lu ms IC %u:", type_name(frame->type), frame->seq, (unsigned long)frame->time_ms, ic + 1);
+    for (uint8_t channel = 0; channel < frame->channels; channel++)
+    {
+      if (frame->present[ic] & (1UL << channel))
+      {
+        LTC681x_format_fixed(frame->codes[ic][channel], 4, text);
+        printf(" %s", text);
+      }
+      else
+      {
+        printf(" -");
+      }
+    }
+    printf("\n");
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  FILE *in = stdin;
+  static uint8_t encoded[TLM_COBS_MAX(TLM_FRAME_MAX)];
+  static uint8_t raw[TLM_COBS_MAX(TLM_FRAME_MAX)];
+  static tlm_frame frame;
+  static tlm_delta base;
+  uint16_t len = 0;
+  bool overflow = false;
+  unsigned long good = 0, bad = 0;
+  int c;
+
+  if (argc > 1 && (in = fopen(argv[1], "rb")) == NULL)
+  {
+    perror(argv[1]);
+    return(2);
+  }
+  tlm_delta_init(&base, 0);
+
+  while ((c = fgetc(in)) != EOF)
+  {
+    if (c != 0)
+    {
+      if (len < sizeof(encoded)) encoded[len++] = (uint8_t)c;
+      else overflow = true;
+      continue;
+    }
+    if (len != 0)
+    {
+      uint16_t raw_len = overflow ? 0 : tlm_cobs_decode(encoded, len, raw);
+      if (raw_len != 0 && tlm_parse_delta(raw, raw_len, &frame, &base) == 0)
+      {
+        print_frame(&frame);
+        good++;
+      }
+      else
+      {
+        bad++;
+      }
+    }
+    len = 0;
+    overflow = false;
+  }
+
+  fprintf(stderr, "%lu frames, %lu dropped\n", good, bad);
+  return(0);
+}
@@ -0,0 +1,292 @@
+/*!
+  Transmit queue check and link simulation
+@verbatim
+  Feeds lib/TxQueue random alert and data messages while draining it in
+  random sized pieces. It checks three things. The sink only ever sees
+  whole messages, in queue order per priority. A waiting alert always goes
+  before the next data message. Every accepted message is either sent or
+  counted as dropped, and only data messages are dropped. Messages larger
+  than a ring, and alerts that find their ring full, must be rejected.
+
+  It then simulates one 9600 baud link, with the 64 byte HardwareSerial
+  buffer, carrying the measurement_loop2 JSON each cycle plus the largest
+  alert message every tenth cycle. It compares the time the loop spends blocked in
+  Serial writes with the time spent queueing. It also shows the drops,
+  late messages and alert delay when the cycle is shorter than the link
+  can carry. The exit status is non-zero if a check fails.
+
+  Usage: txqueue_bench [messages]
+@endverbatim
+*/
+#include <Arduino.h>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "TxQueue.h"
+
+#define UART_BUFFER 64        // HardwareSerial transmit buffer
+#define BYTES_PER_MS 0.96     // 9600 baud, 10 bits a byte
+#define JSON_BYTES 300        // measurement_loop2 serializeJson(doc, Serial1), 12 cells and the LTC2944
+#define ALERT_BYTES 146       // {"Alert":[...]} with all seven LTC2944 alerts, checkAlerts() worst case
+#define DATA_BYTES 332        // Data ring the sketch gives each link for one LTC6811, one JSON document and its header
+
+static uint16_t failures = 0;
+static tx_queue queue;
+static uint8_t data_ring[DATA_BYTES];
+
+static void fail(const char *what, unsigned got, unsigned expected)
+{
+  failures++;
+  if (failures < 10) printf("FAIL %s: %u, expected %u\n", what, got, expected);
+}
+
+static uint32_t rng = 5;
+static uint32_t next_random()
+{
+  rng = rng*1103515245u + 12345u;
+  return(rng >> 8);
+}
+
+/* Message n starts with its number and priority, then bytes derived from n */
+static uint16_t fill_message(uint8_t *msg, uint32_t n, uint8_t priority, uint16_t len)
+{
+  msg[0] = (uint8_t)n;
+  msg[1] = (uint8_t)(n >> 8);
+  msg[2] = (uint8_t)(n >> 16);
+  msg[3] = priority;
+  for (uint16_t i = 4; i < len; i++) msg[i] = (uint8_t)(n*31 + i);
+  return(len);
+}
+
+static void check_ordering(uint32_t messages)
+{
+  static uint8_t msg[DATA_BYTES];
+  std::vector<uint16_t> length;   // By message number
+  std::vector<uint8_t> accepted;
+  std::vector<uint8_t> priority_of;
+  std::vector<uint8_t> stream;
+  uint32_t last[TX_PRIORITIES] = {0, 0};
+  uint32_t accepted_count = 0;
+  uint32_t now = 0;
+
+  tx_init(&queue, data_ring, sizeof(data_ring), 50);
+  for (uint32_t n = 1; n <= messages || (tx_pending(&queue) != 0 && n <= 2*messages); n++)
+  {
+    now += next_random() % 4;
+    if (n <= messages)
+    {
+      uint8_t priority = (next_random() % 5 == 0) ? TX_ALERT : TX_DATA;
+      uint16_t len = (uint16_t)(4 + next_random() % (priority == TX_ALERT ? 24 : 160));
+      fill_message(msg, n, priority, len);
+      length.resize(n + 1);
+      accepted.resize(n + 1);
+      priority_of.resize(n + 1);
+      length[n] = len;
+      priority_of[n] = priority;
+      if (next_random() & 1)
+      {
+        accepted[n] = tx_enqueue(&queue, priority, msg, len, now) == 0;
+      }
+      else // Built in pieces, as serializeJson() writes through a Print
+      {
+        tx_begin(&queue, priority, now);
+        for (uint16_t i = 0; i < len; i += 7) tx_append(&queue, msg + i, (uint16_t)(len - i < 7 ? len - i : 7));
+        accepted[n] = tx_end(&queue) == 0;
+      }
+      accepted_count += accepted[n];
+    }
+
+    // Drain a random amount, as availableForWrite() would allow
+    uint16_t budget = (uint16_t)(next_random() % 48);
+    while (budget != 0)
+    {
+      const uint8_t *data;
+      bool idle = queue.active == TX_NONE;
+      bool alert_waiting = queue.ring[TX_ALERT].waiting != 0;
+      uint16_t avail = tx_peek(&queue, now, &data);
+      if (avail == 0) break;
+      if (idle && alert_waiting && queue.active != TX_ALERT) fail("data started ahead of a waiting alert", n, 0);
+      if (avail > budget) avail = budget;
+      stream.insert(stream.end(), data, data + avail);
+      tx_consume(&queue, avail);
+      budget -= avail;
+    }
+  }
+
+  if (tx_pending(&queue) != 0) fail("queue never drained", tx_pending(&queue), 0);
+
+  // Walk the stream message by message
+  std::vector<uint8_t> seen(length.size(), 0);
+  uint32_t received = 0;
+  for (size_t pos = 0; pos + 4 <= stream.size(); received++)
+  {
+    uint32_t n = stream[pos] | (stream[pos + 1] << 8) | ((uint32_t)stream[pos + 2] << 16);
+    uint8_t priority = stream[pos + 3];
+    if (n == 0 || n >= length.size() || priority >= TX_PRIORITIES || !accepted[n])
+    {
+      fail("unknown message in the stream", n, 0);
+      return;
+    }
+    fill_message(msg, n, priority, length[n]);
+    if (pos + length[n] > stream.size() || memcmp(&stream[pos], msg, length[n]) != 0) fail("message cut or mixed", n, length[n]);
+    if (n <= last[priority]) fail("out of order", n, last[priority]);
+    seen[n] = 1;
+    last[priority] = n;
+    pos += length[n];
+  }
+
+  for (uint32_t n = 1; n < length.size(); n++) // Only data may be dropped
+  {
+    if (accepted[n] && !seen[n] && priority_of[n] == TX_ALERT) fail("alert dropped", n, 0);
+  }
+  if (queue.count.queued != accepted_count) fail("queued count", queue.count.queued, accepted_count);
+  if (queue.count.sent != received) fail("sent count", queue.count.sent, received);
+  if (queue.count.sent + queue.count.dropped != queue.count.queued) fail("sent + dropped", queue.count.sent + queue.count.dropped, queue.count.queued);
+  if (queue.count.dropped == 0) fail("drop-oldest never exercised", 0, 1);
+  printf("%u messages: %lu queued, %lu sent, %lu dropped, %lu rejected, %lu late\n", messages,
+         (unsigned long)queue.count.queued, (unsigned long)queue.count.sent, (unsigned long)queue.count.dropped,
+         (unsigned long)queue.count.rejected, (unsigned long)queue.count.late);
+}
+
+static void check_alerts_kept(uint32_t messages)
+{
+  // Alerts only: nothing may be dropped, overflow is rejected instead
+  static uint8_t msg[TX_ALERT_BYTES + 8];
+  const uint8_t *data;
+  tx_init(&queue, data_ring, sizeof(data_ring), 50);
+  uint32_t accepted = 0;
+  for (uint32_t n = 1; n <= messages; n++)
+  {
+    accepted += tx_enqueue(&queue, TX_ALERT, msg, fill_message(msg, n, TX_ALERT, 12), 0) == 0;
+    if (n % 3 == 0)
+    {
+      uint16_t avail = tx_peek(&queue, 0, &data);
+      tx_consume(&queue, avail);
+    }
+  }
+  if (queue.count.dropped != 0) fail("alert dropped", queue.count.dropped, 0);
+  if (queue.count.rejected + accepted != messages) fail("alert accounting", queue.count.rejected + accepted, messages);
+  if (queue.count.rejected == 0) fail("full alert ring not rejected", 0, 1);
+
+  // A message larger than its ring is rejected and leaves the ring as it was
+  tx_init(&queue, data_ring, sizeof(data_ring), 50);
+  static uint8_t big[DATA_BYTES + 1];
+  tx_enqueue(&queue, TX_DATA, msg, fill_message(msg, 1, TX_DATA, 10), 0);
+  if (tx_enqueue(&queue, TX_DATA, big, sizeof(big), 0) == 0) fail("oversized message accepted", sizeof(big), DATA_BYTES);
+  if (tx_pending(&queue) != TX_HEADER_LEN + 10 || queue.count.dropped != 0) fail("oversized message dropped others", tx_pending(&queue), TX_HEADER_LEN + 10);
+  if (tx_enqueue(&queue, TX_ALERT, msg, TX_ALERT_BYTES - TX_HEADER_LEN + 1, 0) == 0) fail("oversized alert accepted", TX_ALERT_BYTES + 1, TX_ALERT_BYTES);
+  if (tx_enqueue(&queue, TX_ALERT, big, ALERT_BYTES, 0) != 0) fail("worst case alert rejected", ALERT_BYTES, TX_ALERT_BYTES - TX_HEADER_LEN);
+  tx_begin(&queue, TX_DATA, 0);
+  if (tx_begin(&queue, TX_DATA, 0) == 0) fail("nested begin accepted", 1, 0);
+  tx_end(&queue);
+}
+
+/* One 9600 baud link: returns ms the loop spent blocked per cycle */
+static double simulate(uint32_t cycle_ms, bool queued, uint32_t cycles, double *alert_delay_ms)
+{
+  static uint8_t json[JSON_BYTES], alert[ALERT_BYTES];
+  double uart = 0;              // Bytes in the HardwareSerial buffer
+  double blocked = 0;
+  uint32_t alert_sent = 0;
+  double alert_delay = 0;
+  std::vector<uint32_t> alert_time;
+  fill_message(json, 1, TX_DATA, JSON_BYTES);
+  fill_message(alert, 2, TX_ALERT, ALERT_BYTES);
+  tx_init(&queue, data_ring, sizeof(data_ring), 1000);
+
+  for (uint32_t ms = 0; ms < cycles*cycle_ms; ms++)
+  {
+    uart -= BYTES_PER_MS;
+    if (uart < 0) uart = 0;
+    if (ms % cycle_ms == 0)
+    {
+      uint32_t cycle = ms/cycle_ms;
+      uint16_t bytes = (cycle % 10 == 9) ? JSON_BYTES + ALERT_BYTES : JSON_BYTES;
+      if (!queued)
+      {
+        // Serial1.write() spins until the buffer has room for every byte
+        double wait = (uart + bytes - UART_BUFFER)/BYTES_PER_MS;
+        if (wait > 0)
+        {
+          blocked += wait;
+          uart = UART_BUFFER;
+          ms += (uint32_t)wait;
+        }
+        else uart += bytes;
+        continue;
+      }
+      tx_enqueue(&queue, TX_DATA, json, JSON_BYTES, ms);
+      if (cycle % 10 == 9)
+      {
+        tx_enqueue(&queue, TX_ALERT, alert, ALERT_BYTES, ms);
+        alert_time.push_back(ms);
+      }
+    }
+    if (queued)
+    {
+      // tx_service(): hand over what fits without blocking
+      const uint8_t *data;
+      uint16_t room = (uint16_t)(UART_BUFFER - uart);
+      while (room != 0)
+      {
+        uint16_t avail = tx_peek(&queue, ms, &data);
+        if (avail == 0) break;
+        if (queue.active == TX_ALERT && queue.remaining == ALERT_BYTES && alert_sent < alert_time.size())
+        {
+          alert_delay += ms - alert_time[alert_sent++];
+        }
+        if (avail > room) avail = room;
+        tx_consume(&queue, avail);
+        uart += avail;
+        room -= avail;
+      }
+    }
+  }
+  *alert_delay_ms = alert_sent ? alert_delay/alert_sent : 0;
+  return(blocked/cycles);
+}
+
+int main(int argc, char *argv[])
+{
+  uint32_t messages = 20000;
+  if (argc > 1) messages = (uint32_t)atol(argv[1]);
+  if (messages < 100)
+  {
+    fprintf(stderr, "usage: %s [messages, at least 100]\n", argv[0]);
+    return(2);
+  }
+
+  check_ordering(messages);
+  check_alerts_kept(messages/10);
+
+  printf("\n9600 baud link, %u byte JSON a cycle   blocked ms/cycle   dropped   rejected   late   alert delay ms\n", JSON_BYTES);
+  const uint32_t cycles_ms[] = {3000, 1000, 250};
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    double delay_ms;
+    double blocking = simulate(cycles_ms[i], false, 100, &delay_ms);
+    printf("%4lu ms cycle, blocking writes       %10.1f\n", (unsigned long)cycles_ms[i], blocking);
+    simulate(cycles_ms[i], true, 100, &delay_ms);
+    printf("%4lu ms cycle, queued                %10.1f %9lu %10lu %6lu %16.1f\n", (unsigned long)cycles_ms[i], 0.0,
+           (unsigned long)queue.count.dropped, (unsigned long)queue.count.rejected, (unsigned long)queue.count.late, delay_ms);
+  }
+
+  // Producer cost on the host, the part the loop still pays
+  static uint8_t json[JSON_BYTES];
+  const uint8_t *data;
+  tx_init(&queue, data_ring, sizeof(data_ring), 1000);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (uint32_t n = 0; n < messages; n++)
+  {
+    tx_enqueue(&queue, TX_DATA, json, JSON_BYTES, n);
+    uint16_t avail;
+    while ((avail = tx_peek(&queue, n, &data)) != 0) tx_consume(&queue, avail);
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  printf("\nqueue and drain one %u byte message: %.0f ns on this host\n", JSON_BYTES, ns/messages);
+
+  printf("%s, %u failures\n", failures ? "FAIL" : "PASS", failures);
+  return(failures ? 1 : 0);
+}
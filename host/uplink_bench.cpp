@@ -0,0 +1,335 @@
+/*!
+  Batched ESP8266 uplink against a simulated ESP8266
+@verbatim
+  Runs lib/Uplink on a virtual clock, 1 ms per step, over a 9600 baud
+  link. Samples are queued as compact records in a ring of two batches, as
+  the sketch sizes it, and rendered to JSON as they go out. A stand-in for the ESP8266 parses each batch line, uploads it over
+  a Wi-Fi link of limited rate, and answers ACK, NAK or BUSY. Each scenario
+  sets how often it drops a batch without answering, corrupts a byte on
+  the wire, or goes busy. Each also checks several things:
+
+    every sample queued is delivered, dropped for room, abandoned or
+    still queued
+    the ESP8266 receives unique samples in order, none of them damaged
+    no batch starts while a BUSY hold is in force, and none is abandoned
+    however long the ESP8266 stays busy
+    on a clean link batches hold several samples
+    a record the ring wraps inside is rendered whole
+    nothing is lost on a clean or mildly lossy link, and otherwise fewer
+    samples are lost than by the one-shot write
+
+  For each scenario it prints delivered, lost and duplicate samples and
+  the delivery latency. It also prints the samples the old one-shot write
+  to Serial2 would have lost. The exit status is non-zero if a check fails.
+
+  Usage: uplink_bench
+@endverbatim
+*/
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <deque>
+#include <vector>
+#include "Uplink.h"
+
+#define SAMPLE_BYTES 47        // Compact record, the size the sketch queues for one LTC6811
+#define SAMPLE_LEN 250         // Its JSON on the wire
+#define PIECE_LEN 24           // JSON bytes rendered at a time
+#define RING_BYTES (2*4*(UP_HEADER_LEN + SAMPLE_BYTES)) // Two batches of four
+#define BYTES_PER_MS 0.96      // 9600 baud, 10 bits a byte
+#define REPLY_LATENCY_MS 5
+
+static uint16_t failures = 0;
+static uint32_t rng = 12345;
+
+static void fail(const char *what, unsigned got, unsigned expected)
+{
+  failures++;
+  if (failures < 10) printf("FAIL %s: %u, expected %u\n", what, got, expected);
+}
+
+static uint32_t random_u32()
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return(rng);
+}
+
+static bool chance(double p)
+{
+  return((random_u32() % 1000000) < p*1000000);
+}
+
+/* Compact record of sample n, the number then bytes that follow from it */
+static void make_record(uint32_t n, uint8_t *record)
+{
+  memcpy(record, &n, 4);
+  for (int i = 4; i < SAMPLE_BYTES; i++) record[i] = (uint8_t)(n*31 + i*7);
+}
+
+/* JSON of a record, padded to SAMPLE_LEN from its bytes so the ESP8266 can tell a damaged one */
+static std::string record_json(const uint8_t *record)
+{
+  uint32_t n;
+  memcpy(&n, record, 4);
+  char head[32];
+  snprintf(head, sizeof(head), "{\"n\":%u,\"pad\":\"", n);
+  std::string s(head);
+  while (s.size() < SAMPLE_LEN - 2) s += (char)('a' + record[4 + s.size() % (SAMPLE_BYTES - 4)] % 26);
+  return(s + "\"}");
+}
+
+/* JSON sample n should arrive as */
+static std::string make_sample(uint32_t n)
+{
+  uint8_t record[SAMPLE_BYTES];
+  make_record(n, record);
+  return(record_json(record));
+}
+
+/* Writes the JSON of a record PIECE_LEN bytes at a time, as the sketch writes one member at a time */
+static uint8_t render(const uint8_t *sample, uint16_t len, uint16_t piece, char *text)
+{
+  if (len != SAMPLE_BYTES)
+  {
+    fail("record length", len, SAMPLE_BYTES);
+    strcpy(text, "null");
+    return(piece == 0 ? 4 : 0);
+  }
+  std::string s = record_json(sample);
+  size_t at = (size_t)piece*PIECE_LEN;
+  if (at >= s.size()) return(0);
+  size_t n = (s.size() - at < PIECE_LEN) ? s.size() - at : PIECE_LEN;
+  memcpy(text, s.data() + at, n);
+  text[n] = 0;
+  return((uint8_t)n);
+}
+
+typedef struct
+{
+  const char *name;
+  double drop;          //!< Batches the ESP8266 loses without answering
+  double corrupt;       //!< Chance per byte of damage on the wire
+  double busy;          //!< Batches answered BUSY 500 while Wi-Fi is slow
+  uint32_t outage_from; //!< ms the access point goes away, 0 for never
+  uint32_t outage_ms;
+  bool expect_no_loss;
+} scenario;
+
+/*! The ESP8266 end: parses batches, uploads them and answers */
+class EspSim
+{
+  public:
+    std::string line;
+    uint32_t line_start = 0;
+    uint32_t upload_until = 0;  //!< Busy uploading the last batch
+    uint32_t hold_from = 0, hold_until = 0;
+    uint32_t next_n = 0;        //!< Next sample expected, samples arrive in order
+    std::vector<std::pair<uint32_t, uint32_t> > delivered; //!< Sample number and when its upload finished
+    uint32_t duplicates = 0, damaged = 0, out_of_order = 0, held_starts = 0;
+    uint16_t last_seq = 0xFFFF;
+    std::deque<std::pair<uint32_t, std::string> > replies; //!< Answer lines and when they reach the Mega
+
+    void reply(uint32_t now, const std::string &text)
+    {
+      replies.push_back(std::make_pair(now + REPLY_LATENCY_MS, text + "\n"));
+    }
+
+    void receive(uint8_t c, uint32_t now, const scenario &sc)
+    {
+      if (line.empty())
+      {
+        line_start = now;
+        if (now >= hold_from && now < hold_until) held_starts++;
+      }
+      line += (char)c;
+      if (c == '\n') batch(now, sc);
+    }
+
+    void batch(uint32_t now, const scenario &sc)
+    {
+      std::string b;
+      b.swap(line);
+      unsigned seq;
+      int header_len = 0;
+      if (sscanf(b.c_str(), "{\"Batch\":%u,\"Samples\":[%n", &seq, &header_len) != 1 || header_len == 0)
+      {
+        damaged++;
+        return; // Nothing to answer, the Mega times out
+      }
+      if (chance(sc.drop)) return;
+      bool outage = sc.outage_from != 0 && now >= sc.outage_from && now < sc.outage_from + sc.outage_ms;
+      if (outage || now < upload_until || chance(sc.busy))
+      {
+        uint32_t wait = outage ? 2000 : (now < upload_until ? upload_until - now : 500);
+        hold_from = now + REPLY_LATENCY_MS + 1;
+        hold_until = now + REPLY_LATENCY_MS + wait;
+        reply(now, "BUSY " + std::to_string(wait));
+        return;
+      }
+
+      // Check every sample, then take them all or none
+      std::vector<uint32_t> ns;
+      size_t pos = header_len;
+      bool ok = true;
+      while (ok && pos < b.size() && b[pos] == '{')
+      {
+        unsigned n;
+        if (sscanf(b.c_str() + pos, "{\"n\":%u", &n) != 1 || b.compare(pos, SAMPLE_LEN, make_sample(n)) != 0) ok = false;
+        else ns.push_back(n);
+        pos += SAMPLE_LEN;
+        if (pos < b.size() && b[pos] == ',') pos++;
+      }
+      if (!ok || b.compare(pos, std::string::npos, "]}\n") != 0 || ns.empty())
+      {
+        damaged++;
+        reply(now, "NAK " + std::to_string(seq));
+        return;
+      }
+      if (seq == last_seq)
+      {
+        duplicates += ns.size();
+        reply(now, "ACK " + std::to_string(seq));
+        return;
+      }
+      last_seq = (uint16_t)seq;
+      upload_until = now + 100 + (uint32_t)b.size()/20; // Wi-Fi upload at about 20 kB/s
+      for (uint32_t n : ns)
+      {
+        if (n < next_n) out_of_order++;
+        next_n = n + 1;
+        delivered.push_back(std::make_pair(n, upload_until));
+      }
+      reply(upload_until, "ACK " + std::to_string(seq));
+    }
+};
+
+/* Records that wrap around the end of the ring go out whole */
+static void check_wrap()
+{
+  static up_link link;
+  static uint8_t ring[3*(UP_HEADER_LEN + SAMPLE_BYTES) - 20], scratch[SAMPLE_BYTES];
+
+  up_init(&link, ring, sizeof(ring), 1, 1000, 1500);
+  up_set_render(&link, render, scratch, sizeof(scratch));
+  for (uint32_t n = 0; n < 4; n++)
+  {
+    uint8_t record[SAMPLE_BYTES];
+    const uint8_t *data;
+    uint16_t avail;
+    std::string line;
+    make_record(n, record);
+    up_add(&link, record, sizeof(record), n);
+    while ((avail = up_peek(&link, n, &data)) != 0)
+    {
+      line.append((const char *)data, avail);
+      up_consume(&link, avail, n);
+    }
+    if (line != "{\"Batch\":" + std::to_string(n) + ",\"Samples\":[" + make_sample(n) + "]}\n") fail("record wrapped in the ring", n, 0);
+    for (char c : "ACK " + std::to_string(n) + "\n") up_receive(&link, (uint8_t)c, n);
+  }
+  if (link.count.delivered != 4) fail("wrapped records delivered", link.count.delivered, 4);
+}
+
+static void run(const scenario &sc)
+{
+  static up_link link;
+  static uint8_t ring[RING_BYTES], scratch[SAMPLE_BYTES];
+  EspSim esp;
+  const uint32_t run_ms = 600000, period_ms = 1000;
+  double credit = 0;
+  uint32_t produced = 0;
+  std::vector<uint32_t> queued_at;
+  uint64_t latency_sum = 0;
+  uint32_t latency_max = 0;
+  uint32_t one_shot_lost = 0;
+
+  up_init(&link, ring, sizeof(ring), 4, 3000, 1500);
+  up_set_render(&link, render, scratch, sizeof(scratch));
+  for (uint32_t now = 1; now <= run_ms + 60000; now++)
+  {
+    if (now <= run_ms && now % period_ms == 0)
+    {
+      uint8_t record[SAMPLE_BYTES];
+      make_record(produced++, record);
+      queued_at.push_back(now);
+      up_add(&link, record, sizeof(record), now);
+
+      // The old write: one line per sample, lost whenever the ESP8266 cannot take it
+      bool outage = sc.outage_from != 0 && now >= sc.outage_from && now < sc.outage_from + sc.outage_ms;
+      double damaged = 1.0;
+      for (int i = 0; i < SAMPLE_LEN; i++) damaged *= 1.0 - sc.corrupt;
+      if (outage || chance(sc.drop) || chance(sc.busy) || chance(1.0 - damaged)) one_shot_lost++;
+    }
+
+    // UART to the ESP8266
+    credit += BYTES_PER_MS;
+    const uint8_t *data;
+    uint16_t avail;
+    while (credit >= 1.0 && (avail = up_peek(&link, now, &data)) != 0)
+    {
+      uint16_t n = (avail > (uint16_t)credit) ? (uint16_t)credit : avail;
+      for (uint16_t i = 0; i < n; i++)
+      {
+        uint8_t c = data[i];
+        if (chance(sc.corrupt)) c ^= (uint8_t)(1 << (random_u32() % 7));
+        esp.receive(c, now, sc);
+      }
+      up_consume(&link, n, now);
+      credit -= n;
+    }
+    if (credit > 1.0) credit = 1.0; // An idle UART does not save up
+
+    // Answers back to the Mega
+    while (!esp.replies.empty() && esp.replies.front().first <= now)
+    {
+      for (char c : esp.replies.front().second) up_receive(&link, (uint8_t)c, now);
+      esp.replies.pop_front();
+    }
+  }
+
+  for (const std::pair<uint32_t, uint32_t> &d : esp.delivered)
+  {
+    uint32_t lat = d.second - queued_at[d.first];
+    latency_sum += lat;
+    if (lat > latency_max) latency_max = lat;
+  }
+
+  const up_counters *c = &link.count;
+  uint32_t lost = c->dropped + c->abandoned + c->rejected;
+  if (c->queued != c->delivered + c->dropped + c->abandoned + link.samples) fail("samples not accounted for", c->queued, c->delivered + c->dropped + c->abandoned + link.samples);
+  if (esp.delivered.size() != c->delivered) fail("ESP8266 samples against acknowledged", (unsigned)esp.delivered.size(), c->delivered);
+  if (esp.out_of_order != 0) fail("samples out of order", esp.out_of_order, 0);
+  if (sc.corrupt == 0 && esp.damaged != 0) fail("damaged batches on a clean wire", esp.damaged, 0);
+  if (c->abandoned != 0) fail("samples abandoned by an ESP8266 that answers in the end", c->abandoned, 0);
+  if (esp.held_starts != 0) fail("batches started during a BUSY hold", esp.held_starts, 0);
+  if (sc.drop == 0 && sc.busy == 0 && c->batches*3 > produced) fail("batches on a clean link", c->batches, produced/3);
+  if (sc.expect_no_loss && lost != 0) fail("samples lost with capacity to spare", lost, 0);
+  if (!sc.expect_no_loss && lost >= one_shot_lost) fail("samples lost, no better than the one-shot write", lost, one_shot_lost);
+  if (produced - link.samples != c->delivered + lost) fail("samples left queued at the end", link.samples, 0);
+
+  printf("%-10s %6u %9u %6u %10u %8u %7u %6u %9.0f %8u %13u\n", sc.name, produced, c->delivered, lost, esp.duplicates,
+         c->batches, c->resent, c->busy, esp.delivered.empty() ? 0.0 : (double)latency_sum/esp.delivered.size(), latency_max, one_shot_lost);
+}
+
+int main()
+{
+  const scenario scenarios[] =
+  {
+    {"clean",    0.00, 0.0,    0.00, 0, 0, true},
+    {"mild",     0.01, 0.0,    0.05, 0, 0, true},
+    {"lossy",    0.05, 0.0001, 0.10, 0, 0, false},
+    {"outage",   0.02, 0.0,    0.05, 60000, 60000, false},
+  };
+
+  printf("10 minutes of %u byte samples every second, %u bytes of JSON each over 9600 baud, in a %u byte ring\n", SAMPLE_BYTES, SAMPLE_LEN, RING_BYTES);
+  printf("scenario  samples delivered   lost duplicates  batches  resent   busy  mean ms   max ms  one-shot lost\n");
+  for (const scenario &sc : scenarios) run(sc);
+  check_wrap();
+
+  printf("%s, %u failures\n", failures ? "FAIL" : "PASS", failures);
+  return(failures ? 1 : 0);
+}
@@ -0,0 +1,502 @@
+/*! @file
+    Binary columnar SD log format
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include "BinLog.h"
+
+/* Stores a little endian u16 */
+static void put16(uint8_t *p, // Output
+                  uint16_t value // Value to store
+                 )
+{
+	p[0] = (uint8_t)value;
+	p[1] = (uint8_t)(value >> 8);
+}
+
+/* Stores a little endian u32 */
+static void put32(uint8_t *p, // Output
+                  uint32_t value // Value to store
+                 )
+{
+	put16(p, (uint16_t)value);
+	put16(p + 2, (uint16_t)(value >> 16));
+}
+
+/* Loads a little endian u16 */
+static uint16_t get16(const uint8_t *p // Input
+                     )
+{
+	return((uint16_t)(p[0] | (p[1] << 8)));
+}
+
+/* Loads a little endian u32 */
+static uint32_t get32(const uint8_t *p // Input
+                     )
+{
+	return((uint32_t)get16(p) | ((uint32_t)get16(p + 2) << 16));
+}
+
+/* Writes the index block if the next block is its place */
+static int8_t place_index(bin_log *b, // Writer
+                          uint32_t now_ms // millis()
+                         )
+{
+	uint8_t *block;
+
+	if (b->log->block % BL_INDEX_SPAN != BL_INDEX_SPAN - 1)
+	{
+		return(0);
+	}
+	block = sd_log_block(b->log);
+	block[0] = BL_INDEX;
+	block[1] = BL_VERSION;
+	block[2] = b->span_partial ? BL_INDEX_PARTIAL : 0;
+	put32(&block[4], b->log->block - (BL_INDEX_SPAN - 1));
+	put32(&block[8], b->seq);
+	put32(&block[16], b->span_min);
+	put32(&block[20], b->span_max);
+	put32(&block[24], b->span_records);
+	b->span_min = 0xFFFFFFFF;
+	b->span_max = 0;
+	b->span_records = 0;
+	b->span_partial = 0;
+	b->count.indexes++;
+	return(sd_log_commit(b->log, SDLOG_BLOCK, now_ms));
+}
+
+/* CRC of a block, less its own two bytes */
+static uint16_t block_crc(const uint8_t *block // SDLOG_BLOCK bytes
+                         )
+{
+	return(sd_log_crc16(sd_log_crc16(SDLOG_CRC_INIT, block, 12), &block[14], SDLOG_BLOCK - 14));
+}
+
+const sd_log_format bl_format = {bl_check, bl_seal};
+
+/* Checks a block read back */
+int8_t bl_check(const uint8_t *block, // SDLOG_BLOCK bytes
+                uint32_t *seq // Sequence number the block must have, or SDLOG_SEQ_ANY
+               )
+{
+	bl_layout layout;
+	uint32_t first = get32(&block[8]);
+
+	if ((block[0] != BL_HEADER && block[0] != BL_DATA && block[0] != BL_DELTA && block[0] != BL_INDEX) || block[1] != BL_VERSION ||
+	        (*seq != SDLOG_SEQ_ANY && first != *seq) ||
+	        ((block[0] == BL_DATA || block[0] == BL_DELTA) && bl_block_layout(block, &layout) != 0) ||
+	        get16(&block[12]) != block_crc(block))
+	{
+		return(-1);
+	}
+	*seq = first + ((block[0] == BL_DATA || block[0] == BL_DELTA) ? block[2] : 0);
+	return(0);
+}
+
+/* Stores the CRC of a block about to be written */
+uint32_t bl_seal(uint8_t *block // SDLOG_BLOCK bytes
+                )
+{
+	put16(&block[12], block_crc(block));
+	return(get32(&block[8]) + ((block[0] == BL_DATA || block[0] == BL_DELTA) ? block[2] : 0));
+}
+
+/* Starts a session with a header block */
+int8_t bl_open(bin_log *b, // Writer to start
+               sd_log *log, // Open log
+               uint8_t total_ic, // Layout the session starts with
+               uint8_t cells, // Cell codes per IC
+               uint8_t aux, // Aux codes per IC
+               uint16_t ic_type, // 6811, 6812 or 6813
+               uint32_t rtc, // RTC seconds
+               uint32_t now_ms // millis()
+              )
+{
+	uint8_t *block;
+
+	memset(b, 0, sizeof(bin_log));
+	if (log->io == NULL)
+	{
+		return(-1);
+	}
+	b->log = log;
+	b->type = BL_DATA;
+	b->span_min = 0xFFFFFFFF;
+	b->span_partial = (log->block % BL_INDEX_SPAN) != ((log->block < BL_INDEX_SPAN) ? SDLOG_SUPER_BLOCKS : 0); // Blocks of an earlier session are in this span
+	b->seq = log->seq;
+	if (place_index(b, now_ms) != 0)
+	{
+		b->count.errors++;
+	}
+	block = sd_log_block(log);
+	block[0] = BL_HEADER;
+	block[1] = BL_VERSION;
+	block[2] = total_ic;
+	block[3] = cells;
+	block[4] = aux;
+	put16(&block[6], ic_type);
+	put32(&block[8], b->seq);
+	put32(&block[16], rtc);
+	put32(&block[20], now_ms);
+	if (sd_log_commit(log, SDLOG_BLOCK, now_ms) != 0)
+	{
+		b->count.errors++;
+		return(-1);
+	}
+	return(0);
+}
+
+/* Records per data block of a layout */
+uint8_t bl_capacity(uint8_t total_ic, // ICs
+                    uint8_t cells, // Cell codes per IC
+                    uint8_t aux // Aux codes per IC
+                   )
+{
+	uint32_t record_len = 8 + 2*(uint32_t)total_ic*(cells + aux);
+	uint32_t capacity = (SDLOG_BLOCK - BL_DATA_HEADER_LEN)/record_len;
+
+	return((capacity > 255) ? 255 : (uint8_t)capacity);
+}
+
+/* Stores, or with out NULL measures, the varints of one code kind against the record before */
+static uint16_t put_deltas(bin_log *b, // Writer
+                           uint8_t *out, // Output, or NULL
+                           uint16_t channel, // Channel of the first code
+                           uint8_t total_ic, // ICs
+                           uint8_t per_ic, // Codes per IC
+                           const uint16_t *first, // Codes of IC 1
+                           uint16_t ic_stride // Bytes from the codes of one IC to the next
+                          )
+{
+	uint16_t len = 0;
+
+	for (uint8_t ic = 0; ic < total_ic; ic++)
+	{
+		const uint16_t *codes = (const uint16_t *)((const uint8_t *)first + ic*ic_stride);
+		for (uint8_t c = 0; c < per_ic; c++, channel++)
+		{
+			int32_t diff = (int32_t)codes[c] - b->last[channel];
+			if (out == NULL)
+			{
+				len += varint_len(diff);
+				continue;
+			}
+			len += varint_put(&out[len], diff);
+			b->last[channel] = codes[c];
+		}
+	}
+	return(len);
+}
+
+/* Stores one code kind whole, the keyframe of a delta coded block */
+static uint16_t put_codes(bin_log *b, // Writer
+                          uint8_t *out, // Output
+                          uint16_t channel, // Channel of the first code
+                          uint8_t total_ic, // ICs
+                          uint8_t per_ic, // Codes per IC
+                          const uint16_t *first, // Codes of IC 1
+                          uint16_t ic_stride // Bytes from the codes of one IC to the next
+                         )
+{
+	uint16_t len = 0;
+
+	for (uint8_t ic = 0; ic < total_ic; ic++)
+	{
+		const uint16_t *codes = (const uint16_t *)((const uint8_t *)first + ic*ic_stride);
+		for (uint8_t c = 0; c < per_ic; c++, channel++)
+		{
+			put16(&out[len], codes[c]);
+			len += 2;
+			b->last[channel] = codes[c];
+		}
+	}
+	return(len);
+}
+
+/* Appends one record */
+int8_t bl_add(bin_log *b, // Writer
+              uint32_t rtc, // RTC seconds of the measurement
+              uint32_t time_ms, // millis() of the measurement
+              uint8_t total_ic, // ICs
+              uint8_t cells, // Cell codes per IC
+              uint8_t aux, // Aux codes per IC
+              const uint16_t *cell_codes, // Cell codes of IC 1
+              const uint16_t *aux_codes, // Aux codes of IC 1
+              uint16_t ic_stride, // Bytes from the codes of one IC to the next
+              uint32_t now_ms // millis()
+             )
+{
+	uint8_t capacity = bl_capacity(total_ic, cells, aux);
+	uint16_t cell_count = (uint16_t)total_ic*cells;
+	uint8_t delta = b->type == BL_DELTA && cell_count + (uint16_t)total_ic*aux <= BL_DELTA_CHANNELS;
+	bl_layout *l = &b->block;
+	uint8_t *block;
+	uint8_t *column;
+	uint8_t i;
+	int32_t step;
+	int8_t result;
+
+	if (b->log == NULL || b->log->io == NULL || capacity == 0)
+	{
+		b->count.errors++;
+		return(-1);
+	}
+	if (l->count != 0 && (l->total_ic != total_ic || l->cells != cells || l->aux != aux || (l->capacity == 0) != delta))
+	{
+		l->count = 0; // Another layout, the block ends part filled
+		if (sd_log_commit(b->log, SDLOG_BLOCK, now_ms) != 0)
+		{
+			b->count.errors++;
+		}
+	}
+	step = (int32_t)(time_ms - b->last_ms);
+	if (l->count != 0 && delta &&
+	        (l->count == 255 ||
+	         b->used + varint_len((int32_t)(rtc - b->last_rtc)) + varint_len(step - b->step_ms) +
+	         put_deltas(b, NULL, 0, total_ic, cells, cell_codes, ic_stride) +
+	         put_deltas(b, NULL, cell_count, total_ic, aux, aux_codes, ic_stride) > SDLOG_BLOCK))
+	{
+		l->count = 0; // The record does not fit, it starts the next block
+		if (sd_log_commit(b->log, SDLOG_BLOCK, now_ms) != 0)
+		{
+			b->count.errors++;
+		}
+	}
+	if (l->count == 0)
+	{
+		if (place_index(b, now_ms) != 0)
+		{
+			b->count.errors++;
+		}
+		block = sd_log_block(b->log);
+		block[0] = delta ? BL_DELTA : BL_DATA;
+		block[1] = BL_VERSION;
+		block[3] = delta ? 0 : capacity;
+		block[4] = total_ic;
+		block[5] = cells;
+		block[6] = aux;
+		put32(&block[8], b->seq);
+		l->capacity = delta ? 0 : capacity;
+		l->total_ic = total_ic;
+		l->cells = cells;
+		l->aux = aux;
+		b->record_len = 8 + 2*(uint16_t)total_ic*(cells + aux);
+		b->count.blocks++;
+	}
+
+	block = sd_log_block(b->log);
+	i = l->count;
+	if (delta && i == 0)
+	{
+		b->used = BL_DATA_HEADER_LEN;
+		put32(&block[b->used], rtc);
+		put32(&block[b->used + 4], time_ms);
+		b->used += 8;
+		b->used += put_codes(b, &block[b->used], 0, total_ic, cells, cell_codes, ic_stride);
+		b->used += put_codes(b, &block[b->used], cell_count, total_ic, aux, aux_codes, ic_stride);
+		b->step_ms = 0;
+	}
+	else if (delta)
+	{
+		b->used += varint_put(&block[b->used], (int32_t)(rtc - b->last_rtc));
+		b->used += varint_put(&block[b->used], step - b->step_ms);
+		b->used += put_deltas(b, &block[b->used], 0, total_ic, cells, cell_codes, ic_stride);
+		b->used += put_deltas(b, &block[b->used], cell_count, total_ic, aux, aux_codes, ic_stride);
+		b->step_ms = step;
+	}
+	else
+	{
+		put32(&block[BL_DATA_HEADER_LEN + 4*i], rtc);
+		put32(&block[BL_DATA_HEADER_LEN + 4*capacity + 4*i], time_ms);
+		column = &block[BL_DATA_HEADER_LEN + 8*capacity + 2*i];
+		for (uint8_t ic = 0; ic < total_ic; ic++)
+		{
+			const uint16_t *codes = (const uint16_t *)((const uint8_t *)cell_codes + ic*ic_stride);
+			for (uint8_t c = 0; c < cells; c++)
+			{
+				put16(column, codes[c]);
+				column += 2*capacity;
+			}
+		}
+		for (uint8_t ic = 0; ic < total_ic; ic++)
+		{
+			const uint16_t *codes = (const uint16_t *)((const uint8_t *)aux_codes + ic*ic_stride);
+			for (uint8_t c = 0; c < aux; c++)
+			{
+				put16(column, codes[c]);
+				column += 2*capacity;
+			}
+		}
+	}
+	block[2] = ++l->count;
+	b->last_rtc = rtc;
+	b->last_ms = time_ms;
+
+	b->span_min = (rtc < b->span_min) ? rtc : b->span_min;
+	b->span_max = (rtc > b->span_max) ? rtc : b->span_max;
+	b->span_records++;
+	b->seq++;
+	b->count.records++;
+	if (delta)
+	{
+		put16(&block[14], b->used);
+		result = sd_log_commit(b->log, b->used, now_ms);
+	}
+	else if (l->count == capacity)
+	{
+		l->count = 0;
+		result = sd_log_commit(b->log, SDLOG_BLOCK, now_ms);
+	}
+	else
+	{
+		result = sd_log_commit(b->log, BL_DATA_HEADER_LEN + l->count*b->record_len, now_ms);
+	}
+	if (result != 0)
+	{
+		b->count.errors++;
+	}
+	return(result);
+}
+
+/* Reads the header of a data block */
+int8_t bl_block_layout(const uint8_t *block, // SDLOG_BLOCK bytes
+                       bl_layout *layout // Output
+                      )
+{
+	uint8_t capacity = bl_capacity(block[4], block[5], block[6]);
+
+	if (block[0] == BL_DELTA)
+	{
+		if (block[1] != BL_VERSION || block[2] == 0 || block[3] != 0 || capacity == 0 ||
+		        get16(&block[14]) < BL_DATA_HEADER_LEN + 8 + 2*(uint16_t)block[4]*(block[5] + block[6]) ||
+		        get16(&block[14]) > SDLOG_BLOCK)
+		{
+			return(-1);
+		}
+	}
+	else if (block[0] != BL_DATA || block[1] != BL_VERSION || block[3] == 0 || block[2] > block[3] ||
+	         block[3] != capacity)
+	{
+		return(-1);
+	}
+	layout->count = block[2];
+	layout->capacity = block[3];
+	layout->total_ic = block[4];
+	layout->cells = block[5];
+	layout->aux = block[6];
+	return(0);
+}
+
+/* Starts reading the records of a data block in turn */
+int8_t bl_first(bl_reader *r, // Reader to start
+                const uint8_t *block // SDLOG_BLOCK bytes
+               )
+{
+	if (bl_block_layout(block, &r->layout) != 0)
+	{
+		return(-1);
+	}
+	r->block = block;
+	r->i = 0;
+	r->at = BL_DATA_HEADER_LEN;
+	r->step_ms = 0;
+	return(0);
+}
+
+/* Reads the next record of a data block */
+int8_t bl_next(bl_reader *r, // Reader
+               uint16_t *codes // Output, total_ic*(cells + aux) codes in channel order
+              )
+{
+	const uint8_t *block = r->block;
+	uint16_t channels = (uint16_t)r->layout.total_ic*(r->layout.cells + r->layout.aux);
+	uint16_t used = get16(&block[14]);
+	int32_t value;
+	uint8_t len;
+
+	if (r->i >= r->layout.count)
+	{
+		return(-1);
+	}
+	r->seq = bl_seq(block, r->i);
+	if (r->layout.capacity != 0)
+	{
+		r->rtc = bl_rtc(block, r->i);
+		r->ms = bl_millis(block, r->i);
+		for (uint16_t c = 0; c < channels; c++)
+		{
+			codes[c] = bl_code(block, r->i, c);
+		}
+	}
+	else if (r->i == 0)
+	{
+		r->rtc = get32(&block[r->at]);
+		r->ms = get32(&block[r->at + 4]);
+		r->at += 8;
+		for (uint16_t c = 0; c < channels; c++, r->at += 2)
+		{
+			codes[c] = get16(&block[r->at]);
+		}
+	}
+	else
+	{
+		for (uint16_t c = 0; c < channels + 2; c++)
+		{
+			len = (r->at < used) ? varint_get(&block[r->at], used - r->at, &value) : 0;
+			if (len == 0)
+			{
+				return(-1);
+			}
+			r->at += len;
+			if (c == 0)
+			{
+				r->rtc += (uint32_t)value;
+			}
+			else if (c == 1)
+			{
+				r->step_ms += value;
+				r->ms += (uint32_t)r->step_ms;
+			}
+			else
+			{
+				codes[c - 2] = (uint16_t)(codes[c - 2] + value);
+			}
+		}
+	}
+	r->i++;
+	return(0);
+}
+
+/* RTC seconds of a record */
+uint32_t bl_rtc(const uint8_t *block, // Data block
+                uint8_t i // Record
+               )
+{
+	return(get32(&block[BL_DATA_HEADER_LEN + 4*i]));
+}
+
+/* millis() of a record */
+uint32_t bl_millis(const uint8_t *block, // Data block
+                   uint8_t i // Record
+                  )
+{
+	return(get32(&block[BL_DATA_HEADER_LEN + 4*block[3] + 4*i]));
+}
+
+/* Sequence number of a record */
+uint32_t bl_seq(const uint8_t *block, // Data block
+                uint8_t i // Record
+               )
+{
+	return(get32(&block[8]) + i);
+}
+
+/* Code of a record */
+uint16_t bl_code(const uint8_t *block, // Data block
+                 uint8_t i, // Record
+                 uint16_t channel // Channel
+                )
+{
+	return(get16(&block[BL_DATA_HEADER_LEN + 8*block[3] + 2*((uint16_t)channel*block[3] + i)]));
+}
@@ -0,0 +1,262 @@
+/*! @file
+    Binary columnar SD log format
+@verbatim
+  The SD log is a sequence of SDLOG_BLOCK byte blocks written through
+  lib/SdLog, after its checkpoint blocks. Every block starts with a type
+  byte, little endian fields follow. Each block has these fields:
+
+    1 version, 8 sequence number u32, 12 CRC u16
+
+  The CRC is CRC-16/CCITT-FALSE of every byte of the block but its own
+  two. Records are numbered from 0 in the order they were appended, and
+  the numbers run on across resets. The sequence number of a data block
+  is that of its first record, of any other block that of the next
+  record. So each block follows the one before it. A reader can tell
+  from them a torn block, or one out of place, and lib/SdLog finds the
+  end of the log by them after a reset.
+
+    'H' session header, written each time the log is opened
+      2 total_ic, 3 cells per IC, 4 aux per IC, 5 0, 6 IC type u16,
+      14 0, 16 RTC seconds u32, 20 millis() u32
+
+    'D' data, records of one layout
+      2 count, 3 capacity, 4 total_ic, 5 cells per IC, 6 aux per IC,
+      7 0, 14 0, then from BL_DATA_HEADER_LEN the columns, each capacity
+      values long:
+        RTC seconds u32, millis() u32,
+        cell codes u16, IC 1 cell 1 first, then every aux code u16
+
+    'Z' delta coded data, records of one layout
+      2 count, 3 0, 4 total_ic, 5 cells per IC, 6 aux per IC, 7 0,
+      14 bytes used u16, then from BL_DATA_HEADER_LEN the records in
+      turn. The first is whole, a keyframe:
+        RTC seconds u32, millis() u32, every code u16 in channel order
+      each later one is zig-zag varints, see lib/Varint, of its
+      differences from the record before it:
+        RTC seconds, change of the millis() step, every code
+      A record that does not fit in the block starts the next one.
+
+    'I' time index, every block n with n % BL_INDEX_SPAN ==
+      BL_INDEX_SPAN - 1, covering the blocks of its span before it
+      2 flags, 3 0, 4 first block u32, 14 0, 16 earliest RTC u32,
+      20 latest RTC u32, 24 records u32
+
+  A data block is self contained, so a reader can decode any block
+  alone, and many blocks at once. bl_first() and bl_next() read both
+  kinds. Cell codes move a few counts from one record to the next, so
+  most of their deltas take one byte, and a 'Z' block holds two to three
+  times the records of a 'D' block. bl_add() fills 'Z' blocks when type
+  is BL_DELTA and a record has at most BL_DELTA_CHANNELS codes, those of
+  the part BMS_IC_TYPE names. The codes are the raw register values, 100
+  uV per count for cells. A reader seeks by time with the index
+  blocks alone, reading one block in BL_INDEX_SPAN. An index flagged
+  BL_INDEX_PARTIAL misses blocks from before a reset, and its span must
+  be read in full, as must a span whose index was never written.
+@endverbatim
+*/
+
+#ifndef BINLOG_H
+#define BINLOG_H
+
+#include <stdint.h>
+#include "SdLog.h"
+#include "Varint.h"
+
+#define BL_VERSION 2
+#define BL_HEADER 'H'
+#define BL_DATA 'D'
+#define BL_INDEX 'I'
+#define BL_DELTA 'Z'
+#define BL_DATA_HEADER_LEN 16
+#define BL_INDEX_SPAN 256 //!< Blocks per index block
+#define BL_INDEX_PARTIAL 0x01 //!< Index flag, the span holds blocks the index does not cover
+#ifndef BL_DELTA_CHANNELS
+#if defined(BMS_IC_TYPE) && BMS_IC_TYPE == 6811
+#define BL_DELTA_IC_CHANNELS 18 //!< Cell and aux codes of one IC, 12 and 6 on an LTC6811
+#elif defined(BMS_IC_TYPE) && BMS_IC_TYPE == 6812
+#define BL_DELTA_IC_CHANNELS 24 //!< Cell and aux codes of one IC, 15 and 9 on an LTC6812
+#else
+#define BL_DELTA_IC_CHANNELS 27 //!< Cell and aux codes of one IC, 18 and 9 on an LTC6813, the most of any part
+#endif
+#ifdef BMS_TOTAL_IC
+#define BL_DELTA_CHANNELS (BMS_TOTAL_IC*BL_DELTA_IC_CHANNELS) //!< Most codes of a delta coded record, set with -D BL_DELTA_CHANNELS=n
+#else
+#define BL_DELTA_CHANNELS BL_DELTA_IC_CHANNELS
+#endif
+#endif
+
+/*! Layout and progress of a data block */
+typedef struct
+{
+  uint8_t count;    //!< Records in the block
+  uint8_t capacity; //!< Records the block has columns for, 0 for a delta coded block
+  uint8_t total_ic;
+  uint8_t cells;    //!< Cell codes per IC
+  uint8_t aux;      //!< Aux codes per IC
+} bl_layout;
+
+/*! Counts since bl_open() */
+typedef struct
+{
+  uint32_t records;
+  uint32_t blocks;  //!< Data blocks started
+  uint32_t indexes; //!< Index blocks written
+  uint32_t errors;  //!< Records or blocks the card did not take
+} bl_counters;
+
+/*! Log writer state */
+typedef struct
+{
+  sd_log *log;
+  bl_layout block;      //!< Data block being filled, count 0 before its first record
+  uint16_t record_len;  //!< Bytes of one record of that layout
+  uint32_t span_min;    //!< Earliest RTC in the span since the last index
+  uint32_t span_max;
+  uint32_t span_records;
+  uint8_t span_partial; //!< The span began before bl_open()
+  uint32_t seq;         //!< Sequence number of the next record
+  uint8_t type;         //!< BL_DATA, or BL_DELTA to delta code the records, from the next block on
+  uint16_t used;        //!< Bytes of a delta coded block in use
+  uint32_t last_rtc;    //!< Record before the next one of a delta coded block
+  uint32_t last_ms;
+  int32_t step_ms;      //!< millis() from the record before that
+  uint16_t last[BL_DELTA_CHANNELS];
+  bl_counters count;
+} bin_log;
+
+/*! Position in a data block, for bl_first() and bl_next() */
+typedef struct
+{
+  const uint8_t *block;
+  bl_layout layout;
+  uint8_t i;        //!< Record bl_next() reads next
+  uint16_t at;      //!< Offset of that record in a delta coded block
+  uint32_t seq;     //!< Sequence number of the last record read
+  uint32_t rtc;     //!< RTC seconds of the last record read
+  uint32_t ms;      //!< millis() of the last record read
+  int32_t step_ms;
+} bl_reader;
+
+/*! Block checks of the format, for sd_log_open() */
+extern const sd_log_format bl_format;
+
+/*!
+ Checks a block read back, for bl_format. Also tells a reader whether a
+ block is intact, given SDLOG_SEQ_ANY.
+ @return int8_t, 0 and *seq set to the number after the block, or -1 if
+ the block is torn, of another version, or does not follow *seq
+ */
+int8_t bl_check(const uint8_t *block, //!< SDLOG_BLOCK bytes
+                uint32_t *seq //!< Sequence number the block must have, or SDLOG_SEQ_ANY
+               );
+
+/*!
+ Stores the sequence number check of a block about to be written, for
+ bl_format
+ @return uint32_t, sequence number after the block
+ */
+uint32_t bl_seal(uint8_t *block //!< SDLOG_BLOCK bytes
+                );
+
+/*!
+ Starts a session on an open SD log with a header block. Records go in
+ 'D' blocks until type is set to BL_DELTA.
+ @return int8_t, 0 or -1 if the card did not take the header
+ */
+int8_t bl_open(bin_log *b, //!< Writer to start
+               sd_log *log, //!< Open log, opened with bl_format
+               uint8_t total_ic, //!< Layout the session starts with
+               uint8_t cells, //!< Cell codes per IC
+               uint8_t aux, //!< Aux codes per IC
+               uint16_t ic_type, //!< 6811, 6812 or 6813
+               uint32_t rtc, //!< RTC seconds
+               uint32_t now_ms //!< millis()
+              );
+
+/*!
+ Records per data block of a layout
+ @return uint8_t, 0 if one record does not fit in a block
+ */
+uint8_t bl_capacity(uint8_t total_ic, //!< ICs
+                    uint8_t cells, //!< Cell codes per IC
+                    uint8_t aux //!< Aux codes per IC
+                   );
+
+/*!
+ Appends one record. A record of another layout or type than the block
+ being filled starts a new block.
+ @return int8_t, 0 or -1 if the layout does not fit or the card failed
+ */
+int8_t bl_add(bin_log *b, //!< Writer
+              uint32_t rtc, //!< RTC seconds of the measurement
+              uint32_t time_ms, //!< millis() of the measurement
+              uint8_t total_ic, //!< ICs
+              uint8_t cells, //!< Cell codes per IC
+              uint8_t aux, //!< Aux codes per IC, 0 for none
+              const uint16_t *cell_codes, //!< Cell codes of IC 1
+              const uint16_t *aux_codes, //!< Aux codes of IC 1
+              uint16_t ic_stride, //!< Bytes from the codes of one IC to the next
+              uint32_t now_ms //!< millis()
+             );
+
+/*!
+ Reads the header of a data block, 'D' or 'Z'
+ @return int8_t, 0 or -1 if it is not a data block of this version
+ */
+int8_t bl_block_layout(const uint8_t *block, //!< SDLOG_BLOCK bytes
+                       bl_layout *layout //!< Output
+                      );
+
+/*!
+ Starts reading the records of a data block in turn, 'D' or 'Z'
+ @return int8_t, 0 or -1 if it is not a data block of this version
+ */
+int8_t bl_first(bl_reader *r, //!< Reader to start
+                const uint8_t *block //!< SDLOG_BLOCK bytes, kept until the last bl_next()
+               );
+
+/*!
+ Reads the next record of a data block. A 'Z' record is the difference
+ from the one before, so codes must hold the codes bl_next() read last.
+ @return int8_t, 0 and r->seq, r->rtc and r->ms set, or -1 after the last
+ record or if the block is malformed
+ */
+int8_t bl_next(bl_reader *r, //!< Reader
+               uint16_t *codes //!< Output, total_ic*(cells + aux) codes in channel order
+              );
+
+/*!
+ RTC seconds of record i of a 'D' block
+ @return uint32_t
+ */
+uint32_t bl_rtc(const uint8_t *block, //!< Data block
+                uint8_t i //!< Record, below the count
+               );
+
+/*!
+ millis() of record i of a 'D' block
+ @return uint32_t
+ */
+uint32_t bl_millis(const uint8_t *block, //!< Data block
+                   uint8_t i //!< Record, below the count
+                  );
+
+/*!
+ Sequence number of record i of a data block
+ @return uint32_t
+ */
+uint32_t bl_seq(const uint8_t *block, //!< Data block
+                uint8_t i //!< Record, below the count
+               );
+
+/*!
+ Code of record i of a 'D' block. Channel counts the cells of every IC,
+ then their aux codes.
+ @return uint16_t
+ */
+uint16_t bl_code(const uint8_t *block, //!< Data block
+                 uint8_t i, //!< Record, below the count
+                 uint16_t channel //!< Channel, below total_ic*(cells + aux)
+                );
+
+#endif
@@ -0,0 +1,209 @@
+/*! @file
+    BLE link packetizer
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include "BlePacket.h"
+
+/* Adds the checksum, frames a finished packet and hands it over */
+static void finish_packet(uint8_t *packet, // Packet with sequence, count and fields filled in
+                          uint8_t count, // Fields in the packet
+                          uint8_t last, // BLE_LAST on the final packet of the cycle
+                          ble_send_fn send // Called with the frame
+                         )
+{
+	uint8_t frame[BLE_MTU];
+	uint8_t len = BLE_PACKET_OVERHEAD - 1 + count*BLE_FIELD_LEN;
+	uint8_t sum = 0;
+	uint8_t code_at = 0; // Where the count of the current run goes
+	uint8_t frame_len = 1;
+
+	packet[1] = count | last;
+	for (uint8_t i = 0; i < len; i++)
+	{
+		sum += packet[i];
+	}
+	packet[len++] = (uint8_t)(0x100 - sum);
+
+	// COBS, each zero becomes the distance to the next one
+	for (uint8_t i = 0; i < len; i++)
+	{
+		if (packet[i] == 0)
+		{
+			frame[code_at] = frame_len - code_at;
+			code_at = frame_len++;
+		}
+		else
+		{
+			frame[frame_len++] = packet[i];
+		}
+	}
+	frame[code_at] = frame_len - code_at;
+	frame[frame_len++] = 0x00;
+	send(frame, frame_len);
+}
+
+/* Sets the budget and clears the counters */
+void ble_init(ble_link *link, // Link state
+              uint16_t budget_bps // Bytes per second the link is allowed
+             )
+{
+	memset(link, 0, sizeof(ble_link));
+	link->budget_bps = budget_bps;
+	link->tokens = budget_bps; // Start with one second of budget
+}
+
+/* Packs one cycle of fields */
+uint8_t ble_pack(ble_link *link, // Link state
+                 const ble_field *fields, // Required fields first, then optional ones
+                 uint16_t n_fields, // Number of fields
+                 uint16_t n_required, // Fields sent every cycle
+                 uint32_t now_ms, // millis()
+                 ble_send_fn send // Called with each packet
+                )
+{
+	uint8_t packet[BLE_MTU];
+	uint8_t count = 0;
+	uint8_t packets = 0;
+	uint16_t n_optional = (n_fields > n_required) ? n_fields - n_required : 0;
+	uint16_t optional_sent = 0;
+	uint32_t elapsed = now_ms - link->last_ms;
+
+	// Refill the bucket, holding at most one second of budget
+	if (elapsed > 1000)
+	{
+		elapsed = 1000;
+	}
+	link->tokens += (int32_t)((uint32_t)link->budget_bps*elapsed/1000);
+	if (link->tokens > link->budget_bps)
+	{
+		link->tokens = link->budget_bps;
+	}
+	link->last_ms = now_ms;
+	if (n_optional != 0 && link->next >= n_optional)
+	{
+		link->next = 0;
+	}
+
+	for (uint16_t k = 0; k < n_required + n_optional; k++)
+	{
+		const ble_field *field;
+		uint8_t cost = BLE_FIELD_LEN + ((count == 0 || count == BLE_FIELDS_PER_PACKET) ? BLE_FRAME_OVERHEAD + BLE_PACKET_OVERHEAD : 0);
+
+		if (k < n_required)
+		{
+			field = &fields[k];
+		}
+		else
+		{
+			uint16_t i = link->next + (k - n_required); // Rotate through the optional fields
+			if (i >= n_optional)
+			{
+				i -= n_optional;
+			}
+			if (link->tokens < cost)
+			{
+				break;
+			}
+			field = &fields[n_required + i];
+			optional_sent++;
+		}
+
+		if (count == BLE_FIELDS_PER_PACKET)
+		{
+			finish_packet(packet, count, 0, send); // Only once the next field is sure to follow
+			packets++;
+			count = 0;
+		}
+		if (count == 0)
+		{
+			packet[0] = link->seq;
+		}
+		packet[2 + count*BLE_FIELD_LEN] = field->id;
+		packet[3 + count*BLE_FIELD_LEN] = (uint8_t)field->value;
+		packet[4 + count*BLE_FIELD_LEN] = (uint8_t)(field->value >> 8);
+		count++;
+		link->tokens -= cost; // Required fields may overdraw, later cycles pay it back
+	}
+	if (count != 0)
+	{
+		finish_packet(packet, count, BLE_LAST, send);
+		packets++;
+	}
+
+	if (n_optional != 0)
+	{
+		link->next = (uint16_t)((link->next + optional_sent) % n_optional);
+	}
+	link->seq++;
+	link->packets += packets;
+	link->sent += optional_sent;
+	link->deferred += n_optional - optional_sent;
+	return(packets);
+}
+
+/* Decodes a frame, checks the packet and unpacks its fields */
+int8_t ble_unpack(const uint8_t *frame, // Bytes received between two delimiters
+                  uint8_t len, // Frame length without the delimiter
+                  uint8_t *seq, // Output, cycle sequence number
+                  uint8_t *last, // Output, 1 on the last packet of a cycle
+                  ble_field *fields // Output, BLE_FIELDS_PER_PACKET fields
+                 )
+{
+	uint8_t packet[BLE_MTU];
+	uint8_t count;
+	uint8_t sum = 0;
+	uint8_t next_zero = 0;
+
+	if (len < BLE_PACKET_OVERHEAD + 1 || len > BLE_MTU - 1)
+	{
+		return(-1);
+	}
+	for (uint8_t i = 0; i < len; i++)
+	{
+		if (frame[i] == 0 || (i == next_zero && i + frame[i] > len))
+		{
+			return(-1); // A delimiter inside the frame, or a run past its end
+		}
+		if (i == next_zero)
+		{
+			next_zero = i + frame[i];
+			if (i != 0)
+			{
+				packet[i - 1] = 0;
+			}
+		}
+		else
+		{
+			packet[i - 1] = frame[i];
+		}
+	}
+	if (next_zero != len)
+	{
+		return(-1);
+	}
+	len--;
+	count = packet[1] & (uint8_t)~BLE_LAST;
+	if (count > BLE_FIELDS_PER_PACKET || len != BLE_PACKET_OVERHEAD + count*BLE_FIELD_LEN)
+	{
+		return(-1);
+	}
+	for (uint8_t i = 0; i < len; i++)
+	{
+		sum += packet[i];
+	}
+	if (sum != 0)
+	{
+		return(-1);
+	}
+
+	*seq = packet[0];
+	*last = (packet[1] & BLE_LAST) ? 1 : 0;
+	for (uint8_t i = 0; i < count; i++)
+	{
+		fields[i].id = packet[2 + i*BLE_FIELD_LEN];
+		fields[i].value = (uint16_t)(packet[3 + i*BLE_FIELD_LEN] | (packet[4 + i*BLE_FIELD_LEN] << 8));
+	}
+	return((int8_t)count);
+}
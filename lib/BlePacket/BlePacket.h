@@ -0,0 +1,110 @@
+/*! @file
+    BLE link packetizer
+@verbatim
+  Packs telemetry fields into packets no larger than one BLE notification,
+  BLE_MTU bytes, so the UART to BLE bridge sends each packet whole instead
+  of splitting long JSON at arbitrary points. Each field is an id and a 16
+  bit value:
+
+    0     cycle sequence number, low 8 bits
+    1     field count, bit 7 set on the last packet of the cycle
+    2..   id, value low byte, value high byte, per field
+    last  checksum, the sum of every byte of the packet is 0 mod 256
+
+  The bridge is transparent, so nothing on the air marks where a packet
+  starts. Each packet is COBS encoded and ends with a 0x00 delimiter, the
+  only zero byte of the frame, which adds BLE_FRAME_OVERHEAD bytes. A
+  receiver splits the stream at every 0x00 and passes what lies between
+  to ble_unpack(). After a lost or corrupted byte it is back in step at
+  the next delimiter.
+
+  A token bucket tracks the link budget in bytes per second. Each cycle
+  the first n_required fields are always sent, even if that overdraws the
+  budget, so the app always gets fresh pack values. The other fields are
+  sent while the budget lasts, starting where the previous cycle stopped.
+  When the link cannot carry every cell each cycle, each cell is still
+  refreshed every few cycles instead of some never being sent.
+@endverbatim
+*/
+
+#ifndef BLEPACKET_H
+#define BLEPACKET_H
+
+#include <stdint.h>
+
+#ifndef BLE_MTU
+#define BLE_MTU 20 //!< Notification payload, ATT MTU 23 less 3, set with -D BLE_MTU=n
+#endif
+#define BLE_PACKET_OVERHEAD 3 //!< Sequence, count and checksum bytes
+#define BLE_FRAME_OVERHEAD 2  //!< COBS code byte and the 0x00 delimiter, packets are shorter than 254 bytes
+#define BLE_FIELD_LEN 3
+#define BLE_FIELDS_PER_PACKET ((BLE_MTU - BLE_FRAME_OVERHEAD - BLE_PACKET_OVERHEAD)/BLE_FIELD_LEN)
+#define BLE_LAST 0x80 //!< Count byte flag on the last packet of a cycle
+
+/* Field ids */
+#define BLE_PACK_VOLTAGE 1  //!< 10 mV
+#define BLE_CURRENT 2       //!< mA
+#define BLE_MIN_CELL 3      //!< Lowest cell code, 100 uV
+#define BLE_MAX_CELL 4      //!< Highest cell code, 100 uV
+#define BLE_TEMPERATURE 5   //!< 0.1 degree, C or K as set on the LTC2944 menu
+#define BLE_CHARGE 6        //!< mAh or C as set on the LTC2944 menu
+#define BLE_MIN_INDEX 7     //!< Cell number down the chain of BLE_MIN_CELL, from 1
+#define BLE_MAX_INDEX 8     //!< Cell number down the chain of BLE_MAX_CELL, from 1
+#define BLE_CELL 0x40       //!< Cell n down the chain is id BLE_CELL + n, code in 100 uV
+#define BLE_CELLS_MAX (256 - BLE_CELL)
+
+/*! One field of a packet */
+typedef struct
+{
+  uint8_t id;
+  uint16_t value; //!< Signed fields are stored two's complement
+} ble_field;
+
+/*! Link budget and counters */
+typedef struct
+{
+  uint16_t budget_bps; //!< Bytes per second the link is allowed
+  int32_t tokens;      //!< Bytes the budget allows now, negative after an overdraw
+  uint32_t last_ms;    //!< millis() of the last ble_pack()
+  uint16_t next;       //!< Optional field to start from next cycle
+  uint8_t seq;
+  uint32_t packets;    //!< Packets sent
+  uint32_t sent;       //!< Optional fields sent
+  uint32_t deferred;   //!< Optional fields left for a later cycle
+} ble_link;
+
+/*! Called with each framed packet to send, delimiter included */
+typedef void (*ble_send_fn)(const uint8_t *frame, uint8_t len);
+
+/*!
+ Sets the budget and clears the counters
+ @return void
+ */
+void ble_init(ble_link *link, //!< Link state
+              uint16_t budget_bps //!< Bytes per second the link is allowed
+             );
+
+/*!
+ Packs one cycle of fields and hands each framed packet to send
+ @return uint8_t, packets sent
+ */
+uint8_t ble_pack(ble_link *link, //!< Link state
+                 const ble_field *fields, //!< Required fields first, then optional ones
+                 uint16_t n_fields, //!< Number of fields
+                 uint16_t n_required, //!< Fields sent every cycle
+                 uint32_t now_ms, //!< millis()
+                 ble_send_fn send //!< Called with each packet
+                );
+
+/*!
+ Decodes a frame, checks the packet and unpacks its fields
+ @return int8_t, field count, or -1 if the frame or packet is malformed
+ */
+int8_t ble_unpack(const uint8_t *frame, //!< Bytes received between two delimiters
+                  uint8_t len, //!< Frame length without the delimiter
+                  uint8_t *seq, //!< Output, cycle sequence number
+                  uint8_t *last, //!< Output, 1 on the last packet of a cycle
+                  ble_field *fields //!< Output, BLE_FIELDS_PER_PACKET fields
+                 );
+
+#endif
@@ -0,0 +1,101 @@
+/*! @file
+    Triple buffered measurement snapshots
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include "BmsSnapshot.h"
+
+#ifdef LINDUINO
+#include <Arduino.h>
+#endif
+
+/* Slot indices are swapped with interrupts held off, the producer may be an ISR */
+#ifdef __AVR__
+#define SNAPSHOT_LOCK() uint8_t sreg = SREG; noInterrupts()
+#define SNAPSHOT_UNLOCK() SREG = sreg
+#else
+#define SNAPSHOT_LOCK()
+#define SNAPSHOT_UNLOCK()
+#endif
+
+/* Empties every slot */
+void snapshot_init(snapshot_buffer *buf // Slots to clear
+                  )
+{
+	memset(buf, 0, sizeof(snapshot_buffer));
+	buf->front = 0;
+	buf->back = 1;
+	buf->reading = SNAPSHOT_NONE;
+}
+
+/* Copies the measurement registers into the back slot */
+int8_t snapshot_capture(snapshot_buffer *buf, // Slots to fill
+                        uint8_t total_ic, // Number of ICs in the daisy chain
+                        const cell_asic *ic, // ICs just read
+                        uint32_t time_ms // millis() when they were read
+                       )
+{
+	bms_snapshot *snap = &buf->slot[buf->back];
+
+	if (total_ic > BMS_TOTAL_IC)
+	{
+		return(-1);
+	}
+
+	snap->time_ms = time_ms;
+	snap->total_ic = total_ic;
+	for (uint8_t current_ic = 0; current_ic < total_ic; current_ic++)
+	{
+		snap->ic[current_ic].cells = ic[current_ic].cells;
+		snap->ic[current_ic].aux = ic[current_ic].aux;
+		snap->ic[current_ic].stat = ic[current_ic].stat;
+	}
+	return(0);
+}
+
+/* Makes the back slot the newest snapshot */
+uint16_t snapshot_publish(snapshot_buffer *buf // Slots to publish from
+                         )
+{
+	uint16_t seq = ++buf->seq;
+
+	if (seq == 0) // 0 marks a slot never published
+	{
+		seq = buf->seq = 1;
+	}
+	buf->slot[buf->back].seq = seq;
+
+	SNAPSHOT_LOCK();
+	buf->front = buf->back;
+	for (uint8_t i = 0; i < SNAPSHOT_SLOTS; i++) // The one slot that is neither newest nor held
+	{
+		if (i != buf->front && i != buf->reading)
+		{
+			buf->back = i;
+			break;
+		}
+	}
+	SNAPSHOT_UNLOCK();
+	return(seq);
+}
+
+/* Holds the newest snapshot for reading */
+const bms_snapshot *snapshot_acquire(snapshot_buffer *buf // Slots to read from
+                                    )
+{
+	uint8_t slot;
+
+	SNAPSHOT_LOCK();
+	slot = buf->front;
+	buf->reading = slot;
+	SNAPSHOT_UNLOCK();
+	return(&buf->slot[slot]);
+}
+
+/* Lets the producer reuse the held slot */
+void snapshot_release(snapshot_buffer *buf // Slots read from
+                     )
+{
+	buf->reading = SNAPSHOT_NONE;
+}
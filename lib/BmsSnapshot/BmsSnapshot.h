@@ -0,0 +1,90 @@
+/*! @file
+    Triple buffered measurement snapshots
+@verbatim
+  Acquisition copies each finished cycle into a back slot and publishes it
+  with a sequence number; output code acquires the newest published slot
+  and reads from it while the next cycles are acquired. With three slots
+  the producer always has a slot that is neither the newest nor the one a
+  consumer holds, so a consumer never sees a half written cycle, however
+  slow its UART or SD output is. Publish and acquire only swap slot
+  indices with interrupts held off, so the producer may run in an ISR.
+@endverbatim
+*/
+
+#ifndef BMSSNAPSHOT_H
+#define BMSSNAPSHOT_H
+
+#include <stdint.h>
+#include "LTC681x.h"
+
+#define SNAPSHOT_SLOTS 3 //!< Newest, held by a consumer, being filled
+#define SNAPSHOT_NONE 0xFF //!< No slot held
+
+/*! Measurement registers of one IC */
+typedef struct
+{
+  cv cells;
+  ax aux;
+  st stat;
+} ic_measurement;
+
+/*! One complete measurement cycle of the daisy chain */
+typedef struct
+{
+  uint16_t seq;     //!< Publish count, 0 for a slot never published
+  uint32_t time_ms; //!< millis() when the cycle was captured
+  uint8_t total_ic; //!< ICs captured
+  ic_measurement ic[BMS_TOTAL_IC];
+} bms_snapshot;
+
+/*! Snapshot slots and which of them is newest, held and being filled */
+typedef struct
+{
+  bms_snapshot slot[SNAPSHOT_SLOTS];
+  volatile uint8_t front;   //!< Newest published slot
+  volatile uint8_t reading; //!< Slot a consumer holds, SNAPSHOT_NONE if none
+  uint8_t back;             //!< Slot the producer fills next
+  uint16_t seq;             //!< Cycles published
+} snapshot_buffer;
+
+/*!
+ Empties every slot
+ @return void
+ */
+void snapshot_init(snapshot_buffer *buf //!< Slots to clear
+                  );
+
+/*!
+ Copies the measurement registers of the daisy chain into the back slot.
+ The copy is not visible to consumers until snapshot_publish().
+ @return int8_t, 0 or -1 if total_ic is larger than the slots were built for
+ */
+int8_t snapshot_capture(snapshot_buffer *buf, //!< Slots to fill
+                        uint8_t total_ic, //!< Number of ICs in the daisy chain
+                        const cell_asic *ic, //!< ICs just read
+                        uint32_t time_ms //!< millis() when they were read
+                       );
+
+/*!
+ Makes the back slot the newest snapshot and picks the next back slot
+ @return uint16_t, sequence number of the published snapshot
+ */
+uint16_t snapshot_publish(snapshot_buffer *buf //!< Slots to publish from
+                         );
+
+/*!
+ Holds the newest snapshot for reading until the next acquire or release.
+ The producer does not touch a held slot.
+ @return const bms_snapshot *, seq is 0 if nothing has been published yet
+ */
+const bms_snapshot *snapshot_acquire(snapshot_buffer *buf //!< Slots to read from
+                                    );
+
+/*!
+ Lets the producer reuse the held slot
+ @return void
+ */
+void snapshot_release(snapshot_buffer *buf //!< Slots read from
+                     );
+
+#endif
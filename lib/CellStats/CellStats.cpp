@@ -0,0 +1,214 @@
+/*! @file
+    Cell history and running statistics
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include "CellStats.h"
+
+/* Empties the history and clears every statistic */
+void cell_stats_reset(cell_history *history // History to clear
+                     )
+{
+	memset(history, 0, sizeof(cell_history));
+}
+
+/* Folds one fresh code into a cell's statistics */
+static void cell_stats_add(cell_running *run, // Statistics of the cell
+                           uint16_t code, // Fresh cell code
+                           uint32_t time_ms, // When the code was read
+                           uint32_t *scale_dt, // dt the cached scale is for
+                           uint32_t *scale // (100000 << 8) / dt, shared by the cells read together
+                          )
+{
+	int32_t delta;
+
+	if (run->count == 0)
+	{
+		run->min = code;
+		run->max = code;
+		run->offset = code;
+		run->slope = 0;
+	}
+	else
+	{
+		uint32_t dt = time_ms - run->last_ms;
+
+		if (dt != 0)
+		{
+			if (dt != *scale_dt) // Cells read in the same cycle share one division
+			{
+				*scale_dt = dt;
+				*scale = (100000UL << 8)/dt;
+			}
+			int32_t sample = (int32_t)(((int64_t)((int32_t)code - run->last) * *scale) >> 8); // 100 uV codes per ms to uV/s
+			run->slope += (sample - run->slope) >> STATS_SLOPE_SHIFT;
+		}
+		if (code < run->min)
+		{
+			run->min = code;
+		}
+		if (code > run->max)
+		{
+			run->max = code;
+		}
+	}
+
+	if (run->count == STATS_COUNT_MAX) // Halve the sums so older cycles weigh half and nothing overflows
+	{
+		run->count >>= 1;
+		run->sum /= 2;
+		run->sum_sq >>= 1;
+	}
+	delta = (int32_t)code - run->offset;
+	run->count++;
+	run->sum += delta;
+	run->sum_sq += (uint32_t)delta*(uint32_t)delta; // Wraps to the right square for |delta| < 65536
+	run->last = code;
+	run->last_ms = time_ms;
+}
+
+/* Records a snapshot of the cells just read and updates the statistics of the fresh ones */
+int8_t cell_stats_update(cell_history *history, // History to add to
+                         uint8_t total_ic, // Number of ICs in the daisy chain
+                         cell_asic *ic, // ICs whose cells were just read
+                         uint32_t time_ms // millis() when the cells were read
+                        )
+{
+	cell_snapshot *snap = &history->ring[history->head];
+	uint8_t cells = IC_REG(ic[0], cell_channels);
+	uint32_t scale_dt = 0;
+	uint32_t scale = 0;
+
+	if (total_ic > BMS_TOTAL_IC)
+	{
+		return(-1);
+	}
+	if (cells > STATS_IC_CELLS)
+	{
+		cells = STATS_IC_CELLS;
+	}
+
+	snap->time_ms = time_ms;
+	snap->seq = history->seq++;
+	for (uint8_t current_ic = 0; current_ic < total_ic; current_ic++)
+	{
+		uint32_t stale = ic[current_ic].cells.stale;
+
+		memcpy(snap->c_codes[current_ic], ic[current_ic].cells.c_codes, cells*sizeof(uint16_t));
+		for (uint8_t cell = 0; cell < cells; cell++)
+		{
+			if (!(stale & (1UL << cell)))
+			{
+				cell_stats_add(&history->cell[current_ic][cell], ic[current_ic].cells.c_codes[cell], time_ms, &scale_dt, &scale);
+			}
+		}
+	}
+
+	history->head = (history->head + 1) % STATS_HISTORY;
+	if (history->used < STATS_HISTORY)
+	{
+		history->used++;
+	}
+	return(0);
+}
+
+/* Looks up a snapshot by age, 0 for the newest */
+const cell_snapshot *cell_stats_snapshot(const cell_history *history, // History to look in
+                                         uint8_t age // Cycles back from the newest
+                                        )
+{
+	if (age >= history->used)
+	{
+		return(NULL);
+	}
+	return(&history->ring[(history->head + STATS_HISTORY - 1 - age) % STATS_HISTORY]);
+}
+
+/* Reads back the statistics of one cell */
+int8_t cell_stats_cell(const cell_history *history, // History to read
+                       uint8_t nIC, // IC of the cell
+                       uint8_t cell, // Cell, 0 based
+                       cell_summary *summary // Statistics read back
+                      )
+{
+	const cell_running *run;
+	int32_t mean;
+	uint64_t spread;
+
+	if (nIC >= BMS_TOTAL_IC || cell >= STATS_IC_CELLS)
+	{
+		return(-1);
+	}
+	run = &history->cell[nIC][cell];
+	if (run->count == 0)
+	{
+		return(-1);
+	}
+
+	mean = run->sum >= 0 ? (run->sum + run->count/2)/run->count : -((-run->sum + run->count/2)/run->count);
+	spread = run->sum_sq - (uint64_t)((int64_t)run->sum*run->sum)/run->count; // n * variance, never negative
+	summary->min = run->min;
+	summary->max = run->max;
+	summary->mean = (uint16_t)(run->offset + mean);
+	summary->variance = (uint32_t)(spread/run->count);
+	summary->dvdt = run->slope;
+	summary->count = run->count;
+	return(0);
+}
+
+/* Combines the statistics of every cell in the pack */
+int8_t cell_stats_pack(const cell_history *history, // History to read
+                       uint8_t total_ic, // Number of ICs in the daisy chain
+                       uint8_t cells, // Cells per IC
+                       pack_summary *summary // Statistics read back
+                      )
+{
+	cell_summary one;
+	uint32_t mean_sum = 0;
+	int32_t dvdt_sum = 0;
+	uint16_t counted = 0;
+
+	if (total_ic > BMS_TOTAL_IC || cells > STATS_IC_CELLS)
+	{
+		return(-1);
+	}
+
+	for (uint8_t current_ic = 0; current_ic < total_ic; current_ic++)
+	{
+		for (uint8_t cell = 0; cell < cells; cell++)
+		{
+			if (cell_stats_cell(history, current_ic, cell, &one) != 0)
+			{
+				continue;
+			}
+			if (counted == 0 || one.min < summary->min)
+			{
+				summary->min = one.min;
+				summary->min_ic = current_ic;
+				summary->min_cell = cell;
+			}
+			if (counted == 0 || one.max > summary->max)
+			{
+				summary->max = one.max;
+				summary->max_ic = current_ic;
+				summary->max_cell = cell;
+			}
+			if (counted == 0 || one.variance > summary->variance)
+			{
+				summary->variance = one.variance;
+			}
+			mean_sum += one.mean;
+			dvdt_sum += one.dvdt;
+			counted++;
+		}
+	}
+
+	if (counted == 0)
+	{
+		return(-1);
+	}
+	summary->mean = (uint16_t)((mean_sum + counted/2)/counted);
+	summary->dvdt = dvdt_sum/counted;
+	return(0);
+}
@@ -0,0 +1,133 @@
+/*! @file
+    Cell history and running statistics
+@verbatim
+  Keeps the last STATS_HISTORY cycles of cell codes in a ring buffer and,
+  per cell, the min, max, mean, variance and a smoothed dv/dt. Every
+  statistic is updated in integer math with a fixed amount of work per
+  sample, so reading them back never re-samples the chain or walks the
+  history.
+@endverbatim
+*/
+
+#ifndef CELLSTATS_H
+#define CELLSTATS_H
+
+#include <stdint.h>
+#include "LTC681x.h"
+
+#ifndef STATS_HISTORY
+#define STATS_HISTORY 8 //!< Cycle snapshots kept in the ring buffer, set with -D STATS_HISTORY=n
+#endif
+#define STATS_COUNT_MAX 32768U //!< Samples per cell before the sums are halved, keeps the sums in range
+#define STATS_SLOPE_SHIFT 3 //!< dv/dt smoothing, each sample moves the estimate 1/8 of the way
+
+#if BMS_IC_TYPE
+#define STATS_IC_CELLS (BMS_IC_REG.cell_channels) //!< Cells kept per IC
+#else
+#define STATS_IC_CELLS 18 //!< Cells kept per IC, every c_codes entry when the part is chosen at run time
+#endif
+
+/*! Cell codes of one measurement cycle */
+typedef struct
+{
+  uint32_t time_ms; //!< millis() when the cells were read
+  uint16_t seq;     //!< Cycle number, wraps
+  uint16_t c_codes[BMS_TOTAL_IC][STATS_IC_CELLS]; //!< Cell codes, 100 uV per LSB
+} cell_snapshot;
+
+/*! Running statistics of one cell, sums are kept relative to the first code seen */
+typedef struct
+{
+  uint16_t min;      //!< Lowest code since the reset
+  uint16_t max;      //!< Highest code since the reset
+  uint16_t offset;   //!< First code seen
+  uint16_t last;     //!< Most recent fresh code
+  uint32_t last_ms;  //!< When last was read
+  uint16_t count;    //!< Samples in the sums, halved with them at STATS_COUNT_MAX
+  int32_t sum;       //!< Sum of code - offset
+  uint64_t sum_sq;   //!< Sum of (code - offset)^2
+  int32_t slope;     //!< Smoothed dv/dt, uV/s
+} cell_running;
+
+/*! Ring buffer of snapshots and the statistics of every cell */
+typedef struct
+{
+  cell_snapshot ring[STATS_HISTORY];
+  uint8_t head;      //!< Slot the next snapshot goes in
+  uint8_t used;      //!< Snapshots held, up to STATS_HISTORY
+  uint16_t seq;      //!< Cycles recorded since the reset
+  cell_running cell[BMS_TOTAL_IC][STATS_IC_CELLS];
+} cell_history;
+
+/*! Statistics of one cell as read back */
+typedef struct
+{
+  uint16_t min;      //!< 100 uV per LSB
+  uint16_t max;      //!< 100 uV per LSB
+  uint16_t mean;     //!< 100 uV per LSB, rounded
+  uint32_t variance; //!< (100 uV)^2 per LSB
+  int32_t dvdt;      //!< Smoothed dv/dt, uV/s
+  uint16_t count;    //!< Samples behind mean and variance
+} cell_summary;
+
+/*! Statistics of the whole pack as read back */
+typedef struct
+{
+  uint16_t min;      //!< Lowest cell code since the reset
+  uint16_t max;      //!< Highest cell code since the reset
+  uint8_t min_ic;    //!< IC of the lowest cell
+  uint8_t min_cell;  //!< Lowest cell, 0 based
+  uint8_t max_ic;    //!< IC of the highest cell
+  uint8_t max_cell;  //!< Highest cell, 0 based
+  uint16_t mean;     //!< Mean of the cell means, 100 uV per LSB
+  uint32_t variance; //!< Largest cell variance, (100 uV)^2 per LSB
+  int32_t dvdt;      //!< Mean of the cell dv/dt, uV/s
+} pack_summary;
+
+/*!
+ Empties the history and clears every statistic
+ @return void
+ */
+void cell_stats_reset(cell_history *history //!< History to clear
+                     );
+
+/*!
+ Records the cell codes just read as a snapshot and folds every fresh cell
+ into its statistics. Cells flagged in cells.stale keep their statistics.
+ @return int8_t, 0 or -1 if total_ic is larger than the history was built for
+ */
+int8_t cell_stats_update(cell_history *history, //!< History to add to
+                         uint8_t total_ic, //!< Number of ICs in the daisy chain
+                         cell_asic *ic, //!< ICs whose cells were just read
+                         uint32_t time_ms //!< millis() when the cells were read
+                        );
+
+/*!
+ Looks up a snapshot in the ring buffer
+ @return const cell_snapshot *, NULL if the history holds fewer than age + 1 cycles
+ */
+const cell_snapshot *cell_stats_snapshot(const cell_history *history, //!< History to look in
+                                         uint8_t age //!< 0 for the newest cycle, 1 for the one before it
+                                        );
+
+/*!
+ Reads back the statistics of one cell
+ @return int8_t, 0 or -1 if the cell has no samples yet
+ */
+int8_t cell_stats_cell(const cell_history *history, //!< History to read
+                       uint8_t nIC, //!< IC of the cell
+                       uint8_t cell, //!< Cell, 0 based
+                       cell_summary *summary //!< Statistics read back
+                      );
+
+/*!
+ Combines the statistics of every cell in the pack
+ @return int8_t, 0 or -1 if no cell has samples yet
+ */
+int8_t cell_stats_pack(const cell_history *history, //!< History to read
+                       uint8_t total_ic, //!< Number of ICs in the daisy chain
+                       uint8_t cells, //!< Cells per IC
+                       pack_summary *summary //!< Statistics read back
+                      );
+
+#endif
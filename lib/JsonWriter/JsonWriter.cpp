@@ -0,0 +1,268 @@
+/*! @file
+    Streaming JSON writer
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include "JsonWriter.h"
+
+#ifdef LINDUINO
+#include <Arduino.h>
+#endif
+
+/* Appends one byte, keeping room for the NUL */
+static void put(json_writer *w, // Writer
+                char c // Byte to add
+               )
+{
+	if (w->len + 1 >= w->size)
+	{
+		w->overflow = 1;
+		return;
+	}
+	w->buf[w->len++] = c;
+}
+
+/* Appends text held in PROGMEM */
+static void put_P(json_writer *w, // Writer
+                  const char *text // Text in PROGMEM
+                 )
+{
+	char c;
+
+	while ((c = (char)pgm_read_byte_near(text++)) != 0)
+	{
+		put(w, c);
+	}
+}
+
+/* Separates a member or array element from the one before it */
+static void separate(json_writer *w // Writer
+                    )
+{
+	uint8_t bit;
+
+	if (w->after_key)
+	{
+		w->after_key = 0;
+		return;
+	}
+	if (w->depth == 0)
+	{
+		return;
+	}
+	bit = (uint8_t)(1 << (w->depth - 1));
+	if (!(w->first & bit))
+	{
+		put(w, ',');
+	}
+	w->first &= (uint8_t)~bit;
+}
+
+/* Opens an object or array */
+static void open_level(json_writer *w, // Writer
+                       char bracket // '{' or '['
+                      )
+{
+	separate(w);
+	if (w->depth >= JSON_DEPTH_MAX)
+	{
+		w->overflow = 1;
+		return;
+	}
+	put(w, bracket);
+	w->first |= (uint8_t)(1 << w->depth);
+	if (bracket == '[')
+	{
+		w->array |= (uint8_t)(1 << w->depth);
+	}
+	w->depth++;
+}
+
+/* Starts a document */
+void json_begin(json_writer *w, // Writer
+                char *buf, // Output buffer
+                uint16_t size // Buffer size
+               )
+{
+	w->buf = buf;
+	w->size = size;
+	w->len = 0;
+	w->depth = 0;
+	w->first = 0;
+	w->array = 0;
+	w->after_key = 0;
+	w->overflow = (size == 0);
+}
+
+void json_open_object(json_writer *w // Writer
+                     )
+{
+	open_level(w, '{');
+}
+
+void json_open_array(json_writer *w // Writer
+                    )
+{
+	open_level(w, '[');
+}
+
+/* Closes the innermost level with the bracket it was opened with */
+void json_close(json_writer *w // Writer
+               )
+{
+	uint8_t bit;
+
+	if (w->depth == 0)
+	{
+		w->overflow = 1;
+		return;
+	}
+	w->depth--;
+	bit = (uint8_t)(1 << w->depth);
+	put(w, (w->array & bit) ? ']' : '}');
+	w->first &= (uint8_t)~bit;
+	w->array &= (uint8_t)~bit;
+}
+
+void json_key_P(json_writer *w, // Writer
+                const char *key // Key in PROGMEM
+               )
+{
+	separate(w);
+	put(w, '"');
+	put_P(w, key);
+	put(w, '"');
+	put(w, ':');
+	w->after_key = 1;
+}
+
+void json_key_index_P(json_writer *w, // Writer
+                      const char *prefix, // Prefix in PROGMEM
+                      uint16_t index // Number after the prefix
+                     )
+{
+	char text[FIXED_TEXT_LEN];
+
+	separate(w);
+	put(w, '"');
+	put_P(w, prefix);
+	LTC681x_format_fixed(index, 0, text);
+	for (uint8_t i = 0; text[i] != 0; i++)
+	{
+		put(w, text[i]);
+	}
+	put(w, '"');
+	put(w, ':');
+	w->after_key = 1;
+}
+
+void json_fixed(json_writer *w, // Writer
+                int32_t value, // Scaled value
+                uint8_t decimals // Digits after the decimal point
+               )
+{
+	char text[FIXED_TEXT_LEN];
+	uint8_t len = LTC681x_format_fixed(value, decimals, text);
+
+	separate(w);
+	for (uint8_t i = 0; i < len; i++)
+	{
+		put(w, text[i]);
+	}
+}
+
+/* Scales and rounds a float, then writes it as a fixed point number */
+void json_float(json_writer *w, // Writer
+                float value, // Value
+                uint8_t decimals // Digits after the decimal point
+               )
+{
+	float scaled = value;
+	int32_t whole;
+
+	for (uint8_t i = 0; i < decimals; i++)
+	{
+		scaled *= 10.0f;
+	}
+	if (!(scaled > -2147483520.0f && scaled < 2147483520.0f)) // Also catches NaN
+	{
+		separate(w);
+		put(w, 'n');
+		put(w, 'u');
+		put(w, 'l');
+		put(w, 'l');
+		return;
+	}
+	whole = (int32_t)scaled; // Toward zero, so scaled - whole is exact
+	if (scaled - whole >= 0.5f)
+	{
+		whole++;
+	}
+	else if (scaled - whole <= -0.5f)
+	{
+		whole--;
+	}
+	json_fixed(w, whole, decimals);
+}
+
+void json_string(json_writer *w, // Writer
+                 const char *text // Text in RAM
+                )
+{
+	static const char hex[] = "0123456789abcdef";
+
+	separate(w);
+	put(w, '"');
+	for (; *text != 0; text++)
+	{
+		uint8_t c = (uint8_t)*text;
+		if (c == '"' || c == '\\')
+		{
+			put(w, '\\');
+			put(w, (char)c);
+		}
+		else if (c < 0x20)
+		{
+			put(w, '\\');
+			put(w, 'u');
+			put(w, '0');
+			put(w, '0');
+			put(w, hex[c >> 4]);
+			put(w, hex[c & 0x0F]);
+		}
+		else
+		{
+			put(w, (char)c);
+		}
+	}
+	put(w, '"');
+}
+
+/* Hands over the piece written so far */
+uint16_t json_flush(json_writer *w // Writer
+                   )
+{
+	uint16_t len = w->len;
+
+	if (w->size != 0)
+	{
+		w->buf[len] = 0;
+	}
+	w->len = 0;
+	return(w->overflow ? 0 : len);
+}
+
+uint16_t json_end(json_writer *w // Writer
+                 )
+{
+	if (w->size != 0)
+	{
+		w->buf[w->len] = 0;
+	}
+	if (w->overflow || w->depth != 0 || w->after_key)
+	{
+		return(0);
+	}
+	return(w->len);
+}
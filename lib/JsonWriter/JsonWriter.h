@@ -0,0 +1,132 @@
+/*! @file
+    Streaming JSON writer
+@verbatim
+  Writes one JSON document straight into a caller's buffer, in the order
+  the calls are made. No document tree is built and nothing is allocated.
+  Keys are read from PROGMEM, and numbered keys such as "C12" are written
+  from a prefix and a number, so no String is built for them. Numbers go
+  through LTC681x_format_fixed(), so there is no floating point printing.
+
+  Commas and colons are placed by the writer. If the buffer runs out, the
+  writer stops and json_end() returns 0, so a cut off document is never
+  sent.
+
+  A document larger than any buffer can go out in pieces. json_flush()
+  hands over what was written since the last piece and carries on from
+  the start of the same buffer, keeping the nesting, so each piece only
+  needs room for itself.
+@endverbatim
+*/
+
+#ifndef JSONWRITER_H
+#define JSONWRITER_H
+
+#include <stdint.h>
+#include "LTC681x.h"
+
+#define JSON_DEPTH_MAX 8 //!< Nesting levels, one bit each in first and array
+
+/*! Writer state */
+typedef struct
+{
+  char *buf;
+  uint16_t size;      //!< Buffer size, one byte is kept for the terminating NUL
+  uint16_t len;       //!< Bytes written
+  uint8_t depth;      //!< Open objects and arrays
+  uint8_t first;      //!< Bit n set while level n has no members yet
+  uint8_t array;      //!< Bit n set when level n is an array
+  uint8_t after_key;  //!< A key was written, its value comes next
+  uint8_t overflow;   //!< The buffer ran out
+} json_writer;
+
+/*!
+ Starts a document in buf
+ @return void
+ */
+void json_begin(json_writer *w, //!< Writer
+                char *buf, //!< Output buffer
+                uint16_t size //!< Buffer size
+               );
+
+/*!
+ Opens an object, as a value or at the top level
+ @return void
+ */
+void json_open_object(json_writer *w //!< Writer
+                     );
+
+/*!
+ Opens an array, as a value or at the top level
+ @return void
+ */
+void json_open_array(json_writer *w //!< Writer
+                    );
+
+/*!
+ Closes the innermost object or array
+ @return void
+ */
+void json_close(json_writer *w //!< Writer
+               );
+
+/*!
+ Writes a member key
+ @return void
+ */
+void json_key_P(json_writer *w, //!< Writer
+                const char *key //!< Key in PROGMEM, not escaped
+               );
+
+/*!
+ Writes a member key made of a prefix and a number, e.g. "C" and 12 give "C12"
+ @return void
+ */
+void json_key_index_P(json_writer *w, //!< Writer
+                      const char *prefix, //!< Prefix in PROGMEM, not escaped
+                      uint16_t index //!< Number after the prefix
+                     );
+
+/*!
+ Writes value / 10^decimals as a number
+ @return void
+ */
+void json_fixed(json_writer *w, //!< Writer
+                int32_t value, //!< Scaled value
+                uint8_t decimals //!< Digits after the decimal point
+               );
+
+/*!
+ Writes a float as a number, rounded to decimals places. A float holds
+ about 7 significant digits, so a large value with many decimals ends in
+ noise, as it does with Serial.print().
+ @return void
+ */
+void json_float(json_writer *w, //!< Writer
+                float value, //!< Value, written as null if it does not fit in 32 bits once scaled
+                uint8_t decimals //!< Digits after the decimal point, at most 9
+               );
+
+/*!
+ Writes a string value, escaping quotes, backslashes and control characters
+ @return void
+ */
+void json_string(json_writer *w, //!< Writer
+                 const char *text //!< NUL terminated text in RAM
+                );
+
+/*!
+ Ends a piece of the document and NUL terminates it. The next piece is
+ written from the start of the buffer.
+ @return uint16_t, piece length, 0 if the buffer ran out
+ */
+uint16_t json_flush(json_writer *w //!< Writer
+                   );
+
+/*!
+ Ends the document and NUL terminates it
+ @return uint16_t, document length, or that of the last piece after json_flush(), 0 if the buffer ran out or a level is still open
+ */
+uint16_t json_end(json_writer *w //!< Writer
+                 );
+
+#endif
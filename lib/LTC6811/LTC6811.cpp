@@ -62,11 +62,16 @@
 #include "LTC681x.h"
 #include "LTC6811.h"
 
-/* Initialize the Register limits */
+#if BMS_IC_TYPE != 0 && BMS_IC_TYPE != 6811
+#error "The LTC6811 wrappers need BMS_IC_TYPE 6811 or 0"
+#endif
+
+/* Initialize the Register limits, already fixed at compile time when BMS_IC_TYPE is 6811 */
 void LTC6811_init_reg_limits(uint8_t total_ic, //The number of ICs in the system
 							cell_asic *ic  //A two dimensional array where data will be written
 							)
 {
+#if BMS_IC_TYPE == 0
   for (uint8_t cic=0; cic<total_ic; cic++)
   {
     ic[cic].ic_reg.cell_channels=12;
@@ -76,6 +81,7 @@ void LTC6811_init_reg_limits(uint8_t total_ic, //The number of ICs in the system
     ic[cic].ic_reg.num_gpio_reg=2;
     ic[cic].ic_reg.num_stat_reg=3;
   }
+#endif
 }
 
 /*
@@ -156,6 +162,37 @@ uint8_t LTC6811_rdcv(uint8_t reg, // Controls which cell voltage register is rea
   return(pec_error);
 }
 
+/* Reads back only the cell voltage registers holding cells converted with channel selection CH */
+int8_t LTC6811_rdcv_ch(uint8_t CH, // Cell channel selection used for the conversion
+                       uint8_t total_ic, // The number of ICs in the system
+                       cell_asic *ic // Array of the parsed cell codes
+                      )
+{
+  return(LTC681x_rdcv_ch(CH,total_ic,ic));
+}
+
+/* Queues the readback of all LTC6811 cell voltage registers on the SPI engine */
+int8_t LTC6811_rdcv_start(uint8_t total_ic, // The number of ICs in the system
+                          cell_asic *ic // Array of the parsed cell codes
+                         )
+{
+  return(LTC681x_rdcv_start(total_ic,ic));
+}
+
+/* Checks a readback started by LTC6811_rdcv_start() */
+uint8_t LTC6811_rdcv_busy()
+{
+  return(LTC681x_rdcv_busy());
+}
+
+/* Waits for the readback started by LTC6811_rdcv_start() and parses the cell codes */
+int8_t LTC6811_rdcv_finish(uint8_t total_ic, // The number of ICs in the system
+                           cell_asic *ic // Array of the parsed cell codes
+                          )
+{
+  return(LTC681x_rdcv_finish(total_ic,ic));
+}
+
 /*
 The function is used to read the  parsed GPIO codes of the LTC6811. 
 This function will send the requested read commands parse the data 
@@ -199,6 +236,93 @@ uint32_t LTC6811_pollAdc()
   return(LTC681x_pollAdc());
 }
 
+/* Starts a cell voltage conversion without waiting for it */
+void LTC6811_adcv_start(uint8_t MD, //ADC Mode
+                        uint8_t DCP, //Discharge Permit
+                        uint8_t CH, //Cell Channels to be measured
+                        bool adcopt, //ADCOPT bit in the configuration register
+                        adc_conversion *conv //Conversion handle
+                       )
+{
+  LTC681x_adcv_start(MD,DCP,CH,adcopt,conv);
+}
+
+/* Starts a GPIO conversion without waiting for it */
+void LTC6811_adax_start(uint8_t MD, //ADC Mode
+                        uint8_t CHG, //GPIO Channels to be measured
+                        bool adcopt, //ADCOPT bit in the configuration register
+                        adc_conversion *conv //Conversion handle
+                       )
+{
+  LTC681x_adax_start(MD,CHG,adcopt,conv);
+}
+
+/* Starts a status group conversion without waiting for it */
+void LTC6811_adstat_start(uint8_t MD, //ADC Mode
+                          uint8_t CHST, //Stat Channels to be measured
+                          bool adcopt, //ADCOPT bit in the configuration register
+                          adc_conversion *conv //Conversion handle
+                         )
+{
+  LTC681x_adstat_start(MD,CHST,adcopt,conv);
+}
+
+/* Checks a conversion without blocking */
+uint8_t LTC6811_conv_poll(uint8_t total_ic, //Number of ICs in the daisy chain
+                          adc_conversion *conv //Conversion to check
+                         )
+{
+  return(LTC681x_conv_poll(total_ic,conv));
+}
+
+/* Waits for a conversion, running idle_task while the ADC converts */
+uint32_t LTC6811_conv_wait(uint8_t total_ic, //Number of ICs in the daisy chain
+                           adc_conversion *conv, //Conversion to wait for
+                           void (*idle_task)(void) //Work to run while waiting
+                          )
+{
+  return(LTC681x_conv_wait(total_ic,conv,idle_task));
+}
+
+/* Runs a measurement plan of conversions and register reads back to back */
+int8_t LTC6811_run_plan(uint8_t total_ic, //Number of ICs in the daisy chain
+                        cell_asic *ic, //A two dimensional array that will store the data
+                        meas_plan *plan //Plan to run
+                       )
+{
+  return(LTC681x_run_plan(total_ic,ic,plan));
+}
+
+/* Sets up a daisy chain of LTC6811s on its own chip select */
+void LTC6811_chain_init(bms_chain *chain, // Chain to set up
+                        uint8_t cs_pin, // Chip select of the chain
+                        uint8_t total_ic, // Number of ICs in the chain
+                        cell_asic *ic // The chain's ICs
+                       )
+{
+  LTC681x_chain_init(chain,cs_pin,total_ic,ic);
+}
+
+/* Points the driver at a daisy chain */
+void LTC6811_chain_select(bms_chain *chain // Chain to talk to
+                         )
+{
+  LTC681x_chain_select(chain);
+}
+
+/* Converts the cells of several daisy chains at once and reads each back in turn */
+int8_t LTC6811_chains_rdcv(bms_chain *chains, // Chains to measure
+                           uint8_t count, // Number of chains
+                           uint8_t MD, // ADC Mode
+                           uint8_t DCP, // Discharge Permit
+                           uint8_t CH, // Cell Channels to be measured
+                           bool adcopt, // The adcopt bit in the configuration register
+                           void (*idle_task)(void) // Work to run while a conversion is pending
+                          )
+{
+  return(LTC681x_chains_rdcv(chains,count,MD,DCP,CH,adcopt,idle_task));
+}
+
 /*
 The command clears the cell voltage registers and initializes all values to 1. 
 The register will read back hexadecimal 0xFF after the command is sent.
@@ -471,6 +595,57 @@ void LTC6811_reset_crc_count(uint8_t total_ic, //Number of ICs in the system
   LTC681x_reset_crc_count(total_ic,ic);
 }
 
+/* Sets how many times a register group that fails the PEC check is read again */
+void LTC6811_set_read_retries(uint8_t retries // Retries per register read
+                             )
+{
+  LTC681x_set_read_retries(retries);
+}
+
+/* Returns the register read retry counters */
+const retry_counter *LTC6811_retry_stats()
+{
+  return(LTC681x_retry_stats());
+}
+
+/* Clears the register read retry counters */
+void LTC6811_reset_retry_stats()
+{
+  LTC681x_reset_retry_stats();
+}
+
+/* Hands every IC without one a COMM, PWM, S control and CFGRB register shadow */
+int8_t LTC6811_claim_shadows(uint8_t total_ic, //Number of ICs in the system
+                             cell_asic *ic //A two dimensional array that will store the data
+                            )
+{
+  return(LTC681x_claim_shadows(total_ic,ic));
+}
+
+/* Works out the RAM a chain of total_ic ICs takes */
+uint16_t LTC6811_ram_budget(uint8_t total_ic, //Number of ICs
+                            uint8_t shadow_ic //ICs given register shadows
+                           )
+{
+  return(LTC681x_ram_budget(total_ic,shadow_ic));
+}
+
+/* Writes value / 10^decimals as decimal text without floating point */
+uint8_t LTC6811_format_fixed(int32_t value, //Scaled integer to print
+                             uint8_t decimals, //Digits after the decimal point
+                             char *buf //Text output
+                            )
+{
+  return(LTC681x_format_fixed(value,decimals,buf));
+}
+
+/* Converts the internal die temperature code to 0.01 degC */
+int32_t LTC6811_die_temp(uint16_t itmp //Internal die temperature code
+                        )
+{
+  return(LTC681x_die_temp(itmp));
+}
+
 /* Helper function to initialize CFG variables.*/
 void LTC6811_init_cfg(uint8_t total_ic, //Number of ICs in the system
 					  cell_asic *ic //A two dimensional array that will store the data
@@ -140,6 +140,41 @@ uint8_t LTC6811_rdcv(uint8_t reg, //!< Controls which cell voltage register is r
                      uint8_t total_ic, //!< The number of ICs in the daisy chain
                      cell_asic *ic //!< Array of the parsed cell codes from lowest to highest.
                     );				  
+
+/*!
+ Reads back only the LTC6811 cell voltage registers holding cells converted with channel selection CH
+ @return int8_t, PEC Status.
+  0: No PEC error detected
+ -1: PEC error detected, retry read
+ */
+int8_t LTC6811_rdcv_ch(uint8_t CH, //!< Cell channel selection used for the conversion
+                       uint8_t total_ic, //!< The number of ICs in the daisy chain
+                       cell_asic *ic //!< Array of the parsed cell codes from lowest to highest.
+                      );
+
+/*!
+ Queues the readback of all LTC6811 cell voltage registers on the interrupt driven SPI engine
+ @return int8_t, 0 when queued, -1 if a readback is already running
+ */
+int8_t LTC6811_rdcv_start(uint8_t total_ic, //!< The number of ICs in the daisy chain
+                          cell_asic *ic //!< Array of the parsed cell codes
+                         );
+
+/*!
+ Checks a readback started by LTC6811_rdcv_start() without blocking
+ @return uint8_t, 1 while the registers are still being read
+ */
+uint8_t LTC6811_rdcv_busy();
+
+/*!
+ Waits for the readback started by LTC6811_rdcv_start() and parses the cell codes
+ @return int8_t, PEC Status.
+  0: No PEC error detected
+ >0: Number of register groups that failed the PEC check
+ */
+int8_t LTC6811_rdcv_finish(uint8_t total_ic, //!< The number of ICs in the daisy chain
+                           cell_asic *ic //!< Array of the parsed cell codes from lowest to highest.
+                          );
 				  
 /*!
  Reads and parses the LTC6811 auxiliary registers.
@@ -174,6 +209,97 @@ uint8_t LTC6811_pladc();
   @returns uint32_t, the approximate time it took for the ADC function to complete. 
   */
 uint32_t LTC6811_pollAdc();						 
+
+/*!
+ Starts a cell voltage conversion without waiting for it
+ @return void
+ */
+void LTC6811_adcv_start(uint8_t MD, //!< ADC Conversion Mode
+                        uint8_t DCP, //!< Controls if Discharge is permitted during conversion
+                        uint8_t CH, //!< Sets which Cell channels are converted
+                        bool adcopt, //!< The adcopt bit in the configuration register
+                        adc_conversion *conv //!< Conversion handle filled in by the function
+                       );
+
+/*!
+ Starts a GPIO conversion without waiting for it
+ @return void
+ */
+void LTC6811_adax_start(uint8_t MD, //!< ADC Conversion Mode
+                        uint8_t CHG, //!< Sets which GPIO channels are converted
+                        bool adcopt, //!< The adcopt bit in the configuration register
+                        adc_conversion *conv //!< Conversion handle filled in by the function
+                       );
+
+/*!
+ Starts a status group conversion without waiting for it
+ @return void
+ */
+void LTC6811_adstat_start(uint8_t MD, //!< ADC Conversion Mode
+                          uint8_t CHST, //!< Sets which Stat channels are converted
+                          bool adcopt, //!< The adcopt bit in the configuration register
+                          adc_conversion *conv //!< Conversion handle filled in by the function
+                         );
+
+/*!
+ Checks a conversion without blocking and calls its on_complete when it finishes
+ @return uint8_t, 1 when the conversion is complete, 0 while it is still running
+ */
+uint8_t LTC6811_conv_poll(uint8_t total_ic, //!< Number of ICs in the daisy chain
+                          adc_conversion *conv //!< Conversion to check
+                         );
+
+/*!
+ Waits for a conversion, running idle_task while the ADC converts
+ @return uint32_t, microseconds from the conversion command to completion
+ */
+uint32_t LTC6811_conv_wait(uint8_t total_ic, //!< Number of ICs in the daisy chain
+                           adc_conversion *conv, //!< Conversion to wait for
+                           void (*idle_task)(void) //!< Work to run while waiting, NULL to sleep until the expected completion time
+                          );
+
+/*!
+ Runs a measurement plan of conversions and register reads back to back
+ @return int8_t, PEC Status.
+  0: No PEC error detected
+ -1: PEC error detected in at least one read step
+ */
+int8_t LTC6811_run_plan(uint8_t total_ic, //!< Number of ICs in the daisy chain
+                        cell_asic *ic, //!< A two dimensional array that will store the data
+                        meas_plan *plan //!< Plan to run
+                       );
+
+/*!
+ Sets up a daisy chain of LTC6811s on its own chip select
+ @return void
+ */
+void LTC6811_chain_init(bms_chain *chain, //!< Chain to set up
+                        uint8_t cs_pin, //!< Chip select of the chain, already an output held high
+                        uint8_t total_ic, //!< Number of ICs in the chain
+                        cell_asic *ic //!< The chain's ICs
+                       );
+
+/*!
+ Points the driver at a daisy chain, later calls talk to its chip select
+ @return void
+ */
+void LTC6811_chain_select(bms_chain *chain //!< Chain to talk to
+                         );
+
+/*!
+ Converts the cells of several daisy chains at once and reads each back in turn
+ @return int8_t, PEC Status.
+  0: No PEC error detected
+ -1: PEC error detected on at least one chain
+ */
+int8_t LTC6811_chains_rdcv(bms_chain *chains, //!< Chains to measure
+                           uint8_t count, //!< Number of chains
+                           uint8_t MD, //!< ADC Mode
+                           uint8_t DCP, //!< Discharge Permit
+                           uint8_t CH, //!< Cell Channels to be measured
+                           bool adcopt, //!< The adcopt bit in the configuration register
+                           void (*idle_task)(void) //!< Work to run while a conversion is pending, NULL to sleep
+                          );
 	
 /*!
  Clears the LTC6811 cell voltage registers
@@ -420,6 +546,58 @@ void LTC6811_reset_crc_count(uint8_t total_ic, //!< Number of ICs in the system
                              cell_asic *ic //!< A two dimensional array that will store the data
 							 );
 
+/*!
+ Sets how many times a register group that fails the PEC check is read again before the error is reported
+ @return void
+ */
+void LTC6811_set_read_retries(uint8_t retries //!< Retries per register read, 0 to READ_RETRY_MAX
+                             );
+
+/*!
+ Returns the register read retry counters
+ @return const retry_counter*, counters for the whole daisy chain
+ */
+const retry_counter *LTC6811_retry_stats();
+
+/*!
+ Clears the register read retry counters
+ @return void
+ */
+void LTC6811_reset_retry_stats();
+
+/*!
+ Hands every IC without one a COMM, PWM, S control and CFGRB register shadow.
+ Call it before filling in those shadows by hand.
+ @return int8_t, 0 when every IC has a shadow, -1 if the BMS_SHADOW_IC pool ran out
+ */
+int8_t LTC6811_claim_shadows(uint8_t total_ic, //!< Number of ICs in the system
+                             cell_asic *ic //!< A two dimensional array that will store the data
+                            );
+
+/*!
+ Works out the RAM a chain of total_ic ICs takes, see LTC681x_ram_budget()
+ @return uint16_t, bytes
+ */
+uint16_t LTC6811_ram_budget(uint8_t total_ic, //!< Number of ICs
+                            uint8_t shadow_ic //!< ICs given register shadows
+                           );
+
+/*!
+ Writes value / 10^decimals as decimal text without floating point, see LTC681x_format_fixed()
+ @return uint8_t, characters written
+ */
+uint8_t LTC6811_format_fixed(int32_t value, //!< Scaled integer to print
+                             uint8_t decimals, //!< Digits after the decimal point
+                             char *buf //!< Text output, FIXED_TEXT_LEN bytes
+                            );
+
+/*!
+ Converts the internal die temperature code with integer math
+ @return int32_t, die temperature in 0.01 degC
+ */
+int32_t LTC6811_die_temp(uint16_t itmp //!< Internal die temperature code, stat_codes[1]
+                        );
+
 /*!
  Helper Function to initialize the CFGR data structures
  @return void 
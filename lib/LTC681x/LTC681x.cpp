@@ -43,6 +43,7 @@
 */
 
 #include <stdint.h>
+#include <string.h>
 #include "LTC681x.h"
 #include "bms_hardware.h"
 
@@ -50,27 +51,266 @@
 #include <Arduino.h>
 #endif
 
+/*
+Frame buffer shared by every register write and read: 4 command bytes followed by
+6 data and 2 PEC bytes per IC. Sized for BMS_TOTAL_IC at compile time so the
+transport never touches the heap. Only one transfer uses it at a time.
+*/
+static uint8_t spi_frame[BMS_FRAME_LEN];
+static uint8_t *const rx_frame = &spi_frame[4];
+
+/* RDCVA..RDCVF command codes, CMD0 is 0x00 for all of them, and their PECs */
+#define CV_REG_CELLS 0x07UL // Cells of one cell voltage register group, shifted by 3 per group
+static const uint8_t rdcv_code[MAX_CV_REG] = {0x04, 0x06, 0x08, 0x0A, 0x09, 0x0B};
+static const uint16_t rdcv_pec[MAX_CV_REG] = {PEC15_CMD(0x00, 0x04), PEC15_CMD(0x00, 0x06), PEC15_CMD(0x00, 0x08),
+                                              PEC15_CMD(0x00, 0x0A), PEC15_CMD(0x00, 0x09), PEC15_CMD(0x00, 0x0B)};
+
+/*
+Commands, receive buffers and SPI engine transactions for LTC681x_rdcv_start(),
+one per cell voltage register group so the whole readback can be queued at once.
+*/
+static uint8_t cv_cmd[BMS_CV_REG][4];
+static uint8_t cv_frame[BMS_CV_REG][NUM_RX_BYT*BMS_TOTAL_IC];
+static spi_transaction cv_trans[BMS_CV_REG];
+static uint8_t cv_groups = 0;
+
+/*
+Wake state of the daisy chain as seen by the driver. Any frame keeps the
+isoSPI ports READY for tIDLE and any valid command keeps the cores out of
+SLEEP for tSLEEP, so the wakeup functions only pulse CS once those may have
+run out. The counts are the ICs known to be READY/awake, 0 when unknown.
+*/
+static volatile uint8_t isospi_ready_ic = 0;
+static volatile uint8_t isospi_awake_ic = 0;
+static volatile uint32_t isospi_frame_us = 0;
+static volatile uint32_t isospi_cmd_us = 0;
+
+/*
+COMM, PWM, S control and CFGRB shadows. Only ICs that use those registers
+take one, the measurement loop never does.
+*/
+#if BMS_SHADOW_IC > 0
+static ic_shadow shadow_pool[BMS_SHADOW_IC];
+#endif
+static uint8_t shadow_used = 0;
+
+/* Chip select of the chain the driver talks to, and that chain when one was selected */
+static uint8_t chain_cs = CS_PIN;
+static bms_chain *chain_sel = NULL;
+
+/*
+Register reads that fail a PEC check are repeated up to read_retries times,
+re-reading only the register group that failed. retry_stats counts them.
+*/
+static uint8_t read_retries = 0;
+static retry_counter retry_stats;
+
+/* Drops whatever part of the wake state may have timed out by now */
+static void isospi_expire()
+{
+	uint32_t now;
+
+	spi_wait_idle(); // a queued readback updates the timestamps from the SPI interrupt
+	now = micros();
+
+	if ((uint32_t)(now - isospi_frame_us) >= ISOSPI_IDLE_US)
+	{
+		isospi_ready_ic = 0;
+	}
+	if ((uint32_t)(now - isospi_cmd_us) >= ISOSPI_SLEEP_US)
+	{
+		isospi_awake_ic = 0;
+		isospi_ready_ic = 0;
+	}
+}
+
+/* Notes a command frame that has just finished, it restarts both timers on every READY IC */
+static void isospi_traffic()
+{
+	if (isospi_ready_ic != 0)
+	{
+		isospi_frame_us = micros();
+		isospi_cmd_us = isospi_frame_us;
+	}
+}
+
+/* Starts a command frame */
+static void isospi_cs_low()
+{
+	isospi_expire();
+	cs_low(chain_cs);
+}
+
+/* Ends a command frame */
+static void isospi_cs_high()
+{
+	cs_high(chain_cs);
+	isospi_traffic();
+}
+
 /* Wake isoSPI up from IDlE state and enters the READY state */
 void wakeup_idle(uint8_t total_ic) //Number of ICs in the system
 {
+	isospi_expire();
+	if (isospi_ready_ic >= total_ic)
+	{
+		return; // Traffic within tIDLE has kept every port READY
+	}
+
 	for (int i =0; i<total_ic; i++)
 	{
-	   cs_low(CS_PIN);
+	   cs_low(chain_cs);
 	   spi_read_byte(0xff);//Guarantees the isoSPI will be in ready mode
-	   cs_high(CS_PIN);
+	   cs_high(chain_cs);
+	}
+
+	if (isospi_awake_ic >= total_ic)
+	{
+		isospi_ready_ic = total_ic;
+		isospi_frame_us = micros();
 	}
 }
 
 /* Generic wakeup command to wake the LTC681x from sleep state */
 void wakeup_sleep(uint8_t total_ic) //Number of ICs in the system
 {
+	isospi_expire();
+	if (isospi_awake_ic >= total_ic)
+	{
+		wakeup_idle(total_ic); // A command within tSLEEP has kept every core out of SLEEP
+		return;
+	}
+
 	for (int i =0; i<total_ic; i++)
 	{
-	   cs_low(CS_PIN);
+	   cs_low(chain_cs);
 	   delay_u(300); // Guarantees the LTC681x will be in standby
-	   cs_high(CS_PIN);
+	   cs_high(chain_cs);
 	   delay_u(10);
 	}
+
+	isospi_awake_ic = total_ic;
+	isospi_ready_ic = total_ic;
+	isospi_frame_us = micros();
+	isospi_cmd_us = isospi_frame_us;
+}
+
+/* Forgets the tracked wake state so the next wakeup_idle() or wakeup_sleep() sends its pulses */
+void LTC681x_isospi_reset()
+{
+	isospi_ready_ic = 0;
+	isospi_awake_ic = 0;
+}
+
+/* Hands every IC without one a register shadow from the pool */
+int8_t LTC681x_claim_shadows(uint8_t total_ic, // Number of ICs in the daisy chain
+							 cell_asic *ic // A two dimensional array that will store the data
+							)
+{
+	for (uint8_t current_ic = 0; current_ic < total_ic; current_ic++)
+	{
+		if (ic[current_ic].shadow != NULL)
+		{
+			continue;
+		}
+#if BMS_SHADOW_IC > 0
+		if (shadow_used < BMS_SHADOW_IC)
+		{
+			ic[current_ic].shadow = &shadow_pool[shadow_used++];
+			continue;
+		}
+#endif
+		return(-1);
+	}
+	return(0);
+}
+
+/* Works out the RAM a chain of total_ic ICs takes with shadow_ic register shadows */
+uint16_t LTC681x_ram_budget(uint8_t total_ic, // Number of ICs
+							uint8_t shadow_ic // ICs given register shadows
+						   )
+{
+	uint16_t bytes = total_ic*sizeof(cell_asic) + shadow_ic*sizeof(ic_shadow);
+	
+	bytes += 4 + NUM_RX_BYT*total_ic; // spi_frame
+	bytes += BMS_CV_REG*(4 + NUM_RX_BYT*total_ic + sizeof(spi_transaction)); // queued readback, cv_cmd, cv_frame and cv_trans
+	return(bytes);
+}
+
+/* Sets up a daisy chain on its own chip select */
+void LTC681x_chain_init(bms_chain *chain, // Chain to set up
+						uint8_t cs_pin, // Chip select of the chain
+						uint8_t total_ic, // Number of ICs in the chain
+						cell_asic *ic // The chain's ICs
+					   )
+{
+	memset(chain, 0, sizeof(bms_chain));
+	chain->cs_pin = cs_pin;
+	chain->total_ic = total_ic;
+	chain->ic = ic;
+}
+
+/* Points the driver at a daisy chain, swapping the wake state of the old and new chain */
+void LTC681x_chain_select(bms_chain *chain // Chain to talk to
+						 )
+{
+	spi_wait_idle(); // Queued frames belong to the chain selected now
+	if (chain == chain_sel)
+	{
+		return;
+	}
+	if (chain_sel != NULL)
+	{
+		chain_sel->ready_ic = isospi_ready_ic;
+		chain_sel->awake_ic = isospi_awake_ic;
+		chain_sel->frame_us = isospi_frame_us;
+		chain_sel->cmd_us = isospi_cmd_us;
+	}
+	isospi_ready_ic = chain->ready_ic;
+	isospi_awake_ic = chain->awake_ic;
+	isospi_frame_us = chain->frame_us;
+	isospi_cmd_us = chain->cmd_us;
+	chain_cs = chain->cs_pin;
+	chain_sel = chain;
+}
+
+/* Converts the cells of every chain and reads each back while the later ones still convert */
+int8_t LTC681x_chains_rdcv(bms_chain *chains, // Chains to measure
+						   uint8_t count, // Number of chains
+						   uint8_t MD, // ADC Mode
+						   uint8_t DCP, // Discharge Permit
+						   uint8_t CH, // Cell Channels to be measured
+						   bool adcopt, // The adcopt bit in the configuration register
+						   void (*idle_task)(void) // Work to run while a conversion is pending
+						  )
+{
+	int8_t pec_error = 0;
+
+	for (uint8_t i = 0; i < count; i++)
+	{
+		if (chains[i].total_ic > BMS_TOTAL_IC)
+		{
+			return(-1);
+		}
+	}
+
+	for (uint8_t i = 0; i < count; i++) // Only a command per chain, every chain converts at once
+	{
+		LTC681x_chain_select(&chains[i]);
+		wakeup_sleep(chains[i].total_ic);
+		LTC681x_adcv_start(MD, DCP, CH, adcopt, &chains[i].conv);
+	}
+	for (uint8_t i = 0; i < count; i++)
+	{
+		LTC681x_chain_select(&chains[i]);
+		LTC681x_conv_wait(chains[i].total_ic, &chains[i].conv, idle_task);
+		wakeup_idle(chains[i].total_ic);
+		if (LTC681x_rdcv_ch(CH, chains[i].total_ic, chains[i].ic) != 0)
+		{
+			pec_error = -1;
+		}
+	}
+	return(pec_error);
 }
 
 /* Generic function to write 68xx commands. Function calculates PEC for tx_cmd data. */
@@ -86,9 +326,9 @@ void cmd_68(uint8_t tx_cmd[2]) //The command to be transmitted
 	cmd[2] = (uint8_t)(cmd_pec >> 8);
 	cmd[3] = (uint8_t)(cmd_pec);
 	
-	cs_low(CS_PIN);
+	isospi_cs_low();
 	spi_write_array(4,cmd);
-	cs_high(CS_PIN);
+	isospi_cs_high();
 }
 
 /* 
@@ -102,12 +342,16 @@ void write_68(uint8_t total_ic, //Number of ICs to be written to
 {
 	const uint8_t BYTES_IN_REG = 6;
 	const uint8_t CMD_LEN = 4+(8*total_ic);
-	uint8_t *cmd;
+	uint8_t *cmd = spi_frame;
 	uint16_t data_pec;
 	uint16_t cmd_pec;
 	uint8_t cmd_index;
 	
-	cmd = (uint8_t *)malloc(CMD_LEN*sizeof(uint8_t));
+	if (total_ic > BMS_TOTAL_IC)
+	{
+		return;
+	}
+	
 	cmd[0] = tx_cmd[0];
 	cmd[1] = tx_cmd[1];
 	cmd_pec = pec15_calc(2, cmd);
@@ -129,11 +373,39 @@ void write_68(uint8_t total_ic, //Number of ICs to be written to
 		cmd_index = cmd_index + 2;
 	}
 	
-	cs_low(CS_PIN);
+	isospi_cs_low();
 	spi_write_array(CMD_LEN, cmd);
-	cs_high(CS_PIN);
-	
-	free(cmd);
+	isospi_cs_high();
+}
+
+/*
+Decides whether a register read that just finished is tried again. Counts the
+retry against the register group, or the final outcome of a read that needed
+retries.
+*/
+static uint8_t retry_needed(int8_t pec_error, // PEC status of the attempt
+							uint8_t attempt, // Retries already made, 0 for the first read
+							uint16_t *group_retry // Retry counter of the register group
+						   )
+{
+	if (pec_error == 0)
+	{
+		if (attempt != 0)
+		{
+			retry_stats.recovered++;
+		}
+		return(0);
+	}
+	if (attempt >= read_retries)
+	{
+		if (read_retries != 0)
+		{
+			retry_stats.failed++;
+		}
+		return(0);
+	}
+	(*group_retry)++;
+	return(1);
 }
 
 /* Generic function to write 68xx commands and read data. Function calculated PEC for tx_cmd data */
@@ -144,60 +416,131 @@ int8_t read_68( uint8_t total_ic, // Number of ICs in the system
 {
 	const uint8_t BYTES_IN_REG = 8;
 	uint8_t cmd[4];
-	uint8_t data[256];
 	int8_t pec_error = 0;
 	uint16_t cmd_pec;
 	uint16_t data_pec;
 	uint16_t received_pec;
 	
+	if (total_ic > BMS_TOTAL_IC)
+	{
+		return(-1);
+	}
+	
 	cmd[0] = tx_cmd[0];
 	cmd[1] = tx_cmd[1];
 	cmd_pec = pec15_calc(2, cmd);
 	cmd[2] = (uint8_t)(cmd_pec >> 8);
 	cmd[3] = (uint8_t)(cmd_pec);
 	
-	cs_low(CS_PIN);
-	spi_write_read(cmd, 4, data, (BYTES_IN_REG*total_ic));         //Transmits the command and reads the configuration data of all ICs on the daisy chain into rx_data[] array
-	cs_high(CS_PIN);                                         
+	for (uint8_t attempt = 0; ; attempt++)
+	{
+		isospi_cs_low();
+		spi_write_read(cmd, 4, rx_data, (BYTES_IN_REG*total_ic));      //Transmits the command and reads the register data of all ICs on the daisy chain straight into rx_data[]
+		isospi_cs_high();                                         
 
-	for (uint8_t current_ic = 0; current_ic < total_ic; current_ic++) //Executes for each LTC681x in the daisy chain and packs the data
-	{																//into the rx_data array as well as check the received data for any bit errors
-		for (uint8_t current_byte = 0; current_byte < BYTES_IN_REG; current_byte++)
+		pec_error = 0;
+		for (uint8_t current_ic = 0; current_ic < total_ic; current_ic++) //Executes for each LTC681x in the daisy chain and checks the received data for any bit errors
 		{
-			rx_data[(current_ic*8)+current_byte] = data[current_byte + (current_ic*BYTES_IN_REG)];
+			received_pec = (rx_data[(current_ic*8)+6]<<8) + rx_data[(current_ic*8)+7];
+			data_pec = pec15_calc(6, &rx_data[current_ic*8]);
+			
+			if (received_pec != data_pec)
+			{
+			  LTC681x_isospi_reset();
+			  pec_error = -1;
+			}
 		}
-		
-		received_pec = (rx_data[(current_ic*8)+6]<<8) + rx_data[(current_ic*8)+7];
-		data_pec = pec15_calc(6, &rx_data[current_ic*8]);
-		
-		if (received_pec != data_pec)
+		if (!retry_needed(pec_error, attempt, &retry_stats.other_retry))
 		{
-		  pec_error = -1;
+			break;
 		}
+		wakeup_idle(total_ic);
 	}
 	
 	return(pec_error);
 }
 
-/* Calculates  and returns the CRC15 */
-uint16_t pec15_calc(uint8_t len, //Number of bytes that will be used to calculate a PEC
-                    uint8_t *data //Array of data that will be used to calculate  a PEC
-                   )
+/*
+Second table for pec15_update_block(): crc15Table2[x] is the remainder after
+the byte x and then a zero byte have been folded into a zero remainder. With it
+two data bytes cost two table lookups and no dependent shift between them.
+*/
+#ifdef MBED
+static const uint16_t crc15Table2[256] =
+#else
+static const uint16_t crc15Table2[256] PROGMEM =
+#endif
+{
+	0x0, 0xc426, 0x4dd5, 0x89f3, 0x5e33, 0x9a15, 0x13e6, 0xd7c0, 0xf9ff, 0x3dd9, 0xb42a,
+	0x700c, 0xa7cc, 0x63ea, 0xea19, 0x2e3f, 0x3667, 0xf241, 0x7bb2, 0xbf94, 0x6854, 0xac72,
+	0x2581, 0xe1a7, 0xcf98, 0xbbe, 0x824d, 0x466b, 0x91ab, 0x558d, 0xdc7e, 0x1858, 0x6cce,
+	0xa8e8, 0x211b, 0xe53d, 0x32fd, 0xf6db, 0x7f28, 0xbb0e, 0x9531, 0x5117, 0xd8e4, 0x1cc2,
+	0xcb02, 0xf24, 0x86d7, 0x42f1, 0x5aa9, 0x9e8f, 0x177c, 0xd35a, 0x49a, 0xc0bc, 0x494f,
+	0x8d69, 0xa356, 0x6770, 0xee83, 0x2aa5, 0xfd65, 0x3943, 0xb0b0, 0x7496, 0x1c05, 0xd823,
+	0x51d0, 0x95f6, 0x4236, 0x8610, 0xfe3, 0xcbc5, 0xe5fa, 0x21dc, 0xa82f, 0x6c09, 0xbbc9,
+	0x7fef, 0xf61c, 0x323a, 0x2a62, 0xee44, 0x67b7, 0xa391, 0x7451, 0xb077, 0x3984, 0xfda2,
+	0xd39d, 0x17bb, 0x9e48, 0x5a6e, 0x8dae, 0x4988, 0xc07b, 0x45d, 0x70cb, 0xb4ed, 0x3d1e,
+	0xf938, 0x2ef8, 0xeade, 0x632d, 0xa70b, 0x8934, 0x4d12, 0xc4e1, 0xc7, 0xd707, 0x1321,
+	0x9ad2, 0x5ef4, 0x46ac, 0x828a, 0xb79, 0xcf5f, 0x189f, 0xdcb9, 0x554a, 0x916c, 0xbf53,
+	0x7b75, 0xf286, 0x36a0, 0xe160, 0x2546, 0xacb5, 0x6893, 0x380a, 0xfc2c, 0x75df, 0xb1f9,
+	0x6639, 0xa21f, 0x2bec, 0xefca, 0xc1f5, 0x5d3, 0x8c20, 0x4806, 0x9fc6, 0x5be0, 0xd213,
+	0x1635, 0xe6d, 0xca4b, 0x43b8, 0x879e, 0x505e, 0x9478, 0x1d8b, 0xd9ad, 0xf792, 0x33b4,
+	0xba47, 0x7e61, 0xa9a1, 0x6d87, 0xe474, 0x2052, 0x54c4, 0x90e2, 0x1911, 0xdd37, 0xaf7,
+	0xced1, 0x4722, 0x8304, 0xad3b, 0x691d, 0xe0ee, 0x24c8, 0xf308, 0x372e, 0xbedd, 0x7afb,
+	0x62a3, 0xa685, 0x2f76, 0xeb50, 0x3c90, 0xf8b6, 0x7145, 0xb563, 0x9b5c, 0x5f7a, 0xd689,
+	0x12af, 0xc56f, 0x149, 0x88ba, 0x4c9c, 0x240f, 0xe029, 0x69da, 0xadfc, 0x7a3c, 0xbe1a,
+	0x37e9, 0xf3cf, 0xddf0, 0x19d6, 0x9025, 0x5403, 0x83c3, 0x47e5, 0xce16, 0xa30, 0x1268,
+	0xd64e, 0x5fbd, 0x9b9b, 0x4c5b, 0x887d, 0x18e, 0xc5a8, 0xeb97, 0x2fb1, 0xa642, 0x6264,
+	0xb5a4, 0x7182, 0xf871, 0x3c57, 0x48c1, 0x8ce7, 0x514, 0xc132, 0x16f2, 0xd2d4, 0x5b27,
+	0x9f01, 0xb13e, 0x7518, 0xfceb, 0x38cd, 0xef0d, 0x2b2b, 0xa2d8, 0x66fe, 0x7ea6, 0xba80,
+	0x3373, 0xf755, 0x2095, 0xe4b3, 0x6d40, 0xa966, 0x8759, 0x437f, 0xca8c, 0xeaa, 0xd96a,
+	0x1d4c, 0x94bf, 0x5099
+};
+
+#ifdef MBED
+#define PEC15_TABLE(table, addr) (table[addr])
+#else
+#define PEC15_TABLE(table, addr) pgm_read_word_near(table+(addr))
+#endif
+
+/* Folds one byte into a running PEC15 remainder */
+uint16_t pec15_update(uint16_t remainder, // Remainder so far, PEC15_SEED for a new PEC
+                      uint8_t data // Next byte
+                     )
+{
+	uint16_t addr = ((remainder>>7)^data)&0xff;//calculate PEC table address
+	return((remainder<<8)^PEC15_TABLE(crc15Table, addr));
+}
+
+/* Folds a block of bytes into a running PEC15 remainder, two bytes per table step */
+uint16_t pec15_update_block(uint16_t remainder, // Remainder so far, PEC15_SEED for a new PEC
+                            uint8_t len, // Number of bytes to fold in
+                            const uint8_t *data // Bytes to fold in
+                           )
 {
-	uint16_t remainder,addr;
-	remainder = 16;//initialize the PEC
+	uint16_t word;
 	
-	for (uint8_t i = 0; i<len; i++) // loops for each byte in data array
+	while (len >= 2)
+	{
+		word = (remainder<<1)^(((uint16_t)data[0]<<8)|data[1]); // remainder aligned with the next 16 data bits
+		remainder = PEC15_TABLE(crc15Table2, word>>8)^PEC15_TABLE(crc15Table, word&0xff);
+		data = data + 2;
+		len = len - 2;
+	}
+	if (len)
 	{
-		addr = ((remainder>>7)^data[i])&0xff;//calculate PEC table address
-		#ifdef MBED
-			remainder = (remainder<<8)^crc15Table[addr];
-		#else
-			remainder = (remainder<<8)^pgm_read_word_near(crc15Table+addr);
-		#endif
+		remainder = pec15_update(remainder, data[0]);
 	}
 	
-	return(remainder*2);//The CRC15 has a 0 in the LSB so the remainder must be multiplied by 2
+	return(remainder);
+}
+
+/* Calculates  and returns the CRC15 */
+uint16_t pec15_calc(uint8_t len, //Number of bytes that will be used to calculate a PEC
+                    uint8_t *data //Array of data that will be used to calculate  a PEC
+                   )
+{
+	return(PEC15_FINAL(pec15_update_block(PEC15_SEED, len, data)));
 }
 
 /* Write the LTC681x CFGRA */
@@ -206,10 +549,15 @@ void LTC681x_wrcfg(uint8_t total_ic, //The number of ICs being written to
                   )
 {
 	uint8_t cmd[2] = {0x00 , 0x01} ;
-	uint8_t write_buffer[256];
+	uint8_t write_buffer[6*BMS_TOTAL_IC];
 	uint8_t write_count = 0;
 	uint8_t c_ic = 0;
 	
+	if (total_ic > BMS_TOTAL_IC)
+	{
+		return;
+	}
+	
 	for (uint8_t current_ic = 0; current_ic<total_ic; current_ic++)
 	{
 		if (ic->isospi_reverse == true)
@@ -236,10 +584,19 @@ void LTC681x_wrcfgb(uint8_t total_ic, //The number of ICs being written to
                    )
 {
 	uint8_t cmd[2] = {0x00 , 0x24} ;
-	uint8_t write_buffer[256];
+	uint8_t write_buffer[6*BMS_TOTAL_IC];
 	uint8_t write_count = 0;
 	uint8_t c_ic = 0;
 	
+	if (total_ic > BMS_TOTAL_IC)
+	{
+		return;
+	}
+	if (LTC681x_claim_shadows(total_ic, ic) != 0)
+	{
+		return;
+	}
+	
 	for (uint8_t current_ic = 0; current_ic<total_ic; current_ic++)
 	{
 		if (ic->isospi_reverse == true)
@@ -253,7 +610,7 @@ void LTC681x_wrcfgb(uint8_t total_ic, //The number of ICs being written to
 		
 		for (uint8_t data = 0; data<6; data++)
 		{
-			write_buffer[write_count] = ic[c_ic].configb.tx_data[data];
+			write_buffer[write_count] = ic[c_ic].shadow->configb.tx_data[data];
 			write_count++;
 		}
 	}
@@ -266,12 +623,17 @@ int8_t LTC681x_rdcfg(uint8_t total_ic, //Number of ICs in the system
                     )
 {
 	uint8_t cmd[2]= {0x00 , 0x02};
-	uint8_t read_buffer[256];
+	uint8_t *read_buffer = rx_frame;
 	int8_t pec_error = 0;
 	uint16_t data_pec;
 	uint16_t calc_pec;
 	uint8_t c_ic = 0;
 	
+	if (total_ic > BMS_TOTAL_IC)
+	{
+		return(-1);
+	}
+	
 	pec_error = read_68(total_ic, cmd, read_buffer);
 	
 	for (uint8_t current_ic = 0; current_ic<total_ic; current_ic++)
@@ -294,6 +656,7 @@ int8_t LTC681x_rdcfg(uint8_t total_ic, //Number of ICs in the system
 		data_pec = read_buffer[7+(8*current_ic)] | (read_buffer[6+(8*current_ic)]<<8);
 		if (calc_pec != data_pec )
 		{
+			LTC681x_isospi_reset();
 			ic[c_ic].config.rx_pec_match = 1;
 		}
 		else ic[c_ic].config.rx_pec_match = 0;
@@ -309,12 +672,21 @@ int8_t LTC681x_rdcfgb(uint8_t total_ic, //Number of ICs in the system
                      )
 {
 	uint8_t cmd[2]= {0x00 , 0x26};
-	uint8_t read_buffer[256];
+	uint8_t *read_buffer = rx_frame;
 	int8_t pec_error = 0;
 	uint16_t data_pec;
 	uint16_t calc_pec;
 	uint8_t c_ic = 0;
 	
+	if (total_ic > BMS_TOTAL_IC)
+	{
+		return(-1);
+	}
+	if (LTC681x_claim_shadows(total_ic, ic) != 0)
+	{
+		return(-1);
+	}
+	
 	pec_error = read_68(total_ic, cmd, read_buffer);
 	
 	for (uint8_t current_ic = 0; current_ic<total_ic; current_ic++)
@@ -330,16 +702,17 @@ int8_t LTC681x_rdcfgb(uint8_t total_ic, //Number of ICs in the system
 		
 		for (int byte=0; byte<8; byte++)
 		{
-			ic[c_ic].configb.rx_data[byte] = read_buffer[byte+(8*current_ic)];
+			ic[c_ic].shadow->configb.rx_data[byte] = read_buffer[byte+(8*current_ic)];
 		}
 		
 		calc_pec = pec15_calc(6,&read_buffer[8*current_ic]);
 		data_pec = read_buffer[7+(8*current_ic)] | (read_buffer[6+(8*current_ic)]<<8);
 		if (calc_pec != data_pec )
 		{
-			ic[c_ic].configb.rx_pec_match = 1;
+			LTC681x_isospi_reset();
+			ic[c_ic].shadow->configb.rx_pec_match = 1;
 		}
-		else ic[c_ic].configb.rx_pec_match = 0;
+		else ic[c_ic].shadow->configb.rx_pec_match = 0;
 	}
 	LTC681x_check_pec(total_ic,CFGRB,ic);
 	
@@ -428,28 +801,92 @@ void LTC681x_adcvax(uint8_t MD, //ADC Mode
 }
 
 /*
-Reads and parses the LTC681x cell voltage registers.
-The function is used to read the parsed Cell voltages codes of the LTC681x. 
-This function will send the requested read commands parse the data 
-and store the cell voltages in c_codes variable.
+Parses one status register group of one IC out of the read back data
 */
-uint8_t LTC681x_rdcv(uint8_t reg, // Controls which cell voltage register is read back.
-                     uint8_t total_ic, // The number of ICs in the system
-                     cell_asic *ic // Array of the parsed cell codes
-                    )
+static int8_t parse_stat(uint8_t current_ic, // Position of the IC in the read back data
+						 uint8_t stat_reg, // Status register group, 1 or 2
+						 uint8_t data[], // Unparsed data
+						 cell_asic *ic // The IC the data belongs to
+						)
 {
-	int8_t pec_error = 0;
-	uint8_t *cell_data;
+	const uint8_t BYT_IN_REG = 6;
+	const uint8_t STAT_IN_REG = 3;
+	uint8_t data_counter = current_ic*NUM_RX_BYT;
+	uint16_t received_pec;
+	uint16_t data_pec;
+
+	if (stat_reg == 2)
+	{
+		ic->stat.stat_codes[3] = data[data_counter] + (data[data_counter+1]<<8);
+		data_counter = data_counter +2;
+		ic->stat.flags[0] = data[data_counter++];
+		ic->stat.flags[1] = data[data_counter++];
+		ic->stat.flags[2] = data[data_counter++];
+		ic->stat.mux_fail[0] = (data[data_counter] & 0x02)>>1;
+		ic->stat.thsd[0] = data[data_counter++] & 0x01;
+	}
+	else
+	{
+		stat_reg = 1;
+		for (uint8_t current_stat = 0; current_stat< STAT_IN_REG; current_stat++) // Each stat code is received as two bytes
+		{
+			ic->stat.stat_codes[current_stat] = data[data_counter] + (data[data_counter+1]<<8);
+			data_counter=data_counter+2;
+		}
+	}
+
+	received_pec = (data[data_counter]<<8)+ data[data_counter+1]; //The received PEC is transmitted as the 7th and 8th byte after the 6 status data bytes
+	data_pec = pec15_calc(BYT_IN_REG, &data[current_ic*NUM_RX_BYT]);
+	if (received_pec != data_pec)
+	{
+		LTC681x_isospi_reset();
+		ic->stat.pec_match[stat_reg-1]=1;
+		return(1);
+	}
+	ic->stat.pec_match[stat_reg-1]=0;
+	return(0);
+}
+
+/*
+Reads one cell voltage, aux or status register group of every IC and parses
+it. While any IC fails the PEC check the group, and only the group, is read
+again, up to the retry count set with LTC681x_set_read_retries(). frame holds
+data already read for the group, NULL to read it here.
+Returns the number of ICs that failed the PEC check on the last attempt.
+*/
+static uint8_t read_group(uint8_t type, // CELL, AUX or STAT
+						  uint8_t reg, // Register group, starting at 1
+						  uint8_t total_ic, // The number of ICs in the system
+						  cell_asic *ic, // Array of the parsed codes
+						  uint8_t *frame // Data read for the group already, NULL for none
+						 )
+{
+	uint8_t *data = (frame != NULL) ? frame : rx_frame;
+	uint8_t pec_error;
 	uint8_t c_ic = 0;
-	cell_data = (uint8_t *) malloc((NUM_RX_BYT*total_ic)*sizeof(uint8_t));
+	uint16_t *group_retry;
 
-	if (reg == 0)
+	for (uint8_t attempt = 0; ; attempt++)
 	{
-		for (uint8_t cell_reg = 1; cell_reg<ic[0].ic_reg.num_cv_reg+1; cell_reg++) //Executes once for each of the LTC681x cell voltage registers
+		switch (type)
+		{
+			case CELL:
+				if ((attempt != 0) || (frame == NULL)) LTC681x_rdcv_reg(reg, total_ic, data);
+				group_retry = &retry_stats.cell_retry[reg-1];
+				break;
+			case AUX:
+				if ((attempt != 0) || (frame == NULL)) LTC681x_rdaux_reg(reg, total_ic, data);
+				group_retry = &retry_stats.aux_retry[reg-1];
+				break;
+			default:
+				if ((attempt != 0) || (frame == NULL)) LTC681x_rdstat_reg(reg, total_ic, data);
+				group_retry = &retry_stats.stat_retry[reg-1];
+				break;
+		}
+
+		pec_error = 0;
+		for (uint8_t current_ic = 0; current_ic<total_ic; current_ic++)
 		{
-			LTC681x_rdcv_reg(cell_reg, total_ic,cell_data );
-			for (int current_ic = 0; current_ic<total_ic; current_ic++)
-			{
 			if (ic->isospi_reverse == false)
 			{
 			  c_ic = current_ic;
@@ -458,38 +895,121 @@ uint8_t LTC681x_rdcv(uint8_t reg, // Controls which cell voltage register is rea
 			{
 			  c_ic = total_ic - current_ic - 1;
 			}
-			pec_error = pec_error + parse_cells(current_ic,cell_reg, cell_data,
-												&ic[c_ic].cells.c_codes[0],
-												&ic[c_ic].cells.pec_match[0]);
+			switch (type)
+			{
+				case CELL:
+					pec_error = pec_error + parse_cells(current_ic, reg, data,
+														&ic[c_ic].cells.c_codes[0],
+														&ic[c_ic].cells.pec_match[0]);
+					ic[c_ic].cells.stale &= ~(CV_REG_CELLS << ((reg - 1)*3));
+					break;
+				case AUX:
+					pec_error = pec_error + parse_cells(current_ic, reg, data,
+														&ic[c_ic].aux.a_codes[0],
+														&ic[c_ic].aux.pec_match[0]);
+					break;
+				default:
+					pec_error = pec_error + parse_stat(current_ic, reg, data, &ic[c_ic]);
+					break;
 			}
 		}
+
+		if (!retry_needed(pec_error, attempt, group_retry))
+		{
+			return(pec_error);
+		}
+		wakeup_idle(total_ic);
+		data = rx_frame; // The retry reads into the shared frame buffer
 	}
+}
 
-	else
+/*
+Reads and parses the LTC681x cell voltage registers.
+The function is used to read the parsed Cell voltages codes of the LTC681x. 
+This function will send the requested read commands parse the data 
+and store the cell voltages in c_codes variable.
+*/
+uint8_t LTC681x_rdcv(uint8_t reg, // Controls which cell voltage register is read back.
+                     uint8_t total_ic, // The number of ICs in the system
+                     cell_asic *ic // Array of the parsed cell codes
+                    )
+{
+	int8_t pec_error = 0;
+
+	if (total_ic > BMS_TOTAL_IC || reg > MAX_CV_REG)
 	{
-		LTC681x_rdcv_reg(reg, total_ic,cell_data);
+		return(-1);
+	}
 
-		for (int current_ic = 0; current_ic<total_ic; current_ic++)
+	if (reg == 0)
+	{
+		for (uint8_t cell_reg = 1; cell_reg<IC_REG(ic[0], num_cv_reg)+1; cell_reg++) //Executes once for each of the LTC681x cell voltage registers
 		{
-			if (ic->isospi_reverse == false)
-			{
-			c_ic = current_ic;
-			}
-			else
-			{
-			c_ic = total_ic - current_ic - 1;
-			}
-			pec_error = pec_error + parse_cells(current_ic,reg, &cell_data[8*c_ic],
-											  &ic[c_ic].cells.c_codes[0],
-											  &ic[c_ic].cells.pec_match[0]);
+			pec_error = pec_error + read_group(CELL, cell_reg, total_ic, ic, NULL);
 		}
 	}
+	else
+	{
+		pec_error = read_group(CELL, reg, total_ic, ic, NULL);
+	}
 	LTC681x_check_pec(total_ic,CELL,ic);
-	free(cell_data);
 
 	return(pec_error);
 }
 
+/* Returns the cells converted by a cell channel selection, bit n for c_codes[n] */
+uint32_t LTC681x_cv_cells(uint8_t CH // Cell channel selection used for the conversion
+						 )
+{
+	uint32_t cells = 0;
+	
+	if (CH == CELL_CH_ALL)
+	{
+		return(0x3FFFF);
+	}
+	for (uint8_t cell = CH - 1; cell < 18; cell += 6) // CH n converts cells n, n+6 and n+12
+	{
+		cells |= 1UL << cell;
+	}
+	return(cells);
+}
+
+/*
+Reads back only the cell voltage register groups holding cells converted with
+channel selection CH: A, C and E for CH 1 to 3, B, D and F for CH 4 to 6. The
+cells left out of the conversion are flagged in cells.stale.
+*/
+int8_t LTC681x_rdcv_ch(uint8_t CH, // Cell channel selection used for the conversion
+					   uint8_t total_ic, // The number of ICs in the system
+					   cell_asic *ic // Array of the parsed cell codes
+					  )
+{
+	uint32_t fresh = LTC681x_cv_cells(CH);
+	int8_t pec_error = 0;
+
+	if ((CH > CELL_CH_6and12) || (total_ic > BMS_TOTAL_IC))
+	{
+		return(-1);
+	}
+	
+	for (uint8_t cell_reg = 1; cell_reg<IC_REG(ic[0], num_cv_reg)+1; cell_reg++)
+	{
+		if ((fresh & (CV_REG_CELLS << ((cell_reg - 1)*3))) == 0)
+		{
+			continue; // Nothing converted in this group, its codes are from an earlier conversion
+		}
+		if (LTC681x_rdcv(cell_reg, total_ic, ic) != 0)
+		{
+			pec_error = -1;
+		}
+	}
+	for (uint8_t current_ic = 0; current_ic<total_ic; current_ic++)
+	{
+		ic[current_ic].cells.stale = ~fresh & ((1UL << IC_REG(ic[current_ic], cell_channels)) - 1);
+	}
+	return(pec_error);
+}
+
 /*
 The function is used to read the  parsed GPIO codes of the LTC681x. 
 This function will send the requested read commands parse the data 
@@ -500,53 +1020,28 @@ int8_t LTC681x_rdaux(uint8_t reg, //Determines which GPIO voltage register is re
                      cell_asic *ic//A two dimensional array of the gpio voltage codes.
                     )
 {
-	uint8_t *data;
 	int8_t pec_error = 0;
-	uint8_t c_ic =0;
-	data = (uint8_t *) malloc((NUM_RX_BYT*total_ic)*sizeof(uint8_t));
+
+	if (total_ic > BMS_TOTAL_IC || reg > 4)
+	{
+		return(-1);
+	}
 
 	if (reg == 0)
 	{
-		for (uint8_t gpio_reg = 1; gpio_reg<ic[0].ic_reg.num_gpio_reg+1; gpio_reg++) //Executes once for each of the LTC681x aux voltage registers
+		for (uint8_t gpio_reg = 1; gpio_reg<IC_REG(ic[0], num_gpio_reg)+1; gpio_reg++) //Executes once for each of the LTC681x aux voltage registers
 		{
-			LTC681x_rdaux_reg(gpio_reg, total_ic,data);                 //Reads the raw auxiliary register data into the data[] array
-			for (int current_ic = 0; current_ic<total_ic; current_ic++)
+			if (read_group(AUX, gpio_reg, total_ic, ic, NULL) != 0)
 			{
-				if (ic->isospi_reverse == false)
-				{
-				  c_ic = current_ic;
-				}
-				else
-				{
-				  c_ic = total_ic - current_ic - 1;
-				}
-				pec_error = parse_cells(current_ic,gpio_reg, data,
-										&ic[c_ic].aux.a_codes[0],
-										&ic[c_ic].aux.pec_match[0]);
+				pec_error = -1;
 			}
 		}
 	}
-	else
+	else if (read_group(AUX, reg, total_ic, ic, NULL) != 0)
 	{
-		LTC681x_rdaux_reg(reg, total_ic, data);
-
-		for (int current_ic = 0; current_ic<total_ic; current_ic++)
-		{
-			if (ic->isospi_reverse == false)
-			{
-			c_ic = current_ic;
-			}
-			else
-			{
-			c_ic = total_ic - current_ic - 1;
-			}
-			pec_error = parse_cells(current_ic,reg, data,
-								  &ic[c_ic].aux.a_codes[0],
-								  &ic[c_ic].aux.pec_match[0]);
-		}
+		pec_error = -1;
 	}
 	LTC681x_check_pec(total_ic,AUX,ic);
-	free(data);
 
 	return (pec_error);
 }
@@ -563,181 +1058,145 @@ int8_t LTC681x_rdstat(uint8_t reg, //Determines which Stat  register is read bac
                      )
 
 {
-	const uint8_t BYT_IN_REG = 6;
-	const uint8_t STAT_IN_REG = 3;
-	uint8_t *data;
-	uint8_t data_counter = 0;
 	int8_t pec_error = 0;
-	uint16_t parsed_stat;
-	uint16_t received_pec;
-	uint16_t data_pec;
-	uint8_t c_ic = 0;
 	
-	data = (uint8_t *) malloc((12*total_ic)*sizeof(uint8_t));
+	if (total_ic > BMS_TOTAL_IC || reg > 2)
+	{
+		return(-1);
+	}
 	
 	if (reg == 0)
 	{
 		for (uint8_t stat_reg = 1; stat_reg< 3; stat_reg++)                      //Executes once for each of the LTC681x stat voltage registers
 		{
-			data_counter = 0;
-			LTC681x_rdstat_reg(stat_reg, total_ic,data);                            //Reads the raw status register data into the data[] array
-		
-			for (uint8_t current_ic = 0 ; current_ic < total_ic; current_ic++)      // Executes for every LTC681x in the daisy chain
-			{																		// current_ic is used as the IC counter
-				if (ic->isospi_reverse == false)
-				{
-					c_ic = current_ic;
-				}
-				else
-				{
-					c_ic = total_ic - current_ic - 1;
-				}
-
-				if (stat_reg ==1)
-				{
-					for (uint8_t current_stat = 0; current_stat< STAT_IN_REG; current_stat++) // This loop parses the read back data into Status registers, 
-					{																		 // it loops once for each of the 3 stat codes in the register
-						parsed_stat = data[data_counter] + (data[data_counter+1]<<8);       //Each stat codes is received as two bytes and is combined to create the parsed status code
-						ic[c_ic].stat.stat_codes[current_stat] = parsed_stat;
-						data_counter=data_counter+2;                                       //Because stat codes are two bytes the data counter
-					}
-				}
-				else if (stat_reg == 2)
-				{
-					parsed_stat = data[data_counter] + (data[data_counter+1]<<8);          //Each stat is received as two bytes and is combined to create the parsed status code
-					data_counter = data_counter +2;
-					ic[c_ic].stat.stat_codes[3] = parsed_stat;
-					ic[c_ic].stat.flags[0] = data[data_counter++];
-					ic[c_ic].stat.flags[1] = data[data_counter++];
-					ic[c_ic].stat.flags[2] = data[data_counter++];
-					ic[c_ic].stat.mux_fail[0] = (data[data_counter] & 0x02)>>1;
-					ic[c_ic].stat.thsd[0] = data[data_counter++] & 0x01;
-				}
-			
-				received_pec = (data[data_counter]<<8)+ data[data_counter+1];        //The received PEC for the current_ic is transmitted as the 7th and 8th
-																					//after the 6 status data bytes
-				data_pec = pec15_calc(BYT_IN_REG, &data[current_ic*NUM_RX_BYT]);
-			
-				if (received_pec != data_pec)
-				{
-					pec_error = -1;                         //The pec_error variable is simply set negative if any PEC errors
-					ic[c_ic].stat.pec_match[stat_reg-1]=1;  //are detected in the received serial data
-					
-				}
-				else
-				{
-					ic[c_ic].stat.pec_match[stat_reg-1]=0;
-				}
-			
-				data_counter=data_counter+2;    //Because the transmitted PEC code is 2 bytes long the data_counter
-											//must be incremented by 2 bytes to point to the next ICs status data
+			if (read_group(STAT, stat_reg, total_ic, ic, NULL) != 0)
+			{
+				pec_error = -1;
 			}
 		}
 	}
-	else
+	else if (read_group(STAT, reg, total_ic, ic, NULL) != 0)
 	{
-		LTC681x_rdstat_reg(reg, total_ic, data);
-		for (int current_ic = 0 ; current_ic < total_ic; current_ic++)            // Executes for every LTC681x in the daisy chain
-		{																		  // current_ic is used as an IC counter																			
-			if (ic->isospi_reverse == false)
-			{
-			c_ic = current_ic;
-			}
-			else
-			{
-			c_ic = total_ic - current_ic - 1;
-			}
-			if (reg ==1)
-			{
-				for (uint8_t current_stat = 0; current_stat< STAT_IN_REG; current_stat++) // This loop parses the read back data into Status voltages, it
-				{																		  // loops once for each of the 3 stat codes in the register
-					
-					parsed_stat = data[data_counter] + (data[data_counter+1]<<8);           //Each stat codes is received as two bytes and is combined to
-																							// create the parsed stat code
-			
-					ic[c_ic].stat.stat_codes[current_stat] = parsed_stat;
-					data_counter=data_counter+2;                     //Because stat codes are two bytes the data counter
-																	//must increment by two for each parsed stat code
-				}
-			}
-			else if (reg == 2)
-			{
-				parsed_stat = data[data_counter++] + (data[data_counter++]<<8); //Each stat codes is received as two bytes and is combined to
-				ic[c_ic].stat.stat_codes[3] = parsed_stat;
-				ic[c_ic].stat.flags[0] = data[data_counter++];
-				ic[c_ic].stat.flags[1] = data[data_counter++];
-				ic[c_ic].stat.flags[2] = data[data_counter++];
-				ic[c_ic].stat.mux_fail[0] = (data[data_counter] & 0x02)>>1;
-				ic[c_ic].stat.thsd[0] = data[data_counter++] & 0x01;
-			}
-		
-			received_pec = (data[data_counter]<<8)+ data[data_counter+1]; //The received PEC for the current_ic is transmitted as the 7th and 8th
-																		  //after the 6 status data bytes
-			data_pec = pec15_calc(BYT_IN_REG, &data[current_ic*NUM_RX_BYT]);
-			if (received_pec != data_pec)
-			{
-				pec_error = -1;                  //The pec_error variable is simply set negative if any PEC errors
-				ic[c_ic].stat.pec_match[reg-1]=1;
-			}
-		
-			data_counter=data_counter+2;
-		}
+		pec_error = -1;
 	}
 	LTC681x_check_pec(total_ic,STAT,ic);
 	
-	free(data);
-	
 	return (pec_error);
 }
 
-/* Writes the command and reads the raw cell voltage register data */
-void LTC681x_rdcv_reg(uint8_t reg, //Determines which cell voltage register is read back
-                      uint8_t total_ic, //the number of ICs in the
-                      uint8_t *data //An array of the unparsed cell codes
-                     )
+/* Writes the command and reads the raw cell voltage register data */
+void LTC681x_rdcv_reg(uint8_t reg, //Determines which cell voltage register is read back
+                      uint8_t total_ic, //the number of ICs in the
+                      uint8_t *data //An array of the unparsed cell codes
+                     )
+{
+	const uint8_t REG_LEN = 8; //Number of bytes in each ICs register + 2 bytes for the PEC
+	uint8_t cmd[4];
+	uint16_t cmd_pec;
+
+	if (reg < 1 || reg > MAX_CV_REG)
+	{
+		return;
+	}
+
+	cmd[0] = 0x00; //1: RDCVA, 2: RDCVB, 3: RDCVC, 4: RDCVD, 5: RDCVE, 6: RDCVF
+	cmd[1] = rdcv_code[reg-1];
+	cmd_pec = rdcv_pec[reg-1];
+	cmd[2] = (uint8_t)(cmd_pec >> 8);
+	cmd[3] = (uint8_t)(cmd_pec);
+
+	isospi_cs_low();
+	spi_write_read(cmd,4,data,(REG_LEN*total_ic));
+	isospi_cs_high();
+}
+
+/* Called from the SPI interrupt as each queued register read finishes */
+static void cv_frame_done(spi_transaction *)
+{
+	isospi_traffic();
+}
+
+/*
+Queues the readback of every cell voltage register group on the SPI engine and
+returns while the bytes are still shifting
+*/
+int8_t LTC681x_rdcv_start(uint8_t total_ic, // The number of ICs in the system
+                          cell_asic *ic // Used for the number of cell voltage registers
+                         )
 {
-	const uint8_t REG_LEN = 8; //Number of bytes in each ICs register + 2 bytes for the PEC
-	uint8_t cmd[4];
 	uint16_t cmd_pec;
 
-	if (reg == 1)     //1: RDCVA
-	{
-		cmd[1] = 0x04;
-		cmd[0] = 0x00;
-	}
-	else if (reg == 2) //2: RDCVB
+	(void)ic; // Only read through IC_REG(), which ignores it when BMS_IC_TYPE fixes the layout
+	if (total_ic > BMS_TOTAL_IC || LTC681x_rdcv_busy())
 	{
-		cmd[1] = 0x06;
-		cmd[0] = 0x00;
+		return(-1);
 	}
-	else if (reg == 3) //3: RDCVC
+
+	isospi_expire();
+	for (cv_groups = 0; cv_groups < IC_REG(ic[0], num_cv_reg); cv_groups++)
 	{
-		cmd[1] = 0x08;
+		uint8_t *cmd = cv_cmd[cv_groups];
+		spi_transaction *trans = &cv_trans[cv_groups];
+
 		cmd[0] = 0x00;
+		cmd[1] = rdcv_code[cv_groups];
+		cmd_pec = rdcv_pec[cv_groups];
+		cmd[2] = (uint8_t)(cmd_pec >> 8);
+		cmd[3] = (uint8_t)(cmd_pec);
+
+		trans->cs_pin = chain_cs;
+		trans->tx_data = cmd;
+		trans->tx_len = 4;
+		trans->rx_data = cv_frame[cv_groups];
+		trans->rx_len = NUM_RX_BYT*total_ic;
+		trans->on_complete = cv_frame_done;
+		if (spi_submit(trans) != 0)
+		{
+			return(-1);
+		}
 	}
-	else if (reg == 4) //4: RDCVD
+	return(0);
+}
+
+/* Returns 1 while a readback queued by LTC681x_rdcv_start() is still on the SPI port */
+uint8_t LTC681x_rdcv_busy()
+{
+	for (uint8_t cell_reg = 0; cell_reg < cv_groups; cell_reg++)
 	{
-		cmd[1] = 0x0A;
-		cmd[0] = 0x00;
+		if (!cv_trans[cell_reg].done)
+		{
+			return(1);
+		}
 	}
-	else if (reg == 5) //4: RDCVE
+	return(0);
+}
+
+/*
+Waits for the readback queued by LTC681x_rdcv_start() and parses it the same
+way LTC681x_rdcv(0, ...) does
+*/
+int8_t LTC681x_rdcv_finish(uint8_t total_ic, // The number of ICs in the system
+                           cell_asic *ic // Array of the parsed cell codes
+                          )
+{
+	int8_t pec_error = 0;
+
+	if (total_ic > BMS_TOTAL_IC)
 	{
-		cmd[1] = 0x09;
-		cmd[0] = 0x00;
+		return(-1);
 	}
-	else if (reg == 6) //4: RDCVF
+
+	spi_wait_idle();
+	for (uint8_t cell_reg = 1; cell_reg < cv_groups+1; cell_reg++)
 	{
-		cmd[1] = 0x0B;
-		cmd[0] = 0x00;
+		if (read_group(CELL, cell_reg, total_ic, ic, cv_frame[cell_reg-1]) != 0) // A group that fails is re-read on its own
+		{
+			pec_error++;
+		}
 	}
+	LTC681x_check_pec(total_ic,CELL,ic);
 
-	cmd_pec = pec15_calc(2, cmd);
-	cmd[2] = (uint8_t)(cmd_pec >> 8);
-	cmd[3] = (uint8_t)(cmd_pec);
-
-	cs_low(CS_PIN);
-	spi_write_read(cmd,4,data,(REG_LEN*total_ic));
-	cs_high(CS_PIN);
+	return(pec_error);
 }
 
 /*
@@ -758,35 +1217,39 @@ void LTC681x_rdaux_reg(uint8_t reg, //Determines which GPIO voltage register is
 	{
 		cmd[1] = 0x0C;
 		cmd[0] = 0x00;
+		cmd_pec = PEC15_CMD(0x00, 0x0C);
 	}
 	else if (reg == 2)  //Read back auxiliary group B
 	{
 		cmd[1] = 0x0E;
 		cmd[0] = 0x00;
+		cmd_pec = PEC15_CMD(0x00, 0x0E);
 	}
 	else if (reg == 3)  //Read back auxiliary group C
 	{
 		cmd[1] = 0x0D;
 		cmd[0] = 0x00;
+		cmd_pec = PEC15_CMD(0x00, 0x0D);
 	}
 	else if (reg == 4)  //Read back auxiliary group D
 	{
 		cmd[1] = 0x0F;
 		cmd[0] = 0x00;
+		cmd_pec = PEC15_CMD(0x00, 0x0F);
 	}
 	else          //Read back auxiliary group A
 	{
 		cmd[1] = 0x0C;
 		cmd[0] = 0x00;
+		cmd_pec = PEC15_CMD(0x00, 0x0C);
 	}
 
-	cmd_pec = pec15_calc(2, cmd);
 	cmd[2] = (uint8_t)(cmd_pec >> 8);
 	cmd[3] = (uint8_t)(cmd_pec);
 
-	cs_low(CS_PIN);
+	isospi_cs_low();
 	spi_write_read(cmd,4,data,(REG_LEN*total_ic));
-	cs_high(CS_PIN);
+	isospi_cs_high();
 }
 
 /*
@@ -807,26 +1270,28 @@ void LTC681x_rdstat_reg(uint8_t reg, //Determines which stat register is read ba
 	{
 		cmd[1] = 0x10;
 		cmd[0] = 0x00;
+		cmd_pec = PEC15_CMD(0x00, 0x10);
 	}
 	else if (reg == 2)  //Read back status group B
 	{
 		cmd[1] = 0x12;
 		cmd[0] = 0x00;
+		cmd_pec = PEC15_CMD(0x00, 0x12);
 	}
 
 	else          //Read back status group A
 	{
 		cmd[1] = 0x10;
 		cmd[0] = 0x00;
+		cmd_pec = PEC15_CMD(0x00, 0x10);
 	}
 
-	cmd_pec = pec15_calc(2, cmd);
 	cmd[2] = (uint8_t)(cmd_pec >> 8);
 	cmd[3] = (uint8_t)(cmd_pec);
 
-	cs_low(CS_PIN);
+	isospi_cs_low();
 	spi_write_read(cmd,4,data,(REG_LEN*total_ic));
-	cs_high(CS_PIN);
+	isospi_cs_high();
 }
 
 /* Helper function that parses voltage measurement registers */
@@ -862,6 +1327,7 @@ int8_t parse_cells(uint8_t current_ic, // Current IC
 
 	if (received_pec != data_pec)
 	{
+		LTC681x_isospi_reset();
 		pec_error = 1;                             //The pec_error variable is simply set negative if any PEC errors
 		ic_pec[cell_reg-1]=1;
 	}
@@ -883,14 +1349,14 @@ uint8_t LTC681x_pladc()
 	
 	cmd[0] = 0x07;
 	cmd[1] = 0x14;
-	cmd_pec = pec15_calc(2, cmd);
+	cmd_pec = PEC15_CMD(0x07, 0x14);
 	cmd[2] = (uint8_t)(cmd_pec >> 8);
 	cmd[3] = (uint8_t)(cmd_pec);
 	
-	cs_low(CS_PIN);
+	isospi_cs_low();
 	spi_write_array(4,cmd);
 	adc_state = spi_read_byte(0xFF);
-	cs_high(CS_PIN);
+	isospi_cs_high();
 	
 	return(adc_state);
 }
@@ -906,11 +1372,11 @@ uint32_t LTC681x_pollAdc()
 	
 	cmd[0] = 0x07;
 	cmd[1] = 0x14;
-	cmd_pec = pec15_calc(2, cmd);
+	cmd_pec = PEC15_CMD(0x07, 0x14);
 	cmd[2] = (uint8_t)(cmd_pec >> 8);
 	cmd[3] = (uint8_t)(cmd_pec);
 	
-	cs_low(CS_PIN);
+	isospi_cs_low();
 	spi_write_array(4,cmd);
 	while ((counter<200000)&&(finished == 0))
 	{
@@ -924,11 +1390,341 @@ uint32_t LTC681x_pollAdc()
 			counter = counter + 10;
 		}
 	}
-	cs_high(CS_PIN);
+	isospi_cs_high();
 	
 	return(counter);
 }
 
+/*
+Conversion times in microseconds, indexed [ADCOPT][MD]. With ADCOPT=0 the MD
+settings are 422Hz, 27kHz, 7kHz and 26Hz, with ADCOPT=1 they are 1kHz, 14kHz,
+3kHz and 2kHz. Approximate values after the LTC6811 data sheet conversion time tables.
+*/
+#ifdef MBED
+static const uint32_t conv_time_all[5][2][4] =
+#else
+static const uint32_t conv_time_all[5][2][4] PROGMEM =
+#endif
+{
+	{{12807, 1113, 2335, 201317}, {5900, 1288, 3033, 4430}},   // ADCV, all cells
+	{{21340, 1825, 3862, 335543}, {9800, 2116, 5025, 7353}},   // ADAX, all GPIOs
+	{{8537, 748, 1563, 134218}, {3950, 865, 2028, 2959}},      // ADSTAT, all status
+	{{17149, 1515, 3145, 268453}, {7900, 1748, 4075, 5938}},   // ADCVAX
+	{{14978, 1314, 2740, 234885}, {6900, 1518, 3554, 5184}}    // ADCVSC
+};
+
+#ifdef MBED
+static const uint32_t conv_time_single[2][4] =
+#else
+static const uint32_t conv_time_single[2][4] PROGMEM =
+#endif
+{
+	{2171, 201, 405, 33568}, {1000, 230, 521, 754}             // One cell pair, GPIO or status channel
+};
+
+/* Looks up the expected conversion time of an ADC command */
+uint32_t LTC681x_conv_time(uint8_t conv_type, // Type of conversion
+						   uint8_t MD, // ADC Mode
+						   bool adcopt, // ADCOPT bit in the configuration register
+						   uint8_t ch // Channel selection, 0 for all channels
+						  )
+{
+	const uint32_t *entry;
+	
+	if (conv_type > ADC_CONV_CELL_SC)
+	{
+		conv_type = ADC_CONV_CELL_SC;
+	}
+	
+	if ((ch != 0) && (conv_type <= ADC_CONV_STAT))
+	{
+		entry = &conv_time_single[adcopt][MD & 0x03];
+	}
+	else
+	{
+		entry = &conv_time_all[conv_type][adcopt][MD & 0x03];
+	}
+	
+	#ifdef MBED
+		return(*entry);
+	#else
+		return(pgm_read_dword_near(entry));
+	#endif
+}
+
+/* Starts tracking a conversion whose command has just been sent */
+void LTC681x_conv_begin(adc_conversion *conv, // Conversion to track
+						uint8_t conv_type, // Type of conversion
+						uint8_t MD, // ADC Mode
+						bool adcopt, // ADCOPT bit in the configuration register
+						uint8_t ch // Channel selection, 0 for all channels
+					   )
+{
+	conv->start_us = micros();
+	conv->duration_us = LTC681x_conv_time(conv_type, MD, adcopt, ch);
+	conv->busy = 1;
+}
+
+/* Starts a cell voltage conversion without waiting for it */
+void LTC681x_adcv_start(uint8_t MD, // ADC Mode
+						uint8_t DCP, // Discharge Permit
+						uint8_t CH, // Cell Channels to be measured
+						bool adcopt, // ADCOPT bit in the configuration register
+						adc_conversion *conv // Conversion handle
+					   )
+{
+	LTC681x_adcv(MD, DCP, CH);
+	LTC681x_conv_begin(conv, ADC_CONV_CELL, MD, adcopt, CH);
+}
+
+/* Starts a GPIO conversion without waiting for it */
+void LTC681x_adax_start(uint8_t MD, // ADC Mode
+						uint8_t CHG, // GPIO Channels to be measured
+						bool adcopt, // ADCOPT bit in the configuration register
+						adc_conversion *conv // Conversion handle
+					   )
+{
+	LTC681x_adax(MD, CHG);
+	LTC681x_conv_begin(conv, ADC_CONV_GPIO, MD, adcopt, CHG);
+}
+
+/* Starts a status group conversion without waiting for it */
+void LTC681x_adstat_start(uint8_t MD, // ADC Mode
+						  uint8_t CHST, // Stat Channels to be measured
+						  bool adcopt, // ADCOPT bit in the configuration register
+						  adc_conversion *conv // Conversion handle
+						 )
+{
+	LTC681x_adstat(MD, CHST);
+	LTC681x_conv_begin(conv, ADC_CONV_STAT, MD, adcopt, CHST);
+}
+
+/*
+Checks a conversion without blocking. Nothing is sent on the bus until the
+expected conversion time has passed, then a single PLADC byte confirms it.
+*/
+uint8_t LTC681x_conv_poll(uint8_t total_ic, // Number of ICs in the daisy chain
+						  adc_conversion *conv // Conversion to check
+						 )
+{
+	if (conv->busy == 0)
+	{
+		return(1);
+	}
+	
+	if ((uint32_t)(micros() - conv->start_us) < conv->duration_us)
+	{
+		return(0);
+	}
+	
+	wakeup_idle(total_ic);
+	if (LTC681x_pladc() == 0) // SDO is held low while any IC is still converting
+	{
+		return(0);
+	}
+	
+	conv->busy = 0;
+	if (conv->on_complete != NULL)
+	{
+		conv->on_complete();
+	}
+	return(1);
+}
+
+/* Waits for a conversion, running idle_task instead of holding CS low while the ADC converts */
+uint32_t LTC681x_conv_wait(uint8_t total_ic, // Number of ICs in the daisy chain
+						   adc_conversion *conv, // Conversion to wait for
+						   void (*idle_task)(void) // Work to run while waiting, may be NULL
+						  )
+{
+	uint32_t elapsed;
+	uint32_t remaining;
+	
+	while (LTC681x_conv_poll(total_ic, conv) == 0)
+	{
+		if (idle_task != NULL)
+		{
+			idle_task();
+		}
+		else
+		{
+			elapsed = micros() - conv->start_us;
+			remaining = (elapsed < conv->duration_us) ? (conv->duration_us - elapsed) : 100;
+			delay_m(remaining/1000);
+			delay_u(remaining%1000);
+		}
+	}
+	
+	return(micros() - conv->start_us);
+}
+
+/* Register groups a plan step writes (conversions) or reads (register reads) */
+#define PLAN_REG_CV 0x01
+#define PLAN_REG_AUX 0x02
+#define PLAN_REG_STAT 0x04
+
+static uint8_t plan_regs(uint8_t op)
+{
+	switch (op)
+	{
+		case PLAN_ADCV:
+		case PLAN_RDCV:
+			return(PLAN_REG_CV);
+		case PLAN_ADAX:
+		case PLAN_RDAUX:
+			return(PLAN_REG_AUX);
+		case PLAN_ADSTAT:
+		case PLAN_RDSTAT:
+			return(PLAN_REG_STAT);
+		case PLAN_ADCVAX:
+			return(PLAN_REG_CV | PLAN_REG_AUX);
+		case PLAN_ADCVSC:
+			return(PLAN_REG_CV | PLAN_REG_STAT);
+		default:
+			return(0);
+	}
+}
+
+/* Sends the conversion command of a plan step and starts tracking it */
+static void plan_start(meas_plan *plan, // Plan the step belongs to
+					   meas_step *step, // Conversion step
+					   adc_conversion *conv // Conversion tracker
+					  )
+{
+	switch (step->op)
+	{
+		case PLAN_ADCV:
+			LTC681x_adcv_start(plan->MD, plan->DCP, step->arg, plan->adcopt, conv);
+			break;
+		case PLAN_ADAX:
+			LTC681x_adax_start(plan->MD, step->arg, plan->adcopt, conv);
+			break;
+		case PLAN_ADSTAT:
+			LTC681x_adstat_start(plan->MD, step->arg, plan->adcopt, conv);
+			break;
+		case PLAN_ADCVAX:
+			LTC681x_adcvax(plan->MD, plan->DCP);
+			LTC681x_conv_begin(conv, ADC_CONV_CELL_GPIO, plan->MD, plan->adcopt, 0);
+			break;
+		case PLAN_ADCVSC:
+			LTC681x_adcvsc(plan->MD, plan->DCP);
+			LTC681x_conv_begin(conv, ADC_CONV_CELL_SC, plan->MD, plan->adcopt, 0);
+			break;
+		default:
+			break;
+	}
+}
+
+/* Cell channel selection in effect once a plan step has been started */
+static uint8_t plan_cell_ch(const meas_step *step, // Conversion step just started
+							uint8_t cell_ch // Selection before the step
+						   )
+{
+	switch (step->op)
+	{
+		case PLAN_ADCV:
+			return(step->arg);
+		case PLAN_ADCVAX:
+		case PLAN_ADCVSC:
+			return(CELL_CH_ALL);
+		default:
+			return(cell_ch);
+	}
+}
+
+/* Runs a list of conversions and register reads back to back */
+int8_t LTC681x_run_plan(uint8_t total_ic, // Number of ICs in the daisy chain
+						cell_asic *ic, // A two dimensional array that will store the data
+						meas_plan *plan // Plan to run
+					   )
+{
+	adc_conversion conv = {0, 0, 0, NULL};
+	meas_step *converting = NULL; // Step whose conversion conv is tracking
+	uint8_t started = 0; // Index of the first conversion step not yet started
+	uint32_t plan_start_us = micros();
+	uint32_t read_start_us;
+	int8_t pec_error = 0;
+	uint8_t cell_ch = CELL_CH_ALL; // Channel selection of the last cell conversion started
+
+	if (total_ic > BMS_TOTAL_IC)
+	{
+		return(-1);
+	}
+
+	wakeup_sleep(total_ic);
+	for (uint8_t i = 0; i < plan->count; i++)
+	{
+		meas_step *step = &plan->steps[i];
+		uint8_t regs = plan_regs(step->op);
+
+		if (step->op < PLAN_RDCV)
+		{
+			if (i < started)
+			{
+				continue; // Already started ahead of the read before it
+			}
+			if (conv.busy)
+			{
+				converting->time_us = LTC681x_conv_wait(total_ic, &conv, plan->idle_task); // One conversion at a time
+			}
+			wakeup_idle(total_ic);
+			plan_start(plan, step, &conv);
+			cell_ch = plan_cell_ch(step, cell_ch);
+			converting = step;
+			started = i + 1;
+			continue;
+		}
+
+		if (conv.busy && (plan_regs(converting->op) & regs))
+		{
+			converting->time_us = LTC681x_conv_wait(total_ic, &conv, plan->idle_task);
+		}
+		if (!conv.busy && (i + 1 < plan->count) && (i + 1 >= started) && (plan->steps[i+1].op < PLAN_RDCV)
+			&& !(plan_regs(plan->steps[i+1].op) & regs))
+		{
+			wakeup_idle(total_ic);
+			plan_start(plan, &plan->steps[i+1], &conv); // The next conversion does not touch these registers, read while it runs
+			cell_ch = plan_cell_ch(&plan->steps[i+1], cell_ch);
+			converting = &plan->steps[i+1];
+			started = i + 2;
+		}
+
+		wakeup_idle(total_ic);
+		read_start_us = micros();
+		switch (step->op)
+		{
+			case PLAN_RDCV:
+				if ((step->arg == 0) && (cell_ch != CELL_CH_ALL))
+				{
+					step->error = LTC681x_rdcv_ch(cell_ch, total_ic, ic); // Only the groups the conversion wrote
+				}
+				else
+				{
+					step->error = (LTC681x_rdcv(step->arg, total_ic, ic) == 0) ? 0 : -1;
+				}
+				break;
+			case PLAN_RDAUX:
+				step->error = LTC681x_rdaux(step->arg, total_ic, ic);
+				break;
+			default:
+				step->error = LTC681x_rdstat(step->arg, total_ic, ic);
+				break;
+		}
+		step->time_us = micros() - read_start_us;
+		if (step->error != 0)
+		{
+			pec_error = -1;
+		}
+	}
+	if (conv.busy)
+	{
+		converting->time_us = LTC681x_conv_wait(total_ic, &conv, plan->idle_task);
+	}
+
+	plan->total_us = micros() - plan_start_us;
+	return(pec_error);
+}
+
 /*
 The command clears the cell voltage registers and initializes
 all values to 1. The register will read back hexadecimal 0xFF
@@ -1094,7 +1890,7 @@ int16_t LTC681x_run_cell_adc_st(uint8_t adc_reg, // Type of register
 			  error = LTC681x_rdcv(0, total_ic,ic);      
 			  for (int cic = 0; cic < total_ic; cic++)
 				{
-				  for (int channel=0; channel< ic[cic].ic_reg.cell_channels; channel++)
+				  for (int channel=0; channel< IC_REG(ic[cic], cell_channels); channel++)
 				  {
 								 
 					if (ic[cic].cells.c_codes[channel] != expected_result)
@@ -1115,7 +1911,7 @@ int16_t LTC681x_run_cell_adc_st(uint8_t adc_reg, // Type of register
 			  LTC681x_rdaux(0, total_ic,ic);     
 			  for (int cic = 0; cic < total_ic; cic++)
 				{
-				  for (int channel=0; channel< ic[cic].ic_reg.aux_channels; channel++)
+				  for (int channel=0; channel< IC_REG(ic[cic], aux_channels); channel++)
 				  { 
 					 
 					if (ic[cic].aux.a_codes[channel] != expected_result)
@@ -1135,7 +1931,7 @@ int16_t LTC681x_run_cell_adc_st(uint8_t adc_reg, // Type of register
 			  error = LTC681x_rdstat(0,total_ic,ic);
 			  for (int cic = 0; cic < total_ic; cic++)
 				{
-				  for (int channel=0; channel< ic[cic].ic_reg.stat_channels; channel++)
+				  for (int channel=0; channel< IC_REG(ic[cic], stat_channels); channel++)
 				  {
 					if (ic[cic].stat.stat_codes[channel] != expected_result)
 					{
@@ -1206,7 +2002,7 @@ int16_t LTC681x_run_adc_redundancy_st(uint8_t adc_mode, // ADC Mode
 			error = LTC681x_rdaux(0, total_ic,ic);
 			for (int cic = 0; cic < total_ic; cic++)
 			{
-				for (int channel=0; channel< ic[cic].ic_reg.aux_channels; channel++)
+				for (int channel=0; channel< IC_REG(ic[cic], aux_channels); channel++)
 				{ 
 					if (ic[cic].aux.a_codes[channel] >= 65280)
 					{
@@ -1223,7 +2019,7 @@ int16_t LTC681x_run_adc_redundancy_st(uint8_t adc_mode, // ADC Mode
 			error = LTC681x_rdstat(0,total_ic,ic);
 			for (int cic = 0; cic < total_ic; cic++)
 			{
-				for (int channel=0; channel< ic[cic].ic_reg.stat_channels; channel++)
+				for (int channel=0; channel< IC_REG(ic[cic], stat_channels); channel++)
 				{
 					if (ic[cic].stat.stat_codes[channel] >= 65280)
 					{
@@ -1328,7 +2124,7 @@ void LTC681x_run_openwire_single(uint8_t total_ic, // Number of ICs in the daisy
 								)
 {				  
 	uint16_t OPENWIRE_THRESHOLD = 4000;
-	const uint8_t  N_CHANNELS = ic[0].ic_reg.cell_channels;
+	const uint8_t  N_CHANNELS = IC_REG(ic[0], cell_channels);
 	
 	uint16_t pullUp[total_ic][N_CHANNELS];
 	uint16_t pullDwn[total_ic][N_CHANNELS];
@@ -1337,6 +2133,8 @@ void LTC681x_run_openwire_single(uint8_t total_ic, // Number of ICs in the daisy
 	int8_t error;
 	int8_t i;
 	uint32_t conv_time=0;
+	adc_conversion conv = {0, 0, 0, NULL};
+	bool adcopt = ic[0].config.tx_data[0] & 0x01;
 
 	wakeup_sleep(total_ic);
 	LTC681x_clrcell();
@@ -1346,7 +2144,8 @@ void LTC681x_run_openwire_single(uint8_t total_ic, // Number of ICs in the daisy
 	{ 
 	  wakeup_idle(total_ic);
 	  LTC681x_adow(MD_26HZ_2KHZ,PULL_UP_CURRENT,CELL_CH_ALL,DCP_DISABLED);
-	  conv_time =LTC681x_pollAdc();
+	  LTC681x_conv_begin(&conv, ADC_CONV_CELL, MD_26HZ_2KHZ, adcopt, 0);
+	  conv_time = LTC681x_conv_wait(total_ic, &conv, NULL);
 	} 
 	
 	wakeup_idle(total_ic);
@@ -1365,7 +2164,8 @@ void LTC681x_run_openwire_single(uint8_t total_ic, // Number of ICs in the daisy
 	{  
 	  wakeup_idle(total_ic);
 	  LTC681x_adow(MD_26HZ_2KHZ,PULL_DOWN_CURRENT,CELL_CH_ALL,DCP_DISABLED);
-	  conv_time =LTC681x_pollAdc();
+	  LTC681x_conv_begin(&conv, ADC_CONV_CELL, MD_26HZ_2KHZ, adcopt, 0);
+	  conv_time = LTC681x_conv_wait(total_ic, &conv, NULL);
 	}
 	
 	wakeup_idle(total_ic);
@@ -1418,7 +2218,7 @@ void LTC681x_run_openwire_single(uint8_t total_ic, // Number of ICs in the daisy
 						  )
 {              
 	uint16_t OPENWIRE_THRESHOLD = 4000;
-	const uint8_t  N_CHANNELS = ic[0].ic_reg.cell_channels;
+	const uint8_t  N_CHANNELS = IC_REG(ic[0], cell_channels);
 
 	uint16_t pullUp[total_ic][N_CHANNELS];
 	uint16_t pullDwn[total_ic][N_CHANNELS];
@@ -1429,6 +2229,8 @@ void LTC681x_run_openwire_single(uint8_t total_ic, // Number of ICs in the daisy
 	int8_t n=0;
 	int8_t i,j,k;
 	uint32_t conv_time=0;
+	adc_conversion conv = {0, 0, 0, NULL};
+	bool adcopt = ic[0].config.tx_data[0] & 0x01;
 
 	wakeup_sleep(total_ic);
 	LTC681x_clrcell();
@@ -1438,7 +2240,8 @@ void LTC681x_run_openwire_single(uint8_t total_ic, // Number of ICs in the daisy
 	{ 
 		wakeup_idle(total_ic);
 		LTC681x_adow(MD_26HZ_2KHZ,PULL_UP_CURRENT,CELL_CH_ALL,DCP_DISABLED);
-		conv_time =LTC681x_pollAdc();
+		LTC681x_conv_begin(&conv, ADC_CONV_CELL, MD_26HZ_2KHZ, adcopt, 0);
+		conv_time = LTC681x_conv_wait(total_ic, &conv, NULL);
 	} 
 
 	wakeup_idle(total_ic);
@@ -1457,7 +2260,8 @@ void LTC681x_run_openwire_single(uint8_t total_ic, // Number of ICs in the daisy
 	{  
 	  wakeup_idle(total_ic);
 	  LTC681x_adow(MD_26HZ_2KHZ,PULL_DOWN_CURRENT,CELL_CH_ALL,DCP_DISABLED);
-	  conv_time =   LTC681x_pollAdc();
+	  LTC681x_conv_begin(&conv, ADC_CONV_CELL, MD_26HZ_2KHZ, adcopt, 0);
+	  conv_time = LTC681x_conv_wait(total_ic, &conv, NULL);
 	}
 
 	wakeup_idle(total_ic);
@@ -1592,7 +2396,7 @@ void LTC681x_run_gpio_openwire(uint8_t total_ic, // Number of ICs in the daisy c
 								)
  {				  
 	uint16_t OPENWIRE_THRESHOLD = 150;
-	const uint8_t  N_CHANNELS = ic[0].ic_reg.aux_channels +1;
+	const uint8_t  N_CHANNELS = IC_REG(ic[0], aux_channels) +1;
 	
 	uint16_t aux_val[total_ic][N_CHANNELS];
 	uint16_t pDwn[total_ic][N_CHANNELS];
@@ -1601,6 +2405,8 @@ void LTC681x_run_gpio_openwire(uint8_t total_ic, // Number of ICs in the daisy c
 	int8_t error;
 	int8_t i;
 	uint32_t conv_time=0;
+	adc_conversion conv = {0, 0, 0, NULL};
+	bool adcopt = ic[0].config.tx_data[0] & 0x01;
 
 	wakeup_sleep(total_ic); 
 	LTC681x_clraux();
@@ -1609,7 +2415,8 @@ void LTC681x_run_gpio_openwire(uint8_t total_ic, // Number of ICs in the daisy c
 	{ 
 	   wakeup_idle(total_ic);
 	   LTC681x_adax(MD_7KHZ_3KHZ, AUX_CH_ALL);
-	   conv_time= LTC681x_pollAdc();
+	   LTC681x_conv_begin(&conv, ADC_CONV_GPIO, MD_7KHZ_3KHZ, adcopt, 0);
+	   conv_time = LTC681x_conv_wait(total_ic, &conv, NULL);
 	}
 	
 	wakeup_idle(total_ic);
@@ -1629,7 +2436,8 @@ void LTC681x_run_gpio_openwire(uint8_t total_ic, // Number of ICs in the daisy c
 	{ 
 	   wakeup_idle(total_ic);
 	   LTC681x_axow(MD_7KHZ_3KHZ,PULL_DOWN_CURRENT);
-	   conv_time =LTC681x_pollAdc();
+	   LTC681x_conv_begin(&conv, ADC_CONV_GPIO, MD_7KHZ_3KHZ, adcopt, 0);
+	   conv_time = LTC681x_conv_wait(total_ic, &conv, NULL);
 	} 
 	
 	wakeup_idle(total_ic);
@@ -1687,8 +2495,11 @@ void LTC681x_clear_discharge(uint8_t total_ic, // Number of ICs in the daisy cha
 	{
 	   ic[i].config.tx_data[4] = 0;
 	   ic[i].config.tx_data[5] =ic[i].config.tx_data[5]&(0xF0);
-	   ic[i].configb.tx_data[0]=ic[i].configb.tx_data[0]&(0x0F); 
-	   ic[i].configb.tx_data[1]=ic[i].configb.tx_data[1]&(0xF0);
+	   if (ic[i].shadow != NULL)
+	   {
+	     ic[i].shadow->configb.tx_data[0]=ic[i].shadow->configb.tx_data[0]&(0x0F); 
+	     ic[i].shadow->configb.tx_data[1]=ic[i].shadow->configb.tx_data[1]&(0xF0);
+	   }
 	}
 }
 
@@ -1699,7 +2510,7 @@ void LTC681x_wrpwm(uint8_t total_ic, // Number of ICs in the daisy chain
                   )
 {
 	uint8_t cmd[2];
-	uint8_t write_buffer[256];
+	uint8_t write_buffer[6*BMS_TOTAL_IC];
 	uint8_t write_count = 0;
 	uint8_t c_ic = 0;
 	if (pwmReg == 0)
@@ -1713,6 +2524,15 @@ void LTC681x_wrpwm(uint8_t total_ic, // Number of ICs in the daisy chain
 	cmd[1] = 0x1C;
 	}
 	
+	if (total_ic > BMS_TOTAL_IC)
+	{
+		return;
+	}
+	if (LTC681x_claim_shadows(total_ic, ic) != 0)
+	{
+		return;
+	}
+	
 	for (uint8_t current_ic = 0; current_ic<total_ic; current_ic++)
 	{
 		if (ic->isospi_reverse == true)
@@ -1726,7 +2546,7 @@ void LTC681x_wrpwm(uint8_t total_ic, // Number of ICs in the daisy chain
 		
 		for (uint8_t data = 0; data<6; data++)
 		{
-			write_buffer[write_count] = ic[c_ic].pwm.tx_data[data];
+			write_buffer[write_count] = ic[c_ic].shadow->pwm.tx_data[data];
 			write_count++;
 		}
 	}
@@ -1740,14 +2560,22 @@ int8_t LTC681x_rdpwm(uint8_t total_ic, //Number of ICs in the system
                      cell_asic ic[] // A two dimensional array that will store the data
                     )
 {
-	const uint8_t BYTES_IN_REG = 8;
 	uint8_t cmd[4];
-	uint8_t read_buffer[256];
+	uint8_t *read_buffer = rx_frame;
 	int8_t pec_error = 0;
 	uint16_t data_pec;
 	uint16_t calc_pec;
 	uint8_t c_ic = 0;
 	
+	if (total_ic > BMS_TOTAL_IC)
+	{
+		return(-1);
+	}
+	if (LTC681x_claim_shadows(total_ic, ic) != 0)
+	{
+		return(-1);
+	}
+	
 	if (pwmReg == 0)
 	{
 		cmd[0] = 0x00;
@@ -1773,16 +2601,17 @@ int8_t LTC681x_rdpwm(uint8_t total_ic, //Number of ICs in the system
 		
 		for (int byte=0; byte<8; byte++)
 		{
-			ic[c_ic].pwm.rx_data[byte] = read_buffer[byte+(8*current_ic)];
+			ic[c_ic].shadow->pwm.rx_data[byte] = read_buffer[byte+(8*current_ic)];
 		}
 		
 		calc_pec = pec15_calc(6,&read_buffer[8*current_ic]);
 		data_pec = read_buffer[7+(8*current_ic)] | (read_buffer[6+(8*current_ic)]<<8);
 		if (calc_pec != data_pec )
 		{
-			ic[c_ic].pwm.rx_pec_match = 1;
+			LTC681x_isospi_reset();
+			ic[c_ic].shadow->pwm.rx_pec_match = 1;
 		}
-		else ic[c_ic].pwm.rx_pec_match = 0;
+		else ic[c_ic].shadow->pwm.rx_pec_match = 0;
 	}
 	return(pec_error);
 }
@@ -1794,7 +2623,7 @@ void LTC681x_wrsctrl(uint8_t total_ic, // Number of ICs in the daisy chain
                     )
 {
 	uint8_t cmd[2];
-    uint8_t write_buffer[256];
+    uint8_t write_buffer[6*BMS_TOTAL_IC];
     uint8_t write_count = 0;
     uint8_t c_ic = 0;
     if (sctrl_reg == 0)
@@ -1808,6 +2637,15 @@ void LTC681x_wrsctrl(uint8_t total_ic, // Number of ICs in the daisy chain
       cmd[1] = 0x1C;
     }
     
+    if (total_ic > BMS_TOTAL_IC)
+    {
+      return;
+    }
+    if (LTC681x_claim_shadows(total_ic, ic) != 0)
+    {
+      return;
+    }
+    
     for(uint8_t current_ic = 0; current_ic<total_ic;current_ic++)
     {
         if(ic->isospi_reverse == true){c_ic = current_ic;}
@@ -1816,7 +2654,7 @@ void LTC681x_wrsctrl(uint8_t total_ic, // Number of ICs in the daisy chain
 
         for(uint8_t data = 0; data<6;data++)
         {
-            write_buffer[write_count] = ic[c_ic].sctrl.tx_data[data];
+            write_buffer[write_count] = ic[c_ic].shadow->sctrl.tx_data[data];
             write_count++;
         }
     }
@@ -1830,12 +2668,21 @@ int8_t LTC681x_rdsctrl(uint8_t total_ic, // Number of ICs in the daisy chain
                       )	
 {
     uint8_t cmd[4];
-    uint8_t read_buffer[256];
+    uint8_t *read_buffer = rx_frame;
     int8_t pec_error = 0;
     uint16_t data_pec;
     uint16_t calc_pec;
     uint8_t c_ic = 0;
     
+    if (total_ic > BMS_TOTAL_IC)
+    {
+      return(-1);
+    }
+    if (LTC681x_claim_shadows(total_ic, ic) != 0)
+    {
+      return(-1);
+    }
+    
     if (sctrl_reg == 0)
     {
       cmd[0] = 0x00;
@@ -1857,16 +2704,17 @@ int8_t LTC681x_rdsctrl(uint8_t total_ic, // Number of ICs in the daisy chain
 		
         for(int byte=0; byte<8;byte++)
         {
-            ic[c_ic].sctrl.rx_data[byte] = read_buffer[byte+(8*current_ic)]; 	
+            ic[c_ic].shadow->sctrl.rx_data[byte] = read_buffer[byte+(8*current_ic)]; 	
         }
 		
         calc_pec = pec15_calc(6,&read_buffer[8*current_ic]);
         data_pec = read_buffer[7+(8*current_ic)] | (read_buffer[6+(8*current_ic)]<<8);
         if(calc_pec != data_pec )
         {
-            ic[c_ic].sctrl.rx_pec_match = 1;
+            LTC681x_isospi_reset();
+            ic[c_ic].shadow->sctrl.rx_pec_match = 1;
         }
-        else ic[c_ic].sctrl.rx_pec_match = 0;
+        else ic[c_ic].shadow->sctrl.rx_pec_match = 0;
 		
     }
     return(pec_error);
@@ -1883,13 +2731,13 @@ void LTC681x_stsctrl()
     
     cmd[0] = 0x00;
     cmd[1] = 0x19;
-    cmd_pec = pec15_calc(2, cmd);
+    cmd_pec = PEC15_CMD(0x00, 0x19);
     cmd[2] = (uint8_t)(cmd_pec >> 8);
     cmd[3] = (uint8_t)(cmd_pec);
     
-    cs_low(CS_PIN);
+    isospi_cs_low();
     spi_write_array(4,cmd);          
-    cs_high(CS_PIN);
+    isospi_cs_high();
 }
 
 /*
@@ -1909,9 +2757,19 @@ void LTC681x_wrcomm(uint8_t total_ic, //The number of ICs being written to
                    )
 {
 	uint8_t cmd[2]= {0x07 , 0x21};
-	uint8_t write_buffer[256];
+	uint8_t write_buffer[6*BMS_TOTAL_IC];
 	uint8_t write_count = 0;
 	uint8_t c_ic = 0;
+	
+	if (total_ic > BMS_TOTAL_IC)
+	{
+		return;
+	}
+	if (LTC681x_claim_shadows(total_ic, ic) != 0)
+	{
+		return;
+	}
+	
 	for (uint8_t current_ic = 0; current_ic<total_ic; current_ic++)
 	{
 		if (ic->isospi_reverse == true)
@@ -1925,7 +2783,7 @@ void LTC681x_wrcomm(uint8_t total_ic, //The number of ICs being written to
 	
 		for (uint8_t data = 0; data<6; data++)
 		{
-			write_buffer[write_count] = ic[c_ic].com.tx_data[data];
+			write_buffer[write_count] = ic[c_ic].shadow->com.tx_data[data];
 			write_count++;
 		}
 	}
@@ -1938,12 +2796,21 @@ int8_t LTC681x_rdcomm(uint8_t total_ic, //Number of ICs in the system
                      )
 {
 	uint8_t cmd[2]= {0x07 , 0x22};
-	uint8_t read_buffer[256];
+	uint8_t *read_buffer = rx_frame;
 	int8_t pec_error = 0;
 	uint16_t data_pec;
 	uint16_t calc_pec;
 	uint8_t c_ic=0;
 	
+	if (total_ic > BMS_TOTAL_IC)
+	{
+		return(-1);
+	}
+	if (LTC681x_claim_shadows(total_ic, ic) != 0)
+	{
+		return(-1);
+	}
+	
 	pec_error = read_68(total_ic, cmd, read_buffer);
 	
 	for (uint8_t current_ic = 0; current_ic<total_ic; current_ic++)
@@ -1959,16 +2826,17 @@ int8_t LTC681x_rdcomm(uint8_t total_ic, //Number of ICs in the system
 	
 		for (int byte=0; byte<8; byte++)
 		{
-			ic[c_ic].com.rx_data[byte] = read_buffer[byte+(8*current_ic)];
+			ic[c_ic].shadow->com.rx_data[byte] = read_buffer[byte+(8*current_ic)];
 		}
 		
 		calc_pec = pec15_calc(6,&read_buffer[8*current_ic]);
 		data_pec = read_buffer[7+(8*current_ic)] | (read_buffer[6+(8*current_ic)]<<8);
 		if (calc_pec != data_pec )
 		{
-			ic[c_ic].com.rx_pec_match = 1;
+			LTC681x_isospi_reset();
+			ic[c_ic].shadow->com.rx_pec_match = 1;
 		}
-		else ic[c_ic].com.rx_pec_match = 0;
+		else ic[c_ic].shadow->com.rx_pec_match = 0;
 	}
 	
     return(pec_error);
@@ -1982,17 +2850,17 @@ void LTC681x_stcomm(uint8_t len) //Length of data to be transmitted
 
 	cmd[0] = 0x07;
 	cmd[1] = 0x23;
-	cmd_pec = pec15_calc(2, cmd);
+	cmd_pec = PEC15_CMD(0x07, 0x23);
 	cmd[2] = (uint8_t)(cmd_pec >> 8);
 	cmd[3] = (uint8_t)(cmd_pec);
 
-	cs_low(CS_PIN);
+	isospi_cs_low();
 	spi_write_array(4,cmd);
 	for (int i = 0; i<len*3; i++)
 	{
 	  spi_read_byte(0xFF);
 	}
-	cs_high(CS_PIN);
+	isospi_cs_high();
 }
 
 /* Helper function that increments PEC counters */
@@ -2014,14 +2882,15 @@ void LTC681x_check_pec(uint8_t total_ic, //Number of ICs in the system
 		case CFGRB:
 		  for (int current_ic = 0 ; current_ic < total_ic; current_ic++)
 		  {
-			ic[current_ic].crc_count.pec_count = ic[current_ic].crc_count.pec_count + ic[current_ic].configb.rx_pec_match;
-			ic[current_ic].crc_count.cfgr_pec = ic[current_ic].crc_count.cfgr_pec + ic[current_ic].configb.rx_pec_match;
+			if (ic[current_ic].shadow == NULL) continue;
+			ic[current_ic].crc_count.pec_count = ic[current_ic].crc_count.pec_count + ic[current_ic].shadow->configb.rx_pec_match;
+			ic[current_ic].crc_count.cfgr_pec = ic[current_ic].crc_count.cfgr_pec + ic[current_ic].shadow->configb.rx_pec_match;
 		  }
 		break;
 		case CELL:
 		  for (int current_ic = 0 ; current_ic < total_ic; current_ic++)
 		  {
-			for (int i=0; i<ic[0].ic_reg.num_cv_reg; i++)
+			for (int i=0; i<IC_REG(ic[0], num_cv_reg); i++)
 			{
 			  ic[current_ic].crc_count.pec_count = ic[current_ic].crc_count.pec_count + ic[current_ic].cells.pec_match[i];
 			  ic[current_ic].crc_count.cell_pec[i] = ic[current_ic].crc_count.cell_pec[i] + ic[current_ic].cells.pec_match[i];
@@ -2031,7 +2900,7 @@ void LTC681x_check_pec(uint8_t total_ic, //Number of ICs in the system
 		case AUX:
 		  for (int current_ic = 0 ; current_ic < total_ic; current_ic++)
 		  {
-			for (int i=0; i<ic[0].ic_reg.num_gpio_reg; i++)
+			for (int i=0; i<IC_REG(ic[0], num_gpio_reg); i++)
 			{
 			  ic[current_ic].crc_count.pec_count = ic[current_ic].crc_count.pec_count + (ic[current_ic].aux.pec_match[i]);
 			  ic[current_ic].crc_count.aux_pec[i] = ic[current_ic].crc_count.aux_pec[i] + (ic[current_ic].aux.pec_match[i]);
@@ -2043,7 +2912,7 @@ void LTC681x_check_pec(uint8_t total_ic, //Number of ICs in the system
 		  for (int current_ic = 0 ; current_ic < total_ic; current_ic++)
 		  {
 
-			for (int i=0; i<ic[0].ic_reg.num_stat_reg-1; i++)
+			for (int i=0; i<IC_REG(ic[0], num_stat_reg)-1; i++)
 			{
 			  ic[current_ic].crc_count.pec_count = ic[current_ic].crc_count.pec_count + ic[current_ic].stat.pec_match[i];
 			  ic[current_ic].crc_count.stat_pec[i] = ic[current_ic].crc_count.stat_pec[i] + ic[current_ic].stat.pec_match[i];
@@ -2080,6 +2949,25 @@ void LTC681x_reset_crc_count(uint8_t total_ic, //Number of ICs in the system
 	}
 }
 
+/* Sets how many times a register group that fails the PEC check is read again */
+void LTC681x_set_read_retries(uint8_t retries // Retries per register read
+							 )
+{
+	read_retries = (retries > READ_RETRY_MAX) ? READ_RETRY_MAX : retries;
+}
+
+/* Returns the register read retry counters */
+const retry_counter *LTC681x_retry_stats()
+{
+	return(&retry_stats);
+}
+
+/* Clears the register read retry counters */
+void LTC681x_reset_retry_stats()
+{
+	memset(&retry_stats, 0, sizeof(retry_stats));
+}
+
 /* Helper function to initialize CFG variables */
 void LTC681x_init_cfg(uint8_t total_ic, //Number of ICs in the system
 					  cell_asic *ic //A two dimensional array that stores the data
@@ -2181,3 +3069,105 @@ void LTC681x_set_cfgr_ov(uint8_t nIC, cell_asic *ic,uint16_t ov)
 	ic[nIC].config.tx_data[2] = ic[nIC].config.tx_data[2]&0x0F;
 	ic[nIC].config.tx_data[2] = ic[nIC].config.tx_data[2]|((0x000F & tmp)<<4);
 }
+
+/* Powers of ten LTC681x_format_fixed() subtracts, so no digit needs a 32 bit division */
+static const uint32_t pow10_table[10] PROGMEM = {1000000000UL, 100000000UL, 10000000UL, 1000000UL, 100000UL,
+                                                 10000UL, 1000UL, 100UL, 10UL, 1UL};
+
+/* "00" to "99", two digits of a 16 bit value per lookup */
+static const char digit_pairs[200] PROGMEM =
+{
+	'0','0','0','1','0','2','0','3','0','4','0','5','0','6','0','7','0','8','0','9',
+	'1','0','1','1','1','2','1','3','1','4','1','5','1','6','1','7','1','8','1','9',
+	'2','0','2','1','2','2','2','3','2','4','2','5','2','6','2','7','2','8','2','9',
+	'3','0','3','1','3','2','3','3','3','4','3','5','3','6','3','7','3','8','3','9',
+	'4','0','4','1','4','2','4','3','4','4','4','5','4','6','4','7','4','8','4','9',
+	'5','0','5','1','5','2','5','3','5','4','5','5','5','6','5','7','5','8','5','9',
+	'6','0','6','1','6','2','6','3','6','4','6','5','6','6','6','7','6','8','6','9',
+	'7','0','7','1','7','2','7','3','7','4','7','5','7','6','7','7','7','8','7','9',
+	'8','0','8','1','8','2','8','3','8','4','8','5','8','6','8','7','8','8','8','9',
+	'9','0','9','1','9','2','9','3','9','4','9','5','9','6','9','7','9','8','9','9'
+};
+
+/* Writes value / 10^decimals as decimal text without floating point */
+uint8_t LTC681x_format_fixed(int32_t value, // Scaled integer to print
+                             uint8_t decimals, // Digits after the decimal point
+                             char *buf // Text output, FIXED_TEXT_LEN bytes
+                            )
+{
+	uint32_t magnitude = (uint32_t)value;
+	char digits[10]; // One per pow10_table entry
+	uint8_t len = 0;
+	uint8_t place = 0;
+	uint8_t units;
+
+	if (decimals > 9)
+	{
+		decimals = 9;
+	}
+	units = 9 - decimals; // pow10_table entry of the digit before the decimal point
+	if (value < 0)
+	{
+		buf[len++] = '-';
+		magnitude = 0UL - magnitude;
+	}
+
+	if (magnitude < 0x10000UL) // Cell codes: five digits from one subtraction loop and two pair lookups
+	{
+		uint16_t low = (uint16_t)magnitude;
+		uint16_t pair;
+
+		digits[5] = '0';
+		while (low >= 10000)
+		{
+			low -= 10000;
+			digits[5]++;
+		}
+		pair = (uint16_t)(((uint32_t)low*5243) >> 19); // low/100, exact below 10000
+		low -= pair*100;
+		digits[6] = pgm_read_byte_near(digit_pairs + 2*pair);
+		digits[7] = pgm_read_byte_near(digit_pairs + 2*pair + 1);
+		digits[8] = pgm_read_byte_near(digit_pairs + 2*low);
+		digits[9] = pgm_read_byte_near(digit_pairs + 2*low + 1);
+		for (place = 0; place < 5; place++)
+		{
+			digits[place] = '0';
+		}
+	}
+	else
+	{
+		for (place = 0; place < 10; place++)
+		{
+			uint32_t step = pgm_read_dword_near(pow10_table + place);
+			digits[place] = '0';
+			while (magnitude >= step) // At most 9 subtractions per digit
+			{
+				magnitude -= step;
+				digits[place]++;
+			}
+		}
+	}
+
+	place = 0;
+	while (place < units && digits[place] == '0') // Drop leading zeros, keep the units digit
+	{
+		place++;
+	}
+	for (; place < 10; place++)
+	{
+		buf[len++] = digits[place];
+		if (place == units && decimals != 0)
+		{
+			buf[len++] = '.';
+		}
+	}
+	buf[len] = '\0';
+	return(len);
+}
+
+/* Internal die temperature = itmp * 100 uV / 7.5 mV/degC - 273 degC, in 0.01 degC */
+int32_t LTC681x_die_temp(uint16_t itmp // Internal die temperature code
+                        )
+{
+	return((int32_t)(((uint32_t)itmp*4 + 1)/3) - 27300);
+}
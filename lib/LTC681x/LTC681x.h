@@ -56,7 +56,9 @@
 #include <Arduino.h>
 #endif
 
-#define IC_LTC6813
+#ifndef BMS_IC_TYPE
+#define BMS_IC_TYPE 0 //!< 6811, 6812 or 6813 fixes the register layout at compile time, 0 takes it from ic_reg at run time
+#endif
 
 #define MD_422HZ_1KHZ 0
 #define MD_27KHZ_14KHZ 1
@@ -105,19 +107,52 @@
 #define PULL_UP_CURRENT 1
 #define PULL_DOWN_CURRENT 0
 
+#define ADC_CONV_CELL 0
+#define ADC_CONV_GPIO 1
+#define ADC_CONV_STAT 2
+#define ADC_CONV_CELL_GPIO 3
+#define ADC_CONV_CELL_SC 4
+
+/* Measurement plan step operations, see LTC681x_run_plan() */
+#define PLAN_ADCV 0   //!< Cell conversion, arg is the cell channel selection
+#define PLAN_ADAX 1   //!< GPIO conversion, arg is the GPIO channel selection
+#define PLAN_ADSTAT 2 //!< Status conversion, arg is the status channel selection
+#define PLAN_ADCVAX 3 //!< Combined cell and GPIO 1, 2 conversion, arg unused
+#define PLAN_ADCVSC 4 //!< Combined cell and sum of cells conversion, arg unused
+#define PLAN_RDCV 5   //!< Cell voltage register read, arg is the register group, 0 for every group the last cell conversion wrote
+#define PLAN_RDAUX 6  //!< Aux register read, arg is the register group, 0 for all
+#define PLAN_RDSTAT 7 //!< Status register read, arg is the register group, 0 for all
+
 #define NUM_RX_BYT 8
+#define MAX_CV_REG 6 //!< Cell voltage register groups on the largest part, RDCVA to RDCVF
+#define FIXED_TEXT_LEN 13 //!< Sign, 10 digits, decimal point and NUL from LTC681x_format_fixed()
+#define READ_RETRY_MAX 3 //!< Most retries LTC681x_set_read_retries() accepts per register read
 #define CELL 1
 #define AUX 2
 #define STAT 3
 #define CFGR 0
 #define CFGRB 4
-#define CS_PIN 53 //53 for atmega2560, //10 for Uno
+#define CS_PIN 53 //53 for atmega2560, //10 for Uno. Chip select used until LTC681x_chain_select() picks another chain
+
+#ifndef BMS_TOTAL_IC
+#define BMS_TOTAL_IC 1 //!< Largest daisy chain the driver is built for, set with -D BMS_TOTAL_IC=n
+#endif
+#if BMS_TOTAL_IC > 31
+#error "BMS_TOTAL_IC must be 31 or less, SPI transfer lengths are 8 bit"
+#endif
+#ifndef BMS_SHADOW_IC
+#define BMS_SHADOW_IC BMS_TOTAL_IC //!< ICs that can hold COMM, PWM, S control and CFGRB shadows, 0 for a measurement only build
+#endif
+#define ISOSPI_IDLE_US 4000UL //!< tIDLE is 4.3 ms minimum, less a margin for the next frame to start
+#define ISOSPI_SLEEP_US 1700000UL //!< tSLEEP is 1.8 s minimum, less a margin for the next command to arrive
+#define BMS_FRAME_LEN (4+(NUM_RX_BYT*BMS_TOTAL_IC)) //!< Command plus 6 data and 2 PEC bytes per IC
 
 /*! Cell Voltage data structure. */
 typedef struct
 {
   uint16_t c_codes[18]; //!< Cell Voltage Codes
   uint8_t pec_match[6]; //!< If a PEC error was detected during most recent read cmd
+  uint32_t stale; //!< Bit n set when c_codes[n] was not converted by the last channel selective read
 } cv;
 
 /*! AUX Reg Voltage Data structure */
@@ -155,6 +190,17 @@ typedef struct
   uint16_t stat_pec[2]; //!< Status register data PEC error count
 } pec_counter;
 
+/*! Register read retry counters, for the whole daisy chain */
+typedef struct
+{
+  uint16_t cell_retry[6]; //!< Re-reads of each cell voltage register group
+  uint16_t aux_retry[4];  //!< Re-reads of each aux register group
+  uint16_t stat_retry[2]; //!< Re-reads of each status register group
+  uint16_t other_retry;   //!< Re-reads of the configuration, PWM, S control and COMM registers
+  uint16_t recovered;     //!< Reads that passed the PEC check after retrying
+  uint16_t failed;        //!< Reads that still failed the PEC check when the retries ran out
+} retry_counter;
+
 /*! Register configuration structure */
 typedef struct
 {
@@ -166,38 +212,118 @@ typedef struct
   uint8_t num_stat_reg;  //!< Number of  Status register
 } register_cfg;
 
-/*! Cell variable structure */
+/*! Register layout of the part BMS_IC_TYPE names, so loops over it have constant bounds */
+#if BMS_IC_TYPE == 6811
+constexpr register_cfg BMS_IC_REG = {12, 4, 6, 4, 2, 3};
+#elif BMS_IC_TYPE == 6812
+constexpr register_cfg BMS_IC_REG = {15, 4, 9, 5, 4, 3};
+#elif BMS_IC_TYPE == 6813
+constexpr register_cfg BMS_IC_REG = {18, 4, 9, 6, 4, 3};
+#elif BMS_IC_TYPE != 0
+#error "BMS_IC_TYPE must be 6811, 6812, 6813 or 0"
+#endif
+
+#if BMS_IC_TYPE
+#define IC_REG(ic, field) (BMS_IC_REG.field) //!< Compile time register layout, ic is unused
+#define BMS_CV_REG (BMS_IC_REG.num_cv_reg) //!< Cell voltage register groups the driver reserves buffers for
+#else
+#define IC_REG(ic, field) ((ic).ic_reg.field) //!< Register layout set by the part's init_reg_limits()
+#define BMS_CV_REG MAX_CV_REG //!< Cell voltage register groups the driver reserves buffers for
+#endif
+
+/*! ADC conversion tracking structure */
 typedef struct
 {
-  ic_register config;
-  ic_register configb;
-  cv  cells;
-  ax  aux;
-  st  stat;
+  uint32_t start_us;    //!< micros() when the conversion command was sent
+  uint32_t duration_us; //!< Expected conversion time from the data sheet conversion time tables
+  uint8_t busy;         //!< Set until the conversion has been confirmed complete
+  void (*on_complete)(void); //!< Called once when the conversion is confirmed complete, may be NULL
+} adc_conversion;
+
+/*! One step of a measurement plan */
+typedef struct
+{
+  uint8_t op;       //!< PLAN_ADCV to PLAN_RDSTAT
+  uint8_t arg;      //!< Channel selection for conversions, register group for reads
+  uint32_t time_us; //!< Conversion time, or read time, of the last run
+  int8_t error;     //!< PEC status of the last run, reads only
+} meas_step;
+
+/*! Measurement plan run by LTC681x_run_plan() */
+typedef struct
+{
+  meas_step *steps;  //!< Steps in the order their results are needed
+  uint8_t count;     //!< Number of steps
+  uint8_t MD;        //!< ADC Mode for every conversion
+  uint8_t DCP;       //!< Discharge Permit for cell conversions
+  bool adcopt;       //!< The adcopt bit in the configuration register
+  void (*idle_task)(void); //!< Work to run while a conversion is pending, NULL to sleep
+  uint32_t total_us; //!< Time the last run took from the first wakeup to the last read
+} meas_plan;
+
+/*! Register shadows the measurement loop never touches, see LTC681x_claim_shadows() */
+typedef struct
+{
+  ic_register configb; //!< Configuration register B, LTC6812 and LTC6813 only
   ic_register com;
   ic_register pwm;
   ic_register pwmb;
   ic_register sctrl;
   ic_register sctrlb;
   uint8_t sid[6];
+} ic_shadow;
+
+/*! Cell variable structure */
+typedef struct
+{
+  ic_register config;
+  cv  cells;
+  ax  aux;
+  st  stat;
+  ic_shadow *shadow; //!< Cold register shadows, NULL until claimed
   bool isospi_reverse;
   pec_counter crc_count;
-  register_cfg ic_reg;
+#if BMS_IC_TYPE == 0
+  register_cfg ic_reg; //!< Only kept when the part is chosen at run time
+#endif
   long system_open_wire;
 } cell_asic;
 
+/*! One daisy chain on its own chip select */
+typedef struct
+{
+  uint8_t cs_pin;      //!< Chip select of the chain
+  uint8_t total_ic;    //!< Number of ICs in the chain
+  cell_asic *ic;       //!< The chain's ICs, total_ic entries
+  adc_conversion conv; //!< Conversion running on the chain
+  uint8_t ready_ic;    //!< isoSPI wake state, kept here while another chain is selected
+  uint8_t awake_ic;
+  uint32_t frame_us;
+  uint32_t cmd_us;
+} bms_chain;
+
 /*!
- Wake isoSPI up from IDlE state and enters the READY state
+ Wake isoSPI up from IDlE state and enters the READY state. Sends nothing if
+ the driver has talked to the whole chain within tIDLE.
  @return void
  */
 void wakeup_idle(uint8_t total_ic);//!< Number of ICs in the daisy chain
 
 /*!
- Wake the LTC681x from the sleep state 
+ Wake the LTC681x from the sleep state. Falls back to wakeup_idle() if the
+ driver has sent the whole chain a command within tSLEEP.
  @return void  
  */
 void wakeup_sleep(uint8_t total_ic); //!< Number of ICs in the daisy chain
 
+/*!
+ Forgets the wake state tracked by wakeup_idle() and wakeup_sleep(), so the next
+ call sends its wakeup pulses. Use after anything the driver cannot see, such
+ as a power cycle of the chain. PEC errors do this automatically.
+ @return void
+ */
+void LTC681x_isospi_reset();
+
 /*!
  Sends a command to the BMS IC. This code will calculate the PEC code for the transmitted command
  @return void  
@@ -230,6 +356,44 @@ int8_t read_68( uint8_t total_ic, //!< Number of ICs in the daisy chain
 uint16_t pec15_calc(uint8_t len, //!< The length of the data array being passed to the function
                     uint8_t *data //!< The array of data that the PEC will be generated from
                    );
+
+#define PEC15_SEED 16 //!< PEC15 remainder before any data has been folded in
+#define PEC15_FINAL(remainder) ((uint16_t)((remainder)*2)) //!< PEC to transmit for a running remainder, the CRC15 has a 0 in the LSB
+
+/*!
+ Folds one byte into a running PEC15 remainder, so a PEC can be built up as the
+ bytes arrive. Start from PEC15_SEED and finish with PEC15_FINAL().
+ @returns The updated remainder
+ */
+uint16_t pec15_update(uint16_t remainder, //!< Remainder so far
+                      uint8_t data //!< Next byte
+                     );
+
+/*!
+ Folds a block of bytes into a running PEC15 remainder, two bytes per table step
+ @returns The updated remainder
+ */
+uint16_t pec15_update_block(uint16_t remainder, //!< Remainder so far
+                            uint8_t len, //!< Number of bytes to fold in
+                            const uint8_t *data //!< Bytes to fold in
+                           );
+
+/*! Bitwise PEC15 of the remaining bits of one byte, for PEC15_CMD() */
+constexpr uint16_t pec15_const_bits(uint16_t remainder, uint8_t bits)
+{
+  return(bits == 0 ? remainder :
+         pec15_const_bits((uint16_t)(((remainder & 0x4000) ? ((remainder << 1) ^ 0x4599) : (remainder << 1)) & 0x7FFF), bits - 1));
+}
+
+/*!
+ PEC15 of a two byte command word, evaluated by the compiler when both bytes
+ are constants so fixed commands carry no run time PEC cost
+ @returns The PEC to transmit after the command word
+ */
+constexpr uint16_t PEC15_CMD(uint8_t cmd0, uint8_t cmd1)
+{
+  return(PEC15_FINAL(pec15_const_bits(pec15_const_bits(PEC15_SEED ^ ((uint16_t)cmd0 << 7), 8) ^ ((uint16_t)cmd1 << 7), 8)));
+}
 				   
 /*!
  Write the LTC681x CFGRA register
@@ -327,6 +491,25 @@ uint8_t LTC681x_rdcv(uint8_t reg, //!< Controls which cell voltage register is r
                      cell_asic *ic //!< Array of the parsed cell codes
                     );
 
+/*!
+ Returns the cells converted by a cell channel selection, bit n for c_codes[n]
+ @return uint32_t, cell mask
+ */
+uint32_t LTC681x_cv_cells(uint8_t CH //!< Cell channel selection used for the conversion, CELL_CH_ALL to CELL_CH_6and12
+                         );
+
+/*!
+ Reads back only the cell voltage register groups that hold cells converted with channel selection CH.
+ Cells that were not converted are flagged in cells.stale instead of being read again.
+ @return int8_t, PEC Status.
+  0: No PEC error detected
+ -1: PEC error detected, retry read
+ */
+int8_t LTC681x_rdcv_ch(uint8_t CH, //!< Cell channel selection used for the conversion
+                       uint8_t total_ic, //!< The number of ICs in the system
+                       cell_asic *ic //!< Array of the parsed cell codes
+                      );
+
 /*! 
  Reads and parses the LTC681x auxiliary registers.
  The function is used to read the  parsed GPIO codes of the LTC681x. 
@@ -362,6 +545,32 @@ void LTC681x_rdcv_reg(uint8_t reg, //!< Determines which cell voltage register i
                       uint8_t *data //!< An array of the unparsed cell codes
                      );				   
 
+/*!
+ Queues the readback of every cell voltage register on the interrupt driven
+ SPI engine and returns straight away. Wake the chain first, then collect the
+ result with LTC681x_rdcv_finish().
+ @return int8_t, 0 when queued, -1 if a readback is already running or the engine queue is full
+ */
+int8_t LTC681x_rdcv_start(uint8_t total_ic, //!< The number of ICs in the system
+                          cell_asic *ic //!< Used for the number of cell voltage registers
+                         );
+
+/*!
+ Checks a readback started by LTC681x_rdcv_start() without blocking
+ @return uint8_t, 1 while the registers are still being read
+ */
+uint8_t LTC681x_rdcv_busy();
+
+/*!
+ Waits for the readback started by LTC681x_rdcv_start() and parses the cell codes
+ @return int8_t, PEC Status.
+  0: No PEC error detected
+ >0: Number of register groups that failed the PEC check
+ */
+int8_t LTC681x_rdcv_finish(uint8_t total_ic, //!< The number of ICs in the system
+                           cell_asic *ic //!< Array of the parsed cell codes
+                          );
+
 /*! 
  Read the raw data from the LTC681x auxiliary register
  The function reads a single GPIO voltage register and stores the read data in the *data point as a byte array. 
@@ -409,6 +618,150 @@ uint8_t LTC681x_pladc();
   */
 uint32_t LTC681x_pollAdc();
 
+/*!
+ Looks up the expected conversion time of an ADC command
+ @return uint32_t, conversion time in microseconds
+ */
+uint32_t LTC681x_conv_time(uint8_t conv_type, //!< ADC_CONV_CELL, ADC_CONV_GPIO, ADC_CONV_STAT, ADC_CONV_CELL_GPIO or ADC_CONV_CELL_SC
+                           uint8_t MD, //!< ADC Mode
+                           bool adcopt, //!< The adcopt bit in the configuration register
+                           uint8_t ch //!< Channel selection sent with the command, 0 for all channels
+                          );
+
+/*!
+ Starts tracking a conversion whose command has just been sent
+ @return void
+ */
+void LTC681x_conv_begin(adc_conversion *conv, //!< Conversion to track
+                        uint8_t conv_type, //!< ADC_CONV_CELL, ADC_CONV_GPIO, ADC_CONV_STAT, ADC_CONV_CELL_GPIO or ADC_CONV_CELL_SC
+                        uint8_t MD, //!< ADC Mode
+                        bool adcopt, //!< The adcopt bit in the configuration register
+                        uint8_t ch //!< Channel selection sent with the command, 0 for all channels
+                       );
+
+/*!
+ Starts a cell voltage conversion without waiting for it
+ @return void
+ */
+void LTC681x_adcv_start(uint8_t MD, //!< ADC Mode
+                        uint8_t DCP, //!< Discharge Permit
+                        uint8_t CH, //!< Cell Channels to be measured
+                        bool adcopt, //!< The adcopt bit in the configuration register
+                        adc_conversion *conv //!< Conversion handle filled in by the function
+                       );
+
+/*!
+ Starts a GPIO conversion without waiting for it
+ @return void
+ */
+void LTC681x_adax_start(uint8_t MD, //!< ADC Mode
+                        uint8_t CHG, //!< GPIO Channels to be measured
+                        bool adcopt, //!< The adcopt bit in the configuration register
+                        adc_conversion *conv //!< Conversion handle filled in by the function
+                       );
+
+/*!
+ Starts a status group conversion without waiting for it
+ @return void
+ */
+void LTC681x_adstat_start(uint8_t MD, //!< ADC Mode
+                          uint8_t CHST, //!< Stat Channels to be measured
+                          bool adcopt, //!< The adcopt bit in the configuration register
+                          adc_conversion *conv //!< Conversion handle filled in by the function
+                         );
+
+/*!
+ Checks a conversion without blocking. Once the expected conversion time has
+ passed the chain is polled once with PLADC to confirm the result is ready,
+ and on_complete is called.
+ @return uint8_t, 1 when the conversion is complete, 0 while it is still running
+ */
+uint8_t LTC681x_conv_poll(uint8_t total_ic, //!< Number of ICs in the daisy chain
+                          adc_conversion *conv //!< Conversion to check
+                         );
+
+/*!
+ Waits for a conversion, running idle_task while the ADC converts instead of
+ holding CS low for the whole conversion
+ @return uint32_t, microseconds from the conversion command to completion
+ */
+uint32_t LTC681x_conv_wait(uint8_t total_ic, //!< Number of ICs in the daisy chain
+                           adc_conversion *conv, //!< Conversion to wait for
+                           void (*idle_task)(void) //!< Work to run while waiting, NULL to sleep until the expected completion time
+                          );
+
+/*!
+ Hands every IC without one a COMM, PWM, S control and CFGRB register shadow
+ from a pool of BMS_SHADOW_IC. The functions using those registers claim them
+ on their first call; claim them before filling in tx_data by hand.
+ Shadows are never returned to the pool.
+ @return int8_t, 0 when every IC has a shadow, -1 if the pool ran out
+ */
+int8_t LTC681x_claim_shadows(uint8_t total_ic, //!< Number of ICs in the daisy chain
+                             cell_asic *ic //!< A two dimensional array that will store the data
+                            );
+
+/*!
+ Works out the RAM a chain takes: the cell_asic array, the register shadows
+ and the driver's frame buffers sized for total_ic ICs
+ @return uint16_t, bytes
+ */
+uint16_t LTC681x_ram_budget(uint8_t total_ic, //!< Number of ICs, BMS_TOTAL_IC in a build for that chain
+                            uint8_t shadow_ic //!< ICs given register shadows, BMS_SHADOW_IC
+                           );
+
+/*!
+ Sets up a daisy chain on its own chip select. The pin must already be an output held high.
+ @return void
+ */
+void LTC681x_chain_init(bms_chain *chain, //!< Chain to set up
+                        uint8_t cs_pin, //!< Chip select of the chain
+                        uint8_t total_ic, //!< Number of ICs in the chain
+                        cell_asic *ic //!< The chain's ICs
+                       );
+
+/*!
+ Points the driver at a daisy chain. Every driver function after this talks to
+ that chain's chip select and uses its wake state, pass chain->total_ic and
+ chain->ic to them. Waits for queued SPI transactions to finish first.
+ @return void
+ */
+void LTC681x_chain_select(bms_chain *chain //!< Chain to talk to
+                         );
+
+/*!
+ Measures the cells of several daisy chains. A conversion is started on every
+ chain first, then each chain is read back in turn while the ones after it are
+ still converting, so the total time is about one conversion plus one readback
+ per chain. Only the register groups holding cells selected by CH are read.
+ @return int8_t, PEC Status.
+  0: No PEC error detected
+ -1: PEC error detected on at least one chain
+ */
+int8_t LTC681x_chains_rdcv(bms_chain *chains, //!< Chains to measure
+                           uint8_t count, //!< Number of chains
+                           uint8_t MD, //!< ADC Mode
+                           uint8_t DCP, //!< Discharge Permit
+                           uint8_t CH, //!< Cell Channels to be measured
+                           bool adcopt, //!< The adcopt bit in the configuration register
+                           void (*idle_task)(void) //!< Work to run while a conversion is pending, NULL to sleep
+                          );
+
+/*!
+ Runs a measurement plan: each conversion is started, waited for and its
+ registers read in one sequence with a single wakeup. A conversion that
+ follows a read is started before that read when it does not write the
+ registers being read, so the readback overlaps the conversion. Every step
+ records its time in time_us and reads record their PEC status in error.
+ @return int8_t, PEC Status.
+  0: No PEC error detected
+ -1: PEC error detected in at least one read step
+ */
+int8_t LTC681x_run_plan(uint8_t total_ic, //!< Number of ICs in the daisy chain
+                        cell_asic *ic, //!< A two dimensional array that will store the data
+                        meas_plan *plan //!< Plan to run
+                       );
+
 /*! 
  Clears the LTC681x Cell voltage registers
  The command clears the cell voltage registers and initializes all values to 1.
@@ -673,6 +1026,26 @@ void LTC681x_check_pec(uint8_t total_ic, //!< Number of ICs in the daisy chain
                        cell_asic *ic //!< A two dimensional array that will store the data
 					   );
 
+/*!
+ Sets how many times a register group that fails the PEC check is read again before the error is
+ reported. Only the failing group is re-read. A read that passes on a retry does not count in crc_count.
+ @return void
+ */
+void LTC681x_set_read_retries(uint8_t retries //!< Retries per register read, 0 to READ_RETRY_MAX
+                             );
+
+/*!
+ Returns the register read retry counters
+ @return const retry_counter*, counters for the whole daisy chain
+ */
+const retry_counter *LTC681x_retry_stats();
+
+/*!
+ Clears the register read retry counters
+ @return void
+ */
+void LTC681x_reset_retry_stats();
+
 /*!
  Helper Function that resets the PEC error counters
  @return void	 
@@ -766,6 +1139,23 @@ void LTC681x_set_cfgr_ov(uint8_t nIC, //!< Current IC
                          cell_asic *ic, //!< A two dimensional array that will store the data
                          uint16_t ov //!< The OV value
 						 );		
+
+/*!
+ Writes value / 10^decimals as decimal text without floating point, e.g. a
+ cell code with 4 decimals gives volts. buf needs FIXED_TEXT_LEN bytes.
+ @return uint8_t, characters written not counting the terminating NUL
+ */
+uint8_t LTC681x_format_fixed(int32_t value, //!< Scaled integer to print
+                             uint8_t decimals, //!< Digits after the decimal point, 0 to 9
+                             char *buf //!< Text output, NUL terminated
+                            );
+
+/*!
+ Converts the internal die temperature code, stat_codes[1], with integer math
+ @return int32_t, die temperature in 0.01 degC
+ */
+int32_t LTC681x_die_temp(uint16_t itmp //!< Internal die temperature code, 100 uV per LSB
+                        );
 						 
 #ifdef MBED
 //This needs a PROGMEM =  when using with a LINDUINO
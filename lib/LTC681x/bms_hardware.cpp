@@ -47,8 +47,117 @@ Copyright 2017 Linear Technology Corp. (LTC)
 #include "LT_SPI.h"
 #include <SPI.h>
 
+static volatile uint8_t spi_count = 0;
+
+#ifdef __AVR__
+/*
+Transactions queued on the interrupt driven engine. spi_queue[spi_head] is the
+frame on the wire, spi_index counts the bytes of it already shifted.
+*/
+static spi_transaction *volatile spi_queue[SPI_QUEUE_LEN];
+static volatile uint8_t spi_head = 0;
+static volatile uint8_t spi_index = 0;
+
+/* Pulls CS low and loads the first byte, the SPI interrupt does the rest */
+static void spi_start(spi_transaction *trans)
+{
+  output_low(trans->cs_pin);
+  spi_index = 0;
+  SPCR |= _BV(SPIE);
+  SPDR = trans->tx_len ? trans->tx_data[0] : 0xFF;
+}
+
+/* Runs once per byte: stores the byte just received and loads the next one */
+ISR(SPI_STC_vect)
+{
+  spi_transaction *trans = spi_queue[spi_head];
+  uint8_t rx = SPDR;
+  uint8_t index = spi_index;
+
+  if (index >= trans->tx_len)
+  {
+    trans->rx_data[index - trans->tx_len] = rx;
+  }
+  index++;
+  spi_index = index;
+
+  if (index < trans->tx_len + trans->rx_len)
+  {
+    SPDR = (index < trans->tx_len) ? trans->tx_data[index] : 0xFF;
+    return;
+  }
+
+  output_high(trans->cs_pin);
+  trans->done = 1;
+  spi_head = (spi_head + 1) % SPI_QUEUE_LEN;
+  spi_count--;
+  if (spi_count)
+  {
+    spi_start(spi_queue[spi_head]);
+  }
+  else
+  {
+    SPCR &= ~_BV(SPIE);   // leave SPIF to polled users such as the SD card
+  }
+  if (trans->on_complete != NULL)
+  {
+    trans->on_complete(trans);
+  }
+}
+#endif
+
+int8_t spi_submit(spi_transaction *trans)
+{
+  if (trans->tx_len + trans->rx_len == 0)
+  {
+    return(-1);
+  }
+  trans->done = 0;
+
+#ifdef __AVR__
+  uint8_t sreg = SREG;
+  noInterrupts();
+  if (spi_count == SPI_QUEUE_LEN)
+  {
+    SREG = sreg;
+    return(-1);
+  }
+  spi_queue[(spi_head + spi_count) % SPI_QUEUE_LEN] = trans;
+  spi_count++;
+  if (spi_count == 1)
+  {
+    spi_start(trans);
+  }
+  SREG = sreg;
+#else
+  // No SPI interrupt to hand the bytes to, shift them before returning
+  output_low(trans->cs_pin);
+  spi_write_read(trans->tx_data, trans->tx_len, trans->rx_data, trans->rx_len);
+  output_high(trans->cs_pin);
+  trans->done = 1;
+  if (trans->on_complete != NULL)
+  {
+    trans->on_complete(trans);
+  }
+#endif
+  return(0);
+}
+
+uint8_t spi_busy()
+{
+  return(spi_count != 0);
+}
+
+void spi_wait_idle()
+{
+  while (spi_count != 0)
+  {
+  }
+}
+
 void cs_low(uint8_t pin)
 {
+  spi_wait_idle();
   output_low(pin);
 }
 
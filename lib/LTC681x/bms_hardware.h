@@ -48,6 +48,24 @@ Copyright 2017 Linear Technology Corp. (LTC)
 
 #include <stdint.h>
 
+#define SPI_QUEUE_LEN 6 //!< Transactions the interrupt driven SPI engine can hold, one per cell voltage register group
+
+/*!
+ One chip select frame for the interrupt driven SPI engine. tx_len bytes are
+ sent from tx_data, then rx_len bytes are clocked in with 0xFF and stored in
+ rx_data, all with cs_pin held low. The caller owns the struct and both
+ buffers until done is set.
+ */
+typedef struct spi_transaction
+{
+  uint8_t cs_pin; //!< Chip select held low for the whole frame
+  uint8_t *tx_data; //!< Bytes written at the start of the frame
+  uint8_t tx_len; //!< Number of bytes in tx_data
+  uint8_t *rx_data; //!< Bytes read after tx_data has been written, NULL if rx_len is 0
+  uint8_t rx_len; //!< Number of bytes to read
+  void (*on_complete)(struct spi_transaction *trans); //!< Called from the SPI interrupt after CS is released, NULL for none
+  volatile uint8_t done; //!< Set once the frame has finished
+} spi_transaction;
 
 void cs_low(uint8_t pin);//name conflicts with linduino
 
@@ -78,4 +96,24 @@ void spi_write_read(uint8_t tx_Data[],//array of data to be written on SPI port
                    );
 
 uint8_t spi_read_byte(uint8_t tx_dat);//name conflicts with linduino also needs to take a byte as a parameter
+
+/*
+Queues a transaction on the interrupt driven SPI engine and returns straight
+away. The SPI interrupt shifts the bytes and calls on_complete when the frame
+is done. Returns 0 when queued, -1 if the queue is full or the transaction is
+empty. on_complete runs in interrupt context: it may queue more transactions
+but must not call the blocking functions above.
+*/
+int8_t spi_submit(spi_transaction *trans);
+
+/*
+Returns 1 while the engine has transactions queued or shifting
+*/
+uint8_t spi_busy();
+
+/*
+Blocks until every queued transaction has finished. cs_low() calls this, so
+blocking transfers never interleave with a queued frame.
+*/
+void spi_wait_idle();
 #endif
\ No newline at end of file
@@ -0,0 +1,464 @@
+/*! @file
+    Append only SD data log
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <Arduino.h>
+#include "SdLog.h"
+
+#define SUPER_VERSION 1
+#define SUPER_LEN 16 // Checkpoint bytes before its CRC
+
+/* CRC-16/CCITT-FALSE, one nibble per step so the table stays at 32 bytes */
+static const uint16_t crc16_nibble[16] PROGMEM = {0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+                                                  0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF};
+
+/* Stores a little endian u32 */
+static void put32(uint8_t *p, // Output
+                  uint32_t value // Value to store
+                 )
+{
+	p[0] = (uint8_t)value;
+	p[1] = (uint8_t)(value >> 8);
+	p[2] = (uint8_t)(value >> 16);
+	p[3] = (uint8_t)(value >> 24);
+}
+
+/* Loads a little endian u32 */
+static uint32_t get32(const uint8_t *p // Input
+                     )
+{
+	return((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+/* CRC of bytes, continued from crc */
+uint16_t sd_log_crc16(uint16_t crc, // SDLOG_CRC_INIT, or the CRC of the bytes before
+                      const uint8_t *data, // Bytes to check
+                      uint16_t len // Number of bytes
+                     )
+{
+	for (uint16_t i = 0; i < len; i++)
+	{
+		crc = (crc << 4) ^ pgm_read_word_near(crc16_nibble + ((crc >> 12) ^ (data[i] >> 4)));
+		crc = (crc << 4) ^ pgm_read_word_near(crc16_nibble + ((crc >> 12) ^ (data[i] & 0x0F)));
+	}
+	return(crc);
+}
+
+/* Commits what has been written */
+static int8_t sync_log(sd_log *l // Open log
+                      )
+{
+	l->unsynced = 0;
+	l->count.syncs++;
+	if (l->io->sync() != 0)
+	{
+		l->count.errors++;
+		return(-1);
+	}
+	l->synced = l->block; // Every block below is on the card
+	l->synced_seq = l->seq;
+	return(0);
+}
+
+/* Counts a block written, syncing every sync_blocks */
+static int8_t written(sd_log *l // Open log
+                     )
+{
+	if (++l->unsynced >= l->sync_blocks)
+	{
+		return(sync_log(l));
+	}
+	return(0);
+}
+
+/* Writes a checkpoint over the older one, buf must be empty */
+static int8_t write_checkpoint(sd_log *l, // Open log
+                               uint32_t block, // Block all data below which is on the card
+                               uint32_t seq // Sequence number at that block
+                              )
+{
+	uint16_t crc;
+	int8_t result = 0;
+
+	l->buf[0] = SDLOG_SUPER;
+	l->buf[1] = SUPER_VERSION;
+	put32(&l->buf[4], l->generation);
+	put32(&l->buf[8], block);
+	put32(&l->buf[12], seq);
+	crc = sd_log_crc16(SDLOG_CRC_INIT, l->buf, SUPER_LEN);
+	l->buf[SUPER_LEN] = (uint8_t)crc;
+	l->buf[SUPER_LEN + 1] = (uint8_t)(crc >> 8);
+	if (l->io->write(l->generation % SDLOG_SUPER_BLOCKS, l->buf) != 0)
+	{
+		l->count.errors++;
+		result = -1;
+	}
+	else
+	{
+		l->generation++;
+		l->checkpoint = block;
+		l->count.checkpoints++;
+	}
+	memset(l->buf, 0, SUPER_LEN + 2);
+	return(result);
+}
+
+/* Writes buf to its block, whole or padded with zeros */
+static int8_t put_block(sd_log *l // Open log with bytes in buf
+                       )
+{
+	uint32_t seq = l->seq;
+	int8_t result = 0;
+
+	if (l->format != NULL)
+	{
+		seq = l->format->seal(l->buf);
+	}
+	if (l->io->write(l->block, l->buf) != 0)
+	{
+		l->count.errors++;
+		result = -1;
+	}
+	else if (l->block >= l->allocated)
+	{
+		l->allocated = l->block + 1; // The data got ahead of the preallocation
+		l->count.grown++;
+	}
+
+	if (l->len < SDLOG_BLOCK)
+	{
+		l->count.partials++;
+		l->saved = (result == 0) ? l->len : l->saved;
+		return(result);
+	}
+	l->count.blocks++;
+	l->block++;
+	l->seq = seq;
+	l->len = 0;
+	l->saved = 0;
+	memset(l->buf, 0, SDLOG_BLOCK);
+	if (result == 0)
+	{
+		result = written(l);
+	}
+	if (result == 0 && l->format != NULL && l->synced - l->checkpoint >= SDLOG_CHECKPOINT_BLOCKS)
+	{
+		result = write_checkpoint(l, l->synced, l->synced_seq);
+	}
+	return(result);
+}
+
+/* Takes the newest intact checkpoint, returns 1, 0 if there is none, or -1 on a card error */
+static int8_t read_checkpoints(sd_log *l, // Log being opened
+                               const sd_log_io *io, // Block access to the file
+                               uint32_t file_blocks // File size in blocks
+                              )
+{
+	int8_t found = 0;
+
+	for (uint32_t s = 0; s < SDLOG_SUPER_BLOCKS && s < file_blocks; s++)
+	{
+		uint8_t *b = l->buf;
+		if (io->read(s, b) != 0)
+		{
+			return(-1);
+		}
+		l->count.scanned++;
+		if (b[0] != SDLOG_SUPER || b[1] != SUPER_VERSION ||
+		        (b[SUPER_LEN] | (b[SUPER_LEN + 1] << 8)) != sd_log_crc16(SDLOG_CRC_INIT, b, SUPER_LEN) ||
+		        get32(&b[8]) < SDLOG_SUPER_BLOCKS || get32(&b[8]) > file_blocks)
+		{
+			continue; // Torn, never written, or not a binary log
+		}
+		if (found && get32(&b[4]) < l->generation)
+		{
+			continue;
+		}
+		found = 1;
+		l->generation = get32(&b[4]) + 1;
+		l->block = get32(&b[8]);
+		l->seq = get32(&b[12]);
+	}
+	return(found);
+}
+
+/* Moves block past every intact block that follows it, returns 0 or -1 on a card error */
+static int8_t scan_forward(sd_log *l, // Log being opened, at its checkpoint
+                           const sd_log_io *io, // Block access to the file
+                           uint32_t file_blocks // File size in blocks
+                          )
+{
+	while (l->block < file_blocks)
+	{
+		uint32_t seq = l->seq;
+		if (io->read(l->block, l->buf) != 0)
+		{
+			return(-1);
+		}
+		l->count.scanned++;
+		if (l->format->check(l->buf, &seq) != 0)
+		{
+			break;
+		}
+		l->seq = seq;
+		l->block++;
+	}
+	return(0);
+}
+
+/* Finds the first block that starts with a zero byte, at or after first */
+static int8_t search(sd_log *l, // Log being opened
+                     const sd_log_io *io, // Block access to the file
+                     uint32_t first, // First block that may hold data
+                     uint32_t file_blocks // File size in blocks
+                    )
+{
+	uint32_t lo = first;
+	uint32_t hi = file_blocks;
+
+	while (lo < hi) // Blocks below lo hold data, blocks from hi on are empty
+	{
+		uint32_t mid = lo + (hi - lo)/2;
+		if (io->read(mid, l->buf) != 0)
+		{
+			return(-1);
+		}
+		l->count.scanned++;
+		if (l->buf[0] != 0)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	l->block = (lo > first) ? lo : first;
+	return(0);
+}
+
+/* Without a checkpoint, scans on from the first intact block of those just before the first zero block */
+static int8_t scan_tail(sd_log *l, // Log being opened, at the first zero block
+                        const sd_log_io *io, // Block access to the file
+                        uint32_t file_blocks // File size in blocks
+                       )
+{
+	uint32_t end = l->block;
+	uint32_t b = (end > SDLOG_SUPER_BLOCKS + 2*SDLOG_CHECKPOINT_BLOCKS) ? end - 2*SDLOG_CHECKPOINT_BLOCKS : SDLOG_SUPER_BLOCKS;
+
+	for (; b < end; b++)
+	{
+		uint32_t seq = SDLOG_SEQ_ANY;
+		if (io->read(b, l->buf) != 0)
+		{
+			return(-1);
+		}
+		l->count.scanned++;
+		if (l->format->check(l->buf, &seq) == 0)
+		{
+			l->block = b + 1;
+			l->seq = seq;
+			return(scan_forward(l, io, file_blocks)); // Stops at a torn or stale block before the zeros
+		}
+	}
+	return(0); // Nothing intact near the end, the log starts again there
+}
+
+/* Finds the end of the data and starts appending there */
+int8_t sd_log_open(sd_log *l, // Log to open
+                   const sd_log_io *io, // Block access to the file
+                   uint32_t file_blocks, // File size in blocks
+                   uint16_t flush_ms, // Longest a byte waits in RAM
+                   uint8_t sync_blocks, // Full blocks between syncs
+                   const sd_log_format *format // Binary format, NULL for text
+                  )
+{
+	int8_t found;
+
+	memset(l, 0, sizeof(sd_log));
+	l->format = format;
+	if (format != NULL)
+	{
+		found = read_checkpoints(l, io, file_blocks);
+		if (found < 0 || (found == 1 && scan_forward(l, io, file_blocks) != 0) ||
+		        (found == 0 && (search(l, io, SDLOG_SUPER_BLOCKS, file_blocks) != 0 || scan_tail(l, io, file_blocks) != 0)))
+		{
+			memset(l, 0, sizeof(sd_log));
+			return(-1);
+		}
+		memset(l->buf, 0, SDLOG_BLOCK);
+		for (l->allocated = file_blocks; l->allocated < SDLOG_SUPER_BLOCKS; l->allocated++) // A new file
+		{
+			if (io->write(l->allocated, NULL) != 0)
+			{
+				memset(l, 0, sizeof(sd_log));
+				return(-1);
+			}
+		}
+		l->io = io;
+		l->synced = l->block;
+		l->synced_seq = l->seq;
+		if (write_checkpoint(l, l->block, l->seq) != 0)
+		{
+			memset(l, 0, sizeof(sd_log));
+			return(-1);
+		}
+	}
+	else
+	{
+		if (search(l, io, 0, file_blocks) != 0)
+		{
+			memset(l, 0, sizeof(sd_log));
+			return(-1);
+		}
+		memset(l->buf, 0, SDLOG_BLOCK);
+		if (l->block > 0) // The last text block may be part filled
+		{
+			if (io->read(l->block - 1, l->buf) != 0)
+			{
+				memset(l, 0, sizeof(sd_log));
+				return(-1);
+			}
+			while (l->len < SDLOG_BLOCK && l->buf[l->len] != 0) // Text ends at the first NUL
+			{
+				l->len++;
+			}
+			if (l->len < SDLOG_BLOCK)
+			{
+				l->block--; // Appending resumes in this block
+			}
+			else
+			{
+				l->len = 0;
+				memset(l->buf, 0, SDLOG_BLOCK);
+			}
+		}
+		l->allocated = file_blocks;
+	}
+	l->saved = l->len;
+	l->flush_ms = flush_ms;
+	l->sync_blocks = (sync_blocks < 1) ? 1 : sync_blocks;
+	l->io = io;
+	return(0);
+}
+
+/* Appends a record */
+int8_t sd_log_write(sd_log *l, // Log to append to
+                    const uint8_t *data, // Record
+                    uint16_t len, // Record length
+                    uint32_t now_ms // millis()
+                   )
+{
+	int8_t result = 0;
+
+	if (l->io == NULL)
+	{
+		return(-1);
+	}
+	l->count.records++;
+	l->count.bytes += len;
+	while (len > 0)
+	{
+		uint16_t n = SDLOG_BLOCK - l->len;
+		if (n > len)
+		{
+			n = len;
+		}
+		if (l->len == l->saved)
+		{
+			l->dirty_ms = now_ms; // First byte the card does not have yet
+		}
+		memcpy(&l->buf[l->len], data, n);
+		l->len += n;
+		data += n;
+		len -= n;
+		if (l->len == SDLOG_BLOCK && put_block(l) != 0)
+		{
+			result = -1;
+		}
+	}
+	return(result);
+}
+
+/* The block being filled */
+uint8_t *sd_log_block(sd_log *l // Open log
+                     )
+{
+	return(l->buf);
+}
+
+/* Records how much of the block holds data */
+int8_t sd_log_commit(sd_log *l, // Open log
+                     uint16_t len, // Bytes of data
+                     uint32_t now_ms // millis()
+                    )
+{
+	if (l->io == NULL)
+	{
+		return(-1);
+	}
+	if (len > SDLOG_BLOCK)
+	{
+		len = SDLOG_BLOCK;
+	}
+	if (l->len == l->saved && len > l->saved)
+	{
+		l->dirty_ms = now_ms;
+	}
+	l->count.records++;
+	l->count.bytes += len - l->len;
+	l->len = len;
+	if (len == SDLOG_BLOCK)
+	{
+		return(put_block(l));
+	}
+	return(0);
+}
+
+/* Writes the part filled block when due, or preallocates one block */
+int8_t sd_log_service(sd_log *l, // Log to service
+                      uint32_t now_ms // millis()
+                     )
+{
+	if (l->io == NULL)
+	{
+		return(0);
+	}
+	if (l->len > l->saved && now_ms - l->dirty_ms >= l->flush_ms)
+	{
+		if (put_block(l) != 0)
+		{
+			return(-1);
+		}
+		return(sync_log(l));
+	}
+	if (l->allocated < l->block + 1 + SDLOG_EXTENT_BLOCKS) // One block per call, so no call takes long
+	{
+		if (l->io->write(l->allocated, NULL) != 0)
+		{
+			l->count.errors++;
+			return(-1);
+		}
+		l->allocated++;
+		l->count.extended++;
+		return(written(l));
+	}
+	return(0);
+}
+
+/* Writes everything buffered and syncs */
+int8_t sd_log_flush(sd_log *l // Log to flush
+                   )
+{
+	if (l->io == NULL)
+	{
+		return(0);
+	}
+	if (l->len > l->saved && put_block(l) != 0)
+	{
+		return(-1);
+	}
+	return(sync_log(l));
+}
@@ -0,0 +1,180 @@
+/*! @file
+    Append only SD data log
+@verbatim
+  Records are appended to one file that stays open. They are gathered in
+  a buffer of one SD block, SDLOG_BLOCK bytes, and reach the card only as
+  whole blocks at block aligned offsets. The SD library writes those
+  straight to the card, without reading the block back first.
+
+  A full block is written as soon as it fills. The file system is synced
+  every sync_blocks blocks. A part filled block is written, padded with
+  zeros, once its oldest byte has waited flush_ms. It is written again
+  over the same block as it fills.
+
+  The file is preallocated: sd_log_service() keeps SDLOG_EXTENT_BLOCKS
+  zero blocks ahead of the data, one block per call. Steady logging then
+  overwrites blocks the file already has, instead of growing it on every
+  write. When the log is opened, the end of the data is found by a binary
+  search for the first block that starts with a zero byte. Logging
+  resumes after the last byte that reached the card.
+
+  Text records are appended with sd_log_write() and must not contain NUL.
+  A binary format instead fills the block from sd_log_block() itself and
+  reports its progress with sd_log_commit(). Each of its blocks must
+  start with a byte other than zero. Its sd_log_format seals each
+  block with a check and a sequence number just before it is written.
+  When the log is reopened, its check function accepts only an intact
+  block that follows the last one. Appending then starts a new block.
+
+  A file in a binary format keeps SDLOG_SUPER_BLOCKS checkpoints at its
+  start, written in turn. Each one holds a block all data below which was
+  synced, and the sequence number at that block. A checkpoint is written
+  when a block fills, once the data synced has grown by
+  SDLOG_CHECKPOINT_BLOCKS since the last one, and when the log is opened. On opening,
+  the newest intact checkpoint is read, then blocks from its block on
+  until the first one that is not intact or does not follow. Logging
+  resumes there. So a reset reads about SDLOG_CHECKPOINT_BLOCKS +
+  sync_blocks blocks, however long the log is. A torn or stale block ends
+  the log, and is written over. Its records are lost, as are those after
+  a block the card failed to take. With no intact checkpoint, the binary
+  search finds the first zero block, and the scan starts at the first
+  intact block of the 2*SDLOG_CHECKPOINT_BLOCKS before it.
+@endverbatim
+*/
+
+#ifndef SDLOG_H
+#define SDLOG_H
+
+#include <stdint.h>
+
+#define SDLOG_BLOCK 512 //!< SD block size
+#ifndef SDLOG_EXTENT_BLOCKS
+#define SDLOG_EXTENT_BLOCKS 16 //!< Zero blocks kept ahead of the data, set with -D SDLOG_EXTENT_BLOCKS=n
+#endif
+#ifndef SDLOG_CHECKPOINT_BLOCKS
+#define SDLOG_CHECKPOINT_BLOCKS 64 //!< Full blocks between checkpoints, set with -D SDLOG_CHECKPOINT_BLOCKS=n
+#endif
+#define SDLOG_SUPER_BLOCKS 2 //!< Checkpoint blocks at the start of a file in a binary format
+#define SDLOG_SUPER 'S' //!< First byte of a checkpoint block
+#define SDLOG_SEQ_ANY 0xFFFFFFFFUL //!< Sequence number a check function takes any block at
+#define SDLOG_CRC_INIT 0xFFFF //!< Starting value of sd_log_crc16()
+
+/*! Block access to the log file, each call returns 0 or -1 on a card error */
+typedef struct
+{
+  int8_t (*read)(uint32_t block, uint8_t *data);        //!< Reads SDLOG_BLOCK bytes at block*SDLOG_BLOCK
+  int8_t (*write)(uint32_t block, const uint8_t *data); //!< Writes SDLOG_BLOCK bytes there, zeros if data is NULL, block is at most the file size in blocks
+  int8_t (*sync)(void);                                  //!< Commits the file size and cached blocks to the card
+} sd_log_io;
+
+/*! Block checks of a binary format */
+typedef struct
+{
+  int8_t (*check)(const uint8_t *block, uint32_t *seq); //!< 0 if a block read back is intact and its sequence number is *seq, and sets *seq to the number after it, else -1
+  uint32_t (*seal)(uint8_t *block);                      //!< Stores the check of a block about to be written, returns the sequence number after it
+} sd_log_format;
+
+/*! Counts since sd_log_open() */
+typedef struct
+{
+  uint32_t records;   //!< sd_log_write() and sd_log_commit() calls
+  uint32_t bytes;     //!< Bytes appended
+  uint32_t blocks;    //!< Full blocks written
+  uint32_t partials;  //!< Part filled blocks written by the time flush
+  uint32_t syncs;
+  uint32_t extended;  //!< Zero blocks preallocated
+  uint32_t grown;     //!< Data blocks written past the preallocated end
+  uint32_t checkpoints;
+  uint32_t scanned;   //!< Blocks read by sd_log_open()
+  uint32_t errors;    //!< Card errors, a full block that failed is lost
+} sd_log_counters;
+
+/*! Log state */
+typedef struct
+{
+  const sd_log_io *io;   //!< NULL while the log is closed
+  const sd_log_format *format; //!< NULL for text
+  uint8_t buf[SDLOG_BLOCK]; //!< Block being filled, zeros past len
+  uint16_t len;          //!< Bytes in buf
+  uint16_t saved;        //!< Bytes of buf already on the card
+  uint32_t block;        //!< Block buf is written to
+  uint32_t allocated;    //!< File size in blocks
+  uint32_t dirty_ms;     //!< millis() when the oldest unsaved byte arrived
+  uint16_t flush_ms;
+  uint8_t sync_blocks;
+  uint8_t unsynced;      //!< Blocks written since the last sync
+  uint32_t seq;          //!< Sequence number at block
+  uint32_t synced;       //!< Block as of the last sync
+  uint32_t synced_seq;   //!< Sequence number at synced
+  uint32_t checkpoint;   //!< Block of the last checkpoint
+  uint32_t generation;   //!< Checkpoints written to the file
+  sd_log_counters count;
+} sd_log;
+
+/*!
+ CRC-16/CCITT-FALSE, continued from crc
+ @return uint16_t, CRC of the bytes
+ */
+uint16_t sd_log_crc16(uint16_t crc, //!< SDLOG_CRC_INIT, or the CRC of the bytes before
+                      const uint8_t *data, //!< Bytes to check
+                      uint16_t len //!< Number of bytes
+                     );
+
+/*!
+ Finds the end of the data in an open file and starts appending there.
+ In a binary format it also writes a checkpoint of that end.
+ @return int8_t, 0 or -1 on a card error, which leaves the log closed
+ */
+int8_t sd_log_open(sd_log *l, //!< Log to open
+                   const sd_log_io *io, //!< Block access to the file
+                   uint32_t file_blocks, //!< File size in blocks
+                   uint16_t flush_ms, //!< Longest a byte waits in RAM
+                   uint8_t sync_blocks, //!< Full blocks between syncs, at least 1
+                   const sd_log_format *format //!< Binary format, NULL for text, which ends at the first NUL
+                  );
+
+/*!
+ Appends a record, writing each block it fills
+ @return int8_t, 0 or -1 if the log is closed or a block failed
+ */
+int8_t sd_log_write(sd_log *l, //!< Log to append to
+                    const uint8_t *data, //!< Record, text without NUL
+                    uint16_t len, //!< Record length
+                    uint32_t now_ms //!< millis()
+                   );
+
+/*!
+ The block being filled, for a binary format to write into
+ @return uint8_t *, SDLOG_BLOCK bytes
+ */
+uint8_t *sd_log_block(sd_log *l //!< Open log
+                     );
+
+/*!
+ Records that the block from sd_log_block() now holds len bytes of data,
+ and writes it once len reaches SDLOG_BLOCK. The block is then cleared
+ for the next one.
+ @return int8_t, 0 or -1 if the log is closed or the block failed
+ */
+int8_t sd_log_commit(sd_log *l, //!< Open log
+                     uint16_t len, //!< Bytes of data, never less than the last commit of this block
+                     uint32_t now_ms //!< millis()
+                    );
+
+/*!
+ Writes the part filled block once it is due, or else preallocates one
+ block if the file is short of SDLOG_EXTENT_BLOCKS ahead. Call it often.
+ @return int8_t, 0 or -1 on a card error
+ */
+int8_t sd_log_service(sd_log *l, //!< Log to service
+                      uint32_t now_ms //!< millis()
+                     );
+
+/*!
+ Writes everything buffered and syncs, before the card is removed
+ @return int8_t, 0 or -1 on a card error
+ */
+int8_t sd_log_flush(sd_log *l //!< Log to flush
+                   );
+
+#endif
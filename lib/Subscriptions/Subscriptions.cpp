@@ -0,0 +1,113 @@
+/*! @file
+    Per sink field subscriptions
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include "Subscriptions.h"
+
+/* Clears every subscription */
+void sub_init(sub_table *t, // Table to clear
+              uint16_t window_ms // Sinks due this close together share a pass
+             )
+{
+	memset(t, 0, sizeof(sub_table));
+	t->window_ms = window_ms;
+}
+
+/* Sets the fields and period of one sink */
+int8_t sub_set(sub_table *t, // Table to change
+               uint8_t sink, // SUB_SERIAL, SUB_BLE, SUB_WIFI or SUB_SD
+               uint8_t fields, // SUB_ field bits
+               uint16_t period_ms, // Time between outputs
+               uint32_t now_ms // millis()
+              )
+{
+	if (sink >= SUB_SINKS || (fields != 0 && period_ms == 0))
+	{
+		return(-1);
+	}
+	t->sink[sink].fields = fields;
+	t->sink[sink].period_ms = period_ms;
+	t->sink[sink].next_ms = now_ms;
+	return(0);
+}
+
+/* Makes every sink due now */
+void sub_start(sub_table *t, // Table to restart
+               uint32_t now_ms // millis()
+              )
+{
+	for (uint8_t sink = 0; sink < SUB_SINKS; sink++)
+	{
+		t->sink[sink].next_ms = now_ms;
+	}
+}
+
+/* Finds the sinks due in this pass and schedules their next output */
+uint8_t sub_due(sub_table *t, // Table to check
+                uint32_t now_ms // millis()
+               )
+{
+	uint8_t due = 0;
+
+	for (uint8_t sink = 0; sink < SUB_SINKS; sink++)
+	{
+		sub_entry *e = &t->sink[sink];
+		if (e->fields == 0 || (int32_t)(e->next_ms - now_ms) > (int32_t)t->window_ms)
+		{
+			continue;
+		}
+		due |= (uint8_t)(1 << sink);
+		e->next_ms += e->period_ms; // Keeps the period exact when passes run a little late
+		if ((int32_t)(e->next_ms - now_ms) <= 0)
+		{
+			e->next_ms = now_ms + e->period_ms; // Missed slots are skipped, not made up
+		}
+	}
+	return(due);
+}
+
+/* Fields taken by a set of sinks */
+uint8_t sub_fields(const sub_table *t, // Table to check
+                   uint8_t sinks // Bit n set for sink n
+                  )
+{
+	uint8_t fields = 0;
+
+	for (uint8_t sink = 0; sink < SUB_SINKS; sink++)
+	{
+		if (sinks & (1 << sink))
+		{
+			fields |= t->sink[sink].fields;
+		}
+	}
+	return(fields);
+}
+
+/* Time until the next sink is due */
+uint16_t sub_wait_ms(const sub_table *t, // Table to check
+                     uint32_t now_ms // millis()
+                    )
+{
+	uint16_t wait = 0xFFFF;
+
+	for (uint8_t sink = 0; sink < SUB_SINKS; sink++)
+	{
+		const sub_entry *e = &t->sink[sink];
+		int32_t until = (int32_t)(e->next_ms - now_ms);
+		if (e->fields == 0)
+		{
+			continue;
+		}
+		if (until <= 0)
+		{
+			return(0);
+		}
+		if (until < wait)
+		{
+			wait = (uint16_t)until;
+		}
+	}
+	return(wait);
+}
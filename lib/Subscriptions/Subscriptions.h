@@ -0,0 +1,108 @@
+/*! @file
+    Per sink field subscriptions
+@verbatim
+  A sub_table says which fields each output sink takes and how often. The
+  measurement loop asks sub_due() which sinks are due, acquires only the
+  fields those sinks take, and hands each due sink its own fields. Between
+  passes it waits sub_wait_ms(), so acquisition runs at the rate of the
+  fastest sink and a slow sink costs nothing on the passes it skips.
+
+  A sink that falls due within window_ms of another is served in the same
+  pass, so sinks with close periods share one acquisition instead of
+  waking the chain twice a few milliseconds apart. A sink that is late by
+  more than its period skips the missed slots instead of bursting.
+@endverbatim
+*/
+
+#ifndef SUBSCRIPTIONS_H
+#define SUBSCRIPTIONS_H
+
+#include <stdint.h>
+
+/* Fields */
+#define SUB_CELLS 0x01        //!< Cell codes
+#define SUB_AUX 0x02          //!< GPIO and Vref2 codes
+#define SUB_STAT 0x04         //!< Status group codes and flags
+#define SUB_CHARGE 0x08       //!< LTC2944 accumulated charge
+#define SUB_CURRENT 0x10      //!< LTC2944 current
+#define SUB_VOLTAGE 0x20      //!< LTC2944 pack voltage
+#define SUB_TEMPERATURE 0x40  //!< LTC2944 temperature
+#define SUB_PEC 0x80          //!< PEC error and retry counters
+#define SUB_REGISTERS (SUB_CELLS | SUB_AUX | SUB_STAT) //!< Fields read from the daisy chain
+#define SUB_LTC2944 (SUB_CHARGE | SUB_CURRENT | SUB_VOLTAGE | SUB_TEMPERATURE) //!< Fields read from the LTC2944
+#define SUB_ALL 0xFF
+
+/* Sinks */
+#define SUB_SERIAL 0  //!< USB Serial console
+#define SUB_BLE 1     //!< Serial1
+#define SUB_WIFI 2    //!< Serial2, ESP8266
+#define SUB_SD 3      //!< SD card log
+#define SUB_SINKS 4
+
+/*! Subscription of one sink */
+typedef struct
+{
+  uint8_t fields;     //!< SUB_ field bits, 0 for a sink that takes nothing
+  uint16_t period_ms; //!< Time between outputs
+  uint32_t next_ms;   //!< millis() the sink is due next
+} sub_entry;
+
+/*! Subscriptions of every sink */
+typedef struct
+{
+  sub_entry sink[SUB_SINKS];
+  uint16_t window_ms; //!< Sinks due this close together share a pass
+} sub_table;
+
+/*!
+ Clears every subscription
+ @return void
+ */
+void sub_init(sub_table *t, //!< Table to clear
+              uint16_t window_ms //!< Sinks due this close together share a pass
+             );
+
+/*!
+ Sets the fields and period of one sink, it falls due at the next pass
+ @return int8_t, 0 or -1 if the sink does not exist or takes fields with a period of 0
+ */
+int8_t sub_set(sub_table *t, //!< Table to change
+               uint8_t sink, //!< SUB_SERIAL, SUB_BLE, SUB_WIFI or SUB_SD
+               uint8_t fields, //!< SUB_ field bits
+               uint16_t period_ms, //!< Time between outputs
+               uint32_t now_ms //!< millis()
+              );
+
+/*!
+ Makes every sink due now, for the start of a measurement loop
+ @return void
+ */
+void sub_start(sub_table *t, //!< Table to restart
+               uint32_t now_ms //!< millis()
+              );
+
+/*!
+ Finds the sinks due in this pass and schedules their next output
+ @return uint8_t, bit n set when sink n is due
+ */
+uint8_t sub_due(sub_table *t, //!< Table to check
+                uint32_t now_ms //!< millis()
+               );
+
+/*!
+ Fields taken by a set of sinks
+ @return uint8_t, SUB_ field bits
+ */
+uint8_t sub_fields(const sub_table *t, //!< Table to check
+                   uint8_t sinks //!< Bit n set for sink n, as from sub_due()
+                  );
+
+/*!
+ Time until the next sink is due
+ @return uint16_t, ms, 0 if one is due now, 0xFFFF if no sink takes anything
+ */
+uint16_t sub_wait_ms(const sub_table *t, //!< Table to check
+                     uint32_t now_ms //!< millis()
+                    );
+
+#endif
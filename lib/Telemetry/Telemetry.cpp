@@ -0,0 +1,468 @@
+/*! @file
+    Binary telemetry frames
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include "Telemetry.h"
+
+#ifdef LINDUINO
+#include <Arduino.h>
+#endif
+
+/* CRC-16/CCITT-FALSE, one nibble per step so the table stays at 32 bytes */
+static const uint16_t crc16_nibble[16] PROGMEM = {0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+                                                  0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF};
+
+uint16_t tlm_crc16(const uint8_t *data, // Bytes to check
+                   uint16_t len // Number of bytes
+                  )
+{
+	uint16_t crc = 0xFFFF;
+
+	for (uint16_t i = 0; i < len; i++)
+	{
+		crc = (crc << 4) ^ pgm_read_word_near(crc16_nibble + ((crc >> 12) ^ (data[i] >> 4)));
+		crc = (crc << 4) ^ pgm_read_word_near(crc16_nibble + ((crc >> 12) ^ (data[i] & 0x0F)));
+	}
+	return(crc);
+}
+
+/* Codes of one register kind of one IC, and the channels a read left stale */
+static const uint16_t *frame_codes(const bms_snapshot *snap, // Cycle to send
+                                   uint8_t type, // TLM_CELLS, TLM_AUX or TLM_STAT
+                                   uint8_t current_ic, // IC
+                                   uint32_t *skip // Output, bit n set when channel n is left out
+                                  )
+{
+	*skip = 0;
+	if (type == TLM_CELLS)
+	{
+		*skip = snap->ic[current_ic].cells.stale; // Cells a channel selective read left alone
+		return(snap->ic[current_ic].cells.c_codes);
+	}
+	if (type == TLM_AUX)
+	{
+		return(snap->ic[current_ic].aux.a_codes);
+	}
+	return(snap->ic[current_ic].stat.stat_codes);
+}
+
+/* Stores the header shared by keyframes and delta frames */
+static void put_header(uint8_t *frame, // Output
+                       uint8_t type, // Type byte
+                       const bms_snapshot *snap, // Cycle to send
+                       uint8_t channels // Codes per IC to send
+                      )
+{
+	frame[0] = TLM_VERSION;
+	frame[1] = type;
+	frame[2] = (uint8_t)snap->seq;
+	frame[3] = (uint8_t)(snap->seq >> 8);
+	frame[4] = (uint8_t)snap->time_ms;
+	frame[5] = (uint8_t)(snap->time_ms >> 8);
+	frame[6] = (uint8_t)(snap->time_ms >> 16);
+	frame[7] = (uint8_t)(snap->time_ms >> 24);
+	frame[8] = snap->total_ic;
+	frame[9] = channels;
+}
+
+/* Appends the CRC of a frame */
+static uint16_t put_crc(uint8_t *frame, // Frame
+                        uint16_t len // Bytes before the CRC
+                       )
+{
+	uint16_t crc = tlm_crc16(frame, len);
+
+	frame[len++] = (uint8_t)crc;
+	frame[len++] = (uint8_t)(crc >> 8);
+	return(len);
+}
+
+/* Codes per IC the base of a type keeps */
+static uint8_t base_channels(uint8_t t // Type less one
+                            )
+{
+	const uint8_t channels[TLM_TYPES] = {TLM_BASE_CELLS, TLM_BASE_AUX, TLM_BASE_STAT};
+
+	return(channels[t]);
+}
+
+/* Base codes of a type, total_ic*channels of them */
+static uint16_t *base_codes(tlm_delta *d, // Link state
+                            uint8_t t // Type less one
+                           )
+{
+	uint16_t offset = 0;
+
+	for (uint8_t i = 0; i < t; i++)
+	{
+		offset += BMS_TOTAL_IC*base_channels(i);
+	}
+	return(&d->codes[offset]);
+}
+
+/* Builds a raw frame of one register kind from a snapshot */
+uint16_t tlm_build(uint8_t *frame, // Output, TLM_FRAME_MAX bytes
+                   uint8_t type, // TLM_CELLS, TLM_AUX or TLM_STAT
+                   const bms_snapshot *snap, // Cycle to send
+                   uint8_t channels // Codes per IC to send
+                  )
+{
+	uint16_t bits = (uint16_t)snap->total_ic*channels;
+	uint8_t *bitmap = &frame[TLM_HEADER_LEN];
+	uint16_t len = TLM_HEADER_LEN + (bits + 7)/8;
+	uint16_t bit = 0;
+
+	if (channels == 0 || channels > TLM_MAX_CHANNELS)
+	{
+		return(0);
+	}
+
+	put_header(frame, type, snap, channels);
+	memset(bitmap, 0, (bits + 7)/8);
+
+	for (uint8_t current_ic = 0; current_ic < snap->total_ic; current_ic++)
+	{
+		uint32_t skip;
+		const uint16_t *codes = frame_codes(snap, type, current_ic, &skip);
+
+		for (uint8_t channel = 0; channel < channels; channel++, bit++)
+		{
+			if (skip & (1UL << channel))
+			{
+				continue;
+			}
+			bitmap[bit >> 3] |= (uint8_t)(1 << (bit & 7));
+			frame[len++] = (uint8_t)codes[channel];
+			frame[len++] = (uint8_t)(codes[channel] >> 8);
+		}
+	}
+
+	return(put_crc(frame, len));
+}
+
+/* Clears the bases of a link */
+void tlm_delta_init(tlm_delta *d, // Link state
+                    uint8_t keyframe_every // Frames of a type from one keyframe to the next, sender only
+                   )
+{
+	memset(d, 0, sizeof(tlm_delta));
+	d->keyframe_every = keyframe_every;
+}
+
+/* Builds a delta frame, or a keyframe when one is due */
+uint16_t tlm_build_delta(uint8_t *frame, // Output, TLM_FRAME_MAX bytes
+                         uint8_t type, // TLM_CELLS, TLM_AUX or TLM_STAT
+                         const bms_snapshot *snap, // Cycle to send
+                         uint8_t channels, // Codes per IC to send
+                         tlm_delta *d // Sender state of the link
+                        )
+{
+	uint8_t t = type - 1;
+	uint16_t bits = (uint16_t)snap->total_ic*channels;
+	uint16_t key_len;
+	uint16_t len = TLM_DELTA_HEADER_LEN + (bits + 7)/8;
+	uint16_t *base;
+	uint8_t key;
+
+	if (type < TLM_CELLS || type > TLM_STAT || snap->total_ic > BMS_TOTAL_IC)
+	{
+		return(0);
+	}
+	key_len = tlm_build(frame, type, snap, channels); // The keyframe, kept if the deltas are no shorter
+	if (key_len == 0 || channels > base_channels(t))
+	{
+		d->valid &= (uint8_t)~(1 << t); // No room for a base, keyframes only
+		return(key_len);
+	}
+	base = base_codes(d, t);
+	key = !(d->valid & (1 << t)) || d->total_ic[t] != snap->total_ic || d->channels[t] != channels ||
+	      d->since_key[t] + 1 >= d->keyframe_every;
+	for (uint8_t current_ic = 0; current_ic < snap->total_ic && !key; current_ic++)
+	{
+		uint32_t skip;
+		const uint16_t *codes = frame_codes(snap, type, current_ic, &skip);
+
+		for (uint8_t channel = 0; channel < channels; channel++)
+		{
+			if (!(skip & (1UL << channel)))
+			{
+				len += varint_len((int32_t)codes[channel] - base[current_ic*channels + channel]);
+			}
+		}
+		key = len + TLM_CRC_LEN >= key_len;
+	}
+
+	if (key)
+	{
+		memset(base, 0, BMS_TOTAL_IC*base_channels(t)*sizeof(uint16_t));
+		d->since_key[t] = 0;
+		len = key_len;
+	}
+	else
+	{
+		frame[1] = type | TLM_DELTA;
+		memmove(&frame[TLM_DELTA_HEADER_LEN], &frame[TLM_HEADER_LEN], (bits + 7)/8); // Bitmap of the keyframe
+		frame[10] = (uint8_t)d->seq[t];
+		frame[11] = (uint8_t)(d->seq[t] >> 8);
+		len = TLM_DELTA_HEADER_LEN + (bits + 7)/8;
+		d->since_key[t]++;
+	}
+	for (uint8_t current_ic = 0; current_ic < snap->total_ic; current_ic++)
+	{
+		uint32_t skip;
+		const uint16_t *codes = frame_codes(snap, type, current_ic, &skip);
+
+		for (uint8_t channel = 0; channel < channels; channel++)
+		{
+			if (skip & (1UL << channel))
+			{
+				continue;
+			}
+			if (!key)
+			{
+				len += varint_put(&frame[len], (int32_t)codes[channel] - base[current_ic*channels + channel]);
+			}
+			base[current_ic*channels + channel] = codes[channel];
+		}
+	}
+	d->valid |= (uint8_t)(1 << t);
+	d->seq[t] = snap->seq;
+	d->total_ic[t] = snap->total_ic;
+	d->channels[t] = channels;
+	return(key ? len : put_crc(frame, len));
+}
+
+/* COBS encodes a frame between two delimiters */
+uint16_t tlm_cobs_encode(const uint8_t *in, // Raw frame
+                         uint16_t len, // Raw frame length
+                         uint8_t *out // Output, TLM_COBS_MAX(len) bytes
+                        )
+{
+	uint16_t code_at = 1; // Where the count of the current run goes
+	uint16_t out_len = 2;
+	uint8_t code = 1;
+
+	out[0] = 0x00;
+	for (uint16_t i = 0; i < len; i++)
+	{
+		if (in[i] == 0)
+		{
+			out[code_at] = code;
+			code_at = out_len++;
+			code = 1;
+			continue;
+		}
+		out[out_len++] = in[i];
+		if (++code == 0xFF) // A full run of 254 non zero bytes
+		{
+			out[code_at] = code;
+			code_at = out_len++;
+			code = 1;
+		}
+	}
+	out[code_at] = code;
+	out[out_len++] = 0x00;
+	return(out_len);
+}
+
+/* Decodes the COBS bytes between two delimiters */
+uint16_t tlm_cobs_decode(const uint8_t *in, // Encoded bytes without the delimiter
+                         uint16_t len, // Encoded length
+                         uint8_t *out // Output, len bytes
+                        )
+{
+	uint16_t i = 0;
+	uint16_t out_len = 0;
+
+	while (i < len)
+	{
+		uint8_t code = in[i++];
+
+		if (code == 0 || i + code - 1 > len)
+		{
+			return(0);
+		}
+		for (uint8_t j = 1; j < code; j++)
+		{
+			if (in[i] == 0)
+			{
+				return(0);
+			}
+			out[out_len++] = in[i++];
+		}
+		if (code != 0xFF && i < len) // A short run stood for a zero, except at the end
+		{
+			out[out_len++] = 0;
+		}
+	}
+	return(out_len);
+}
+
+/* Checks and unpacks a raw frame */
+int8_t tlm_parse(const uint8_t *frame, // Raw frame, COBS already decoded
+                 uint16_t len, // Raw frame length
+                 tlm_frame *out // Decoded frame
+                )
+{
+	uint16_t bits;
+	uint16_t pos;
+	uint16_t bit = 0;
+
+	if (len < TLM_HEADER_LEN + TLM_CRC_LEN ||
+	    tlm_crc16(frame, len - TLM_CRC_LEN) != (uint16_t)(frame[len - 2] | (frame[len - 1] << 8)))
+	{
+		return(-1);
+	}
+	if (frame[0] != TLM_VERSION || (frame[1] & TLM_DELTA) || frame[8] > BMS_TOTAL_IC || frame[9] == 0 || frame[9] > TLM_MAX_CHANNELS)
+	{
+		return(-1);
+	}
+
+	out->version = frame[0];
+	out->type = frame[1];
+	out->seq = (uint16_t)(frame[2] | (frame[3] << 8));
+	out->time_ms = (uint32_t)frame[4] | ((uint32_t)frame[5] << 8) | ((uint32_t)frame[6] << 16) | ((uint32_t)frame[7] << 24);
+	out->total_ic = frame[8];
+	out->channels = frame[9];
+	bits = (uint16_t)out->total_ic*out->channels;
+	pos = TLM_HEADER_LEN + (bits + 7)/8;
+	if (pos > len - TLM_CRC_LEN)
+	{
+		return(-1);
+	}
+
+	for (uint8_t current_ic = 0; current_ic < out->total_ic; current_ic++)
+	{
+		out->present[current_ic] = 0;
+		for (uint8_t channel = 0; channel < out->channels; channel++, bit++)
+		{
+			if (!(frame[TLM_HEADER_LEN + (bit >> 3)] & (1 << (bit & 7))))
+			{
+				out->codes[current_ic][channel] = 0;
+				continue;
+			}
+			if (pos + 2 > len - TLM_CRC_LEN)
+			{
+				return(-1);
+			}
+			out->present[current_ic] |= 1UL << channel;
+			out->codes[current_ic][channel] = (uint16_t)(frame[pos] | (frame[pos + 1] << 8));
+			pos += 2;
+		}
+	}
+	return(pos == len - TLM_CRC_LEN ? 0 : -1);
+}
+
+/* Checks and unpacks a keyframe or delta frame, and makes it the base of the next */
+int8_t tlm_parse_delta(const uint8_t *frame, // Raw frame, COBS already decoded
+                       uint16_t len, // Raw frame length
+                       tlm_frame *out, // Decoded frame
+                       tlm_delta *d // Receiver state of the link
+                      )
+{
+	uint8_t type;
+	uint8_t t;
+	uint16_t bits;
+	uint16_t pos;
+	uint16_t bit = 0;
+	uint16_t *base;
+
+	if (len < TLM_DELTA_HEADER_LEN + TLM_CRC_LEN || !(frame[1] & TLM_DELTA))
+	{
+		if (tlm_parse(frame, len, out) != 0)
+		{
+			return(-1);
+		}
+		t = out->type - 1;
+		if (out->type >= TLM_CELLS && out->type <= TLM_STAT && out->channels > base_channels(t))
+		{
+			d->valid &= (uint8_t)~(1 << t); // No room for a base, the sender sends keyframes only
+		}
+		else if (out->type >= TLM_CELLS && out->type <= TLM_STAT)
+		{
+			base = base_codes(d, t);
+			memset(base, 0, BMS_TOTAL_IC*base_channels(t)*sizeof(uint16_t));
+			for (uint8_t current_ic = 0; current_ic < out->total_ic; current_ic++)
+			{
+				memcpy(&base[current_ic*out->channels], out->codes[current_ic], out->channels*sizeof(uint16_t));
+			}
+			d->valid |= (uint8_t)(1 << t);
+			d->seq[t] = out->seq;
+			d->total_ic[t] = out->total_ic;
+			d->channels[t] = out->channels;
+		}
+		return(0);
+	}
+
+	type = frame[1] & (uint8_t)~TLM_DELTA;
+	t = type - 1;
+	if (tlm_crc16(frame, len - TLM_CRC_LEN) != (uint16_t)(frame[len - 2] | (frame[len - 1] << 8)) ||
+	    frame[0] != TLM_VERSION || type < TLM_CELLS || type > TLM_STAT)
+	{
+		return(-1);
+	}
+	if (!(d->valid & (1 << t)) || d->seq[t] != (uint16_t)(frame[10] | (frame[11] << 8)) ||
+	    d->total_ic[t] != frame[8] || d->channels[t] != frame[9])
+	{
+		return(-1); // The base was missed, wait for the next keyframe
+	}
+	base = base_codes(d, t);
+
+	out->version = frame[0];
+	out->type = type;
+	out->seq = (uint16_t)(frame[2] | (frame[3] << 8));
+	out->time_ms = (uint32_t)frame[4] | ((uint32_t)frame[5] << 8) | ((uint32_t)frame[6] << 16) | ((uint32_t)frame[7] << 24);
+	out->total_ic = frame[8];
+	out->channels = frame[9];
+	bits = (uint16_t)out->total_ic*out->channels;
+	pos = TLM_DELTA_HEADER_LEN + (bits + 7)/8;
+	if (pos > len - TLM_CRC_LEN)
+	{
+		return(-1);
+	}
+
+	for (uint8_t current_ic = 0; current_ic < out->total_ic; current_ic++)
+	{
+		out->present[current_ic] = 0;
+		for (uint8_t channel = 0; channel < out->channels; channel++, bit++)
+		{
+			int32_t diff;
+			int32_t code;
+			uint8_t used;
+
+			if (!(frame[TLM_DELTA_HEADER_LEN + (bit >> 3)] & (1 << (bit & 7))))
+			{
+				out->codes[current_ic][channel] = 0;
+				continue;
+			}
+			used = varint_get(&frame[pos], len - TLM_CRC_LEN - pos, &diff);
+			code = (int32_t)base[current_ic*out->channels + channel] + diff;
+			if (used == 0 || code < 0 || code > 0xFFFF)
+			{
+				return(-1);
+			}
+			out->present[current_ic] |= 1UL << channel;
+			out->codes[current_ic][channel] = (uint16_t)code;
+			pos += used;
+		}
+	}
+	if (pos != len - TLM_CRC_LEN)
+	{
+		return(-1);
+	}
+
+	for (uint8_t current_ic = 0; current_ic < out->total_ic; current_ic++) // Whole frame good, it becomes the base
+	{
+		for (uint8_t channel = 0; channel < out->channels; channel++)
+		{
+			if (out->present[current_ic] & (1UL << channel))
+			{
+				base[current_ic*out->channels + channel] = out->codes[current_ic][channel];
+			}
+		}
+	}
+	d->seq[t] = out->seq;
+	return(0);
+}
@@ -0,0 +1,182 @@
+/*! @file
+    Binary telemetry frames
+@verbatim
+  A frame carries the raw 16 bit codes of one register kind (cells, aux or
+  status) for the whole daisy chain, all values little endian:
+
+    0     version, TLM_VERSION
+    1     type, TLM_CELLS, TLM_AUX or TLM_STAT
+    2-3   snapshot sequence number
+    4-7   millis() when the snapshot was captured
+    8     ICs in the frame
+    9     channels per IC
+    10    bitmap, bit ic*channels + channel set when that code follows,
+          least significant bit first, (ICs * channels + 7) / 8 bytes
+    ..    one 16 bit code per set bit, in bit order
+    ..    CRC-16/CCITT-FALSE of every byte before it
+
+  A delta frame has TLM_DELTA set in the type byte, and sends each code
+  as a zig-zag varint of its difference from the code of the frame it
+  follows, see lib/Varint. Cell codes move a few counts per cycle, so most
+  take one byte instead of two:
+
+    0-9   as above
+    10-11 sequence number of the frame the deltas are from
+    12    bitmap, as above
+    ..    one varint per set bit, code less the base code
+    ..    CRC
+
+  The base of a type is the last frame of that type sent on the link,
+  keyframe or delta. A keyframe clears the base first, so a channel it
+  leaves out has base 0, and any frame stores the codes it carries. A
+  receiver that missed a frame sees the base sequence number differ and
+  drops the deltas until the next keyframe. tlm_build_delta() sends a
+  keyframe every keyframe_every frames of a type, on a change of layout,
+  and whenever the deltas would not be shorter.
+
+  On the wire each frame is COBS encoded between two 0x00 delimiters, so a
+  receiver that joins mid stream, or sees text between frames, resyncs on
+  the next 0x00 and drops anything that fails the CRC. The decoding half
+  builds on the host too, see host/tlm_decode.cpp.
+@endverbatim
+*/
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include "LTC681x.h"
+#include "BmsSnapshot.h"
+#include "Varint.h"
+
+#define TLM_VERSION 2 //!< Bumped whenever the frame layout changes
+#define TLM_CELLS 1   //!< Cell codes, stale cells are left out
+#define TLM_AUX 2     //!< GPIO and Vref2 codes
+#define TLM_STAT 3    //!< Sum of cells, die temperature, VregA and VregD codes
+#define TLM_DELTA 0x80 //!< Type flag of a delta frame
+#define TLM_TYPES 3
+
+#define TLM_HEADER_LEN 10 //!< Bytes before the bitmap
+#define TLM_DELTA_HEADER_LEN 12 //!< Bytes before the bitmap of a delta frame
+#define TLM_CRC_LEN 2
+#define TLM_MAX_CHANNELS 18 //!< Most codes per IC of any type, the cells of an LTC6813
+#define TLM_FRAME_MAX (TLM_DELTA_HEADER_LEN + (BMS_TOTAL_IC*TLM_MAX_CHANNELS + 7)/8 + 2*BMS_TOTAL_IC*TLM_MAX_CHANNELS + TLM_CRC_LEN) //!< Largest raw frame, a delta frame is never longer than its keyframe
+#define TLM_COBS_MAX(len) ((len) + (len)/254 + 3) //!< Encoded length of a len byte frame, with both delimiters
+#if BMS_IC_TYPE
+#define TLM_BASE_CELLS (BMS_IC_REG.cell_channels) //!< Cell codes per IC a delta base keeps, the cells of the part BMS_IC_TYPE names
+#define TLM_BASE_AUX (BMS_IC_REG.aux_channels)
+#define TLM_BASE_STAT (BMS_IC_REG.stat_channels)
+#else
+#define TLM_BASE_CELLS TLM_MAX_CHANNELS //!< Cell codes per IC a delta base keeps, any part when it is chosen at run time
+#define TLM_BASE_AUX TLM_MAX_CHANNELS
+#define TLM_BASE_STAT TLM_MAX_CHANNELS
+#endif
+
+/*! A frame as decoded */
+typedef struct
+{
+  uint8_t version;
+  uint8_t type;
+  uint16_t seq;
+  uint32_t time_ms;
+  uint8_t total_ic;
+  uint8_t channels;
+  uint32_t present[BMS_TOTAL_IC]; //!< Bit n set when codes[ic][n] was in the frame
+  uint16_t codes[BMS_TOTAL_IC][TLM_MAX_CHANNELS];
+} tlm_frame;
+
+/*! Base codes of the delta frames of one link, one end of it. The codes of
+    each type follow those of the type before, total_ic*channels of them */
+typedef struct
+{
+  uint8_t keyframe_every;            //!< Frames of a type from one keyframe to the next, 1 for keyframes only
+  uint8_t valid;                     //!< Bit type - 1 set when that type has a base
+  uint8_t since_key[TLM_TYPES];      //!< Frames of each type since its keyframe
+  uint16_t seq[TLM_TYPES];           //!< Sequence number of the base frame
+  uint8_t total_ic[TLM_TYPES];       //!< Layout of the base frame
+  uint8_t channels[TLM_TYPES];
+  uint16_t codes[BMS_TOTAL_IC*(TLM_BASE_CELLS + TLM_BASE_AUX + TLM_BASE_STAT)];
+} tlm_delta;
+
+/*!
+ Builds a raw frame of one register kind from a snapshot
+ @return uint16_t, frame length, 0 if channels is out of range
+ */
+uint16_t tlm_build(uint8_t *frame, //!< Output, TLM_FRAME_MAX bytes
+                   uint8_t type, //!< TLM_CELLS, TLM_AUX or TLM_STAT
+                   const bms_snapshot *snap, //!< Cycle to send
+                   uint8_t channels //!< Codes per IC to send
+                  );
+
+/*!
+ Clears the bases of a link, so the next frame of each type is a keyframe.
+ Used at the start, and by the sender when a frame was lost before it
+ went out.
+ @return void
+ */
+void tlm_delta_init(tlm_delta *d, //!< Link state
+                    uint8_t keyframe_every //!< Frames of a type from one keyframe to the next, sender only
+                   );
+
+/*!
+ Builds a delta frame of one register kind from a snapshot, or a keyframe
+ when one is due, and makes the codes sent the base of the next. More
+ channels than the base of the type keeps always go as keyframes.
+ @return uint16_t, frame length, 0 if channels is out of range
+ */
+uint16_t tlm_build_delta(uint8_t *frame, //!< Output, TLM_FRAME_MAX bytes
+                         uint8_t type, //!< TLM_CELLS, TLM_AUX or TLM_STAT
+                         const bms_snapshot *snap, //!< Cycle to send
+                         uint8_t channels, //!< Codes per IC to send
+                         tlm_delta *d //!< Sender state of the link
+                        );
+
+/*!
+ COBS encodes a frame between two 0x00 delimiters. The leading one ends
+ any text sent since the last frame.
+ @return uint16_t, encoded length including the delimiters
+ */
+uint16_t tlm_cobs_encode(const uint8_t *in, //!< Raw frame
+                         uint16_t len, //!< Raw frame length
+                         uint8_t *out //!< Output, TLM_COBS_MAX(len) bytes
+                        );
+
+/*!
+ Decodes the COBS bytes between two delimiters
+ @return uint16_t, decoded length, 0 if the bytes are not valid COBS
+ */
+uint16_t tlm_cobs_decode(const uint8_t *in, //!< Encoded bytes without the delimiter
+                         uint16_t len, //!< Encoded length
+                         uint8_t *out //!< Output, len bytes
+                        );
+
+/*!
+ CRC-16/CCITT-FALSE, polynomial 0x1021, seed 0xFFFF
+ @return uint16_t, CRC of the bytes
+ */
+uint16_t tlm_crc16(const uint8_t *data, //!< Bytes to check
+                   uint16_t len //!< Number of bytes
+                  );
+
+/*!
+ Checks and unpacks a raw keyframe
+ @return int8_t, 0 or -1 if the CRC, version or length is wrong, or it is
+ a delta frame
+ */
+int8_t tlm_parse(const uint8_t *frame, //!< Raw frame, COBS already decoded
+                 uint16_t len, //!< Raw frame length
+                 tlm_frame *out //!< Decoded frame
+                );
+
+/*!
+ Checks and unpacks a raw keyframe or delta frame, and makes it the base
+ of the next delta frame of its type. out->type never has TLM_DELTA set.
+ @return int8_t, 0 or -1 if the frame is bad or its base was missed
+ */
+int8_t tlm_parse_delta(const uint8_t *frame, //!< Raw frame, COBS already decoded
+                       uint16_t len, //!< Raw frame length
+                       tlm_frame *out, //!< Decoded frame
+                       tlm_delta *d //!< Receiver state of the link
+                      );
+
+#endif
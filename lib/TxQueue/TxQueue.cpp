@@ -0,0 +1,285 @@
+/*! @file
+    Prioritized transmit queues for the serial links
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include "TxQueue.h"
+
+/* Index of the byte at offset from the head, offset is below the ring size */
+static uint16_t ring_index(const tx_ring *r, // Ring
+                           uint16_t offset // Bytes past the head
+                          )
+{
+	uint16_t index = r->head + offset;
+
+	if (index >= r->size)
+	{
+		index -= r->size;
+	}
+	return(index);
+}
+
+/* Bytes of a ring that must stay, the message being sent and the one being built */
+static uint16_t ring_pinned(const tx_queue *q, // Queue
+                            uint8_t priority // Ring
+                           )
+{
+	uint16_t pinned = 0;
+
+	if (q->active == priority)
+	{
+		pinned += q->remaining;
+	}
+	if (q->open == priority && !q->overflow)
+	{
+		pinned += TX_HEADER_LEN + q->open_len;
+	}
+	return(pinned);
+}
+
+/* Discards the oldest data message that has not started */
+static void drop_oldest(tx_queue *q // Queue with a waiting data message
+                       )
+{
+	tx_ring *r = &q->ring[TX_DATA];
+	uint16_t start = (q->active == TX_DATA) ? q->remaining : 0; // The message being sent stays ahead of it
+	uint16_t len = TX_HEADER_LEN + (r->buf[ring_index(r, start)] | (r->buf[ring_index(r, start + 1)] << 8));
+
+	for (uint16_t i = start; i > 0; i--) // Slide the rest of the message being sent over the dropped one
+	{
+		r->buf[ring_index(r, i - 1 + len)] = r->buf[ring_index(r, i - 1)];
+	}
+	r->head = ring_index(r, len);
+	r->used -= len;
+	r->waiting--;
+	q->count.dropped++;
+}
+
+/* Frees need bytes in a ring, dropping old data messages if that is allowed */
+static int8_t make_room(tx_queue *q, // Queue
+                        uint8_t priority, // Ring
+                        uint16_t need // Bytes to add
+                       )
+{
+	tx_ring *r = &q->ring[priority];
+
+	if ((uint32_t)ring_pinned(q, priority) + need > r->size)
+	{
+		return(-1); // Would not fit even after dropping every waiting message
+	}
+	while (r->size - r->used < need)
+	{
+		if (priority != TX_DATA || r->waiting == 0)
+		{
+			return(-1);
+		}
+		drop_oldest(q);
+	}
+	return(0);
+}
+
+/* Copies bytes to the tail of a ring that has room for them */
+static void ring_write(tx_ring *r, // Ring
+                       const uint8_t *data, // Bytes to add
+                       uint16_t len // Number of bytes
+                      )
+{
+	for (uint16_t i = 0; i < len; i++)
+	{
+		r->buf[ring_index(r, r->used++)] = data[i];
+	}
+}
+
+/* Empties a queue and clears its counters */
+void tx_init(tx_queue *q, // Queue to clear
+             uint8_t *data_buf, // Data ring
+             uint16_t data_size, // Data ring size
+             uint16_t late_ms // Queue time after which a message counts as late
+            )
+{
+	memset(q, 0, sizeof(tx_queue));
+	q->ring[TX_ALERT].buf = q->alert_buf;
+	q->ring[TX_ALERT].size = TX_ALERT_BYTES;
+	q->ring[TX_DATA].buf = data_buf;
+	q->ring[TX_DATA].size = data_size;
+	q->active = TX_NONE;
+	q->open = TX_NONE;
+	q->late_ms = late_ms;
+}
+
+/* Starts building a message */
+int8_t tx_begin(tx_queue *q, // Queue to add to
+                uint8_t priority, // TX_ALERT or TX_DATA
+                uint32_t now_ms // millis()
+               )
+{
+	uint8_t header[TX_HEADER_LEN] = {0, 0, (uint8_t)now_ms, (uint8_t)(now_ms >> 8)}; // Length is filled in by tx_end()
+
+	if (q->open != TX_NONE || priority >= TX_PRIORITIES)
+	{
+		q->count.rejected++;
+		return(-1);
+	}
+	q->open = priority;
+	q->open_len = 0;
+	q->overflow = make_room(q, priority, TX_HEADER_LEN) != 0;
+	if (!q->overflow)
+	{
+		ring_write(&q->ring[priority], header, TX_HEADER_LEN);
+	}
+	return(0);
+}
+
+/* Adds bytes to the open message */
+int8_t tx_append(tx_queue *q, // Queue with an open message
+                 const uint8_t *data, // Bytes to add
+                 uint16_t len // Number of bytes
+                )
+{
+	tx_ring *r;
+
+	if (q->open == TX_NONE || q->overflow)
+	{
+		return(-1);
+	}
+	r = &q->ring[q->open];
+	if (make_room(q, q->open, len) != 0)
+	{
+		r->used -= TX_HEADER_LEN + q->open_len; // The open message is always last
+		q->overflow = 1;
+		return(-1);
+	}
+	ring_write(r, data, len);
+	q->open_len += len;
+	return(0);
+}
+
+/* Queues the open message */
+int8_t tx_end(tx_queue *q // Queue with an open message
+             )
+{
+	tx_ring *r;
+	uint16_t header;
+
+	if (q->open == TX_NONE)
+	{
+		q->count.rejected++;
+		return(-1);
+	}
+	r = &q->ring[q->open];
+	q->open = TX_NONE;
+	if (q->overflow)
+	{
+		q->count.rejected++;
+		return(-1);
+	}
+	header = r->used - TX_HEADER_LEN - q->open_len;
+	r->buf[ring_index(r, header)] = (uint8_t)q->open_len;
+	r->buf[ring_index(r, header + 1)] = (uint8_t)(q->open_len >> 8);
+	r->waiting++;
+	q->count.queued++;
+	return(0);
+}
+
+/* Queues a whole message */
+int8_t tx_enqueue(tx_queue *q, // Queue to add to
+                  uint8_t priority, // TX_ALERT or TX_DATA
+                  const uint8_t *data, // Message
+                  uint16_t len, // Message length
+                  uint32_t now_ms // millis()
+                 )
+{
+	if (tx_begin(q, priority, now_ms) != 0)
+	{
+		return(-1);
+	}
+	tx_append(q, data, len);
+	return(tx_end(q));
+}
+
+/* Points at the next bytes to send */
+uint16_t tx_peek(tx_queue *q, // Queue to send from
+                 uint32_t now_ms, // millis(), for the late count
+                 const uint8_t **data // Output, first byte to send
+                )
+{
+	tx_ring *r;
+
+	while (q->active == TX_NONE)
+	{
+		uint16_t queued_ms;
+
+		if (q->ring[TX_ALERT].waiting != 0)
+		{
+			q->active = TX_ALERT;
+		}
+		else if (q->ring[TX_DATA].waiting != 0)
+		{
+			q->active = TX_DATA;
+		}
+		else
+		{
+			return(0);
+		}
+
+		r = &q->ring[q->active];
+		q->remaining = r->buf[r->head] | (r->buf[ring_index(r, 1)] << 8);
+		queued_ms = r->buf[ring_index(r, 2)] | (r->buf[ring_index(r, 3)] << 8);
+		r->head = ring_index(r, TX_HEADER_LEN);
+		r->used -= TX_HEADER_LEN;
+		r->waiting--;
+		if ((uint16_t)((uint16_t)now_ms - queued_ms) > q->late_ms)
+		{
+			q->count.late++;
+		}
+		if (q->remaining == 0)
+		{
+			q->active = TX_NONE;
+			q->count.sent++;
+		}
+	}
+
+	r = &q->ring[q->active];
+	*data = &r->buf[r->head];
+	return((r->size - r->head < q->remaining) ? r->size - r->head : q->remaining);
+}
+
+/* Removes bytes the UART has taken */
+void tx_consume(tx_queue *q, // Queue sent from
+                uint16_t n // Bytes sent
+               )
+{
+	tx_ring *r;
+
+	if (q->active == TX_NONE)
+	{
+		return;
+	}
+	r = &q->ring[q->active];
+	if (n > q->remaining)
+	{
+		n = q->remaining;
+	}
+	r->head = ring_index(r, n);
+	r->used -= n;
+	q->remaining -= n;
+	if (q->remaining == 0)
+	{
+		q->active = TX_NONE;
+		q->count.sent++;
+	}
+}
+
+/* Bytes waiting in both rings */
+uint16_t tx_pending(const tx_queue *q // Queue to check
+                   )
+{
+	uint16_t pending = q->ring[TX_ALERT].used + q->ring[TX_DATA].used;
+
+	if (q->open != TX_NONE && !q->overflow)
+	{
+		pending -= TX_HEADER_LEN + q->open_len; // Not queued until tx_end()
+	}
+	return(pending);
+}
@@ -0,0 +1,145 @@
+/*! @file
+    Prioritized transmit queues for the serial links
+@verbatim
+  One tx_queue per serial sink holds whole messages in two byte rings, one
+  for alerts and one for periodic data. The caller supplies the data ring,
+  sized for the largest message it sends. Producers queue a message with
+  tx_enqueue(), or build one piece by piece with tx_begin(), tx_append()
+  and tx_end(). They never wait on the UART. The main loop drains each
+  queue with tx_peek() and tx_consume(), handing the UART only as many
+  bytes as it can take without blocking.
+
+  A message is sent whole before the next one starts. Between messages
+  alerts go before data. When the data ring is full, the oldest data
+  message that has not started is dropped to make room, since a newer
+  cycle supersedes it. An alert that does not fit is rejected and counted,
+  and so is any message larger than its ring.
+
+  Each message carries the low 16 bits of millis() from when it was queued.
+  A message that starts sending more than late_ms later is counted as late.
+@endverbatim
+*/
+
+#ifndef TXQUEUE_H
+#define TXQUEUE_H
+
+#include <stdint.h>
+
+#define TX_ALERT 0      //!< Alarms, sent before any queued data
+#define TX_DATA 1       //!< Periodic telemetry, oldest dropped when full
+#define TX_PRIORITIES 2
+#define TX_NONE 0xFF    //!< No ring
+
+#ifndef TX_ALERT_BYTES
+#define TX_ALERT_BYTES 160 //!< Alert ring size, one pass of all seven LTC2944 alerts, set with -D TX_ALERT_BYTES=n
+#endif
+#define TX_HEADER_LEN 4    //!< Length and queue time stored ahead of each message
+
+/*! Byte ring of whole messages */
+typedef struct
+{
+  uint8_t *buf;
+  uint16_t size;
+  uint16_t head;    //!< Oldest byte
+  uint16_t used;    //!< Bytes in the ring, including an open message
+  uint8_t waiting;  //!< Messages queued and not yet started
+} tx_ring;
+
+/*! Message counts since tx_init() */
+typedef struct
+{
+  uint32_t queued;   //!< Messages accepted
+  uint32_t sent;     //!< Messages handed to the UART in full
+  uint32_t dropped;  //!< Data messages discarded to make room for newer ones
+  uint32_t rejected; //!< Messages that did not fit, or were built without tx_begin()
+  uint32_t late;     //!< Messages that started more than late_ms after they were queued
+} tx_counters;
+
+/*! Queue of one serial sink */
+typedef struct
+{
+  uint8_t alert_buf[TX_ALERT_BYTES];
+  tx_ring ring[TX_PRIORITIES];
+  uint8_t active;     //!< Ring whose head message is being sent, TX_NONE between messages
+  uint16_t remaining; //!< Bytes of the active message not yet sent
+  uint8_t open;       //!< Ring a message is being built in, TX_NONE if none
+  uint16_t open_len;  //!< Bytes appended to the open message
+  uint8_t overflow;   //!< The open message did not fit and was discarded
+  uint16_t late_ms;   //!< Queue time after which a message counts as late
+  tx_counters count;
+} tx_queue;
+
+/*!
+ Empties a queue and clears its counters
+ @return void
+ */
+void tx_init(tx_queue *q, //!< Queue to clear
+             uint8_t *data_buf, //!< Data ring
+             uint16_t data_size, //!< Data ring size, a larger message is rejected
+             uint16_t late_ms //!< Queue time after which a message counts as late
+            );
+
+/*!
+ Starts building a message at the tail of one ring. If there is no room
+ the message is discarded, and tx_end() reports it.
+ @return int8_t, 0 or -1 if a message is already open
+ */
+int8_t tx_begin(tx_queue *q, //!< Queue to add to
+                uint8_t priority, //!< TX_ALERT or TX_DATA
+                uint32_t now_ms //!< millis()
+               );
+
+/*!
+ Adds bytes to the open message, dropping the oldest waiting data messages
+ when the data ring is full
+ @return int8_t, 0 or -1 if the message no longer fits, it is then discarded
+ */
+int8_t tx_append(tx_queue *q, //!< Queue with an open message
+                 const uint8_t *data, //!< Bytes to add
+                 uint16_t len //!< Number of bytes
+                );
+
+/*!
+ Queues the open message for sending
+ @return int8_t, 0 or -1 if it was discarded
+ */
+int8_t tx_end(tx_queue *q //!< Queue with an open message
+             );
+
+/*!
+ Queues a whole message
+ @return int8_t, 0 or -1 if it was rejected
+ */
+int8_t tx_enqueue(tx_queue *q, //!< Queue to add to
+                  uint8_t priority, //!< TX_ALERT or TX_DATA
+                  const uint8_t *data, //!< Message
+                  uint16_t len, //!< Message length
+                  uint32_t now_ms //!< millis()
+                 );
+
+/*!
+ Points at the next bytes to send, starting the next message if none is
+ in progress. The bytes stay queued until tx_consume().
+ @return uint16_t, contiguous bytes at *data, 0 if the queue is empty
+ */
+uint16_t tx_peek(tx_queue *q, //!< Queue to send from
+                 uint32_t now_ms, //!< millis(), for the late count
+                 const uint8_t **data //!< Output, first byte to send
+                );
+
+/*!
+ Removes bytes the UART has taken
+ @return void
+ */
+void tx_consume(tx_queue *q, //!< Queue sent from
+                uint16_t n //!< Bytes sent, at most what tx_peek() returned
+               );
+
+/*!
+ Bytes waiting to be sent in both rings
+ @return uint16_t, queued bytes including message headers
+ */
+uint16_t tx_pending(const tx_queue *q //!< Queue to check
+                   );
+
+#endif
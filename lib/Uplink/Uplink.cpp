@@ -0,0 +1,463 @@
+/*! @file
+    Store and forward uplink to the ESP8266
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include "Uplink.h"
+
+/* Index of the byte at offset from the head, offset is below the ring size */
+static uint16_t ring_index(const up_link *l, // Uplink
+                           uint16_t offset // Bytes past the head
+                          )
+{
+	uint16_t index = l->head + offset;
+
+	if (index >= l->size)
+	{
+		index -= l->size;
+	}
+	return(index);
+}
+
+/* Ring bytes of the sample whose header is offset bytes past the head */
+static uint16_t sample_size(const up_link *l, // Uplink
+                            uint16_t offset // Header offset from the head
+                           )
+{
+	return(UP_HEADER_LEN + (l->buf[ring_index(l, offset)] | (l->buf[ring_index(l, offset + 1)] << 8)));
+}
+
+/* Ring bytes of the samples that must stay, the current batch */
+static uint16_t pinned_bytes(const up_link *l // Uplink
+                            )
+{
+	return((l->state == UP_IDLE) ? 0 : l->batch_bytes);
+}
+
+/* Removes samples from the head of the ring */
+static void drop_head(up_link *l, // Uplink
+                      uint8_t n // Samples to remove
+                     )
+{
+	for (uint8_t i = 0; i < n; i++)
+	{
+		uint16_t size = sample_size(l, 0);
+		l->head = ring_index(l, size);
+		l->used -= size;
+		l->samples--;
+	}
+}
+
+/* Discards the oldest sample that is not in the current batch */
+static void drop_oldest(up_link *l // Uplink with a sample past the batch
+                       )
+{
+	uint16_t start = pinned_bytes(l); // The batch stays ahead of it
+	uint16_t size = sample_size(l, start);
+
+	for (uint16_t i = start; i > 0; i--) // Slide the batch over the dropped sample, offsets from the head stay valid
+	{
+		l->buf[ring_index(l, i - 1 + size)] = l->buf[ring_index(l, i - 1)];
+	}
+	l->head = ring_index(l, size);
+	l->used -= size;
+	l->samples--;
+	l->count.dropped++;
+}
+
+/* Sets the text to send next */
+static void set_text(up_link *l, // Uplink
+                     const char *text // Text to send
+                    )
+{
+	l->text_len = (uint8_t)strlen(text);
+	memcpy(l->text, text, l->text_len);
+	l->text_pos = 0;
+	l->in_text = 1;
+}
+
+/* Appends a decimal number to text */
+static uint8_t put_number(char *text, // Output
+                          uint32_t value // Number to write
+                         )
+{
+	char digits[10];
+	uint8_t n = 0;
+	uint8_t len = 0;
+
+	do
+	{
+		digits[n++] = (char)('0' + value % 10);
+		value /= 10;
+	}
+	while (value != 0);
+	while (n > 0)
+	{
+		text[len++] = digits[--n];
+	}
+	return(len);
+}
+
+/* Starts sending the current batch from its header */
+static void start_batch(up_link *l // Uplink with batch and seq set
+                       )
+{
+	static const char head[] = "{\"Batch\":";
+	static const char samples[] = ",\"Samples\":[";
+	uint8_t len = 0;
+
+	memcpy(l->text, head, sizeof(head) - 1);
+	len += sizeof(head) - 1;
+	len += put_number(&l->text[len], l->seq);
+	memcpy(&l->text[len], samples, sizeof(samples) - 1);
+	len += sizeof(samples) - 1;
+	l->text_len = len;
+	l->text_pos = 0;
+	l->in_text = 1;
+	l->part = 0;
+	l->offset = 0;
+	l->rendering = 0;
+	l->resend = 0;
+	l->state = UP_SENDING;
+	l->count.batches++;
+}
+
+/* Sets the next rendered piece of the sample in scratch as the text to send */
+static uint8_t render_piece(up_link *l // Uplink rendering a sample
+                           )
+{
+	uint8_t len = l->render(l->scratch, l->scratch_len, l->piece, l->text);
+
+	if (len == 0 || len >= UP_TEXT_LEN)
+	{
+		l->rendering = 0;
+		return(0);
+	}
+	l->text_len = len;
+	l->text_pos = 0;
+	l->in_text = 1;
+	return(1);
+}
+
+/* Moves on from a finished piece of the batch */
+static void next_piece(up_link *l, // Uplink
+                       uint32_t now_ms // millis()
+                      )
+{
+	if (l->in_text && l->rendering)
+	{
+		l->piece++;
+		if (render_piece(l))
+		{
+			return;
+		}
+	}
+	else if (l->in_text)
+	{
+		if (l->part == l->batch) // Trailer sent
+		{
+			l->state = l->resend ? UP_RETRY : UP_WAITING;
+			l->deadline_ms = l->resend ? l->hold_ms : now_ms + l->ack_timeout_ms;
+			return;
+		}
+		l->remaining = sample_size(l, l->offset) - UP_HEADER_LEN;
+		l->offset += UP_HEADER_LEN;
+		if (l->render != NULL) // Copied out whole, the ring may wrap inside it
+		{
+			for (l->scratch_len = 0; l->scratch_len < l->remaining; l->scratch_len++)
+			{
+				l->scratch[l->scratch_len] = l->buf[ring_index(l, l->offset++)];
+			}
+			l->remaining = 0;
+			l->piece = 0;
+			l->rendering = 1;
+			if (render_piece(l))
+			{
+				return;
+			}
+		}
+		else
+		{
+			l->in_text = 0;
+			if (l->remaining != 0)
+			{
+				return;
+			}
+		}
+	}
+	l->part++; // Sample sent, offset is at the next header
+	set_text(l, (l->part < l->batch) ? "," : "]}\n");
+}
+
+/* Schedules the current batch to be sent again */
+static void retry_batch(up_link *l, // Uplink with a batch
+                        uint32_t when_ms // Earliest resend time
+                       )
+{
+	l->state = UP_RETRY;
+	l->deadline_ms = when_ms;
+}
+
+/* Frees the samples of an acknowledged or abandoned batch */
+static void end_batch(up_link *l // Uplink with a batch
+                     )
+{
+	drop_head(l, l->batch);
+	l->batch = 0;
+	l->batch_bytes = 0;
+	l->retries = 0;
+	l->seq++;
+	l->state = UP_IDLE;
+}
+
+/* Acts on one answer line from the ESP8266 */
+static void answer(up_link *l, // Uplink
+                   uint32_t now_ms // millis()
+                  )
+{
+	static const char *const words[] = {"ACK ", "NAK ", "BUSY "};
+	uint8_t word;
+	uint8_t i = 0;
+	uint32_t value = 0;
+
+	for (word = 0; word < 3; word++)
+	{
+		uint8_t n = (uint8_t)strlen(words[word]);
+		if (l->line_len > n && memcmp(l->line, words[word], n) == 0)
+		{
+			i = n;
+			break;
+		}
+	}
+	if (word == 3)
+	{
+		return;
+	}
+	for (; i < l->line_len; i++)
+	{
+		if (l->line[i] < '0' || l->line[i] > '9' || value > 100000000UL)
+		{
+			return;
+		}
+		value = value*10 + (uint32_t)(l->line[i] - '0');
+	}
+
+	if (word == 2) // BUSY
+	{
+		l->count.busy++;
+		if (value > UP_BUSY_MAX_MS)
+		{
+			value = UP_BUSY_MAX_MS;
+		}
+		l->hold_ms = now_ms + value;
+		if (l->state != UP_IDLE)
+		{
+			l->resend = 1;
+		}
+		if (l->state == UP_WAITING || l->state == UP_RETRY)
+		{
+			retry_batch(l, l->hold_ms);
+		}
+		return;
+	}
+	if (l->state == UP_IDLE || l->state == UP_SENDING || value != l->seq)
+	{
+		return; // Stale answer to an earlier send
+	}
+	if (word == 0) // ACK, also after a timeout, so the resend is saved
+	{
+		l->count.delivered += l->batch;
+		end_batch(l);
+	}
+	else if (l->state == UP_WAITING) // NAK
+	{
+		l->count.naks++;
+		retry_batch(l, now_ms);
+	}
+}
+
+/* Empties the uplink and sets when batches start */
+void up_init(up_link *l, // Uplink to clear
+             uint8_t *buf, // Sample ring
+             uint16_t size, // Ring size
+             uint8_t batch_samples, // Samples waiting that start a batch
+             uint16_t max_wait_ms, // Age of the oldest sample that starts a smaller batch
+             uint16_t ack_timeout_ms // Time to wait for an answer to a batch
+            )
+{
+	memset(l, 0, sizeof(up_link));
+	l->buf = buf;
+	l->size = size;
+	l->batch_samples = (batch_samples < 1) ? 1 : (batch_samples > UP_BATCH_MAX) ? UP_BATCH_MAX : batch_samples;
+	l->max_wait_ms = max_wait_ms;
+	l->ack_timeout_ms = ack_timeout_ms;
+}
+
+/* Sends samples as compact records rendered as JSON */
+void up_set_render(up_link *l, // Uplink
+                   up_render render, // Writes the JSON of a sample
+                   uint8_t *scratch, // Room for the largest sample
+                   uint16_t scratch_size // Its size
+                  )
+{
+	l->render = render;
+	l->scratch = scratch;
+	l->scratch_size = scratch_size;
+}
+
+/* Queues a sample */
+int8_t up_add(up_link *l, // Uplink to add to
+              const uint8_t *data, // Sample
+              uint16_t len, // Sample length
+              uint32_t now_ms // millis()
+             )
+{
+	uint8_t header[UP_HEADER_LEN] = {(uint8_t)len, (uint8_t)(len >> 8), (uint8_t)now_ms, (uint8_t)(now_ms >> 8),
+	                                 (uint8_t)(now_ms >> 16), (uint8_t)(now_ms >> 24)};
+
+	if ((uint32_t)pinned_bytes(l) + UP_HEADER_LEN + len > l->size || l->samples == 0xFF || (l->render != NULL && len > l->scratch_size))
+	{
+		l->count.rejected++;
+		return(-1);
+	}
+	while (l->size - l->used < UP_HEADER_LEN + len)
+	{
+		drop_oldest(l);
+	}
+	for (uint8_t i = 0; i < UP_HEADER_LEN; i++)
+	{
+		l->buf[ring_index(l, l->used++)] = header[i];
+	}
+	for (uint16_t i = 0; i < len; i++)
+	{
+		l->buf[ring_index(l, l->used++)] = data[i];
+	}
+	l->samples++;
+	l->count.queued++;
+	return(0);
+}
+
+/* Points at the next bytes to send */
+uint16_t up_peek(up_link *l, // Uplink to send from
+                 uint32_t now_ms, // millis()
+                 const uint8_t **data // Output, first byte to send
+                )
+{
+	uint16_t index;
+
+	if (l->state == UP_WAITING && (int32_t)(now_ms - l->deadline_ms) >= 0)
+	{
+		uint32_t backoff = (uint32_t)UP_BACKOFF_MS << (l->retries < 5 ? l->retries : 5);
+		l->count.timeouts++;
+		retry_batch(l, now_ms + (backoff > UP_BACKOFF_MAX_MS ? UP_BACKOFF_MAX_MS : backoff));
+	}
+	if (l->state == UP_RETRY && (int32_t)(now_ms - l->deadline_ms) >= 0 && (int32_t)(now_ms - l->hold_ms) >= 0)
+	{
+		if (!l->resend && l->retries >= UP_RETRY_MAX)
+		{
+			l->count.abandoned += l->batch;
+			end_batch(l);
+		}
+		else
+		{
+			l->retries += l->resend ? 0 : 1; // A busy ESP8266 is not a failed send
+			l->count.resent++;
+			start_batch(l);
+		}
+	}
+	if (l->state == UP_IDLE && l->samples != 0 && (int32_t)(now_ms - l->hold_ms) >= 0)
+	{
+		uint32_t queued_ms = (uint32_t)l->buf[ring_index(l, 2)] | ((uint32_t)l->buf[ring_index(l, 3)] << 8) |
+		                     ((uint32_t)l->buf[ring_index(l, 4)] << 16) | ((uint32_t)l->buf[ring_index(l, 5)] << 24);
+		if (l->samples >= l->batch_samples || now_ms - queued_ms >= l->max_wait_ms || l->used >= l->size/2)
+		{
+			l->batch = 0;
+			l->batch_bytes = 0;
+			do // At most half the ring, so new samples still fit while the batch waits
+			{
+				l->batch_bytes += sample_size(l, l->batch_bytes);
+				l->batch++;
+			}
+			while (l->batch < l->samples && l->batch < UP_BATCH_MAX &&
+			       l->batch_bytes + sample_size(l, l->batch_bytes) <= l->size/2);
+			start_batch(l);
+		}
+	}
+	if (l->state != UP_SENDING)
+	{
+		return(0);
+	}
+
+	if (l->in_text)
+	{
+		*data = (const uint8_t *)&l->text[l->text_pos];
+		return(l->text_len - l->text_pos);
+	}
+	index = ring_index(l, l->offset);
+	*data = &l->buf[index];
+	return((l->size - index < l->remaining) ? l->size - index : l->remaining);
+}
+
+/* Advances past bytes the UART has taken */
+void up_consume(up_link *l, // Uplink sent from
+                uint16_t n, // Bytes sent
+                uint32_t now_ms // millis()
+               )
+{
+	if (l->state != UP_SENDING)
+	{
+		return;
+	}
+	if (l->in_text)
+	{
+		l->text_pos += (n > l->text_len - l->text_pos) ? l->text_len - l->text_pos : n;
+		if (l->text_pos == l->text_len)
+		{
+			next_piece(l, now_ms);
+		}
+		return;
+	}
+	if (n > l->remaining)
+	{
+		n = l->remaining;
+	}
+	l->offset += n;
+	l->remaining -= n;
+	if (l->remaining == 0)
+	{
+		next_piece(l, now_ms);
+	}
+}
+
+/* Takes one byte from the ESP8266 */
+void up_receive(up_link *l, // Uplink the answer is for
+                uint8_t c, // Byte received
+                uint32_t now_ms // millis()
+               )
+{
+	if (c == '\n' || c == '\r')
+	{
+		if (l->line_len <= UP_LINE_LEN)
+		{
+			answer(l, now_ms);
+		}
+		l->line_len = 0;
+		return;
+	}
+	if (l->line_len < UP_LINE_LEN)
+	{
+		l->line[l->line_len++] = (char)c;
+	}
+	else
+	{
+		l->line_len = UP_LINE_LEN + 1; // Too long, ignored up to the newline
+	}
+}
+
+/* Whether a batch is part way out */
+uint8_t up_sending(const up_link *l // Uplink to check
+                  )
+{
+	return(l->state == UP_SENDING);
+}
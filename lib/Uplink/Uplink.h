@@ -0,0 +1,195 @@
+/*! @file
+    Store and forward uplink to the ESP8266
+@verbatim
+  Samples wait in a RAM ring until the ESP8266 has acknowledged them. They
+  go out in batches of up to UP_BATCH_MAX samples, one line per batch:
+
+    {"Batch":<seq>,"Samples":[<sample>,<sample>,...]}\n
+
+  A sample is one JSON value, or with up_set_render() a compact record
+  the ring holds in a fraction of the space. Each record is then copied
+  out of the ring and written as JSON one piece at a time, up to
+  UP_TEXT_LEN - 1 bytes a piece, as the UART takes it, so its JSON is
+  never held whole.
+
+  The ESP8266 answers each batch with one line:
+
+    ACK <seq>    the batch is stored or forwarded, its samples are freed
+    NAK <seq>    the batch arrived damaged, it is sent again
+    BUSY <ms>    nothing is taken for ms, the batch is sent again after that
+
+  A batch that is not answered within ack_timeout_ms is sent again after a
+  backoff that doubles with each retry, up to UP_BACKOFF_MAX_MS. A batch
+  still unanswered or refused after UP_RETRY_MAX retries is abandoned, so
+  one sample the ESP8266 cannot take does not stall the link. Resends
+  after BUSY do not count, however long the ESP8266 stays busy. The ESP8266 can tell a
+  resent batch by its sequence number.
+
+  A batch starts once batch_samples samples are waiting, the oldest has
+  waited max_wait_ms, or the samples fill half the ring, so newer samples
+  never push out older ones before they get a batch. A batch takes at most
+  half the ring, and at least one sample. A sample larger than half the
+  ring goes alone, and samples that arrive while it waits for its answer
+  are rejected. While the ESP8266 is slow, new samples keep arriving.
+  When the ring is full the oldest sample not in the batch being sent is
+  dropped and counted. The batch on the wire is never broken.
+
+  The sender drains the uplink with up_peek() and up_consume() like a
+  tx_queue, and feeds every byte the ESP8266 sends to up_receive().
+@endverbatim
+*/
+
+#ifndef UPLINK_H
+#define UPLINK_H
+
+#include <stdint.h>
+
+#define UP_HEADER_LEN 6       //!< Length and queue time stored ahead of each sample
+#define UP_BATCH_MAX 8        //!< Samples per batch
+#define UP_RETRY_MAX 8        //!< Resends before a batch is abandoned
+#define UP_BACKOFF_MS 500     //!< Wait before the first resend after a timeout
+#define UP_BACKOFF_MAX_MS 16000
+#define UP_BUSY_MAX_MS 30000  //!< Longest hold a BUSY line can ask for
+#define UP_TEXT_LEN 32        //!< Batch header text, or one rendered piece of a sample
+#define UP_LINE_LEN 16        //!< Longest answer line
+
+/* States */
+#define UP_IDLE 0     //!< No batch
+#define UP_SENDING 1  //!< Batch going out
+#define UP_WAITING 2  //!< Batch sent, waiting for the answer
+#define UP_RETRY 3    //!< Batch to be sent again at deadline_ms
+
+/*! Counts since up_init() */
+typedef struct
+{
+  uint32_t queued;    //!< Samples accepted
+  uint32_t dropped;   //!< Samples dropped unsent to make room for newer ones
+  uint32_t rejected;  //!< Samples that did not fit beside the batch waiting for its answer, or the render scratch
+  uint32_t delivered; //!< Samples acknowledged
+  uint32_t abandoned; //!< Samples in batches given up after UP_RETRY_MAX resends
+  uint32_t batches;   //!< Batches sent, resends included
+  uint32_t resent;    //!< Batches sent again
+  uint32_t naks;      //!< NAK answers
+  uint32_t busy;      //!< BUSY answers
+  uint32_t timeouts;  //!< Batches not answered in time
+} up_counters;
+
+/*!
+ Writes one piece of the JSON of a compact sample into text, a NUL
+ terminated string of at most UP_TEXT_LEN - 1 bytes. Pieces are asked for
+ in order from 0, and there is at least one.
+ @return uint8_t, piece length, 0 once the sample is done
+ */
+typedef uint8_t (*up_render)(const uint8_t *sample, //!< Sample as up_add() took it
+                             uint16_t len, //!< Sample length
+                             uint16_t piece, //!< Piece to write
+                             char *text //!< Output, UP_TEXT_LEN bytes
+                            );
+
+/*! Uplink state */
+typedef struct
+{
+  uint8_t *buf;          //!< Sample ring
+  uint16_t size;         //!< Ring size
+  uint16_t head;         //!< Oldest byte
+  uint16_t used;         //!< Bytes in the ring
+  uint8_t samples;       //!< Samples in the ring
+  uint8_t batch_samples; //!< Samples waiting that start a batch
+  uint16_t max_wait_ms;  //!< Age of the oldest sample that starts a batch
+  uint16_t ack_timeout_ms;
+  uint8_t state;         //!< UP_IDLE, UP_SENDING, UP_WAITING or UP_RETRY
+  uint16_t seq;          //!< Sequence number of the current batch
+  uint8_t batch;         //!< Samples in the current batch, the oldest in the ring
+  uint16_t batch_bytes;  //!< Ring bytes of those samples
+  uint8_t retries;       //!< Resends of the current batch
+  uint8_t resend;        //!< The next resend is for BUSY, and does not count as a retry
+  uint32_t deadline_ms;  //!< Answer due in UP_WAITING, resend time in UP_RETRY
+  uint32_t hold_ms;      //!< No batch starts before this, after BUSY
+  uint8_t part;          //!< Sample being sent, batch while the trailer is
+  uint8_t in_text;       //!< Sending text, not sample bytes
+  uint16_t offset;       //!< Ring offset from the head of the next sample byte, or its header
+  uint16_t remaining;    //!< Sample bytes left to send
+  up_render render;      //!< Writes the JSON of compact samples, NULL if samples are JSON
+  uint8_t *scratch;      //!< Sample being rendered, copied out of the ring
+  uint16_t scratch_size;
+  uint16_t scratch_len;  //!< Length of that sample
+  uint16_t piece;        //!< Piece of it in text
+  uint8_t rendering;     //!< The text is a piece of a sample
+  char text[UP_TEXT_LEN];
+  uint8_t text_len;
+  uint8_t text_pos;
+  char line[UP_LINE_LEN]; //!< Answer being received
+  uint8_t line_len;
+  up_counters count;
+} up_link;
+
+/*!
+ Empties the uplink, clears its counters and sets when batches start
+ @return void
+ */
+void up_init(up_link *l, //!< Uplink to clear
+             uint8_t *buf, //!< Sample ring, at least two batches of samples with UP_HEADER_LEN bytes each
+             uint16_t size, //!< Ring size
+             uint8_t batch_samples, //!< Samples waiting that start a batch, 1 to UP_BATCH_MAX
+             uint16_t max_wait_ms, //!< Age of the oldest sample that starts a smaller batch
+             uint16_t ack_timeout_ms //!< Time to wait for an answer to a batch
+            );
+
+/*!
+ Sends samples as compact records, each written as JSON by render as it
+ goes out
+ @return void
+ */
+void up_set_render(up_link *l, //!< Uplink, set up with up_init()
+                   up_render render, //!< Writes the JSON of a sample
+                   uint8_t *scratch, //!< Room for the largest sample
+                   uint16_t scratch_size //!< Its size, larger samples are rejected
+                  );
+
+/*!
+ Queues a sample, dropping the oldest unsent samples if the ring is full
+ @return int8_t, 0 or -1 if it can never fit
+ */
+int8_t up_add(up_link *l, //!< Uplink to add to
+              const uint8_t *data, //!< Sample, one JSON value or a record for the render function
+              uint16_t len, //!< Sample length
+              uint32_t now_ms //!< millis()
+             );
+
+/*!
+ Points at the next bytes to send, starting or resending a batch when it
+ is time. The bytes stay queued until up_consume().
+ @return uint16_t, contiguous bytes at *data, 0 if nothing is to be sent now
+ */
+uint16_t up_peek(up_link *l, //!< Uplink to send from
+                 uint32_t now_ms, //!< millis()
+                 const uint8_t **data //!< Output, first byte to send
+                );
+
+/*!
+ Advances past bytes the UART has taken
+ @return void
+ */
+void up_consume(up_link *l, //!< Uplink sent from
+                uint16_t n, //!< Bytes sent, at most what up_peek() returned
+                uint32_t now_ms //!< millis(), starts the answer timeout
+               );
+
+/*!
+ Takes one byte from the ESP8266 and acts on each whole answer line
+ @return void
+ */
+void up_receive(up_link *l, //!< Uplink the answer is for
+                uint8_t c, //!< Byte received
+                uint32_t now_ms //!< millis()
+               );
+
+/*!
+ Whether a batch is part way out, so no other message may be sent on the
+ same UART until it ends
+ @return uint8_t, 1 while sending
+ */
+uint8_t up_sending(const up_link *l //!< Uplink to check
+                  );
+
+#endif
@@ -0,0 +1,58 @@
+/*! @file
+    Zig-zag varints
+*/
+
+#include <stdint.h>
+#include "Varint.h"
+
+/* Stores a signed value as a zig-zag varint */
+uint8_t varint_put(uint8_t *out, // Output, VARINT_MAX bytes
+                   int32_t value // Value to store
+                  )
+{
+	uint32_t zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+	uint8_t len = 0;
+
+	while (zigzag >= 0x80)
+	{
+		out[len++] = (uint8_t)(zigzag | 0x80);
+		zigzag >>= 7;
+	}
+	out[len++] = (uint8_t)zigzag;
+	return(len);
+}
+
+/* Bytes a signed value takes as a zig-zag varint */
+uint8_t varint_len(int32_t value // Value to measure
+                  )
+{
+	uint32_t zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+	uint8_t len = 1;
+
+	while (zigzag >= 0x80)
+	{
+		zigzag >>= 7;
+		len++;
+	}
+	return(len);
+}
+
+/* Loads a zig-zag varint */
+uint8_t varint_get(const uint8_t *in, // Input
+                   uint16_t len, // Bytes available
+                   int32_t *value // Output
+                  )
+{
+	uint32_t zigzag = 0;
+
+	for (uint8_t i = 0; i < len && i < VARINT_MAX; i++)
+	{
+		zigzag |= (uint32_t)(in[i] & 0x7F) << (7*i);
+		if (!(in[i] & 0x80))
+		{
+			*value = (int32_t)((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+			return((uint8_t)(i + 1));
+		}
+	}
+	return(0);
+}
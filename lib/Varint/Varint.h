@@ -0,0 +1,45 @@
+/*! @file
+    Zig-zag varints
+@verbatim
+  Signed differences of slowly changing codes are small, so they are stored
+  in as few bytes as they need. Zig-zag maps a signed value to an unsigned
+  one, small magnitudes to small numbers: 0, -1, 1, -2, 2 become 0, 1, 2,
+  3, 4. The result is then stored 7 bits per byte, least significant first,
+  with bit 7 set on every byte but the last. A difference within +-63 takes
+  one byte, within +-8191 two, and a 16 bit code three at most.
+@endverbatim
+*/
+
+#ifndef VARINT_H
+#define VARINT_H
+
+#include <stdint.h>
+
+#define VARINT_MAX 5 //!< Most bytes of one value
+
+/*!
+ Stores a signed value as a zig-zag varint
+ @return uint8_t, bytes stored
+ */
+uint8_t varint_put(uint8_t *out, //!< Output, VARINT_MAX bytes
+                   int32_t value //!< Value to store
+                  );
+
+/*!
+ Bytes a signed value takes as a zig-zag varint
+ @return uint8_t, 1 to VARINT_MAX
+ */
+uint8_t varint_len(int32_t value //!< Value to measure
+                  );
+
+/*!
+ Loads a zig-zag varint
+ @return uint8_t, bytes read, 0 if the value runs past len or is longer
+ than VARINT_MAX bytes
+ */
+uint8_t varint_get(const uint8_t *in, //!< Input
+                   uint16_t len, //!< Bytes available
+                   int32_t *value //!< Output
+                  );
+
+#endif
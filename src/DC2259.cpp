@@ -82,29 +82,85 @@ In this sketch book:
 #include "LTC681x.h"
 #include "LTC6811.h"
 #include "LTC2944.h"
+#include "CellStats.h"
+#include "BmsSnapshot.h"
+#include "Telemetry.h"
+#include "TxQueue.h"
+#include "JsonWriter.h"
+#include "BlePacket.h"
+#include "Subscriptions.h"
+#include "Uplink.h"
+#include "SdLog.h"
+#include "BinLog.h"
 #include <Wire.h>
 
 #include "RTClib.h"
 #include <SD.h>
-#include <ArduinoJson.h>
 
 /************************* Defines *****************************/
 #define ENABLED 1
 #define DISABLED 0
 #define DATALOG_ENABLED 1
 #define DATALOG_DISABLED 0
+#define OUTPUT_TEXT 0
+#define OUTPUT_BINARY 1
+#define SINK_BLE 0
+#define SINK_WIFI 1
+#define TX_SINKS 2
+#define JSON_TELEMETRY_MAX (160 + 14*BMS_TOTAL_IC*STATS_IC_CELLS) //!< LTC2944 readings and time, then "Cnnn":v.vvvv, per cell
+#define TX_DATA_BYTES (TX_HEADER_LEN + JSON_TELEMETRY_MAX) //!< Data ring of each link, one telemetry document of the whole chain
+#define UPLINK_SAMPLE_MAX (23 + 2*BMS_TOTAL_IC*STATS_IC_CELLS) //!< Compact WiFi sample, see queue_sample()
+#define TIMESTAMP_LEN 20 //!< YYYY-MM-DDTHH:MM:SS and the NUL
 #define SPI_CLOCK_DIV16 0x01
 
-File myFile;
+File myFile; //!< Data log file, open from setup() on
 
 String data1;
 static char outstr[15];
-StaticJsonDocument<512> doc;
+static_assert(UPLINK_SAMPLE_MAX <= JSON_TELEMETRY_MAX, "WiFi samples are built in TELEMETRY_JSON");
+char TELEMETRY_JSON[JSON_TELEMETRY_MAX]; //!< measurement_loop2 JSON, written once per pass and sent to every link
+json_writer TELEMETRY; //!< Writer filling TELEMETRY_JSON
+json_writer UPLINK_JSON; //!< Writer of the WiFi sample going out, one member at a time into the uplink's text
+const char KEY_CELL[] PROGMEM = "C"; //!< Cells are numbered down the whole chain, C13 is cell 1 of IC 2 with 12 cells
+const char KEY_CHARGE[] PROGMEM = "Charge";
+const char KEY_CURRENT[] PROGMEM = "Current";
+const char KEY_VOLTAGE[] PROGMEM = "Voltage";
+const char KEY_TIME[] PROGMEM = "Time";
+const char KEY_TEMPERATURE[] PROGMEM = "Temperature";
+const char *const PACK_KEYS[] PROGMEM = {KEY_CHARGE, KEY_CURRENT, KEY_VOLTAGE, KEY_TIME, KEY_TEMPERATURE}; //!< LTC2944 members after the cells, in the order build_json() writes them
+const char ALERT_UVLO[] PROGMEM = "UVLO Alert";
+const char ALERT_VOLTAGE[] PROGMEM = "Voltage Alert";
+const char ALERT_CHARGE_LOW[] PROGMEM = "Charge Low Alert";
+const char ALERT_CHARGE_HIGH[] PROGMEM = "Charge High Alert";
+const char ALERT_TEMPERATURE[] PROGMEM = "Temperature Alert";
+const char ALERT_CHARGE_FLOW[] PROGMEM = "Charge Over/Under Flow Alert";
+const char ALERT_CURRENT[] PROGMEM = "Current Alert";
+const char *const ALERT_NAMES[] PROGMEM = {ALERT_UVLO, ALERT_VOLTAGE, ALERT_CHARGE_LOW, ALERT_CHARGE_HIGH,
+                                           ALERT_TEMPERATURE, ALERT_CHARGE_FLOW, ALERT_CURRENT}; //!< By LTC2944 status bit
+#define ALERT_JSON_MAX 146 //!< {"Alert":[...]} naming all seven alerts
+static_assert(TX_HEADER_LEN + ALERT_JSON_MAX <= TX_ALERT_BYTES, "One pass of alerts does not fit the link queues, raise TX_ALERT_BYTES in platformio.ini");
+const char SINK_NAME_SERIAL[] PROGMEM = "Serial";
+const char SINK_NAME_BLE[] PROGMEM = "BLE (Serial1)";
+const char SINK_NAME_WIFI[] PROGMEM = "WiFi (Serial2)";
+const char SINK_NAME_SD[] PROGMEM = "SD";
+const char *const SINK_NAMES[SUB_SINKS] PROGMEM = {SINK_NAME_SERIAL, SINK_NAME_BLE, SINK_NAME_WIFI, SINK_NAME_SD}; //!< By SUB_ sink
+
+/*! LTC2944 readings of one measurement_loop2 pass, in the units chosen on the settings menu */
+typedef struct
+{
+  float charge;      //!< mAh or C
+  float current;     //!< A
+  float voltage;     //!< V
+  float temperature; //!< C or K
+  uint8_t status;    //!< Status register, read every pass for the alerts
+} pack_reading;
 
 /**************** Local Function Declaration *******************/
 
-void ReadSD();
-void writeSD(uint8_t data);
+void log_open(void);
+int8_t log_read(uint32_t block, uint8_t *data);
+int8_t log_write(uint32_t block, const uint8_t *data);
+int8_t log_sync(void);
 
 
 void measurement_loop(uint8_t datalog_en);
@@ -112,19 +168,43 @@ void measurement_loop2(uint8_t datalog_en, int8_t mAh_or_Coulombs , int8_t celci
 void print_menu(void);
 void print_wrconfig(void);
 void print_rxconfig(void);
-void print_cells(uint8_t datalog_en);
-void print_cells_SD(uint8_t datalog_en);
-void BLE_cells(uint8_t datalog_en); //added by AE
-void print_aux(uint8_t datalog_en);
-void print_stat(void);
-void print_sumofcells(void);
+void print_cells(const bms_snapshot *snap, uint8_t datalog_en);
+void log_cells(const bms_snapshot *snap, uint8_t fields);
+void BLE_cells(const bms_snapshot *snap, uint8_t datalog_en); //added by AE
+void print_aux(const bms_snapshot *snap, uint8_t datalog_en);
+void print_stat(const bms_snapshot *snap);
+void print_sumofcells(const bms_snapshot *snap);
+const bms_snapshot *publish_measurements(void);
+void send_telemetry(Print &port, const bms_snapshot *snap, uint8_t fields, tlm_delta *delta);
+uint16_t build_json(const bms_snapshot *snap, const pack_reading *pack, uint8_t fields, const char *stamp);
+void send_link(uint8_t sink, const bms_snapshot *snap, const pack_reading *pack, uint8_t fields, const char *stamp, uint32_t rtc_s);
+void queue_sample(const bms_snapshot *snap, const pack_reading *pack, uint8_t fields, uint32_t rtc_s);
+uint8_t render_sample(const uint8_t *sample, uint16_t len, uint16_t piece, char *text);
+void send_ble(const bms_snapshot *snap, const pack_reading *pack, uint8_t fields);
+int8_t read_pack(pack_reading *pack, uint8_t fields, int8_t mAh_or_Coulombs, int8_t celcius_or_kelvin, uint16_t prescalar_mode, uint16_t prescalarValue, uint16_t alcc_mode);
+void print_pack(const pack_reading *pack, uint8_t fields, const char *stamp, int8_t mAh_or_Coulombs, int8_t celcius_or_kelvin);
+void print_serial(const bms_snapshot *snap, const pack_reading *pack, uint8_t fields, const char *stamp, uint8_t datalog_en, int8_t mAh_or_Coulombs, int8_t celcius_or_kelvin);
+void set_subscription(void);
+void set_delta_sink(void);
+void print_subscriptions(void);
+void ble_send(const uint8_t *frame, uint8_t len);
+int32_t round_clamped(float value, int32_t low, int32_t high);
+void format_timestamp(const DateTime &time, char *text);
+void queue_alerts(uint8_t status_code);
+void tx_service(void);
+void tx_wait(uint32_t wait_ms);
+void print_tx_counters(void);
 void check_mux_fail(void);
 void print_selftest_errors(uint8_t adc_reg ,int8_t error);
 void print_overlap_results(int8_t error);
 void print_digital_redundancy_errors(uint8_t adc_reg ,int8_t error);
 void print_open_wires(void);
 void print_pec_error_count(void);
+void print_ram_budget(void);
+int free_ram(void);
+void print_cell_stats(void);
 int8_t select_s_pin(void);
+int8_t claim_shadows(void);
 void print_wrpwm(void);
 void print_rxpwm(void);
 void print_wrsctrl(void);
@@ -132,9 +212,12 @@ void print_rxsctrl(void);
 void print_wrcomm(void);
 void print_rxcomm(void);
 void print_conv_time(uint32_t conv_time);
+void conversion_idle_task(void);
+void build_loop_plan(uint8_t fields);
 void check_error(int error);
 void serial_print_text(char data[]);
 void serial_print_hex(uint8_t data);
+void print_fixed(Print &port, int32_t value, uint8_t decimals);
 char read_hex(void);   
 char get_char(void);
 void run_command(uint32_t cmd);
@@ -180,7 +263,7 @@ static uint8_t alert_code = 0;             //!< Value stored or read from ALERT
   Setup Variables
   The following variables can be modified to configure the software.
 ********************************************************************/
-const uint8_t TOTAL_IC = 1;//!< Number of ICs in the daisy chain
+const uint8_t TOTAL_IC = BMS_TOTAL_IC;//!< Number of ICs in the daisy chain, set in platformio.ini
 
 
 
@@ -196,6 +279,16 @@ const uint8_t SEL_REG_A = REG_1; //!< Register Selection
 const uint8_t SEL_REG_B = REG_2; //!< Register Selection 
 
 const uint16_t MEASUREMENT_LOOP_TIME = 3000; //!< Loop Time in milliseconds(ms)
+const uint16_t TX_LATE_MS = 2000; //!< A queued BLE or WiFi message that waits longer than this counts as late
+const uint16_t SUB_WINDOW_MS = 50; //!< Sinks due this close together share one acquisition
+const uint16_t BLE_BUDGET_BPS = 480; //!< Bytes per second of BLE packets, half of 9600 baud so alerts still get through
+const uint8_t UPLINK_BATCH = 4; //!< WiFi samples sent to the ESP8266 in one batch
+const uint16_t UPLINK_WAIT_MS = 10000; //!< A smaller batch goes once its oldest sample has waited this long
+const uint16_t UPLINK_ACK_MS = 1500; //!< A batch the ESP8266 has not answered by then is sent again
+const uint16_t LOG_FLUSH_MS = 1000; //!< Longest SD log data waits in RAM before it is written to the card
+const uint8_t LOG_SYNC_BLOCKS = 8; //!< SD log blocks written between file system syncs
+const uint8_t TLM_KEYFRAME_EVERY = 16; //!< Delta frames of a type from one keyframe to the next, the most cycles a receiver waits after a lost frame
+const char LOG_FILE[] = "bmslog.bin"; //!< SD data log in the lib/BinLog format, appended to across resets
 
 //Under Voltage and Over Voltage Thresholds
 const uint16_t OV_THRESHOLD = 44000; //!< Over voltage threshold ADC Code. LSB = 0.0001 ---(4.4V)
@@ -207,7 +300,9 @@ const uint8_t READ_CONFIG = DISABLED; //!< This is to ENABLED or DISABLED readin
 const uint8_t MEASURE_CELL = ENABLED; //!< This is to ENABLED or DISABLED measuring the cell voltages in a continuous loop
 const uint8_t MEASURE_AUX = DISABLED; //!< This is to ENABLED or DISABLED reading the auxiliary registers in a continuous loop
 const uint8_t MEASURE_STAT = DISABLED; //!< This is to ENABLED or DISABLED reading the status registers in a continuous loop
+const uint8_t READ_RETRIES = 2; //!< Times a register group that fails the PEC check is read again, up to READ_RETRY_MAX
 const uint8_t PRINT_PEC = DISABLED; //!< This is to ENABLED or DISABLED printing the PEC Error Count in a continuous loop
+const uint8_t LOOP_FIELDS = (MEASURE_CELL == ENABLED ? SUB_CELLS : 0) | (MEASURE_AUX == ENABLED ? SUB_AUX : 0) | (MEASURE_STAT == ENABLED ? SUB_STAT : 0); //!< Registers measurement_loop reads, and the default subscriptions
 
 RTC_DS3231 rtc; //Real time clock object
 
@@ -224,6 +319,39 @@ RTC_DS3231 rtc; //Real time clock object
  on the number of ICs on the stack
  ******************************************************/
 cell_asic BMS_IC[TOTAL_IC]; //!< Global Battery Variable
+adc_conversion ADC_CONV = {0, 0, 0, NULL}; //!< ADC conversion in progress on the daisy chain
+char loop_input = 0; //!< Character received while the measurement loops wait on the ADC
+cell_history CELL_HISTORY; //!< Last STATS_HISTORY cycles of cell codes and the running statistics of every cell
+snapshot_buffer SNAPSHOTS; //!< Complete measurement cycles for the output code, filled from BMS_IC
+/*! Print that fills the open message of a tx_queue, so print() can build a queued message */
+class QueuedPrint : public Print
+{
+  public:
+    QueuedPrint(tx_queue *q) : queue(q) {}
+    using Print::write;
+    size_t write(uint8_t c) { return(tx_append(queue, &c, 1) == 0); }
+    size_t write(const uint8_t *buffer, size_t size) { return(tx_append(queue, buffer, size) == 0 ? size : 0); }
+    tx_queue *queue;
+};
+
+tx_queue TX_QUEUES[TX_SINKS]; //!< Transmit queues of the 9600 baud links, drained by tx_service() so no loop waits on them
+uint8_t TX_DATA_RINGS[TX_SINKS][TX_DATA_BYTES]; //!< Data rings of TX_QUEUES
+HardwareSerial *const TX_SERIAL[TX_SINKS] = {&Serial1, &Serial2}; //!< SINK_BLE, SINK_WIFI
+QueuedPrint TX_PRINT[TX_SINKS] = {QueuedPrint(&TX_QUEUES[SINK_BLE]), QueuedPrint(&TX_QUEUES[SINK_WIFI])};
+uint8_t OUTPUT_FORMAT = OUTPUT_TEXT; //!< OUTPUT_TEXT or OUTPUT_BINARY telemetry frames from the measurement loops, command 34
+sub_table SUBSCRIPTIONS; //!< Fields and period of each measurement_loop2 sink, command 36
+uint8_t DELTA_SINKS = 0; //!< Bit 1 << SUB_BLE, SUB_WIFI or SUB_SD set when that sink delta codes its register fields, command 37
+tlm_delta LINK_DELTA[TX_SINKS]; //!< Codes the last frames of each link carried, the base of its next delta frames
+uint32_t LINK_DROPPED[TX_SINKS]; //!< Data messages each queue had dropped when its last delta frames were queued
+ble_link BLE_LINK; //!< Budget and counters of the BLE packets measurement_loop2 sends in OUTPUT_BINARY
+ble_field BLE_FIELDS[8 + BMS_TOTAL_IC*STATS_IC_CELLS]; //!< Pack fields, then every cell, for one ble_pack()
+up_link UPLINK; //!< WiFi samples held until the ESP8266 acknowledges them, see lib/Uplink
+uint8_t UPLINK_RING[2*UPLINK_BATCH*(UP_HEADER_LEN + UPLINK_SAMPLE_MAX)]; //!< Two whole batches of compact samples, one waiting for its answer while the next fills
+uint8_t UPLINK_SCRATCH[UPLINK_SAMPLE_MAX]; //!< The sample being written out as JSON
+const sd_log_io LOG_IO = {log_read, log_write, log_sync}; //!< Blocks of myFile
+sd_log SD_LOG; //!< Data log on the SD card, see lib/SdLog
+bin_log BIN_LOG; //!< Binary records of SD_LOG, see lib/BinLog
+extern char __heap_start, *__brkval; //!< From avr-libc, the end of the static data and the top of the heap, 0 until malloc()
 
 /*********************************************************
  Set the configuration bits. 
@@ -238,6 +366,21 @@ bool DCCBITS_A[12] = {false,false,false,false,false,false,false,false,false,fals
 bool DCTOBITS[4] = {true, false, true, false}; //!< Discharge time value // Dcto 0,1,2,3 // Programed for 4 min 
 /*Ensure that Dcto bits are set according to the required discharge time. Refer to the data sheet */
 
+/*********************************************************
+ Measurement plans. Each runs its conversions and register
+ reads back to back with a single wakeup, see LTC681x_run_plan().
+**********************************************************/
+meas_step CVAX_STEPS[] = {{PLAN_ADCVAX, 0, 0, 0}, {PLAN_RDCV, SEL_ALL_REG, 0, 0}, {PLAN_RDAUX, SEL_REG_A, 0, 0}}; //!< Run command 9
+meas_plan CVAX_PLAN = {CVAX_STEPS, 3, ADC_CONVERSION_MODE, ADC_DCP, ADCOPT, NULL, 0};
+meas_step CVSC_STEPS[] = {{PLAN_ADCVSC, 0, 0, 0}, {PLAN_RDCV, SEL_ALL_REG, 0, 0}, {PLAN_RDSTAT, SEL_REG_A, 0, 0}}; //!< Run command 10
+meas_plan CVSC_PLAN = {CVSC_STEPS, 3, ADC_CONVERSION_MODE, ADC_DCP, ADCOPT, NULL, 0};
+meas_step ALL_STEPS[] = {{PLAN_ADCV, CELL_CH_TO_CONVERT, 0, 0}, {PLAN_RDCV, SEL_ALL_REG, 0, 0}, //!< Run command 14
+                         {PLAN_ADAX, AUX_CH_TO_CONVERT, 0, 0}, {PLAN_RDAUX, SEL_ALL_REG, 0, 0},
+                         {PLAN_ADSTAT, STAT_CH_TO_CONVERT, 0, 0}, {PLAN_RDSTAT, SEL_ALL_REG, 0, 0}};
+meas_plan ALL_PLAN = {ALL_STEPS, 6, ADC_CONVERSION_MODE, ADC_DCP, ADCOPT, NULL, 0};
+meas_step LOOP_STEPS[6]; //!< Measurement loops, filled in from MEASURE_CELL, MEASURE_AUX and MEASURE_STAT
+meas_plan LOOP_PLAN = {LOOP_STEPS, 0, ADC_CONVERSION_MODE, ADC_DCP, ADCOPT, conversion_idle_task, 0};
+
 /*!**********************************************************************
  \brief  Initializes hardware and variables
  @return void
@@ -245,8 +388,6 @@ bool DCTOBITS[4] = {true, false, true, false}; //!< Discharge time value // Dcto
 
 
 int pinCS = 7; // Pin 10 on Arduino Uno
-void ReadSD();
-void writeSD(String data);
 
 /***********************************************************************************************************/
 /*                                               SETUP BEGINS                                              */
@@ -267,13 +408,6 @@ void setup()
   //demo_board_connected = discover_demo_board(demo_name);
   demo_board_connected = true;
   //digitalWrite(pinCS, HIGH);
-      // SD Card Initialization
-  // Serial.print("Initializing SD card...");
-
-  // if (!SD.begin(pinCS)) {
-  //   Serial.println("initialization failed!");
-  //   //while (1);
-  // }
   Serial.println("initialization done.");
   if (demo_board_connected)
   {
@@ -300,7 +434,24 @@ void setup()
     LTC6811_set_cfgr(current_ic,BMS_IC,REFON,ADCOPT,GPIOBITS_A,DCCBITS_A, DCTOBITS, UV, OV);
   }
   LTC6811_reset_crc_count(TOTAL_IC,BMS_IC);
+  LTC6811_set_read_retries(READ_RETRIES);
   LTC6811_init_reg_limits(TOTAL_IC,BMS_IC);
+  cell_stats_reset(&CELL_HISTORY);
+  snapshot_init(&SNAPSHOTS);
+  for (uint8_t sink = 0; sink < TX_SINKS; sink++)
+  {
+    tx_init(&TX_QUEUES[sink], TX_DATA_RINGS[sink], sizeof(TX_DATA_RINGS[sink]), TX_LATE_MS);
+    tlm_delta_init(&LINK_DELTA[sink], TLM_KEYFRAME_EVERY);
+  }
+  ble_init(&BLE_LINK, BLE_BUDGET_BPS);
+  up_init(&UPLINK, UPLINK_RING, sizeof(UPLINK_RING), UPLINK_BATCH, UPLINK_WAIT_MS, UPLINK_ACK_MS);
+  up_set_render(&UPLINK, render_sample, UPLINK_SCRATCH, sizeof(UPLINK_SCRATCH));
+  log_open();
+  // Every sink starts with what measurement_loop2 has always sent it
+  sub_init(&SUBSCRIPTIONS, SUB_WINDOW_MS);
+  sub_set(&SUBSCRIPTIONS, SUB_SERIAL, LOOP_FIELDS | SUB_LTC2944 | (PRINT_PEC == ENABLED ? SUB_PEC : 0), SCAN_MODE_DISPLAY_DELAY, millis());
+  sub_set(&SUBSCRIPTIONS, SUB_BLE, LOOP_FIELDS | SUB_LTC2944, SCAN_MODE_DISPLAY_DELAY, millis());
+  sub_set(&SUBSCRIPTIONS, SUB_WIFI, LOOP_FIELDS | SUB_LTC2944, SCAN_MODE_DISPLAY_DELAY, millis());
   print_menu();
 
 }
@@ -311,6 +462,7 @@ void setup()
 ***********************************************************************/
 void loop()
 {
+  tx_service();
 
   if (Serial.available())           // Check for user input
   {
@@ -338,6 +490,7 @@ void run_command(uint32_t cmd)
   int8_t error = 0;
   uint32_t conv_time = 0;
   int8_t s_pin_read=0;
+  const bms_snapshot *snap;
   
     int8_t ack = 0;                               //! I2C acknowledge indicator
                  //! The user input command
@@ -367,8 +520,8 @@ void run_command(uint32_t cmd)
 
     case 3: // Start Cell ADC Measurement
       wakeup_sleep(TOTAL_IC);
-      LTC6811_adcv(ADC_CONVERSION_MODE,ADC_DCP,CELL_CH_TO_CONVERT);
-      conv_time = LTC6811_pollAdc();
+      LTC6811_adcv_start(ADC_CONVERSION_MODE,ADC_DCP,CELL_CH_TO_CONVERT,ADCOPT,&ADC_CONV);
+      conv_time = LTC6811_conv_wait(TOTAL_IC,&ADC_CONV,NULL);
       print_conv_time(conv_time);
       break;
 
@@ -376,13 +529,13 @@ void run_command(uint32_t cmd)
       wakeup_sleep(TOTAL_IC);
       error = LTC6811_rdcv(SEL_ALL_REG, TOTAL_IC,BMS_IC); // Set to read back all cell voltage registers
       check_error(error);
-      print_cells(DATALOG_DISABLED);
+      print_cells(publish_measurements(),DATALOG_DISABLED);
       break;
 
     case 5: // Start GPIO ADC Measurement
       wakeup_sleep(TOTAL_IC);
-      LTC6811_adax(ADC_CONVERSION_MODE, AUX_CH_TO_CONVERT);
-      conv_time = LTC6811_pollAdc();
+      LTC6811_adax_start(ADC_CONVERSION_MODE, AUX_CH_TO_CONVERT,ADCOPT,&ADC_CONV);
+      conv_time = LTC6811_conv_wait(TOTAL_IC,&ADC_CONV,NULL);
       print_conv_time(conv_time); 
       break;
 
@@ -390,13 +543,13 @@ void run_command(uint32_t cmd)
       wakeup_sleep(TOTAL_IC);
       error = LTC6811_rdaux(SEL_ALL_REG,TOTAL_IC,BMS_IC); // Set to read back all aux registers
       check_error(error);
-      print_aux(DATALOG_DISABLED);
+      print_aux(publish_measurements(),DATALOG_DISABLED);
       break;
 
     case 7: // Start Status ADC Measurement
       wakeup_sleep(TOTAL_IC);
-      LTC6811_adstat(ADC_CONVERSION_MODE, STAT_CH_TO_CONVERT);
-      conv_time=LTC6811_pollAdc();
+      LTC6811_adstat_start(ADC_CONVERSION_MODE, STAT_CH_TO_CONVERT,ADCOPT,&ADC_CONV);
+      conv_time = LTC6811_conv_wait(TOTAL_IC,&ADC_CONV,NULL);
       print_conv_time(conv_time);
       break;
 
@@ -404,37 +557,27 @@ void run_command(uint32_t cmd)
       wakeup_sleep(TOTAL_IC);
       error = LTC6811_rdstat(SEL_ALL_REG,TOTAL_IC,BMS_IC); // Set to read back all stat registers
       check_error(error);
-      print_stat();
+      print_stat(publish_measurements());
       break;
 
     case 9:// Start Combined Cell Voltage and GPIO1, GPIO2 Conversion and Poll Status
-      wakeup_sleep(TOTAL_IC);
-      LTC6811_adcvax(ADC_CONVERSION_MODE,ADC_DCP);
-      conv_time = LTC6811_pollAdc();
-      print_conv_time(conv_time);
-      wakeup_idle(TOTAL_IC);
-      error =LTC6811_rdcv(SEL_ALL_REG, TOTAL_IC,BMS_IC); // Set to read back all cell voltage registers
-      check_error(error);
-      print_cells(DATALOG_DISABLED);     
-      wakeup_idle(TOTAL_IC);
-      error = LTC6811_rdaux(SEL_REG_A,TOTAL_IC,BMS_IC); // Set to read back aux registers A
-      check_error(error);
-      print_aux(DATALOG_DISABLED);
+      LTC6811_run_plan(TOTAL_IC,BMS_IC,&CVAX_PLAN);
+      print_conv_time(CVAX_STEPS[0].time_us);
+      snap = publish_measurements();
+      check_error(CVAX_STEPS[1].error);
+      print_cells(snap,DATALOG_DISABLED);     
+      check_error(CVAX_STEPS[2].error);
+      print_aux(snap,DATALOG_DISABLED);
       break;
       
     case 10: //Start Combined Cell Voltage and Sum of cells
-      wakeup_sleep(TOTAL_IC);
-      LTC6811_adcvsc(ADC_CONVERSION_MODE,ADC_DCP);
-      conv_time = LTC6811_pollAdc();
-      print_conv_time(conv_time);
-      wakeup_idle(TOTAL_IC);
-      error = LTC6811_rdcv(SEL_ALL_REG, TOTAL_IC,BMS_IC); // Set to read back all cell voltage registers
-      check_error(error);
-      print_cells(DATALOG_DISABLED);
-      wakeup_idle(TOTAL_IC);
-      error = LTC6811_rdstat(SEL_REG_A,TOTAL_IC,BMS_IC); // Set to read stat registers A
-      check_error(error);
-      print_sumofcells();
+      LTC6811_run_plan(TOTAL_IC,BMS_IC,&CVSC_PLAN);
+      print_conv_time(CVSC_STEPS[0].time_us);
+      snap = publish_measurements();
+      check_error(CVSC_STEPS[1].error);
+      print_cells(snap,DATALOG_DISABLED);
+      check_error(CVSC_STEPS[2].error);
+      print_sumofcells(snap);
       break;
       
     case 11: // Loop Measurements of configuration register or cell voltages or auxiliary register or status register without data-log output
@@ -459,42 +602,28 @@ void run_command(uint32_t cmd)
       LTC6811_clrstat();
       wakeup_idle(TOTAL_IC);    
       LTC6811_rdcv(SEL_ALL_REG, TOTAL_IC,BMS_IC); // Read back all cell voltage registers
-      print_cells(DATALOG_DISABLED);
-
       LTC6811_rdaux(SEL_ALL_REG,TOTAL_IC,BMS_IC); // Read back all aux registers
-      print_aux(DATALOG_DISABLED);
-
       LTC6811_rdstat(SEL_ALL_REG,TOTAL_IC,BMS_IC); // Read back all stat 
-      print_stat();           
+      snap = publish_measurements();
+      print_cells(snap,DATALOG_DISABLED);
+      print_aux(snap,DATALOG_DISABLED);
+      print_stat(snap);           
       break;
         
     case 14: //Read CV,AUX and ADSTAT Voltages 
-      wakeup_sleep(TOTAL_IC);
-      LTC6811_adcv(ADC_CONVERSION_MODE,ADC_DCP,CELL_CH_TO_CONVERT);
-      conv_time = LTC6811_pollAdc();
-      print_conv_time(conv_time);
-      wakeup_idle(TOTAL_IC);      
-      error = LTC6811_rdcv(SEL_ALL_REG, TOTAL_IC,BMS_IC); // Set to read back all cell voltage registers
-      check_error(error);
-      print_cells(DATALOG_DISABLED);
-
-      wakeup_sleep(TOTAL_IC);
-      LTC6811_adax(ADC_CONVERSION_MODE , AUX_CH_TO_CONVERT);
-      conv_time = LTC6811_pollAdc();
-      print_conv_time(conv_time);
-      wakeup_idle(TOTAL_IC); 
-      error = LTC6811_rdaux(SEL_ALL_REG,TOTAL_IC,BMS_IC); // Set to read back all aux registers
-      check_error(error);
-      print_aux(DATALOG_DISABLED);   
-
-      wakeup_sleep(TOTAL_IC);
-      LTC6811_adstat(ADC_CONVERSION_MODE, STAT_CH_TO_CONVERT);
-      conv_time = LTC6811_pollAdc();
-      print_conv_time(conv_time);
-      wakeup_idle(TOTAL_IC);
-      error = LTC6811_rdstat(SEL_ALL_REG,TOTAL_IC,BMS_IC); // Set to read back all status registers 
-      check_error(error);
-      print_stat();    
+      LTC6811_run_plan(TOTAL_IC,BMS_IC,&ALL_PLAN);
+      snap = publish_measurements();
+      print_conv_time(ALL_STEPS[0].time_us);
+      check_error(ALL_STEPS[1].error);
+      print_cells(snap,DATALOG_DISABLED);
+
+      print_conv_time(ALL_STEPS[2].time_us);
+      check_error(ALL_STEPS[3].error);
+      print_aux(snap,DATALOG_DISABLED);   
+
+      print_conv_time(ALL_STEPS[4].time_us);
+      check_error(ALL_STEPS[5].error);
+      print_stat(snap);    
       break;
 
     case 15: // Run the Mux Decoder Self Test
@@ -561,6 +690,7 @@ void run_command(uint32_t cmd)
 
     case 22: // Reset PEC Counter
       LTC6811_reset_crc_count(TOTAL_IC,BMS_IC);
+      LTC6811_reset_retry_stats();
       print_pec_error_count();
       break;
       
@@ -588,6 +718,10 @@ void run_command(uint32_t cmd)
       break;
 
     case 25:// Write read pwm configuration     
+      if (claim_shadows() != 0)
+      {
+        break;
+      }
       /*****************************************************
          PWM configuration data.
          1)Set the corresponding DCC bit to one for pwm operation. 
@@ -599,12 +733,12 @@ void run_command(uint32_t cmd)
       wakeup_sleep(TOTAL_IC);
       for (uint8_t current_ic = 0; current_ic<TOTAL_IC;current_ic++) 
       {
-        BMS_IC[current_ic].pwm.tx_data[0]= 0x88; // Duty cycle for S pin 2 and 1
-        BMS_IC[current_ic].pwm.tx_data[1]= 0x88; // Duty cycle for S pin 4 and 3
-        BMS_IC[current_ic].pwm.tx_data[2]= 0x88; // Duty cycle for S pin 6 and 5
-        BMS_IC[current_ic].pwm.tx_data[3]= 0x88; // Duty cycle for S pin 8 and 7
-        BMS_IC[current_ic].pwm.tx_data[4]= 0x88; // Duty cycle for S pin 10 and 9
-        BMS_IC[current_ic].pwm.tx_data[5]= 0x88; // Duty cycle for S pin 12 and 11
+        BMS_IC[current_ic].shadow->pwm.tx_data[0]= 0x88; // Duty cycle for S pin 2 and 1
+        BMS_IC[current_ic].shadow->pwm.tx_data[1]= 0x88; // Duty cycle for S pin 4 and 3
+        BMS_IC[current_ic].shadow->pwm.tx_data[2]= 0x88; // Duty cycle for S pin 6 and 5
+        BMS_IC[current_ic].shadow->pwm.tx_data[3]= 0x88; // Duty cycle for S pin 8 and 7
+        BMS_IC[current_ic].shadow->pwm.tx_data[4]= 0x88; // Duty cycle for S pin 10 and 9
+        BMS_IC[current_ic].shadow->pwm.tx_data[5]= 0x88; // Duty cycle for S pin 12 and 11
       }          
       LTC6811_wrpwm(TOTAL_IC,0,BMS_IC);
       print_wrpwm(); 
@@ -615,6 +749,10 @@ void run_command(uint32_t cmd)
       break;
 
     case 26: // Write and read S Control Register Group
+      if (claim_shadows() != 0)
+      {
+        break;
+      }
       wakeup_sleep(TOTAL_IC);
       /**************************************************************************************
          S pin control. 
@@ -624,12 +762,12 @@ void run_command(uint32_t cmd)
       ***************************************************************************************/
       for (uint8_t current_ic = 0; current_ic<TOTAL_IC;current_ic++) 
       {
-        BMS_IC[current_ic].sctrl.tx_data[0]=0xFF; // No. of high pulses on S pin 2 and 1
-        BMS_IC[current_ic].sctrl.tx_data[1]=0xFF; // No. of high pulses on S pin 4 and 3
-        BMS_IC[current_ic].sctrl.tx_data[2]=0xFF; // No. of high pulses on S pin 6 and 5
-        BMS_IC[current_ic].sctrl.tx_data[3]=0xFF; // No. of high pulses on S pin 8 and 7
-        BMS_IC[current_ic].sctrl.tx_data[4]=0xFF; // No. of high pulses on S pin 10 and 9
-        BMS_IC[current_ic].sctrl.tx_data[5]=0xFF; // No. of high pulses on S pin 12 and 11
+        BMS_IC[current_ic].shadow->sctrl.tx_data[0]=0xFF; // No. of high pulses on S pin 2 and 1
+        BMS_IC[current_ic].shadow->sctrl.tx_data[1]=0xFF; // No. of high pulses on S pin 4 and 3
+        BMS_IC[current_ic].shadow->sctrl.tx_data[2]=0xFF; // No. of high pulses on S pin 6 and 5
+        BMS_IC[current_ic].shadow->sctrl.tx_data[3]=0xFF; // No. of high pulses on S pin 8 and 7
+        BMS_IC[current_ic].shadow->sctrl.tx_data[4]=0xFF; // No. of high pulses on S pin 10 and 9
+        BMS_IC[current_ic].shadow->sctrl.tx_data[5]=0xFF; // No. of high pulses on S pin 12 and 11
       }
       LTC6811_wrsctrl(TOTAL_IC,streg,BMS_IC);
       print_wrsctrl();
@@ -646,6 +784,10 @@ void run_command(uint32_t cmd)
       break;
 
     case 27: // Clear S Control Register Group
+      if (claim_shadows() != 0)
+      {
+        break;
+      }
       wakeup_sleep(TOTAL_IC);
       LTC6811_clrsctrl();
       
@@ -656,18 +798,22 @@ void run_command(uint32_t cmd)
       break;
       
     case 28://SPI Communication 
+      if (claim_shadows() != 0)
+      {
+        break;
+      }
       /*************************************************************
          Ensure to set the GPIO bits to 1 in the CFG register group. 
       *************************************************************/  
       for (uint8_t current_ic = 0; current_ic<TOTAL_IC;current_ic++) 
       {
         //Communication control bits and communication data bytes. Refer to the data sheet.
-        BMS_IC[current_ic].com.tx_data[0]= 0x81; // Icom CSBM Low(8) + data D0 (0x11)
-        BMS_IC[current_ic].com.tx_data[1]= 0x10; // Fcom CSBM Low(0) 
-        BMS_IC[current_ic].com.tx_data[2]= 0xA2; // Icom CSBM Falling Edge (A) +  D1 (0x25)
-        BMS_IC[current_ic].com.tx_data[3]= 0x50; // Fcom CSBM Low(0)    
-        BMS_IC[current_ic].com.tx_data[4]= 0xA1; // Icom CSBM Falling Edge (A) +  D2 (0x17)
-        BMS_IC[current_ic].com.tx_data[5]= 0x79; // Fcom CSBM High(9)
+        BMS_IC[current_ic].shadow->com.tx_data[0]= 0x81; // Icom CSBM Low(8) + data D0 (0x11)
+        BMS_IC[current_ic].shadow->com.tx_data[1]= 0x10; // Fcom CSBM Low(0) 
+        BMS_IC[current_ic].shadow->com.tx_data[2]= 0xA2; // Icom CSBM Falling Edge (A) +  D1 (0x25)
+        BMS_IC[current_ic].shadow->com.tx_data[3]= 0x50; // Fcom CSBM Low(0)    
+        BMS_IC[current_ic].shadow->com.tx_data[4]= 0xA1; // Icom CSBM Falling Edge (A) +  D2 (0x17)
+        BMS_IC[current_ic].shadow->com.tx_data[5]= 0x79; // Fcom CSBM High(9)
       }
       wakeup_sleep(TOTAL_IC);   
       LTC6811_wrcomm(TOTAL_IC,BMS_IC); // write to comm register                 
@@ -683,18 +829,22 @@ void run_command(uint32_t cmd)
       break;
 
   case 29: // write byte I2C Communication on the GPIO Ports(using I2C eeprom 24LC025)
+      if (claim_shadows() != 0)
+      {
+        break;
+      }
        /************************************************************
          Ensure to set the GPIO bits to 1 in the CFG register group. 
       *************************************************************/   
       for (uint8_t current_ic = 0; current_ic<TOTAL_IC;current_ic++) 
       {
         //Communication control bits and communication data bytes. Refer to the data sheet.
-        BMS_IC[current_ic].com.tx_data[0]= 0x6A; // Icom Start(6) + I2C_address D0 (0xA0)
-        BMS_IC[current_ic].com.tx_data[1]= 0x08; // Fcom master NACK(8)  
-        BMS_IC[current_ic].com.tx_data[2]= 0x00; // Icom Blank (0) + eeprom address D1 (0x00)
-        BMS_IC[current_ic].com.tx_data[3]= 0x08; // Fcom master NACK(8)   
-        BMS_IC[current_ic].com.tx_data[4]= 0x01; // Icom Blank (0) + data D2 (0x11)
-        BMS_IC[current_ic].com.tx_data[5]= 0x19; // Fcom master NACK + Stop(9) 
+        BMS_IC[current_ic].shadow->com.tx_data[0]= 0x6A; // Icom Start(6) + I2C_address D0 (0xA0)
+        BMS_IC[current_ic].shadow->com.tx_data[1]= 0x08; // Fcom master NACK(8)  
+        BMS_IC[current_ic].shadow->com.tx_data[2]= 0x00; // Icom Blank (0) + eeprom address D1 (0x00)
+        BMS_IC[current_ic].shadow->com.tx_data[3]= 0x08; // Fcom master NACK(8)   
+        BMS_IC[current_ic].shadow->com.tx_data[4]= 0x01; // Icom Blank (0) + data D2 (0x11)
+        BMS_IC[current_ic].shadow->com.tx_data[5]= 0x19; // Fcom master NACK + Stop(9) 
       }
       wakeup_sleep(TOTAL_IC);       
       LTC6811_wrcomm(TOTAL_IC,BMS_IC); // write to comm register    
@@ -710,18 +860,22 @@ void run_command(uint32_t cmd)
       break; 
 
     case 30: // Read byte data I2C Communication on the GPIO Ports(using I2C eeprom 24LC025)
+      if (claim_shadows() != 0)
+      {
+        break;
+      }
       /************************************************************
          Ensure to set the GPIO bits to 1 in the CFG register group.  
       *************************************************************/     
       for (uint8_t current_ic = 0; current_ic<TOTAL_IC;current_ic++) 
       {
         //Communication control bits and communication data bytes. Refer to the data sheet.        
-        BMS_IC[current_ic].com.tx_data[0]= 0x6A; // Icom Start (6) + I2C_address D0 (A0) (Write operation to set the word address)
-        BMS_IC[current_ic].com.tx_data[1]= 0x08; // Fcom master NACK(8)  
-        BMS_IC[current_ic].com.tx_data[2]= 0x00; // Icom Blank (0) + eeprom address(word address) D1 (0x00)
-        BMS_IC[current_ic].com.tx_data[3]= 0x08; // Fcom master NACK(8)
-        BMS_IC[current_ic].com.tx_data[4]= 0x6A; // Icom Start (6) + I2C_address D2 (0xA1)(Read operation)
-        BMS_IC[current_ic].com.tx_data[5]= 0x18; // Fcom master NACK(8)  
+        BMS_IC[current_ic].shadow->com.tx_data[0]= 0x6A; // Icom Start (6) + I2C_address D0 (A0) (Write operation to set the word address)
+        BMS_IC[current_ic].shadow->com.tx_data[1]= 0x08; // Fcom master NACK(8)  
+        BMS_IC[current_ic].shadow->com.tx_data[2]= 0x00; // Icom Blank (0) + eeprom address(word address) D1 (0x00)
+        BMS_IC[current_ic].shadow->com.tx_data[3]= 0x08; // Fcom master NACK(8)
+        BMS_IC[current_ic].shadow->com.tx_data[4]= 0x6A; // Icom Start (6) + I2C_address D2 (0xA1)(Read operation)
+        BMS_IC[current_ic].shadow->com.tx_data[5]= 0x18; // Fcom master NACK(8)  
       }
       wakeup_sleep(TOTAL_IC);         
       LTC6811_wrcomm(TOTAL_IC,BMS_IC); // write to comm register 
@@ -732,12 +886,12 @@ void run_command(uint32_t cmd)
       for (uint8_t current_ic = 0; current_ic<TOTAL_IC;current_ic++) 
       { 
         //Communication control bits and communication data bytes. Refer to the data sheet.       
-        BMS_IC[current_ic].com.tx_data[0]= 0x0F; // Icom Blank (0) + data D0 (FF)
-        BMS_IC[current_ic].com.tx_data[1]= 0xF9; // Fcom master NACK + Stop(9) 
-        BMS_IC[current_ic].com.tx_data[2]= 0x7F; // Icom No Transmit (7) + data D1 (FF)
-        BMS_IC[current_ic].com.tx_data[3]= 0xF9; // Fcom master NACK + Stop(9)
-        BMS_IC[current_ic].com.tx_data[4]= 0x7F; // Icom No Transmit (7) + data D2 (FF)
-        BMS_IC[current_ic].com.tx_data[5]= 0xF9; // Fcom master NACK + Stop(9) 
+        BMS_IC[current_ic].shadow->com.tx_data[0]= 0x0F; // Icom Blank (0) + data D0 (FF)
+        BMS_IC[current_ic].shadow->com.tx_data[1]= 0xF9; // Fcom master NACK + Stop(9) 
+        BMS_IC[current_ic].shadow->com.tx_data[2]= 0x7F; // Icom No Transmit (7) + data D1 (FF)
+        BMS_IC[current_ic].shadow->com.tx_data[3]= 0xF9; // Fcom master NACK + Stop(9)
+        BMS_IC[current_ic].shadow->com.tx_data[4]= 0x7F; // Icom No Transmit (7) + data D2 (FF)
+        BMS_IC[current_ic].shadow->com.tx_data[5]= 0xF9; // Fcom master NACK + Stop(9) 
       }  
 
       wakeup_idle(TOTAL_IC);
@@ -766,6 +920,32 @@ void run_command(uint32_t cmd)
       LTC6811_wrcfg(TOTAL_IC,BMS_IC);
       print_wrconfig();
       break;
+
+    case 32: // RAM budget
+      print_ram_budget();
+      break;
+
+    case 33: // Running cell statistics from the measurement loops
+      print_cell_stats();
+      break;
+
+    case 34: // Binary telemetry frames instead of text from the measurement loops
+      OUTPUT_FORMAT = (OUTPUT_FORMAT == OUTPUT_TEXT) ? OUTPUT_BINARY : OUTPUT_TEXT;
+      Serial.print(F("Measurement loop output: "));
+      Serial.println((OUTPUT_FORMAT == OUTPUT_BINARY) ? F("binary frames, decode with host/tlm_decode") : F("text"));
+      break;
+
+    case 35: // Queued, dropped and late messages of the BLE and WiFi links
+      print_tx_counters();
+      break;
+
+    case 36: // Fields and period of one measurement_loop2 sink
+      set_subscription();
+      break;
+
+    case 37: // Delta coded register fields on one measurement_loop2 sink
+      set_delta_sink();
+      break;
         case 41:
         ack |= menu_1_automatic_mode(mAh_or_Coulombs, celcius_or_kelvin, prescalar_mode, prescalarValue, alcc_mode);  //! Automatic Mode
         break;
@@ -821,16 +1001,28 @@ void measurement_loop2(uint8_t datalog_en, int8_t mAh_or_Coulombs , int8_t celci
 {
   int8_t error = 0;
   char input = 0;
-  DateTime now = rtc.now(); //print timestamp
+  const bms_snapshot *snap;
+  pack_reading pack;
+  char stamp[TIMESTAMP_LEN];
+  DateTime time;
+  uint8_t due, fields;
   
   Serial.println(F("Transmit 'm' to quit"));
+  sub_start(&SUBSCRIPTIONS, millis());
   
   while (input != 'm')
   {
-     if (Serial.available() > 0)
-      {
-        input = read_char();
-      } 
+     conversion_idle_task();
+     input = loop_input;
+     loop_input = 0;
+    // Each pass serves the sinks now due, acquiring only the fields they take
+    if (sub_wait_ms(&SUBSCRIPTIONS, millis()) != 0)
+    {
+      continue;
+    }
+    due = sub_due(&SUBSCRIPTIONS, millis());
+    fields = sub_fields(&SUBSCRIPTIONS, due);
+
     if (WRITE_CONFIG == ENABLED)
     {
       wakeup_sleep(TOTAL_IC);
@@ -846,146 +1038,151 @@ void measurement_loop2(uint8_t datalog_en, int8_t mAh_or_Coulombs , int8_t celci
       print_rxconfig();
     }
   
-    if (MEASURE_CELL == ENABLED)
+    build_loop_plan(fields);
+    if (LOOP_PLAN.count != 0)
     {
-      wakeup_idle(TOTAL_IC);
-      LTC6811_adcv(ADC_CONVERSION_MODE,ADC_DCP,CELL_CH_TO_CONVERT);
-      LTC6811_pollAdc();
-      wakeup_idle(TOTAL_IC);
-      error = LTC6811_rdcv(SEL_ALL_REG, TOTAL_IC,BMS_IC);
+      error = LTC6811_run_plan(TOTAL_IC,BMS_IC,&LOOP_PLAN);
       check_error(error);
-      print_cells(datalog_en);
-      // BLE_cells will print Cell measurements to Serial1 which is where the Bluetooth is connected.
-      BLE_cells(datalog_en); 
-    }
-  
-    if (MEASURE_AUX == ENABLED)
-    {
-      wakeup_idle(TOTAL_IC);
-      LTC6811_adax(ADC_CONVERSION_MODE , AUX_CH_ALL);
-      LTC6811_pollAdc();
-      wakeup_idle(TOTAL_IC);
-      error = LTC6811_rdaux(SEL_ALL_REG,TOTAL_IC,BMS_IC); // Set to read back all aux registers
-      check_error(error);
-      print_aux(datalog_en);
+      if (fields & SUB_CELLS)
+      {
+        cell_stats_update(&CELL_HISTORY,TOTAL_IC,BMS_IC,millis());
+      }
+      snapshot_capture(&SNAPSHOTS,TOTAL_IC,BMS_IC,millis());
+      snapshot_publish(&SNAPSHOTS);
     }
-  
-    if (MEASURE_STAT == ENABLED)
+
+    // Output reads the newest complete cycle, never BMS_IC, so acquisition can overlap it
+    snap = snapshot_acquire(&SNAPSHOTS);
+    if (read_pack(&pack, fields, mAh_or_Coulombs, celcius_or_kelvin, prescalar_mode, prescalarValue, alcc_mode) != 0)
     {
-      wakeup_idle(TOTAL_IC);
-      LTC6811_adstat(ADC_CONVERSION_MODE, STAT_CH_ALL);
-      LTC6811_pollAdc();
-      wakeup_idle(TOTAL_IC);
-      error = LTC6811_rdstat(SEL_ALL_REG,TOTAL_IC,BMS_IC); // Set to read back all aux registers
-      check_error(error);
-      print_stat();
+      Serial.println(ack_error);
     }
-  
-    if (PRINT_PEC == ENABLED)
+    checkAlerts(pack.status);                                                                          //! Alerts go out every pass, whatever the sinks take
+    time = rtc.now();
+    format_timestamp(time, stamp);
+
+    if (due & (1 << SUB_SERIAL))
     {
-      print_pec_error_count();
+      print_serial(snap, &pack, SUBSCRIPTIONS.sink[SUB_SERIAL].fields, stamp, datalog_en, mAh_or_Coulombs, celcius_or_kelvin);
     }
+    for (uint8_t sink = SINK_BLE; sink < TX_SINKS; sink++)
     {
-  int8_t LTC2944_mode;
-  int8_t ack = 0;
-  LTC2944_mode = LTC2944_SCAN_MODE|prescalar_mode|alcc_mode ;                           //! Set the control mode of the LTC2944 to scan mode as well as set prescalar and AL#/CC# pin values.
-  Serial.println();
-  ack |= LTC2944_write(LTC2944_I2C_ADDRESS, LTC2944_CONTROL_REG, LTC2944_mode);          //! Writes the set mode to the LTC2944 control register
-
-  //do
-  //{
-    Serial.print(F("*************************\n\n"));
-
-    uint8_t status_code;
-    uint16_t charge_code, current_code, voltage_code, temperature_code;
-
-
-    ack |= LTC2944_read_16_bits(LTC2944_I2C_ADDRESS, LTC2944_ACCUM_CHARGE_MSB_REG, &charge_code);         //! Read MSB and LSB Accumulated Charge Registers for 16 bit charge code
-    ack |= LTC2944_read_16_bits(LTC2944_I2C_ADDRESS, LTC2944_VOLTAGE_MSB_REG, &voltage_code);             //! Read MSB and LSB Voltage Registers for 16 bit voltage code
-    ack |= LTC2944_read_16_bits(LTC2944_I2C_ADDRESS, LTC2944_CURRENT_MSB_REG, &current_code);             //! Read MSB and LSB Current Registers for 16 bit current code
-    ack |= LTC2944_read_16_bits(LTC2944_I2C_ADDRESS, LTC2944_TEMPERATURE_MSB_REG, &temperature_code);     //! Read MSB and LSB Temperature Registers for 16 bit temperature code
-    ack |= LTC2944_read(LTC2944_I2C_ADDRESS, LTC2944_STATUS_REG, &status_code);                           //! Read Status Registers for 8 bit status code
-
-    float charge, current, voltage, temperature;
-    if (mAh_or_Coulombs)
-    {
-      
-      charge = LTC2944_code_to_coulombs(charge_code, resistor, prescalarValue);                             //! Convert charge code to Coulombs if Coulomb units are desired.
-      Serial.print("Coulombs: ");
-      Serial.print(charge, 4);
-      Serial.print(F(" C\n"));
+      if (due & (1 << (SUB_BLE + sink))) // SUB_BLE and SUB_WIFI follow the order of SINK_BLE and SINK_WIFI
+      {
+        send_link(sink, snap, &pack, SUBSCRIPTIONS.sink[SUB_BLE + sink].fields, stamp, time.unixtime());
+      }
     }
-    else
+    if ((due & (1 << SUB_SD)) && (SUBSCRIPTIONS.sink[SUB_SD].fields & SUB_CELLS))
     {
-      charge = LTC2944_code_to_mAh(charge_code, resistor, prescalarValue);                                  //! Convert charge code to mAh if mAh units are desired.
-      Serial.print("mAh: ");
-      Serial.print(charge, 4);
-      Serial.print(F(" mAh\n"));
+      log_cells(snap, SUBSCRIPTIONS.sink[SUB_SD].fields);
     }
+  }
+}
 
-      //doc["Charge"] = dtostrf(charge,7,4,outstr); 
-      doc["Charge"] = charge;
+/*!************************************************************
+  \brief Reads the LTC2944 readings among fields, and the status
+  register every pass for the alerts
+  @return int8_t, 0 or 1 if the LTC2944 did not acknowledge
+ *************************************************************/
+int8_t read_pack(pack_reading *pack, uint8_t fields, int8_t mAh_or_Coulombs, int8_t celcius_or_kelvin, uint16_t prescalar_mode, uint16_t prescalarValue, uint16_t alcc_mode)
+{
+  int8_t ack = 0;
+  uint16_t code;
 
+  ack |= LTC2944_write(LTC2944_I2C_ADDRESS, LTC2944_CONTROL_REG, LTC2944_SCAN_MODE|prescalar_mode|alcc_mode);  //! Set the control mode of the LTC2944 to scan mode as well as set prescalar and AL#/CC# pin values.
+  if (fields & SUB_CHARGE)
+  {
+    ack |= LTC2944_read_16_bits(LTC2944_I2C_ADDRESS, LTC2944_ACCUM_CHARGE_MSB_REG, &code);            //! Read MSB and LSB Accumulated Charge Registers for 16 bit charge code
+    pack->charge = mAh_or_Coulombs ? LTC2944_code_to_coulombs(code, resistor, prescalarValue) : LTC2944_code_to_mAh(code, resistor, prescalarValue);
+  }
+  if (fields & SUB_CURRENT)
+  {
+    ack |= LTC2944_read_16_bits(LTC2944_I2C_ADDRESS, LTC2944_CURRENT_MSB_REG, &code);                 //! Read MSB and LSB Current Registers for 16 bit current code
+    pack->current = LTC2944_code_to_current(code, resistor);
+  }
+  if (fields & SUB_VOLTAGE)
+  {
+    ack |= LTC2944_read_16_bits(LTC2944_I2C_ADDRESS, LTC2944_VOLTAGE_MSB_REG, &code);                 //! Read MSB and LSB Voltage Registers for 16 bit voltage code
+    pack->voltage = LTC2944_code_to_voltage(code);
+  }
+  if (fields & SUB_TEMPERATURE)
+  {
+    ack |= LTC2944_read_16_bits(LTC2944_I2C_ADDRESS, LTC2944_TEMPERATURE_MSB_REG, &code);             //! Read MSB and LSB Temperature Registers for 16 bit temperature code
+    pack->temperature = celcius_or_kelvin ? LTC2944_code_to_kelvin_temperature(code) : LTC2944_code_to_celcius_temperature(code);
+  }
+  ack |= LTC2944_read(LTC2944_I2C_ADDRESS, LTC2944_STATUS_REG, &pack->status);                          //! Read Status Registers for 8 bit status code
+  return(ack);
+}
 
-    current = LTC2944_code_to_current(current_code, resistor);
-    
-    doc["Current"] = current;                        
-                     //! Convert current code to Amperes
-    voltage = LTC2944_code_to_voltage(voltage_code);    
-    //char bufferV[10];
-    //dtostrf(voltage,5,3,bufferV); 
-    doc["Voltage"] = voltage;                                             //! Convert voltage code to Volts
-    doc["Time"] = String(now.timestamp(DateTime::TIMESTAMP_FULL)); 
-    Serial.print(now.timestamp(DateTime::TIMESTAMP_FULL));
-    
+/*!************************************************************
+  \brief Prints the LTC2944 readings among fields to the serial port
+  @return void
+ *************************************************************/
+void print_pack(const pack_reading *pack, uint8_t fields, const char *stamp, int8_t mAh_or_Coulombs, int8_t celcius_or_kelvin)
+{
+  Serial.print(F("*************************\n\n"));
+  if (fields & SUB_CHARGE)
+  {
+    Serial.print(mAh_or_Coulombs ? F("Coulombs: ") : F("mAh: "));
+    Serial.print(pack->charge, 4);
+    Serial.print(mAh_or_Coulombs ? F(" C\n") : F(" mAh\n"));
+  }
+  Serial.println(stamp);
+  if (fields & SUB_CURRENT)
+  {
     Serial.print(F("Current "));
-    Serial.print(current, 4);
+    Serial.print(pack->current, 4);
     Serial.print(F(" A\n"));
-
+  }
+  if (fields & SUB_VOLTAGE)
+  {
     Serial.print(F("Voltage "));
-    Serial.print(voltage, 4);
+    Serial.print(pack->voltage, 4);
     Serial.print(F(" V\n"));
+  }
+  if (fields & SUB_TEMPERATURE)
+  {
+    Serial.print(F("Temperature "));
+    Serial.print(pack->temperature, 4);
+    Serial.print(celcius_or_kelvin ? F(" K\n") : F(" C\n"));
+  }
+}
 
-
-    if (celcius_or_kelvin)
+/*!************************************************************
+  \brief Prints the fields the console subscribes to, as text or
+  as binary frames followed by the LTC2944 readings
+  @return void
+ *************************************************************/
+void print_serial(const bms_snapshot *snap, const pack_reading *pack, uint8_t fields, const char *stamp, uint8_t datalog_en, int8_t mAh_or_Coulombs, int8_t celcius_or_kelvin)
+{
+  if (OUTPUT_FORMAT == OUTPUT_BINARY)
+  {
+    send_telemetry(Serial, snap, fields, NULL);
+  }
+  else
+  {
+    if (fields & SUB_CELLS)
     {
-      temperature = LTC2944_code_to_kelvin_temperature(temperature_code);                             //! Convert temperature code to Kelvin if Kelvin units are desired.
-      Serial.print(F("Temperature "));
-      Serial.print(temperature, 4);
-      Serial.print(F(" K\n"));
+      print_cells(snap,datalog_en);
     }
-    else
+    if (fields & SUB_AUX)
     {
-      temperature = LTC2944_code_to_celcius_temperature(temperature_code);                           //! Convert temperature code to Celcius if Celcius units are desired.
-      Serial.print(F("Temperature "));
-      Serial.print(temperature, 4);
-      Serial.print(F(" C\n"));
+      print_aux(snap,datalog_en);
+    }
+    if (fields & SUB_STAT)
+    {
+      print_stat(snap);
     }
-
-    doc["Temperature"] = temperature;
-
-    checkAlerts(status_code);                                                                          //! Check status code for Alerts. If an Alert has been set, print out appropriate message in the Serial Prompt
-
-    serializeJsonPretty(doc, Serial);
-    serializeJson(doc, Serial1);
-    serializeJson(doc, Serial2);
-
-    doc.clear();
-
-    Serial.print(F("m-Main Menu\n\n"));
-
-    Serial.flush();
-    delay(SCAN_MODE_DISPLAY_DELAY);
   }
-  //while (Serial.available() == false && !(ack));
-  //read_int();  // clears the Serial.available
- // return(ack);
-    
-    //delay(MEASUREMENT_LOOP_TIME);
-
-  //}
-  //input = 'm';
-}
+  if (fields & SUB_PEC)
+  {
+    print_pec_error_count();
+  }
+  if (fields & SUB_LTC2944)
+  {
+    print_pack(pack, fields, stamp, mAh_or_Coulombs, celcius_or_kelvin);
+  }
+  Serial.print(F("m-Main Menu\n\n"));
 }
 
 
@@ -1000,15 +1197,16 @@ void measurement_loop(uint8_t datalog_en)
 {
   int8_t error = 0;
   char input = 0;
+  const bms_snapshot *snap;
   
   Serial.println(F("Transmit 'm' to quit"));
+  build_loop_plan(LOOP_FIELDS);
   
   while (input != 'm')
   {
-     if (Serial.available() > 0)
-      {
-        input = read_char();
-      } 
+     conversion_idle_task();
+     input = loop_input;
+     loop_input = 0;
     if (WRITE_CONFIG == ENABLED)
     {
       wakeup_sleep(TOTAL_IC);
@@ -1024,40 +1222,40 @@ void measurement_loop(uint8_t datalog_en)
       print_rxconfig();
     }
   
-    if (MEASURE_CELL == ENABLED)
+    if (LOOP_PLAN.count != 0)
     {
-      wakeup_idle(TOTAL_IC);
-      LTC6811_adcv(ADC_CONVERSION_MODE,ADC_DCP,CELL_CH_TO_CONVERT);
-      LTC6811_pollAdc();
-      wakeup_idle(TOTAL_IC);
-      error = LTC6811_rdcv(SEL_ALL_REG, TOTAL_IC,BMS_IC);
+      error = LTC6811_run_plan(TOTAL_IC,BMS_IC,&LOOP_PLAN);
       check_error(error);
-      print_cells(datalog_en);
-      // BLE_cells will print Cell measurements to Serial1 which is where the Bluetooth is connected.
-      BLE_cells(datalog_en); 
-      //print_cells_SD(datalog_en);
+      if (MEASURE_CELL == ENABLED)
+      {
+        cell_stats_update(&CELL_HISTORY,TOTAL_IC,BMS_IC,millis());
+      }
+      snapshot_capture(&SNAPSHOTS,TOTAL_IC,BMS_IC,millis());
+      snapshot_publish(&SNAPSHOTS);
     }
-  
-    if (MEASURE_AUX == ENABLED)
+
+    // Output reads the newest complete cycle, never BMS_IC, so acquisition can overlap it
+    snap = snapshot_acquire(&SNAPSHOTS);
+    if (OUTPUT_FORMAT == OUTPUT_BINARY)
     {
-      wakeup_idle(TOTAL_IC);
-      LTC6811_adax(ADC_CONVERSION_MODE , AUX_CH_ALL);
-      LTC6811_pollAdc();
-      wakeup_idle(TOTAL_IC);
-      error = LTC6811_rdaux(SEL_ALL_REG,TOTAL_IC,BMS_IC); // Set to read back all aux registers
-      check_error(error);
-      print_aux(datalog_en);
+      send_telemetry(Serial,snap,LOOP_FIELDS,NULL);
     }
-  
-    if (MEASURE_STAT == ENABLED)
+    else
     {
-      wakeup_idle(TOTAL_IC);
-      LTC6811_adstat(ADC_CONVERSION_MODE, STAT_CH_ALL);
-      LTC6811_pollAdc();
-      wakeup_idle(TOTAL_IC);
-      error = LTC6811_rdstat(SEL_ALL_REG,TOTAL_IC,BMS_IC); // Set to read back all aux registers
-      check_error(error);
-      print_stat();
+      if (MEASURE_CELL == ENABLED)
+      {
+        print_cells(snap,datalog_en);
+      }
+  
+      if (MEASURE_AUX == ENABLED)
+      {
+        print_aux(snap,datalog_en);
+      }
+  
+      if (MEASURE_STAT == ENABLED)
+      {
+        print_stat(snap);
+      }
     }
   
     if (PRINT_PEC == ENABLED)
@@ -1066,7 +1264,7 @@ void measurement_loop(uint8_t datalog_en)
     }
     
 
-    delay(MEASUREMENT_LOOP_TIME);
+    tx_wait(MEASUREMENT_LOOP_TIME);
   }
 }
 
@@ -1095,8 +1293,12 @@ void print_menu(void)
   Serial.println(F("Start Stat Voltage Conversion: 7                           |Run Digital Redundancy Test: 18                |I2C Communication Write to Slave: 29"));             
   Serial.println(F("Read Stat Voltages: 8                                      |Open Wire Test for single cell detection: 19   |I2C Communication Read from Slave:30"));                        
   Serial.println(F("Start Combined Cell Voltage and GPIO1, GPIO2 Conversion: 9 |Open Wire Test for multiple cell detection: 20 |Set or Reset the GPIO pins: 31 ")); 
-  Serial.println(F("Start  Cell Voltage and Sum of cells : 10                  |Print PEC Counter: 21                          |"));
-  Serial.println(F("Loop Measurements: 11                                      |Reset PEC Counter: 22                          | \n "));
+  Serial.println(F("Start  Cell Voltage and Sum of cells : 10                  |Print PEC Counter: 21                          |Print RAM Budget: 32"));
+  Serial.println(F("Loop Measurements: 11                                      |Reset PEC Counter: 22                          |Print Cell Statistics: 33"));
+  Serial.println(F("                                                           |                                               |Toggle Binary Telemetry: 34"));
+  Serial.println(F("                                                           |                                               |Print Link Counters: 35"));
+  Serial.println(F("                                                           |                                               |Set Sink Subscription: 36"));
+  Serial.println(F("                                                           |                                               |Toggle Delta Compression: 37\n "));
   Serial.println(F("List of 2944 Commands: "));
   Serial.print(F("\n41-Automatic Mode\n"));
   Serial.print(F("42-Scan Mode\n"));
@@ -1171,25 +1373,27 @@ void print_rxconfig(void)
   \brief Prints cell voltage to the serial port
    @return void
  *************************************************************/
-void print_cells(uint8_t datalog_en) {
+void print_cells(const bms_snapshot *snap, uint8_t datalog_en) {
 //unsigned long int time = millis();
-DateTime now = rtc.now(); //print timestamp
+char stamp[TIMESTAMP_LEN];
+format_timestamp(rtc.now(), stamp); //print timestamp
 
-  for (int current_ic = 0 ; current_ic < TOTAL_IC; current_ic++)
+  for (int current_ic = 0 ; current_ic < snap->total_ic; current_ic++)
   {
     if (datalog_en == 0)
     {
-      Serial.println(String("DateTime:\t")+now.timestamp(DateTime::TIMESTAMP_FULL));
+      Serial.print(F("DateTime:\t"));
+      Serial.println(stamp);
       
 
       Serial.print(" IC ");
       Serial.print(current_ic+1,DEC);
-      Serial.print(": ");      for (int i=0; i< BMS_IC[0].ic_reg.cell_channels; i++)
+      Serial.print(": ");      for (int i=0; i< IC_REG(BMS_IC[0], cell_channels); i++)
       {
         Serial.print(" C");
         Serial.print(i+1,DEC);
         Serial.print(":");        
-        Serial.print(BMS_IC[current_ic].cells.c_codes[i]*0.0001,4);
+        print_fixed(Serial, snap->ic[current_ic].cells.c_codes[i], 4);
         Serial.print(",");
       }
       Serial.println();
@@ -1197,9 +1401,9 @@ DateTime now = rtc.now(); //print timestamp
     else
     {
       Serial.print(" Cells :");
-      for (int i=0; i<BMS_IC[0].ic_reg.cell_channels; i++)
+      for (int i=0; i<IC_REG(BMS_IC[0], cell_channels); i++)
       {
-        Serial.print(BMS_IC[current_ic].cells.c_codes[i]*0.0001,4);
+        print_fixed(Serial, snap->ic[current_ic].cells.c_codes[i], 4);
         Serial.print(",");
       }
     }
@@ -1208,226 +1412,645 @@ DateTime now = rtc.now(); //print timestamp
 }
 
 
-void print_cells_SD(uint8_t datalog_en) {
-//unsigned long int time = millis();
-myFile = SD.open("test.txt", FILE_WRITE);
-DateTime now = rtc.now(); //print timestamp
- // if the file opened okay, write to it:
- delay(100);
-  if (myFile) {
-       Serial.println("Writing to file...");
-
-    for (int current_ic = 0 ; current_ic < TOTAL_IC; current_ic++)
-    {
+/*!************************************************************
+  \brief Appends the cell codes, and the aux codes if fields has
+  SUB_AUX, to the SD log as one binary record with the RTC time
+  and millis() of the snapshot, see lib/BinLog
+  @return void
+ *************************************************************/
+void log_cells(const bms_snapshot *snap, uint8_t fields)
+{
+  if (SD_LOG.io == NULL)
+  {
+    return; // No card, log_open() said so at reset
+  }
+  bl_add(&BIN_LOG, rtc.now().unixtime(), snap->time_ms, snap->total_ic,
+         IC_REG(BMS_IC[0], cell_channels), (fields & SUB_AUX) ? IC_REG(BMS_IC[0], aux_channels) : 0,
+         snap->ic[0].cells.c_codes, snap->ic[0].aux.a_codes, sizeof(ic_measurement), millis());
+}
+
+
+/*!************************************************************
+  \brief Adds the cell voltages to the telemetry JSON that
+  build_json() writes
+   @return void
+ *************************************************************/
+void BLE_cells(const bms_snapshot *snap, uint8_t datalog_en)
+
+{
+  char text[FIXED_TEXT_LEN];
+  for (int current_ic = 0 ; current_ic < snap->total_ic; current_ic++)
+  {
     if (datalog_en == 0)
     {
-      myFile.println(String("DateTime:\t")+now.timestamp(DateTime::TIMESTAMP_FULL));
+      //Serial1.print(" IC ");
+      //data1 += " IC ";
+      //Serial1.print(current_ic+1,DEC);
+      //data1 += current_ic+1, DEC;
 
-      myFile.print(" IC ");
-      myFile.print(current_ic+1,DEC);
-      myFile.print(": ");      for (int i=0; i< BMS_IC[0].ic_reg.cell_channels; i++)
+      //Serial1.print(": ");
+      //data1+= ": ";      
+      for (int i=0; i< IC_REG(BMS_IC[0], cell_channels); i++)
       {
-        myFile.print(" C");
-        myFile.print(i+1,DEC);
-        myFile.print(":");        
-        myFile.print(BMS_IC[current_ic].cells.c_codes[i]*0.0001,4);
-        myFile.print(",");
+        //Serial1.print(" C");
+        //Serial1.print(i+1,DEC);
+
+        //Serial1.print(":");        
+        //Serial1.print(snap->ic[current_ic].cells.c_codes[i]*0.0001,4);
+        //Serial1.print(",");
+        /*Adding cells to the telemetry JSON.*/
+        json_key_index_P(&TELEMETRY, KEY_CELL, current_ic*IC_REG(BMS_IC[0], cell_channels) + i + 1);
+        json_fixed(&TELEMETRY, snap->ic[current_ic].cells.c_codes[i], 4);
+
       }
-      myFile.println();
+      //Serial1.println();
     }
     else
     {
-      myFile.print(" Cells :");
-      for (int i=0; i<BMS_IC[0].ic_reg.cell_channels; i++)
+      //Serial1.print(" Cells :");
+      for (int i=0; i<IC_REG(BMS_IC[0], cell_channels); i++)
       {
-        myFile.print(BMS_IC[current_ic].cells.c_codes[i]*0.0001,4);
-        myFile.print(",");
+        //Serial1.print(snap->ic[current_ic].cells.c_codes[i]*0.0001,4);
+        //Serial1.print(",");
       }
     }
   }
- 
-    myFile.close(); // close the file
-    Serial.println("Done.");
+  //Serial1.println("\n");
+}
+
+/*!****************************************************************************
+  \brief Prints GPIO voltage codes and Vref2 voltage code onto the serial port
+ @return void
+ *****************************************************************************/
+void print_aux(const bms_snapshot *snap, uint8_t datalog_en)
+{
+
+  for (int current_ic =0 ; current_ic < snap->total_ic; current_ic++)
+  {
+    if (datalog_en == 0)
+    {
+      Serial.print(" IC ");
+      Serial.print(current_ic+1,DEC);
+      Serial.print(":");
+      
+      for (int i=0; i < 5; i++)
+      {
+        Serial.print(F(" GPIO-"));
+        Serial.print(i+1,DEC);
+        Serial.print(":");
+        print_fixed(Serial, snap->ic[current_ic].aux.a_codes[i], 4);
+        Serial.print(",");
+      }
+      Serial.print(F(" Vref2"));
+      Serial.print(":");
+      print_fixed(Serial, snap->ic[current_ic].aux.a_codes[5], 4);
+      Serial.println();
+    }
+    else
+    {
+      Serial.print("AUX ");
+      Serial.print(" IC ");
+      Serial.print(current_ic+1,DEC);
+      Serial.print(": ");
+
+      for (int i=0; i < 6; i++)
+      {
+        print_fixed(Serial, snap->ic[current_ic].aux.a_codes[i], 4);
+        Serial.print(",");
+      }
+    }
   }
+  Serial.println("\n");
+}
 
-    // if the file didn't open, print an error:
-  else {
-    Serial.println("error opening test.txt");
+/*!****************************************************************************
+  \brief Prints Status voltage codes and Vref2 voltage code onto the serial port
+ @return void
+ *****************************************************************************/
+void print_stat(const bms_snapshot *snap)
+{
+  for (uint8_t current_ic =0 ; current_ic < snap->total_ic; current_ic++)
+  {
+    Serial.print(F(" IC "));
+    Serial.print(current_ic+1,DEC);
+    Serial.print(F(": "));
+    Serial.print(F(" SOC:"));
+    print_fixed(Serial, snap->ic[current_ic].stat.stat_codes[0]*20L, 4);
+    Serial.print(F(","));
+    Serial.print(F(" Itemp:"));
+    print_fixed(Serial, LTC6811_die_temp(snap->ic[current_ic].stat.stat_codes[1]), 2);   //Internal Die Temperature(°C) = itmp • (100 µV / 7.5mV)°C - 273°C
+    Serial.print(F(","));
+    Serial.print(F(" VregA:"));
+    print_fixed(Serial, snap->ic[current_ic].stat.stat_codes[2], 4);
+    Serial.print(F(","));
+    Serial.print(F(" VregD:"));
+    print_fixed(Serial, snap->ic[current_ic].stat.stat_codes[3], 4);
+    Serial.println();
+    Serial.print(F(" Flags:"));
+    Serial.print(F(" 0x"));
+    serial_print_hex(snap->ic[current_ic].stat.flags[0]);
+    Serial.print(F(", 0x"));
+    serial_print_hex(snap->ic[current_ic].stat.flags[1]);
+    Serial.print(F(", 0x"));
+    serial_print_hex(snap->ic[current_ic].stat.flags[2]);
+    Serial.print(F("   Mux fail flag:"));
+    Serial.print(F(" 0x"));
+    serial_print_hex(snap->ic[current_ic].stat.mux_fail[0]);
+    Serial.print(F("   THSD:"));
+    Serial.print(F(" 0x"));
+    serial_print_hex(snap->ic[current_ic].stat.thsd[0]);
+    Serial.println("\n");  
   }
+}
 
+/*!****************************************************************************
+  \brief Prints Status voltage codes for SOC onto the serial port
+ @return void
+ *****************************************************************************/
+void print_sumofcells(const bms_snapshot *snap)
+{
+ for (int current_ic =0 ; current_ic < snap->total_ic; current_ic++)
+  {
+    Serial.print(F(" IC "));
+    Serial.print(current_ic+1,DEC);
+    Serial.print(F(": "));
+    Serial.print(F(" SOC:"));
+    print_fixed(Serial, snap->ic[current_ic].stat.stat_codes[0]*20L, 4);
+    Serial.print(F(","));
+  }
   Serial.println("\n");
 }
 
+/*!************************************************************
+  \brief Copies the registers just read from BMS_IC into the
+  back snapshot, publishes it and holds it for printing
+  @return const bms_snapshot *, the published cycle
+ *************************************************************/
+const bms_snapshot *publish_measurements(void)
+{
+  snapshot_capture(&SNAPSHOTS,TOTAL_IC,BMS_IC,millis());
+  snapshot_publish(&SNAPSHOTS);
+  return(snapshot_acquire(&SNAPSHOTS));
+}
+
+/*!************************************************************
+  \brief Writes the cells and LTC2944 readings among fields into
+  TELEMETRY_JSON, with the time
+  @return uint16_t, length, 0 if it did not fit
+ *************************************************************/
+uint16_t build_json(const bms_snapshot *snap, const pack_reading *pack, uint8_t fields, const char *stamp)
+{
+  uint16_t len;
 
-/**
- *   myFile = SD.open("test.txt", FILE_WRITE);
-    // if the file opened okay, write to it:
-  if (myFile) {
-    Serial.println("Writing to file...");
-    // Write to file
-    myFile.println("BMS DATA");
-    myFile.println(data);
-    myFile.close(); // close the file
-    Serial.println("Done.");
+  json_begin(&TELEMETRY, TELEMETRY_JSON, sizeof(TELEMETRY_JSON));
+  json_open_object(&TELEMETRY);
+  if (fields & SUB_CELLS)
+  {
+    BLE_cells(snap,DATALOG_DISABLED);
+  }
+  if (fields & SUB_CHARGE)
+  {
+    json_key_P(&TELEMETRY, KEY_CHARGE);
+    json_float(&TELEMETRY, pack->charge, 4);
+  }
+  if (fields & SUB_CURRENT)
+  {
+    json_key_P(&TELEMETRY, KEY_CURRENT);
+    json_float(&TELEMETRY, pack->current, 4);
+  }
+  if (fields & SUB_VOLTAGE)
+  {
+    json_key_P(&TELEMETRY, KEY_VOLTAGE);
+    json_float(&TELEMETRY, pack->voltage, 4);
   }
+  json_key_P(&TELEMETRY, KEY_TIME);
+  json_string(&TELEMETRY, stamp);
+  if (fields & SUB_TEMPERATURE)
+  {
+    json_key_P(&TELEMETRY, KEY_TEMPERATURE);
+    json_float(&TELEMETRY, pack->temperature, 4);
+  }
+  json_close(&TELEMETRY);
+  len = json_end(&TELEMETRY);
+  if (len == 0)
+  {
+    Serial.println(F("Telemetry JSON does not fit in JSON_TELEMETRY_MAX"));
+  }
+  return(len);
+}
+
+/*!************************************************************
+  \brief Queues the fields one link subscribes to. Text output is
+  the JSON of the cells and LTC2944 readings. Binary output is
+  BLE packets on Serial1, and on Serial2 frames of the register
+  fields followed by the JSON of the LTC2944 readings. A link in
+  DELTA_SINKS sends its register fields as delta frames in either
+  format, then the JSON of the rest. The WiFi JSON goes to the
+  ESP8266 in acknowledged batches, queued as compact samples
+  @return void
+ *************************************************************/
+void send_link(uint8_t sink, const bms_snapshot *snap, const pack_reading *pack, uint8_t fields, const char *stamp, uint32_t rtc_s)
+{
+  uint16_t len;
+  tlm_delta *delta = (DELTA_SINKS & (1 << (SUB_BLE + sink))) ? &LINK_DELTA[sink] : NULL;
 
-    // if the file didn't open, print an error:
-  else {
-    Serial.println("error opening test.txt");
+  if (OUTPUT_FORMAT == OUTPUT_BINARY || delta != NULL)
+  {
+    if (sink == SINK_BLE && delta == NULL)
+    {
+      send_ble(snap, pack, fields);
+      return;
+    }
+    if (fields & SUB_REGISTERS)
+    {
+      if (delta != NULL && TX_QUEUES[sink].count.dropped != LINK_DROPPED[sink])
+      {
+        tlm_delta_init(delta, TLM_KEYFRAME_EVERY); // The queue dropped a message, maybe frames the receiver needs
+      }
+      LINK_DROPPED[sink] = TX_QUEUES[sink].count.dropped;
+      tx_begin(&TX_QUEUES[sink], TX_DATA, millis());
+      send_telemetry(TX_PRINT[sink], snap, fields, delta);
+      if (tx_end(&TX_QUEUES[sink]) != 0 && delta != NULL)
+      {
+        tlm_delta_init(delta, TLM_KEYFRAME_EVERY); // The frames never went out, the next are keyframes
+      }
+    }
+    fields &= (uint8_t)~SUB_REGISTERS;
+  }
+  if ((fields & (SUB_CELLS | SUB_LTC2944)) && sink == SINK_WIFI)
+  {
+    queue_sample(snap, pack, fields, rtc_s); // Kept until the ESP8266 answers ACK
   }
+  else if (fields & (SUB_CELLS | SUB_LTC2944))
+  {
+    len = build_json(snap, pack, fields, stamp);
+    if (len != 0)
+    {
+      tx_enqueue(&TX_QUEUES[sink], TX_DATA, (const uint8_t *)TELEMETRY_JSON, len, millis()); // Goes out from tx_service() at 9600 baud
+    }
+  }
+}
 
- * 
-*/
 /*!************************************************************
-  \brief Prints cell voltage to the serial1 port for BLE
-   @return void
+  \brief Queues a WiFi sample in the uplink as a compact record,
+  a fraction of its JSON: 0 fields, 1 ICs, 2 cells per IC, 3 RTC
+  seconds u32, 7 charge, current, voltage and temperature as
+  floats, then from 23 the cell codes u16 if fields has SUB_CELLS.
+  render_sample() writes the JSON build_json() would as it goes out
+  @return void
  *************************************************************/
-void BLE_cells(uint8_t datalog_en)
+void queue_sample(const bms_snapshot *snap, const pack_reading *pack, uint8_t fields, uint32_t rtc_s)
+{
+  uint8_t *sample = (uint8_t *)TELEMETRY_JSON; // Free between build_json() calls, up_add() copies it
+  uint8_t cells = IC_REG(BMS_IC[0], cell_channels);
+  const float readings[4] = {pack->charge, pack->current, pack->voltage, pack->temperature};
+  uint16_t len = 23;
+
+  sample[0] = fields;
+  sample[1] = snap->total_ic;
+  sample[2] = cells;
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    sample[3 + i] = (uint8_t)(rtc_s >> (8*i));
+  }
+  memcpy(&sample[7], readings, sizeof(readings));
+  for (uint8_t current_ic = 0; (fields & SUB_CELLS) && current_ic < snap->total_ic; current_ic++)
+  {
+    for (uint8_t i = 0; i < cells; i++)
+    {
+      sample[len++] = (uint8_t)snap->ic[current_ic].cells.c_codes[i];
+      sample[len++] = (uint8_t)(snap->ic[current_ic].cells.c_codes[i] >> 8);
+    }
+  }
+  up_add(&UPLINK, sample, len, millis());
+}
 
+/*!************************************************************
+  \brief Writes one member of the JSON of a WiFi sample into
+  text for the uplink, the cells then the LTC2944 readings and
+  time. The first piece opens the object, the last closes it
+  @return uint8_t, piece length, 0 once the sample is done
+ *************************************************************/
+uint8_t render_sample(const uint8_t *sample, uint16_t len, uint16_t piece, char *text)
 {
-  char buffer[10];
-  for (int current_ic = 0 ; current_ic < TOTAL_IC; current_ic++)
+  uint8_t fields = sample[0];
+  uint16_t cells = (fields & SUB_CELLS) ? (uint16_t)sample[1]*sample[2] : 0;
+  const uint8_t present[5] = {(fields & SUB_CHARGE) != 0, (fields & SUB_CURRENT) != 0, (fields & SUB_VOLTAGE) != 0, 1, (fields & SUB_TEMPERATURE) != 0}; // Time always goes
+  uint8_t member = 0;
+  uint16_t n = cells;
+  float reading;
+  char stamp[TIMESTAMP_LEN];
+
+  if (len < 23 + 2*cells)
   {
-    if (datalog_en == 0)
+    return(0);
+  }
+  if (piece == 0)
+  {
+    json_begin(&UPLINK_JSON, text, UP_TEXT_LEN);
+    json_open_object(&UPLINK_JSON);
+  }
+  if (piece < cells)
+  {
+    json_key_index_P(&UPLINK_JSON, KEY_CELL, piece + 1);
+    json_fixed(&UPLINK_JSON, (uint16_t)(sample[23 + 2*piece] | ((uint16_t)sample[24 + 2*piece] << 8)), 4);
+    return(json_flush(&UPLINK_JSON));
+  }
+  for (member = 0; member < 5; member++) // Find the member this piece is
+  {
+    if (present[member] && n++ == piece)
     {
-      //Serial1.print(" IC ");
-      //data1 += " IC ";
-      //Serial1.print(current_ic+1,DEC);
-      //data1 += current_ic+1, DEC;
+      break;
+    }
+  }
+  if (member == 5)
+  {
+    return(0);
+  }
+  json_key_P(&UPLINK_JSON, (const char *)pgm_read_word(&PACK_KEYS[member]));
+  if (member == 3)
+  {
+    format_timestamp(DateTime((uint32_t)sample[3] | ((uint32_t)sample[4] << 8) | ((uint32_t)sample[5] << 16) | ((uint32_t)sample[6] << 24)), stamp);
+    json_string(&UPLINK_JSON, stamp);
+  }
+  else
+  {
+    memcpy(&reading, &sample[7 + 4*(member < 3 ? member : 3)], sizeof(reading));
+    json_float(&UPLINK_JSON, reading, 4);
+  }
+  if (member == 4 || (member == 3 && !(fields & SUB_TEMPERATURE)))
+  {
+    json_close(&UPLINK_JSON);
+    return((uint8_t)json_end(&UPLINK_JSON));
+  }
+  return((uint8_t)json_flush(&UPLINK_JSON));
+}
 
-      //Serial1.print(": ");
-      //data1+= ": ";      
-      for (int i=0; i< BMS_IC[0].ic_reg.cell_channels; i++)
-      {
-        //Serial1.print(" C");
-        //Serial1.print(i+1,DEC);
+/*!************************************************************
+  \brief Packs the pack readings and cell codes among fields into
+  framed BLE_MTU packets for the BLE link, see lib/BlePacket. Pack
+  voltage, current, the lowest and highest cell and temperature
+  go every cycle, charge and the cells as the link budget allows
+  @return void
+ *************************************************************/
+void send_ble(const bms_snapshot *snap, const pack_reading *pack, uint8_t fields)
+{
+  uint16_t n = 0;
+  uint16_t min_code = 0xFFFF, max_code = 0;
+  uint16_t min_index = 0, max_index = 0; // Cells down the whole chain, up to 31 ICs of 18
+  uint8_t cells = IC_REG(BMS_IC[0], cell_channels);
 
-        //Serial1.print(":");        
-        //Serial1.print(BMS_IC[current_ic].cells.c_codes[i]*0.0001,4);
-        //Serial1.print(",");
-        /*Saving cells to doc object.*/
-        doc["C" + String(i + 1)] = BMS_IC[current_ic].cells.c_codes[i]*0.0001;  
+  if (fields & SUB_CELLS)
+  {
+    for (uint8_t current_ic = 0; current_ic < snap->total_ic; current_ic++)
+    {
+      const cv *c = &snap->ic[current_ic].cells;
+      for (uint8_t i = 0; i < cells; i++)
+      {
+        if (c->stale & ((uint32_t)1 << i))
+        {
+          continue;
+        }
+        if (c->c_codes[i] < min_code)
+        {
+          min_code = c->c_codes[i];
+          min_index = (uint16_t)current_ic*cells + i + 1;
+        }
+        if (c->c_codes[i] >= max_code)
+        {
+          max_code = c->c_codes[i];
+          max_index = (uint16_t)current_ic*cells + i + 1;
+        }
+      }
+    }
+  }
 
+  if (fields & SUB_VOLTAGE)
+  {
+    BLE_FIELDS[n++] = {BLE_PACK_VOLTAGE, (uint16_t)round_clamped(pack->voltage*100.0f, 0, 65535)};
+  }
+  if (fields & SUB_CURRENT)
+  {
+    BLE_FIELDS[n++] = {BLE_CURRENT, (uint16_t)round_clamped(pack->current*1000.0f, -32768, 32767)};
+  }
+  if (max_index != 0)
+  {
+    BLE_FIELDS[n++] = {BLE_MIN_CELL, min_code};
+    BLE_FIELDS[n++] = {BLE_MAX_CELL, max_code};
+    BLE_FIELDS[n++] = {BLE_MIN_INDEX, min_index};
+    BLE_FIELDS[n++] = {BLE_MAX_INDEX, max_index};
+  }
+  if (fields & SUB_TEMPERATURE)
+  {
+    BLE_FIELDS[n++] = {BLE_TEMPERATURE, (uint16_t)round_clamped(pack->temperature*10.0f, -32768, 32767)};
+  }
+  const uint16_t required = n;
+  if (fields & SUB_CHARGE)
+  {
+    BLE_FIELDS[n++] = {BLE_CHARGE, (uint16_t)round_clamped(pack->charge, 0, 65535)};
+  }
+  for (uint8_t current_ic = 0; (fields & SUB_CELLS) && current_ic < snap->total_ic; current_ic++)
+  {
+    for (uint8_t i = 0; i < cells && current_ic*cells + i < BLE_CELLS_MAX; i++)
+    {
+      if (!(snap->ic[current_ic].cells.stale & ((uint32_t)1 << i)))
+      {
+        BLE_FIELDS[n++] = {(uint8_t)(BLE_CELL + current_ic*cells + i), snap->ic[current_ic].cells.c_codes[i]};
       }
-      //serializeJson(doc, Serial1);
-      //Serial1.println();
     }
-    else
+  }
+  if (n != 0)
+  {
+    ble_pack(&BLE_LINK, BLE_FIELDS, n, required, millis(), ble_send);
+  }
+}
+
+/*!************************************************************
+  \brief Queues one BLE packet, COBS framed with its delimiter,
+  called from ble_pack()
+  @return void
+ *************************************************************/
+void ble_send(const uint8_t *frame, uint8_t len)
+{
+  tx_enqueue(&TX_QUEUES[SINK_BLE], TX_DATA, frame, len, millis());
+}
+
+/*!************************************************************
+  \brief Rounds a reading to the nearest integer, held within
+  low and high, so a reading outside a BLE field's range, or NaN
+  after a failed LTC2944 read, never reaches an overflowing cast
+  @return int32_t, the rounded value, low for NaN
+ *************************************************************/
+int32_t round_clamped(float value, int32_t low, int32_t high)
+{
+  if (!(value > low)) // Also NaN
+  {
+    return(low);
+  }
+  if (value >= high)
+  {
+    return(high);
+  }
+  return((int32_t)(value < 0 ? value - 0.5f : value + 0.5f));
+}
+
+/*!************************************************************
+  \brief Writes a DateTime as YYYY-MM-DDTHH:MM:SS, the format of
+  DateTime::timestamp(), without building a String
+  @return void
+ *************************************************************/
+void format_timestamp(const DateTime &time, char *text)
+{
+  uint16_t year = time.year();
+  uint8_t fields[5] = {time.month(), time.day(), time.hour(), time.minute(), time.second()};
+  const char separators[5] = {'-', 'T', ':', ':', 0};
+
+  text[0] = '0' + year/1000;
+  text[1] = '0' + (year/100)%10;
+  text[2] = '0' + (year/10)%10;
+  text[3] = '0' + year%10;
+  text[4] = '-';
+  for (uint8_t i = 0; i < 5; i++)
+  {
+    text[5 + 3*i] = '0' + fields[i]/10;
+    text[6 + 3*i] = '0' + fields[i]%10;
+    text[7 + 3*i] = separators[i];
+  }
+}
+
+/*!************************************************************
+  \brief Queues the alerts of one LTC2944 status read for the
+  BLE and WiFi links, ahead of any data still waiting. They go
+  out as one message, {"Alert":["Current Alert",...]}, so a pass
+  that raises all seven takes ALERT_JSON_MAX bytes of the ring
+  @return void
+ *************************************************************/
+void queue_alerts(uint8_t status_code)
+{
+  if (!(status_code & 0x7F))
+  {
+    return;
+  }
+  for (uint8_t sink = 0; sink < TX_SINKS; sink++)
+  {
+    char separator = '[';
+    tx_begin(&TX_QUEUES[sink], TX_ALERT, millis());
+    TX_PRINT[sink].print(F("{\"Alert\":"));
+    for (int8_t bit = 6; bit >= 0; bit--)
     {
-      //Serial1.print(" Cells :");
-      for (int i=0; i<BMS_IC[0].ic_reg.cell_channels; i++)
+      if (status_code & (1 << bit))
       {
-        //Serial1.print(BMS_IC[current_ic].cells.c_codes[i]*0.0001,4);
-        //Serial1.print(",");
+        TX_PRINT[sink].print(separator);
+        TX_PRINT[sink].print('"');
+        TX_PRINT[sink].print((const __FlashStringHelper *)pgm_read_word(&ALERT_NAMES[bit]));
+        TX_PRINT[sink].print('"');
+        separator = ',';
       }
     }
+    TX_PRINT[sink].print(F("]}"));
+    tx_end(&TX_QUEUES[sink]);
   }
-  //Serial1.println("\n");
 }
 
-/*!****************************************************************************
-  \brief Prints GPIO voltage codes and Vref2 voltage code onto the serial port
- @return void
- *****************************************************************************/
-void print_aux(uint8_t datalog_en)
+/*!************************************************************
+  \brief Hands each link as many queued bytes as its UART
+  buffer takes without blocking, and passes the ESP8266 answers
+  to the uplink. On Serial2 the uplink batches go out between
+  queued messages, never inside one. Also gives the SD log its
+  time flush and preallocation
+  @return void
+ *************************************************************/
+void tx_service(void)
 {
+  const uint8_t *data;
+  uint16_t avail;
 
-  for (int current_ic =0 ; current_ic < TOTAL_IC; current_ic++)
+  sd_log_service(&SD_LOG, millis());
+  while (Serial2.available())
   {
-    if (datalog_en == 0)
+    up_receive(&UPLINK, (uint8_t)Serial2.read(), millis());
+  }
+  for (uint8_t sink = 0; sink < TX_SINKS; sink++)
+  {
+    int room = TX_SERIAL[sink]->availableForWrite();
+    while (room > 0)
     {
-      Serial.print(" IC ");
-      Serial.print(current_ic+1,DEC);
-      Serial.print(":");
-      
-      for (int i=0; i < 5; i++)
+      uint8_t uplink = 0;
+      if (sink == SINK_WIFI && up_sending(&UPLINK))
       {
-        Serial.print(F(" GPIO-"));
-        Serial.print(i+1,DEC);
-        Serial.print(":");
-        Serial.print(BMS_IC[current_ic].aux.a_codes[i]*0.0001,4);
-        Serial.print(",");
+        uplink = 1; // Finish the batch before anything else
       }
-      Serial.print(F(" Vref2"));
-      Serial.print(":");
-      Serial.print(BMS_IC[current_ic].aux.a_codes[5]*0.0001,4);
-      Serial.println();
-    }
-    else
-    {
-      Serial.print("AUX ");
-      Serial.print(" IC ");
-      Serial.print(current_ic+1,DEC);
-      Serial.print(": ");
-
-      for (int i=0; i < 6; i++)
+      else if ((avail = tx_peek(&TX_QUEUES[sink], millis(), &data)) == 0)
       {
-        Serial.print(BMS_IC[current_ic].aux.a_codes[i]*0.0001,4);
-        Serial.print(",");
+        uplink = (sink == SINK_WIFI); // Alerts and frames first, batches when the queue is empty
+      }
+      if (uplink)
+      {
+        avail = up_peek(&UPLINK, millis(), &data);
+      }
+      if (avail == 0)
+      {
+        break;
+      }
+      if (avail > room)
+      {
+        avail = room;
+      }
+      TX_SERIAL[sink]->write(data, avail);
+      if (uplink)
+      {
+        up_consume(&UPLINK, avail, millis());
+      }
+      else
+      {
+        tx_consume(&TX_QUEUES[sink], avail);
       }
+      room -= avail;
     }
   }
-  Serial.println("\n");
 }
 
-/*!****************************************************************************
-  \brief Prints Status voltage codes and Vref2 voltage code onto the serial port
- @return void
- *****************************************************************************/
-void print_stat(void)
+/*!************************************************************
+  \brief Waits, servicing the link queues instead of delay()
+  @return void
+ *************************************************************/
+void tx_wait(uint32_t wait_ms)
 {
-   double itmp;
-  for (uint8_t current_ic =0 ; current_ic < TOTAL_IC; current_ic++)
+  uint32_t start = millis();
+  while (millis() - start < wait_ms)
   {
-    Serial.print(F(" IC "));
-    Serial.print(current_ic+1,DEC);
-    Serial.print(F(": "));
-    Serial.print(F(" SOC:"));
-    Serial.print(BMS_IC[current_ic].stat.stat_codes[0]*0.0001*20,4);
-    Serial.print(F(","));
-    Serial.print(F(" Itemp:"));
-    itmp = (double)((BMS_IC[current_ic].stat.stat_codes[1] * (0.0001 / 0.0075)) - 273);   //Internal Die Temperature(°C) = itmp • (100 µV / 7.5mV)°C - 273°C
-    Serial.print(itmp,4);
-    Serial.print(F(","));
-    Serial.print(F(" VregA:"));
-    Serial.print(BMS_IC[current_ic].stat.stat_codes[2]*0.0001,4);
-    Serial.print(F(","));
-    Serial.print(F(" VregD:"));
-    Serial.print(BMS_IC[current_ic].stat.stat_codes[3]*0.0001,4);
-    Serial.println();
-    Serial.print(F(" Flags:"));
-    Serial.print(F(" 0x"));
-    serial_print_hex(BMS_IC[current_ic].stat.flags[0]);
-    Serial.print(F(", 0x"));
-    serial_print_hex(BMS_IC[current_ic].stat.flags[1]);
-    Serial.print(F(", 0x"));
-    serial_print_hex(BMS_IC[current_ic].stat.flags[2]);
-    Serial.print(F("   Mux fail flag:"));
-    Serial.print(F(" 0x"));
-    serial_print_hex(BMS_IC[current_ic].stat.mux_fail[0]);
-    Serial.print(F("   THSD:"));
-    Serial.print(F(" 0x"));
-    serial_print_hex(BMS_IC[current_ic].stat.thsd[0]);
-    Serial.println("\n");  
+    tx_service();
   }
 }
 
-/*!****************************************************************************
-  \brief Prints Status voltage codes for SOC onto the serial port
- @return void
- *****************************************************************************/
-void print_sumofcells(void)
+/*!************************************************************
+  \brief Sends the register fields of a snapshot as COBS framed
+  binary telemetry, see lib/Telemetry. With delta, each frame is
+  the difference from the last one on that link, or a keyframe
+  @return void
+ *************************************************************/
+void send_telemetry(Print &port, const bms_snapshot *snap, uint8_t fields, tlm_delta *delta)
 {
- for (int current_ic =0 ; current_ic < TOTAL_IC; current_ic++)
+  static uint8_t raw[TLM_FRAME_MAX];
+  static uint8_t encoded[TLM_COBS_MAX(TLM_FRAME_MAX)];
+  uint16_t len;
+
+  if (fields & SUB_CELLS)
   {
-    Serial.print(F(" IC "));
-    Serial.print(current_ic+1,DEC);
-    Serial.print(F(": "));
-    Serial.print(F(" SOC:"));
-    Serial.print(BMS_IC[current_ic].stat.stat_codes[0]*0.0001*20,4);
-    Serial.print(F(","));
+    len = delta ? tlm_build_delta(raw, TLM_CELLS, snap, IC_REG(BMS_IC[0], cell_channels), delta)
+                : tlm_build(raw, TLM_CELLS, snap, IC_REG(BMS_IC[0], cell_channels));
+    port.write(encoded, tlm_cobs_encode(raw, len, encoded));
+  }
+  if (fields & SUB_AUX)
+  {
+    len = delta ? tlm_build_delta(raw, TLM_AUX, snap, 6, delta) : tlm_build(raw, TLM_AUX, snap, 6);
+    port.write(encoded, tlm_cobs_encode(raw, len, encoded));
+  }
+  if (fields & SUB_STAT)
+  {
+    len = delta ? tlm_build_delta(raw, TLM_STAT, snap, 4, delta) : tlm_build(raw, TLM_STAT, snap, 4);
+    port.write(encoded, tlm_cobs_encode(raw, len, encoded));
   }
-  Serial.println("\n");
 }
 
 /*!****************************************************************
@@ -1536,9 +2159,319 @@ void print_pec_error_count(void)
     Serial.print(F(" : PEC Errors Detected on IC"));
     Serial.println(current_ic+1,DEC);
   }
+
+  const retry_counter *retries = LTC6811_retry_stats();
+  Serial.print(F("\nRetries, cell groups:"));
+  for (uint8_t i = 0; i < IC_REG(BMS_IC[0], num_cv_reg); i++)
+  {
+    Serial.print(F(" "));
+    Serial.print(retries->cell_retry[i],DEC);
+  }
+  Serial.print(F(", aux groups:"));
+  for (uint8_t i = 0; i < IC_REG(BMS_IC[0], num_gpio_reg); i++)
+  {
+    Serial.print(F(" "));
+    Serial.print(retries->aux_retry[i],DEC);
+  }
+  Serial.print(F(", stat groups: "));
+  Serial.print(retries->stat_retry[0],DEC);
+  Serial.print(F(" "));
+  Serial.print(retries->stat_retry[1],DEC);
+  Serial.print(F(", other: "));
+  Serial.println(retries->other_retry,DEC);
+  Serial.print(retries->recovered,DEC);
+  Serial.print(F(" reads recovered, "));
+  Serial.print(retries->failed,DEC);
+  Serial.println(F(" failed after retrying"));
   Serial.println("\n");
 }
 
+/*!************************************************************
+  \brief Prints the RAM the daisy chain needs for 1 to 31 ICs,
+  with and without the PWM, S control and COMM shadows, then the
+  buffers of this build, their total, the static data of the
+  whole image against the ATmega2560's 8 KB and the free stack
+  @return void
+ *************************************************************/
+void print_ram_budget(void)
+{
+  Serial.print(F("\ncell_asic: "));
+  Serial.print(sizeof(cell_asic),DEC);
+  Serial.print(F(" bytes, shadow: "));
+  Serial.print(sizeof(ic_shadow),DEC);
+  Serial.println(F(" bytes per IC"));
+  Serial.println(F("ICs, bytes with shadows, bytes measuring only"));
+  for (uint8_t n = 1; n <= 31; n++)
+  {
+    Serial.print(n,DEC);
+    Serial.print(F(", "));
+    Serial.print(LTC6811_ram_budget(n,n),DEC);
+    Serial.print(F(", "));
+    Serial.println(LTC6811_ram_budget(n,0),DEC);
+  }
+  Serial.print(F("This build: "));
+  Serial.print(LTC6811_ram_budget(TOTAL_IC,BMS_SHADOW_IC),DEC);
+  Serial.print(F(" bytes, cell history: "));
+  Serial.print(sizeof(cell_history),DEC);
+  Serial.print(F(" bytes, snapshots: "));
+  Serial.print(sizeof(snapshot_buffer),DEC);
+  Serial.print(F(" bytes, link queues: "));
+  Serial.print(sizeof(TX_QUEUES) + sizeof(TX_DATA_RINGS),DEC);
+  Serial.print(F(" bytes, uplink: "));
+  Serial.print(sizeof(UPLINK) + sizeof(UPLINK_RING) + sizeof(UPLINK_SCRATCH),DEC);
+  Serial.print(F(" bytes, SD log: "));
+  Serial.print(sizeof(SD_LOG) + sizeof(BIN_LOG),DEC);
+  Serial.print(F(" bytes, delta bases: "));
+  Serial.print(sizeof(LINK_DELTA),DEC);
+  Serial.print(F(" bytes, telemetry JSON: "));
+  Serial.print(sizeof(TELEMETRY_JSON) + sizeof(BLE_FIELDS),DEC);
+  Serial.print(F(" bytes, total: "));
+  Serial.print(LTC6811_ram_budget(TOTAL_IC,BMS_SHADOW_IC) + sizeof(cell_history) + sizeof(snapshot_buffer) +
+               sizeof(TX_QUEUES) + sizeof(TX_DATA_RINGS) + sizeof(UPLINK) + sizeof(UPLINK_RING) + sizeof(UPLINK_SCRATCH) + sizeof(SD_LOG) + sizeof(BIN_LOG) + sizeof(LINK_DELTA) +
+               sizeof(TELEMETRY_JSON) + sizeof(BLE_FIELDS),DEC);
+  Serial.println(F(" bytes"));
+  Serial.print(F("Static data with the core and libraries: "));
+  Serial.print((size_t)&__heap_start - RAMSTART,DEC);
+  Serial.print(F(" of "));
+  Serial.print(RAMEND - RAMSTART + 1,DEC);
+  Serial.print(F(" bytes, free stack: "));
+  Serial.print(free_ram(),DEC);
+  Serial.println(F(" bytes\n"));
+}
+
+/*!************************************************************
+  \brief Bytes between the top of the heap and the stack, what
+  deeper calls and String growth still have
+  @return int, free bytes
+ *************************************************************/
+int free_ram(void)
+{
+  char top;
+
+  return(&top - (__brkval == 0 ? &__heap_start : __brkval));
+}
+
+/*!************************************************************
+  \brief Prints the message counters of the BLE and WiFi links,
+  and the block counters of the SD log
+  @return void
+ *************************************************************/
+void print_tx_counters(void)
+{
+  for (uint8_t sink = 0; sink < TX_SINKS; sink++)
+  {
+    const tx_counters *count = &TX_QUEUES[sink].count;
+    Serial.print((const __FlashStringHelper *)pgm_read_word(&SINK_NAMES[SUB_BLE + sink]));
+    Serial.print(F(": queued "));
+    Serial.print(count->queued);
+    Serial.print(F(", sent "));
+    Serial.print(count->sent);
+    Serial.print(F(", dropped "));
+    Serial.print(count->dropped);
+    Serial.print(F(", rejected "));
+    Serial.print(count->rejected);
+    Serial.print(F(", late "));
+    Serial.print(count->late);
+    Serial.print(F(", pending bytes "));
+    Serial.println(tx_pending(&TX_QUEUES[sink]));
+  }
+  Serial.print(F("BLE packets "));
+  Serial.print(BLE_LINK.packets);
+  Serial.print(F(", cells and charge sent "));
+  Serial.print(BLE_LINK.sent);
+  Serial.print(F(", deferred "));
+  Serial.println(BLE_LINK.deferred);
+  Serial.print(F("WiFi uplink: queued "));
+  Serial.print(UPLINK.count.queued);
+  Serial.print(F(", delivered "));
+  Serial.print(UPLINK.count.delivered);
+  Serial.print(F(", dropped "));
+  Serial.print(UPLINK.count.dropped);
+  Serial.print(F(", abandoned "));
+  Serial.print(UPLINK.count.abandoned);
+  Serial.print(F(", batches "));
+  Serial.print(UPLINK.count.batches);
+  Serial.print(F(", resent "));
+  Serial.print(UPLINK.count.resent);
+  Serial.print(F(", NAK "));
+  Serial.print(UPLINK.count.naks);
+  Serial.print(F(", BUSY "));
+  Serial.print(UPLINK.count.busy);
+  Serial.print(F(", timeouts "));
+  Serial.print(UPLINK.count.timeouts);
+  Serial.print(F(", waiting "));
+  Serial.println(UPLINK.samples);
+  Serial.print(F("SD log: records "));
+  Serial.print(BIN_LOG.count.records);
+  Serial.print(F(", index blocks "));
+  Serial.print(BIN_LOG.count.indexes);
+  Serial.print(F(", blocks "));
+  Serial.print(SD_LOG.count.blocks);
+  Serial.print(F(", time flushes "));
+  Serial.print(SD_LOG.count.partials);
+  Serial.print(F(", syncs "));
+  Serial.print(SD_LOG.count.syncs);
+  Serial.print(F(", preallocated "));
+  Serial.print(SD_LOG.count.extended);
+  Serial.print(F(", checkpoints "));
+  Serial.print(SD_LOG.count.checkpoints);
+  Serial.print(F(", errors "));
+  Serial.println(SD_LOG.count.errors);
+  Serial.println();
+}
+
+/*!************************************************************
+  \brief Asks for a sink, its fields and its period, and sets
+  its subscription for measurement_loop2. Only Serial prints the
+  PEC counters, so SUB_PEC on another sink is refused
+  @return void
+ *************************************************************/
+void set_subscription(void)
+{
+  int32_t sink, fields, period;
+
+  print_subscriptions();
+  Serial.print(F("Sink, 0 Serial, 1 BLE, 2 WiFi, 3 SD: "));
+  sink = read_int();
+  Serial.println(sink);
+  Serial.print(F("Fields, sum of 1 cells, 2 aux, 4 stat, 8 charge, 16 current, 32 voltage, 64 temperature, 128 PEC (Serial only): "));
+  fields = read_int();
+  Serial.println(fields);
+  Serial.print(F("Period in ms: "));
+  period = read_int();
+  Serial.println(period);
+  if (fields >= SUB_PEC && fields <= SUB_ALL && sink != SUB_SERIAL)
+  {
+    Serial.println(F("Only Serial prints the PEC counters, nothing changed"));
+    return;
+  }
+  if (sink < 0 || fields < 0 || fields > SUB_ALL || period < 0 || period > 0xFFFF ||
+      sub_set(&SUBSCRIPTIONS, (uint8_t)sink, (uint8_t)fields, (uint16_t)period, millis()) != 0)
+  {
+    Serial.println(F("Invalid subscription, nothing changed"));
+    return;
+  }
+  print_subscriptions();
+}
+
+/*!************************************************************
+  \brief Turns delta coding of the register fields on or off for
+  one sink, then prints which sinks have it. The BLE and WiFi
+  links send delta frames, see lib/Telemetry, decoded by
+  host/tlm_decode. The SD log fills delta coded blocks from its
+  next block on, see lib/BinLog
+  @return void
+ *************************************************************/
+void set_delta_sink(void)
+{
+  int32_t sink;
+
+  Serial.print(F("Sink, 1 BLE, 2 WiFi, 3 SD: "));
+  sink = read_int();
+  Serial.println(sink);
+  if (sink < SUB_BLE || sink > SUB_SD)
+  {
+    Serial.println(F("Invalid sink, nothing changed"));
+    return;
+  }
+  DELTA_SINKS ^= (uint8_t)(1 << sink);
+  if (sink == SUB_SD)
+  {
+    BIN_LOG.type = (DELTA_SINKS & (1 << SUB_SD)) ? BL_DELTA : BL_DATA;
+  }
+  else
+  {
+    tlm_delta_init(&LINK_DELTA[sink - SUB_BLE], TLM_KEYFRAME_EVERY); // Its first frames are keyframes
+  }
+  for (uint8_t n = SUB_BLE; n <= SUB_SD; n++)
+  {
+    Serial.print((const __FlashStringHelper *)pgm_read_word(&SINK_NAMES[n]));
+    Serial.println((DELTA_SINKS & (1 << n)) ? F(": delta coded") : F(": whole codes"));
+  }
+  Serial.println();
+}
+
+/*!************************************************************
+  \brief Prints the fields and period of every measurement_loop2 sink
+  @return void
+ *************************************************************/
+void print_subscriptions(void)
+{
+  for (uint8_t sink = 0; sink < SUB_SINKS; sink++)
+  {
+    Serial.print(sink);
+    Serial.print(F(" "));
+    Serial.print((const __FlashStringHelper *)pgm_read_word(&SINK_NAMES[sink]));
+    Serial.print(F(": fields "));
+    Serial.print(SUBSCRIPTIONS.sink[sink].fields);
+    Serial.print(F(" every "));
+    Serial.print(SUBSCRIPTIONS.sink[sink].period_ms);
+    Serial.println(F(" ms"));
+  }
+  Serial.println();
+}
+
+/*!************************************************************
+  \brief Prints the running statistics of every cell and of the
+  pack, gathered by the measurement loops
+  @return void
+ *************************************************************/
+void print_cell_stats(void)
+{
+  cell_summary cell;
+  pack_summary pack;
+
+  for (uint8_t current_ic = 0; current_ic < TOTAL_IC; current_ic++)
+  {
+    for (uint8_t i = 0; i < IC_REG(BMS_IC[0], cell_channels); i++)
+    {
+      if (cell_stats_cell(&CELL_HISTORY, current_ic, i, &cell) != 0)
+      {
+        continue;
+      }
+      Serial.print(F(" IC "));
+      Serial.print(current_ic+1,DEC);
+      Serial.print(F(" C"));
+      Serial.print(i+1,DEC);
+      Serial.print(F(": min "));
+      print_fixed(Serial, cell.min, 4);
+      Serial.print(F(", max "));
+      print_fixed(Serial, cell.max, 4);
+      Serial.print(F(", mean "));
+      print_fixed(Serial, cell.mean, 4);
+      Serial.print(F(", variance "));
+      print_fixed(Serial, cell.variance, 8);
+      Serial.print(F(" V^2, dV/dt "));
+      print_fixed(Serial, cell.dvdt, 3);
+      Serial.print(F(" mV/s, samples "));
+      Serial.println(cell.count,DEC);
+    }
+  }
+
+  if (cell_stats_pack(&CELL_HISTORY, TOTAL_IC, IC_REG(BMS_IC[0], cell_channels), &pack) != 0)
+  {
+    Serial.println(F("No cell statistics yet, run the measurement loop: 11\n"));
+    return;
+  }
+  Serial.print(F(" Pack: min "));
+  print_fixed(Serial, pack.min, 4);
+  Serial.print(F(" (IC "));
+  Serial.print(pack.min_ic+1,DEC);
+  Serial.print(F(" C"));
+  Serial.print(pack.min_cell+1,DEC);
+  Serial.print(F("), max "));
+  print_fixed(Serial, pack.max, 4);
+  Serial.print(F(" (IC "));
+  Serial.print(pack.max_ic+1,DEC);
+  Serial.print(F(" C"));
+  Serial.print(pack.max_cell+1,DEC);
+  Serial.print(F("), mean "));
+  print_fixed(Serial, pack.mean, 4);
+  Serial.print(F(", dV/dt "));
+  print_fixed(Serial, pack.dvdt, 3);
+  Serial.println(F(" mV/s\n"));
+}
+
 /*!****************************************************
   \brief Function to select the S pin for discharge
   @return void
@@ -1553,6 +2486,23 @@ int8_t select_s_pin(void)
   return(read_s_pin);
 }
 
+/*!************************************************************
+  \brief Hands every IC its PWM, S control and COMM register
+  shadows the first time a command needs them, see
+  LTC681x_claim_shadows()
+  @return int8_t, 0 or -1 after printing an error if the pool of
+  BMS_SHADOW_IC shadows ran out
+ *************************************************************/
+int8_t claim_shadows(void)
+{
+  if (LTC6811_claim_shadows(TOTAL_IC,BMS_IC) != 0)
+  {
+    Serial.println(F("No register shadows for this chain, build with a larger BMS_SHADOW_IC"));
+    return(-1);
+  }
+  return(0);
+}
+
 /*!******************************************************************************
  \brief Prints  PWM the configuration data that is going to be written to the LTC6811
  to the serial port.
@@ -1562,6 +2512,11 @@ void print_wrpwm(void)
 {
   int pwm_pec;
 
+  if (claim_shadows() != 0)
+  {
+    return;
+  }
+
   Serial.println(F("Written PWM Configuration: "));
   for (uint8_t current_ic = 0; current_ic<TOTAL_IC; current_ic++)
   {
@@ -1570,10 +2525,10 @@ void print_wrpwm(void)
     for(int i = 0; i < 6; i++)
     {
       Serial.print(F(", 0x"));
-     serial_print_hex(BMS_IC[current_ic].pwm.tx_data[i]);
+     serial_print_hex(BMS_IC[current_ic].shadow->pwm.tx_data[i]);
     }
     Serial.print(F(", Calculated PEC: 0x"));
-    pwm_pec = pec15_calc(6,&BMS_IC[current_ic].pwm.tx_data[0]);
+    pwm_pec = pec15_calc(6,&BMS_IC[current_ic].shadow->pwm.tx_data[0]);
     serial_print_hex((uint8_t)(pwm_pec>>8));
     Serial.print(F(", 0x"));
     serial_print_hex((uint8_t)(pwm_pec));
@@ -1588,6 +2543,10 @@ void print_wrpwm(void)
  *******************************************************************/
 void print_rxpwm(void)
 {
+  if (claim_shadows() != 0)
+  {
+    return;
+  }
   Serial.println(F("Received pwm Configuration:"));
   for (uint8_t current_ic=0; current_ic<TOTAL_IC; current_ic++)
   {
@@ -1596,12 +2555,12 @@ void print_rxpwm(void)
     for(int i = 0; i < 6; i++)
     {
       Serial.print(F(", 0x"));
-     serial_print_hex(BMS_IC[current_ic].pwm.rx_data[i]);
+     serial_print_hex(BMS_IC[current_ic].shadow->pwm.rx_data[i]);
     }
     Serial.print(F(", Received PEC: 0x"));
-    serial_print_hex(BMS_IC[current_ic].pwm.rx_data[6]);
+    serial_print_hex(BMS_IC[current_ic].shadow->pwm.rx_data[6]);
     Serial.print(F(", 0x"));
-    serial_print_hex(BMS_IC[current_ic].pwm.rx_data[7]);
+    serial_print_hex(BMS_IC[current_ic].shadow->pwm.rx_data[7]);
     Serial.println("\n");
   }
 }
@@ -1614,6 +2573,11 @@ void print_wrsctrl(void)
 {
    int sctrl_pec;
 
+  if (claim_shadows() != 0)
+  {
+    return;
+  }
+
   Serial.println(F("Written Data in Sctrl register: "));
   for (int current_ic = 0; current_ic<TOTAL_IC; current_ic++)
   {
@@ -1623,11 +2587,11 @@ void print_wrsctrl(void)
     for(int i = 0; i < 6; i++)
     {
       Serial.print(F(", 0x"));
-      serial_print_hex(BMS_IC[current_ic].sctrl.tx_data[i]);
+      serial_print_hex(BMS_IC[current_ic].shadow->sctrl.tx_data[i]);
     }
     
     Serial.print(F(", Calculated PEC: 0x"));
-    sctrl_pec = pec15_calc(6,&BMS_IC[current_ic].sctrl.tx_data[0]);
+    sctrl_pec = pec15_calc(6,&BMS_IC[current_ic].shadow->sctrl.tx_data[0]);
     serial_print_hex((uint8_t)(sctrl_pec>>8));
     Serial.print(F(", 0x"));
     serial_print_hex((uint8_t)(sctrl_pec));
@@ -1642,6 +2606,10 @@ void print_wrsctrl(void)
  *************************************************************/
 void print_rxsctrl(void)
 {
+  if (claim_shadows() != 0)
+  {
+    return;
+  }
   Serial.println(F("Received Data:"));
   for (int current_ic=0; current_ic<TOTAL_IC; current_ic++)
   {
@@ -1651,13 +2619,13 @@ void print_rxsctrl(void)
     for(int i = 0; i < 6; i++)
     {
     Serial.print(F(", 0x"));
-    serial_print_hex(BMS_IC[current_ic].sctrl.rx_data[i]);
+    serial_print_hex(BMS_IC[current_ic].shadow->sctrl.rx_data[i]);
     }
     
     Serial.print(F(", Received PEC: 0x"));
-    serial_print_hex(BMS_IC[current_ic].sctrl.rx_data[6]);
+    serial_print_hex(BMS_IC[current_ic].shadow->sctrl.rx_data[6]);
     Serial.print(F(", 0x"));
-    serial_print_hex(BMS_IC[current_ic].sctrl.rx_data[7]);
+    serial_print_hex(BMS_IC[current_ic].shadow->sctrl.rx_data[7]);
     Serial.println("\n");
   }
 }
@@ -1670,6 +2638,11 @@ void print_wrcomm(void)
 {
   int comm_pec;
 
+  if (claim_shadows() != 0)
+  {
+    return;
+  }
+
   Serial.println(F("Written Data in COMM Register: "));
   for (int current_ic = 0; current_ic<TOTAL_IC; current_ic++)
   {
@@ -1679,10 +2652,10 @@ void print_wrcomm(void)
     for(int i = 0; i < 6; i++)
     {
       Serial.print(F(", 0x"));
-      serial_print_hex(BMS_IC[current_ic].com.tx_data[i]);
+      serial_print_hex(BMS_IC[current_ic].shadow->com.tx_data[i]);
     }
     Serial.print(F(", Calculated PEC: 0x"));
-    comm_pec = pec15_calc(6,&BMS_IC[current_ic].com.tx_data[0]);
+    comm_pec = pec15_calc(6,&BMS_IC[current_ic].shadow->com.tx_data[0]);
     serial_print_hex((uint8_t)(comm_pec>>8));
     Serial.print(F(", 0x"));
     serial_print_hex((uint8_t)(comm_pec));
@@ -1697,6 +2670,10 @@ void print_wrcomm(void)
  *************************************************************/
 void print_rxcomm(void)
 {
+  if (claim_shadows() != 0)
+  {
+    return;
+  }
   Serial.println(F("Received Data in COMM register:"));
   for (int current_ic=0; current_ic<TOTAL_IC; current_ic++)
   {
@@ -1706,16 +2683,57 @@ void print_rxcomm(void)
     for(int i = 0; i < 6; i++)
     {
       Serial.print(F(", 0x"));
-      serial_print_hex(BMS_IC[current_ic].com.rx_data[i]);
+      serial_print_hex(BMS_IC[current_ic].shadow->com.rx_data[i]);
     }
     Serial.print(F(", Received PEC: 0x"));
-    serial_print_hex(BMS_IC[current_ic].com.rx_data[6]);
+    serial_print_hex(BMS_IC[current_ic].shadow->com.rx_data[6]);
     Serial.print(F(", 0x"));
-    serial_print_hex(BMS_IC[current_ic].com.rx_data[7]);
+    serial_print_hex(BMS_IC[current_ic].shadow->com.rx_data[7]);
     Serial.println("\n");
   }
 }
 
+/*!****************************************************************************
+  \brief Services the UART while the LTC6811 converts so a quit request sent
+  during a long conversion is picked up by the measurement loops, and the
+  queued BLE and WiFi messages keep moving
+  @return void
+ *****************************************************************************/
+void conversion_idle_task(void)
+{
+  tx_service();
+  if ((loop_input == 0) && (Serial.available() > 0))
+  {
+    loop_input = read_char();
+  }
+}
+
+/*!****************************************************************************
+  \brief Fills in LOOP_PLAN from the register fields, LOOP_FIELDS or those the
+  due sinks take, so the measurement loops wake the chain once per pass
+  @return void
+ *****************************************************************************/
+void build_loop_plan(uint8_t fields)
+{
+  uint8_t count = 0;
+  if (fields & SUB_CELLS)
+  {
+    LOOP_STEPS[count].op = PLAN_ADCV; LOOP_STEPS[count++].arg = CELL_CH_TO_CONVERT;
+    LOOP_STEPS[count].op = PLAN_RDCV; LOOP_STEPS[count++].arg = SEL_ALL_REG;
+  }
+  if (fields & SUB_AUX)
+  {
+    LOOP_STEPS[count].op = PLAN_ADAX; LOOP_STEPS[count++].arg = AUX_CH_ALL;
+    LOOP_STEPS[count].op = PLAN_RDAUX; LOOP_STEPS[count++].arg = SEL_ALL_REG;
+  }
+  if (fields & SUB_STAT)
+  {
+    LOOP_STEPS[count].op = PLAN_ADSTAT; LOOP_STEPS[count++].arg = STAT_CH_ALL;
+    LOOP_STEPS[count].op = PLAN_RDSTAT; LOOP_STEPS[count++].arg = SEL_ALL_REG;
+  }
+  LOOP_PLAN.count = count;
+}
+
 /*!****************************************************************************
   \brief Function to print the Conversion Time
   @return void
@@ -1765,6 +2783,18 @@ void serial_print_hex(uint8_t data)
     Serial.print((byte)data,HEX);
 }
 
+/*!************************************************************
+ \brief Prints value / 10^decimals without floating point,
+ e.g. a 100 uV ADC code with 4 decimals prints volts
+ @return void
+ *************************************************************/
+void print_fixed(Print &port, int32_t value, uint8_t decimals)
+{
+  char text[FIXED_TEXT_LEN];
+  LTC6811_format_fixed(value, decimals, text);
+  port.print(text);
+}
+
 /*!************************************************************
  \brief Hex conversion constants
  *************************************************************/
@@ -1888,7 +2918,7 @@ int8_t menu_1_automatic_mode(int8_t mAh_or_Coulombs, int8_t celcius_or_kelvin ,u
     Serial.print(F("m-Main Menu\n\n"));
 
     Serial.flush();
-    delay(AUTOMATIC_MODE_DISPLAY_DELAY);                                      //! Delay for 1s before next polling
+    tx_wait(AUTOMATIC_MODE_DISPLAY_DELAY);                                    //! Delay for 1s before next polling
   }
   while (Serial.available() == false && !(ack));                                 //! if Serial is not available and an NACK has not been recieved, keep polling the registers.
   read_int();  // clears the Serial.available
@@ -1968,7 +2998,7 @@ int8_t menu_2_scan_mode(int8_t mAh_or_Coulombs , int8_t celcius_or_kelvin ,uint1
     Serial.print(F("m-Main Menu\n\n"));
 
     Serial.flush();
-    delay(SCAN_MODE_DISPLAY_DELAY);
+    tx_wait(SCAN_MODE_DISPLAY_DELAY);
   }
   while (Serial.available() == false && !(ack));
   read_int();  // clears the Serial.available
@@ -2062,7 +3092,7 @@ int8_t menu_3_manual_mode(int8_t mAh_or_Coulombs ,int8_t celcius_or_kelvin ,uint
 
     staleData = 1;
     Serial.flush();
-    delay(AUTOMATIC_MODE_DISPLAY_DELAY);
+    tx_wait(AUTOMATIC_MODE_DISPLAY_DELAY);
   }
   while (Serial.available() == false && !(ack));
   read_int();  // clears the Serial.available
@@ -2123,7 +3153,7 @@ int8_t menu_4_sleep_mode(int8_t mAh_or_Coulombs ,uint16_t prescalar_mode, uint16
     checkAlerts(status_code);
 
     Serial.flush();
-    delay(AUTOMATIC_MODE_DISPLAY_DELAY);
+    tx_wait(AUTOMATIC_MODE_DISPLAY_DELAY);
   }
   while (Serial.available() == false || (ack));
   read_int();  // clears the Serial.available
@@ -2577,39 +3607,90 @@ void checkAlerts(uint8_t status_code)
     Serial.print(F("UVLO Alert\n"));
     Serial.print(F("***********************\n"));
   }
+  queue_alerts(status_code);
 }
 
-void writeSD(String data){
-    // Create/Open file 
-  myFile = SD.open("test.txt", FILE_WRITE);
-    // if the file opened okay, write to it:
-  if (myFile) {
-    Serial.println("Writing to file...");
-    // Write to file
-    myFile.println("BMS DATA");
-    myFile.println(data);
-    myFile.close(); // close the file
-    Serial.println("Done.");
+/*!************************************************************
+  \brief Starts the SD card and opens the data log, appending a
+  new session after the last intact record LOG_FILE holds
+  @return void
+ *************************************************************/
+void log_open(void)
+{
+  if (!SD.begin(pinCS))
+  {
+    Serial.println(F("No SD card, data log off"));
   }
-
-    // if the file didn't open, print an error:
-  else {
-    Serial.println("error opening test.txt");
+  else if (!(myFile = SD.open(LOG_FILE, O_READ | O_WRITE | O_CREAT))) // Not FILE_WRITE, its O_APPEND would ignore the seek of each block
+  {
+    Serial.println(F("error opening bmslog.bin"));
+  }
+  else if (sd_log_open(&SD_LOG, &LOG_IO, myFile.size()/SDLOG_BLOCK, LOG_FLUSH_MS, LOG_SYNC_BLOCKS, &bl_format) != 0)
+  {
+    Serial.println(F("error reading bmslog.bin"));
+    myFile.close();
+  }
+  else if (bl_capacity(TOTAL_IC, IC_REG(BMS_IC[0], cell_channels), IC_REG(BMS_IC[0], aux_channels)) == 0 ||
+           bl_open(&BIN_LOG, &SD_LOG, TOTAL_IC, IC_REG(BMS_IC[0], cell_channels), IC_REG(BMS_IC[0], aux_channels),
+                   BMS_IC_TYPE, rtc.now().unixtime(), millis()) != 0)
+  {
+    Serial.println(F("error starting bmslog.bin, records too long for a block or card error"));
+    SD_LOG.io = NULL;
+    myFile.close();
   }
+  else
+  {
+    Serial.print(F("SD log resumed at record "));
+    Serial.print(SD_LOG.seq);
+    Serial.print(F(", block "));
+    Serial.print(SD_LOG.block);
+    Serial.print(F(", "));
+    Serial.print(SD_LOG.count.scanned);
+    Serial.println(F(" blocks read"));
+  }
+  spi_enable(SPI_CLOCK_DIV16); // The SD library leaves the SPI at its own clock
+}
 
+/*!************************************************************
+  \brief Reads one SD log block
+  @return int8_t, 0 or -1 on a card error
+ *************************************************************/
+int8_t log_read(uint32_t block, uint8_t *data)
+{
+  int8_t result = (myFile.seek(block*SDLOG_BLOCK) && myFile.read(data, SDLOG_BLOCK) == SDLOG_BLOCK) ? 0 : -1;
+  spi_enable(SPI_CLOCK_DIV16);
+  return(result);
 }
-void ReadSD() {
-    // Reading the file
-  myFile = SD.open("test.txt");
-  if (myFile) {
-    Serial.println("Read:");
-    // Reading the whole file
-    while (myFile.available()) {
-      Serial.write(myFile.read());
-   }
-    myFile.close();
+
+/*!************************************************************
+  \brief Writes one SD log block, or a block of zeros when data
+  is NULL
+  @return int8_t, 0 or -1 on a card error
+ *************************************************************/
+int8_t log_write(uint32_t block, const uint8_t *data)
+{
+  static const uint8_t zeros[32] = {0};
+  bool ok = myFile.seek(block*SDLOG_BLOCK);
+
+  if (data != NULL)
+  {
+    ok = ok && myFile.write(data, SDLOG_BLOCK) == SDLOG_BLOCK; // Block aligned, so it goes straight to the card
   }
-  else {
-    Serial.println("error opening test.txt");
+  for (uint16_t i = 0; data == NULL && ok && i < SDLOG_BLOCK; i += sizeof(zeros))
+  {
+    ok = myFile.write(zeros, sizeof(zeros)) == sizeof(zeros);
   }
+  spi_enable(SPI_CLOCK_DIV16);
+  return(ok ? 0 : -1);
+}
+
+/*!************************************************************
+  \brief Commits the SD log file size and cached blocks
+  @return int8_t, 0
+ *************************************************************/
+int8_t log_sync(void)
+{
+  myFile.flush();
+  spi_enable(SPI_CLOCK_DIV16);
+  return(0);
 }
\ No newline at end of file